@@ -10,6 +10,7 @@
 #include<sstream>
 #include<vector>
 #include<cstdio>
+#include<cstring>
 #include<typeinfo>
 #include<iostream>
 #include<cassert>
@@ -0,0 +1,358 @@
+// Headless benchmark of the capture pipeline (gcv_utils/capture_benchmark.h): no game, no Windows.
+// Build on Linux from the repository root (Eigen and nlohmann/json are header-only dependencies of readback_ring.h;
+// GCC needs -mavx2 -mf16c to compile the AVX2 kernels, which are still only called when the CPU has them):
+//   g++ -O2 -std=c++17 -pthread -mavx2 -mf16c -I. -I3rdparty -I/usr/include/eigen3 capture_bench/capture_bench.cpp
+//       capture_bench/kernel_benchmarks.cpp capture_bench/writer_benchmarks.cpp gcv_utils/depth_utils.cpp gcv_utils/cpu_features.cpp
+//       gcv_reshade/bc_block_kernels.cpp gcv_reshade/pixel_swizzle_kernels.cpp gcv_reshade/pixel_unpack.cpp
+//       gcv_utils/capture_benchmark.cpp gcv_utils/readback_ring.cpp gcv_utils/staging_pool.cpp gcv_utils/parallel_rows.cpp
+//       gcv_utils/packedbuf_downscale.cpp gcv_utils/simple_packed_buf.cpp gcv_utils/depth_frame_stats.cpp
+//       gcv_utils/raw_frame_pool.cpp gcv_utils/image_queue_entry.cpp 3rdparty/cnpy.cpp 3rdparty/fpzip/*.cpp
+//       gcv_utils/png_strip_encoder.cpp gcv_utils/depth_quantize.cpp gcv_utils/npy_writer.cpp gcv_utils/fpzip_tiled.cpp IGCSConnector/fpng.cpp -mpclmul -fno-strict-aliasing -lz -o capture_bench
+//       gcv_utils/epr_lz4.cpp gcv_utils/image_write_queue.cpp gcv_utils/seg_pixel_runs.cpp renderdoc/lz4/lz4.cpp -Irenderdoc
+// Example: 1080p recording at 30 fps with color, depth and segmentation written to /tmp/capbench:
+//   ./capture_bench --width 1920 --height 1080 --fps 30 --frames 300 --seg --out /tmp/capbench
+#include "gcv_utils/capture_benchmark.h"
+#include "capture_bench/kernel_benchmarks.h"
+#include "capture_bench/writer_benchmarks.h"
+#include "gcv_utils/parallel_rows.h"
+#include "gcv_utils/depth_utils.h"
+#include "gcv_reshade/bc_block_kernels.h"
+#include "gcv_utils/png_strip_encoder.h"
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/fpzip_tiled.h"
+#include "gcv_utils/epr_lz4.h"
+#include "gcv_utils/seg_pixel_runs.h"
+#include <cnpy.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void print_usage() {
+	printf("usage: capture_bench [options]\n"
+		"  --mode recording|snapshot  ring readback or waiting on every copy (default recording)\n"
+		"  --width N --height N       frame size (default 1920 x 1080)\n"
+		"  --fps F                    rendered frames per second, 0 = as fast as possible (default 30)\n"
+		"  --frames N                 frames to render (default 300)\n"
+		"  --every N                  capture one of every N frames (default 1)\n"
+		"  --ring N                   readback ring depth, 0 = wait for each copy (default 3)\n"
+		"  --drop                     drop frames when the ring is full instead of waiting\n"
+		"  --gpu-latency-us N         time from a copy until its fence passes (default 2000)\n"
+		"  --frame-work-us N          render-thread time of the frame itself (default 0)\n"
+		"  --color bgra|rgba|rgb48|rgba64|rgbaf32  color format (default bgra)\n"
+		"  --no-color --no-depth --seg  what is captured (default color and depth)\n"
+		"  --downscale N              integer downscale while converting (default 1)\n"
+		"  --row-threads N            conversion threads, including the render thread, and threads compressing one image\n"
+		"                             for its writer (default half the cores)\n"
+		"  --writers N                writer threads (default 3)\n"
+		"  --max-writers N            start more writer threads while frames wait, up to N (default: no more)\n"
+		"  --queue-items N --queue-mb N  frames and MB waiting for the writers before --queue-policy applies (default 64, 2048)\n"
+		"  --queue-policy block|drop-oldest|drop-newest  when the writer queue is full (default block)\n"
+		"  --convert-on-writers       the render thread only copies rows out; writer threads convert them\n"
+		"  --fpng                     write 8-bit color png with fpng instead of stb\n"
+		"  --png-strips               write 8-bit color png deflated in strips on the row threads instead of stb\n"
+		"  --fpzip --fpzip-tiled      also write depth as one fpzip stream (.fpzip) / as bands on the row threads (.fpzt)\n"
+		"  --fpzip-bench              only time one fpzip stream against bands on a synthetic depth frame of the frame size\n"
+		"  --fpzip-npy FILE           like --fpzip-bench, on a depth map saved as a HxW float32 .npy (repeatable)\n"
+		"  --epr-lz4                  also write depth as byte-shuffled LZ4 bands (.epr v2)\n"
+		"  --epr-bench                only time EPR v2 against raw npy/EPR v1 and fpzip on a synthetic depth frame of the frame size\n"
+		"  --epr-npy FILE             like --epr-bench, on a depth map saved as a HxW float32 .npy (repeatable)\n"
+		"  --depth-png16              also write depth as 16-bit log codes (_u16.png)\n"
+		"  --depth-preview-bench      only time the depth png preview on a synthetic depth frame of the frame size\n"
+		"  --png-bench                only time stb, fpng and zlib strips on a synthetic color frame of the frame size\n"
+		"  --png-npy FILE             like --png-bench, on a screenshot saved as a HxWx3 or HxWx4 uint8 .npy (repeatable)\n"
+		"  --npy-bench DIR            only time cnpy against the gathered npy writer on 1080p and 4K depth in DIR, and\n"
+		"                             leave samples there for python_threedee/check_npy_roundtrip.py\n"
+		"  --tests                    only run the self-tests that are too slow for the addon's on_init\n"
+		"  --depth-span-bench         only time each game's depth conversion per pixel against its span on a frame of the frame size\n"
+		"  --log-depth-bench          only time std::exp against the fast exp approximations of the log depth games\n"
+		"  --bc-bench                 only time the per-pixel BC1/3/4/5 decoder against the block decoders on a frame of the frame size\n"
+		"  --row-pool-bench           only time the row pool on 1, 2, 4, ... --row-threads threads on a frame of the frame size\n"
+		"  --seg-runs-bench           only time segmentation colors hashed per pixel against per run of identical pixels\n"
+		"  --ring-bench               only time the render thread of the recording options, without writing, through readback\n"
+		"                             rings of depth 0 to 4 that wait or drop\n"
+		"  --out DIR                  write png/npy files there; without it frames end after conversion\n");
+}
+
+static bool load_depth_npy(const std::string &npyfile, simple_packed_buf &depth) {
+	cnpy::NpyArray arr = cnpy::npy_load(npyfile);
+	if (arr.word_size != 4 || arr.shape.size() != 2 || arr.fortran_order || !depth.init_full(arr.shape[1], arr.shape[0], BUF_PIX_FMT_GRAYF32)) {
+		fprintf(stderr, "%s: expected a HxW float32 array\n", npyfile.c_str());
+		return false;
+	}
+	std::memcpy(depth.data<float>(), arr.data<float>(), depth.num_total_bytes());
+	return true;
+}
+
+static bool parse_color_format(const std::string &name, BufPixelFormat &pixfmt) {
+	if (name == "bgra") pixfmt = BUF_PIX_FMT_BGRA;
+	else if (name == "rgba") pixfmt = BUF_PIX_FMT_RGBA;
+	else if (name == "rgb48") pixfmt = BUF_PIX_FMT_RGB48;
+	else if (name == "rgba64") pixfmt = BUF_PIX_FMT_RGBA64;
+	else if (name == "rgbaf32") pixfmt = BUF_PIX_FMT_RGBAF32;
+	else return false;
+	return true;
+}
+
+// --row-threads sizes both the conversion pool and the writers' compression pool, like the addon sizes them in on_init
+static void set_row_pool_threads(size_t num_threads) {
+	global_row_thread_pool().change_num_threads(num_threads);
+	writer_row_thread_pool().change_num_threads(num_threads);
+}
+
+// the recording of cfg, without writing, through rings of depth 0 (a wait on every copy) to 4, waiting for the
+// oldest slot and dropping the newest frame when the GPU falls behind
+static bool run_readback_ring_sweep(CaptureBenchConfig cfg) {
+	cfg.mode = CaptureBench_Recording;
+	cfg.out_dir.clear();
+	printf("readback ring, %u x %u, %.1f fps, %llu frames, gpu latency %lld us:\n", cfg.width, cfg.height, cfg.fps,
+		static_cast<unsigned long long>(cfg.num_frames), static_cast<long long>(cfg.gpu_latency_us));
+	bool allgood = true;
+	for (size_t depth = 0; depth <= 4; ++depth) {
+		for (const ReadbackBackPressure policy : { ReadbackRing_WaitOldest, ReadbackRing_DropNewest }) {
+			if (depth == 0 && policy == ReadbackRing_DropNewest) continue;
+			cfg.ring_depth = depth;
+			cfg.back_pressure = policy;
+			const CaptureBenchResult res = run_capture_benchmark(cfg);
+			printf("  ring %zu %-5s render thread per capture: mean %7.1f us, p99 %7.1f us, max %7.1f us; %s\n",
+				depth, (policy == ReadbackRing_DropNewest) ? "drop" : "wait", res.render_thread.mean, res.render_thread.p99,
+				res.render_thread.max, res.ring.summary().c_str());
+			allgood &= res.images_failed == 0 && res.early_maps == 0;
+		}
+	}
+	return allgood;
+}
+
+int main(int argc, char **argv) {
+	CaptureBenchConfig cfg;
+	size_t row_threads = std::max<size_t>(1, std::thread::hardware_concurrency() / 2);
+	bool depth_preview_bench = false;
+	bool png_bench = false;
+	bool fpzip_bench = false;
+	bool epr_bench = false;
+	bool row_pool_bench = false;
+	bool depth_span_bench = false;
+	bool run_tests = false;
+	bool log_depth_bench = false;
+	bool bc_bench = false;
+	bool seg_runs_bench = false;
+	bool ring_bench = false;
+	std::vector<std::string> png_npy_files;
+	std::string npy_bench_dir;
+	std::vector<std::string> fpzip_npy_files;
+	std::vector<std::string> epr_npy_files;
+	for (int ii = 1; ii < argc; ++ii) {
+		const std::string arg = argv[ii];
+		const bool has_value = (ii + 1 < argc);
+		const char *value = has_value ? argv[ii + 1] : "";
+		if (arg == "--help" || arg == "-h") { print_usage(); return 0; }
+		else if (arg == "--drop") cfg.back_pressure = ReadbackRing_DropNewest;
+		else if (arg == "--no-color") cfg.capture_color = false;
+		else if (arg == "--no-depth") cfg.capture_depth = false;
+		else if (arg == "--seg") cfg.capture_seg = true;
+		else if (arg == "--convert-on-writers") cfg.convert_on_writers = true;
+		else if (arg == "--fpng") cfg.color_writers = ImageWriter_fpng;
+		else if (arg == "--png-strips") cfg.color_writers = ImageWriter_png_strips;
+		else if (arg == "--fpzip") cfg.depth_writers |= ImageWriter_fpzip;
+		else if (arg == "--fpzip-tiled") cfg.depth_writers |= ImageWriter_fpzip_tiled;
+		else if (arg == "--fpzip-bench") fpzip_bench = true;
+		else if (arg == "--epr-lz4") cfg.depth_writers |= ImageWriter_epr_lz4;
+		else if (arg == "--epr-bench") epr_bench = true;
+		else if (arg == "--depth-png16") cfg.depth_writers |= ImageWriter_png16depth;
+		else if (arg == "--depth-preview-bench") depth_preview_bench = true;
+		else if (arg == "--png-bench") png_bench = true;
+		else if (arg == "--row-pool-bench") row_pool_bench = true;
+		else if (arg == "--depth-span-bench") depth_span_bench = true;
+		else if (arg == "--tests") run_tests = true;
+		else if (arg == "--log-depth-bench") log_depth_bench = true;
+		else if (arg == "--bc-bench") bc_bench = true;
+		else if (arg == "--seg-runs-bench") seg_runs_bench = true;
+		else if (arg == "--ring-bench") ring_bench = true;
+		else if (!has_value) { fprintf(stderr, "missing value for %s\n", arg.c_str()); return 1; }
+		else {
+			++ii;
+			if (arg == "--mode") {
+				if (std::strcmp(value, "snapshot") == 0) cfg.mode = CaptureBench_Snapshot;
+				else if (std::strcmp(value, "recording") == 0) cfg.mode = CaptureBench_Recording;
+				else { fprintf(stderr, "unknown mode %s\n", value); return 1; }
+			}
+			else if (arg == "--width") cfg.width = static_cast<uint32_t>(std::atoi(value));
+			else if (arg == "--height") cfg.height = static_cast<uint32_t>(std::atoi(value));
+			else if (arg == "--fps") cfg.fps = std::atof(value);
+			else if (arg == "--frames") cfg.num_frames = std::strtoull(value, nullptr, 10);
+			else if (arg == "--every") cfg.capture_every = static_cast<uint32_t>(std::atoi(value));
+			else if (arg == "--ring") cfg.ring_depth = static_cast<size_t>(std::atoi(value));
+			else if (arg == "--gpu-latency-us") cfg.gpu_latency_us = std::atoll(value);
+			else if (arg == "--frame-work-us") cfg.frame_work_us = std::atof(value);
+			else if (arg == "--downscale") cfg.downscale = static_cast<size_t>(std::max(1, std::atoi(value)));
+			else if (arg == "--row-threads") row_threads = static_cast<size_t>(std::max(1, std::atoi(value)));
+			else if (arg == "--writers") cfg.num_writer_threads = static_cast<size_t>(std::max(1, std::atoi(value)));
+			else if (arg == "--max-writers") cfg.max_writer_threads = static_cast<size_t>(std::max(1, std::atoi(value)));
+			else if (arg == "--queue-items") cfg.max_queued_writes = static_cast<size_t>(std::max(1, std::atoi(value)));
+			else if (arg == "--queue-mb") cfg.max_queued_bytes = std::strtoull(value, nullptr, 10) << 20;
+			else if (arg == "--queue-policy") {
+				if (std::strcmp(value, "block") == 0) cfg.write_policy = WriteQueue_BlockProducer;
+				else if (std::strcmp(value, "drop-oldest") == 0) cfg.write_policy = WriteQueue_DropOldest;
+				else if (std::strcmp(value, "drop-newest") == 0) cfg.write_policy = WriteQueue_DropNewest;
+				else { fprintf(stderr, "unknown queue policy %s\n", value); return 1; }
+			}
+			else if (arg == "--out") cfg.out_dir = value;
+			else if (arg == "--png-npy") png_npy_files.push_back(value);
+			else if (arg == "--npy-bench") npy_bench_dir = value;
+			else if (arg == "--fpzip-npy") fpzip_npy_files.push_back(value);
+			else if (arg == "--epr-npy") epr_npy_files.push_back(value);
+			else if (arg == "--color") {
+				if (!parse_color_format(value, cfg.color_format)) { fprintf(stderr, "unknown color format %s\n", value); return 1; }
+			}
+			else { fprintf(stderr, "unknown option %s\n", arg.c_str()); print_usage(); return 1; }
+		}
+	}
+	if (cfg.color_format == BUF_PIX_FMT_RGB48 || cfg.color_format == BUF_PIX_FMT_RGBA64) cfg.color_writers = ImageWriter_png16;
+	if (cfg.color_format == BUF_PIX_FMT_RGBAF32) cfg.color_writers = ImageWriter_exr;
+	if (!cfg.out_dir.empty()) {
+		std::error_code ec;
+		std::filesystem::create_directories(cfg.out_dir, ec);
+	}
+	if (depth_preview_bench) {
+		printf("depth preview tests: %s\n", run_depth_preview_png_tests().c_str());
+		printf("depth quantize tests: %s\n", run_depth_quantize_tests().c_str());
+		printf("png16 depth tests: %s\n", run_png16depth_tests().c_str());
+		simple_packed_buf depth;
+		if (!fill_synthetic_texture(SynthTex_Depth, BUF_PIX_FMT_GRAYF32, cfg.width, cfg.height, 0, depth)) return 1;
+		printf("%s\n", benchmark_depth_preview_png(depth).c_str());
+		return 0;
+	}
+	if (!npy_bench_dir.empty()) {
+		printf("npy writer tests: %s\n", run_npy_writer_tests().c_str());
+		std::error_code ec;
+		std::filesystem::create_directories(npy_bench_dir, ec);
+		std::string errstr;
+		if (!write_npy_roundtrip_samples(npy_bench_dir, errstr)) { fprintf(stderr, "%s\n", errstr.c_str()); return 1; }
+		const uint32_t sizes[2][2] = { { 1920, 1080 }, { 3840, 2160 } };
+		for (const auto &size : sizes) {
+			simple_packed_buf depth;
+			if (!fill_synthetic_texture(SynthTex_Depth, BUF_PIX_FMT_GRAYF32, size[0], size[1], 0, depth)) return 1;
+			printf("%s\n", benchmark_npy_writers(depth, npy_bench_dir, 10).c_str());
+		}
+		return 0;
+	}
+	if (run_tests) {
+		int num_failed = 0;
+		const auto report = [&num_failed](const char *name, const std::string &result) {
+			printf("%s tests: %s\n", name, result.c_str());
+			if (result.compare(0, 2, "ok") != 0) ++num_failed;
+		};
+		report("depth LUT", run_depth_lut_tests());
+		report("log depth", run_log_depth_tests(true));
+		report("bc block decoder", run_bc_block_kernel_tests());
+		report("headless capture benchmark", run_capture_benchmark_tests());
+		report("png strip encoder", run_png_strip_encoder_tests());
+		report("depth preview png", run_depth_preview_png_tests());
+		report("color png writer", run_color_png_writer_tests());
+		report("fpzip tiled", run_fpzip_tiled_tests());
+		report("epr lz4", run_epr_lz4_tests());
+		report("image write queue", run_image_write_queue_tests());
+		return (num_failed == 0) ? 0 : 2;
+	}
+	if (log_depth_bench) {
+		printf("log depth tests: %s\n", run_log_depth_tests().c_str());
+		printf("%s\n", benchmark_log_depth_exp(cfg.width, cfg.height).c_str());
+		return 0;
+	}
+	if (bc_bench) {
+		printf("%s\n", benchmark_bc_block_decoders(cfg.width, cfg.height).c_str());
+		return 0;
+	}
+	if (seg_runs_bench) {
+		printf("seg pixel run tests: %s\n", run_seg_pixel_run_tests().c_str());
+		printf("%s\n", benchmark_seg_pixel_runs(cfg.width, cfg.height).c_str());
+		return 0;
+	}
+	if (row_pool_bench) {
+		printf("parallel for rows tests: %s\n", run_parallel_for_rows_tests().c_str());
+		printf("%s\n", benchmark_row_pool_scaling(cfg.width, cfg.height, row_threads).c_str());
+		return 0;
+	}
+	if (depth_span_bench) {
+		printf("reverse-Z depth tests: %s\n", run_reversez_depth_tests().c_str());
+		printf("%s\n", benchmark_depth_span_per_game(cfg.width, cfg.height).c_str());
+		return 0;
+	}
+	set_row_pool_threads(row_threads);
+	if (fpzip_bench || !fpzip_npy_files.empty()) {
+		printf("fpzip tiled tests: %s\n", run_fpzip_tiled_tests().c_str());
+		for (const std::string &npyfile : fpzip_npy_files) {
+			simple_packed_buf depth;
+			if (!load_depth_npy(npyfile, depth)) return 1;
+			printf("%s: %s\n", npyfile.c_str(), benchmark_fpzip_tiled(depth).c_str());
+		}
+		if (fpzip_bench) {
+			simple_packed_buf depth;
+			if (!fill_synthetic_texture(SynthTex_Depth, BUF_PIX_FMT_GRAYF32, cfg.width, cfg.height, 0, depth)) return 1;
+			printf("synthetic: %s\n", benchmark_fpzip_tiled(depth).c_str());
+		}
+		set_row_pool_threads(1);
+		return 0;
+	}
+	if (epr_bench || !epr_npy_files.empty()) {
+		printf("epr lz4 tests: %s\n", run_epr_lz4_tests().c_str());
+		for (const std::string &npyfile : epr_npy_files) {
+			simple_packed_buf depth;
+			if (!load_depth_npy(npyfile, depth)) return 1;
+			printf("%s: %s\n", npyfile.c_str(), benchmark_epr_lz4(depth).c_str());
+		}
+		if (epr_bench) {
+			simple_packed_buf depth;
+			if (!fill_synthetic_texture(SynthTex_Depth, BUF_PIX_FMT_GRAYF32, cfg.width, cfg.height, 0, depth)) return 1;
+			printf("synthetic: %s\n", benchmark_epr_lz4(depth).c_str());
+		}
+		set_row_pool_threads(1);
+		return 0;
+	}
+	if (png_bench || !png_npy_files.empty()) {
+		printf("color png writer tests: %s\n", run_color_png_writer_tests().c_str());
+		printf("png strip encoder tests: %s\n", run_png_strip_encoder_tests().c_str());
+		std::vector<std::pair<std::string, simple_packed_buf>> frames;
+		for (const std::string &npyfile : png_npy_files) {
+			cnpy::NpyArray arr = cnpy::npy_load(npyfile);
+			if (arr.word_size != 1 || arr.shape.size() != 3 || (arr.shape[2] != 3 && arr.shape[2] != 4) || arr.fortran_order) {
+				fprintf(stderr, "%s: expected a HxWx3 or HxWx4 uint8 array\n", npyfile.c_str());
+				return 1;
+			}
+			simple_packed_buf color;
+			if (!color.init_full(arr.shape[1], arr.shape[0], (arr.shape[2] == 3) ? BUF_PIX_FMT_RGB24 : BUF_PIX_FMT_RGBA)) return 1;
+			std::memcpy(color.data<uint8_t>(), arr.data<uint8_t>(), color.num_total_bytes());
+			frames.emplace_back(npyfile, std::move(color));
+		}
+		if (png_bench) {
+			simple_packed_buf color;
+			if (!fill_synthetic_texture(SynthTex_Color, BUF_PIX_FMT_RGBA, cfg.width, cfg.height, 0, color)) return 1;
+			frames.emplace_back("synthetic", std::move(color));
+		}
+		for (const auto &frame : frames) {
+			printf("%s: %s\n", frame.first.c_str(), benchmark_color_png_writers(frame.second).c_str());
+		}
+		set_row_pool_threads(1);
+		return 0;
+	}
+
+	if (ring_bench) {
+		printf("readback ring tests: %s\n", run_readback_ring_tests().c_str());
+		const bool allgood = run_readback_ring_sweep(cfg);
+		set_row_pool_threads(1);
+		return allgood ? 0 : 2;
+	}
+
+	printf("capture tests: %s\n", run_capture_benchmark_tests().c_str());
+	printf("%s, %u x %u, %.1f fps, %llu frames, ring %zu, downscale %zu, %zu row threads, %zu writers%s%s%s\n",
+		(cfg.mode == CaptureBench_Snapshot) ? "snapshot" : "recording", cfg.width, cfg.height, cfg.fps,
+		static_cast<unsigned long long>(cfg.num_frames), cfg.ring_depth, cfg.downscale, row_threads, cfg.num_writer_threads,
+		cfg.convert_on_writers ? ", converting on writers" : "", cfg.out_dir.empty() ? "" : ", writing to ", cfg.out_dir.c_str());
+	const CaptureBenchResult res = run_capture_benchmark(cfg);
+	printf("%s\n", res.summary().c_str());
+	set_row_pool_threads(1);
+	return (res.images_failed == 0 && res.early_maps == 0) ? 0 : 2;
+}
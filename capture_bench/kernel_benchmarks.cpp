@@ -0,0 +1,488 @@
+#include "capture_bench/kernel_benchmarks.h"
+#include "gcv_utils/parallel_rows.h"
+#include "gcv_utils/depth_utils.h"
+#include "gcv_reshade/bc_block_kernels.h"
+#include "gcv_utils/seg_pixel_runs.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+typedef std::chrono::steady_clock benchclock;
+
+static double ms_since(benchclock::time_point start) {
+	return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+}
+
+std::string benchmark_row_pool_scaling(uint32_t width, uint32_t height, size_t max_threads, int repeats) {
+	if (width == 0 || height == 0) return "row pool benchmark: empty frame";
+	repeats = std::max(repeats, 1);
+	max_threads = std::max<size_t>(max_threads, 1);
+	const size_t num_pixels = static_cast<size_t>(width) * height;
+	std::vector<uint8_t> bgra(num_pixels * 4), rgb(num_pixels * 3);
+	std::vector<uint32_t> depth(num_pixels);
+	std::vector<float> meters(num_pixels);
+	std::mt19937 rng(3);
+	for (size_t ii = 0; ii < num_pixels; ++ii) {
+		const uint32_t rnd = rng();
+		std::memcpy(bgra.data() + ii * 4, &rnd, 4);
+		depth[ii] = rnd;
+	}
+	const row_band_fn swizzle_rows = [&](size_t row_begin, size_t row_end) {
+		for (size_t y = row_begin; y < row_end; ++y) {
+			const uint8_t *src = bgra.data() + y * width * 4;
+			uint8_t *dst = rgb.data() + y * width * 3;
+			for (uint32_t x = 0; x < width; ++x, src += 4, dst += 3) {
+				dst[0] = src[2];
+				dst[1] = src[1];
+				dst[2] = src[0];
+			}
+		}
+	};
+	const row_band_fn log_depth_rows = [&](size_t row_begin, size_t row_end) {
+		for (size_t ii = row_begin * width; ii < row_end * width; ++ii) {
+			const double z = static_cast<double>(depth[ii]) / 4294967295.0;
+			meters[ii] = static_cast<float>(1.28 / (0.000077579959 + std::exp(354.9329993 * z - 83.84035513)));
+		}
+	};
+
+	std::vector<size_t> thread_counts;
+	for (size_t nt = 1; nt < max_threads; nt *= 2) thread_counts.push_back(nt);
+	thread_counts.push_back(max_threads);
+	char line[256];
+	snprintf(line, sizeof(line), "row pool scaling on %u x %u, mean of %d, %u hardware threads:", width, height, repeats, std::thread::hardware_concurrency());
+	std::string result(line);
+	double bgra_1 = 0.0, log_1 = 0.0;
+	row_thread_pool pool;
+	for (const size_t nt : thread_counts) {
+		pool.change_num_threads(nt);
+		pool.parallel_for_rows(height, 0, swizzle_rows); // first touch
+		double bgra_ms = 0.0, log_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			pool.parallel_for_rows(height, 0, swizzle_rows);
+			bgra_ms += ms_since(start);
+			start = benchclock::now();
+			pool.parallel_for_rows(height, 0, log_depth_rows);
+			log_ms += ms_since(start);
+		}
+		bgra_ms /= repeats;
+		log_ms /= repeats;
+		if (nt == 1) {
+			bgra_1 = bgra_ms;
+			log_1 = log_ms;
+		}
+		snprintf(line, sizeof(line), "\n  %2zu threads: bgra to rgb %.2f ms (%.2fx), log depth %.2f ms (%.2fx)",
+			nt, bgra_ms, bgra_1 / bgra_ms, log_ms, log_1 / log_ms);
+		result += line;
+	}
+	return result;
+}
+
+// GameInterface needs Windows.h, so these mirror its two depth entry points with each game's own conversion
+namespace {
+struct bench_depth_game {
+	virtual ~bench_depth_game() {}
+	virtual float convert_to_physical_distance_depth_u64(uint64_t depthval) const = 0;
+	virtual void convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const = 0;
+};
+
+template<typename ConvertFn, typename SpanFn>
+struct bench_game_with : public bench_depth_game {
+	ConvertFn convertfn;
+	SpanFn spanfn;
+	bench_game_with(ConvertFn c, SpanFn s) : convertfn(c), spanfn(s) {}
+	float convert_to_physical_distance_depth_u64(uint64_t depthval) const override { return convertfn(depthval); }
+	void convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const override {
+		spanfn(src, count, bytes_per_px, depth_bytes, dst);
+	}
+};
+
+template<typename ConvertFn, typename SpanFn>
+std::unique_ptr<bench_depth_game> make_bench_game(ConvertFn c, SpanFn s) {
+	return std::unique_ptr<bench_depth_game>(new bench_game_with<ConvertFn, SpanFn>(c, s));
+}
+
+// a game whose span inlines its scalar conversion, like Control or HorizonZeroDawn
+template<typename ConvertFn>
+std::unique_ptr<bench_depth_game> make_scalar_span_game(ConvertFn c) {
+	return make_bench_game(c, [c](const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) {
+		convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst, c);
+	});
+}
+
+// the same 24-bit curve through a DepthLinearizationLUT in the span, to compare with the exact span the games inline
+template<typename ConvertFn>
+std::unique_ptr<bench_depth_game> make_lut_game(ConvertFn c) {
+	std::shared_ptr<DepthLinearizationLUT> lut = std::make_shared<DepthLinearizationLUT>();
+	lut->build([c](uint64_t depthval) { return static_cast<double>(c(depthval)); }, 24);
+	return make_bench_game(c, [c, lut](const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) {
+		convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+			[&](uint64_t depthval) { return lut->covers(depthval) ? lut->lookup(depthval) : c(depthval); });
+	});
+}
+
+template<typename Policy>
+std::unique_ptr<bench_depth_game> make_reversez_game() {
+	return make_bench_game([](uint64_t depthval) { return Policy::convert(depthval); }, Policy::convert_span);
+}
+
+std::unique_ptr<bench_depth_game> make_log_depth_game(const LogDepthExpFit &fit) {
+	return make_bench_game([fit](uint64_t depthval) { return fit.convert(depthval); },
+		[fit](const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) {
+			fit.convert_span(src, count, bytes_per_px, depth_bytes, dst);
+		});
+}
+
+typedef std::function<uint32_t(std::mt19937 &rng)> depth_word_fn;
+
+struct bench_depth_case {
+	const char *games;
+	int bytes_per_px;
+	int depth_bytes;
+	depth_word_fn depth_word; // the low depth_bytes of the texel
+	std::unique_ptr<bench_depth_game> game;
+};
+
+// reverse-Z floats of distances spread log-uniformly from 0.1 m to 10 km
+template<typename Policy>
+depth_word_fn reversez_words() {
+	return [](std::mt19937 &rng) {
+		const float dist = std::pow(10.0f, std::uniform_real_distribution<float>(-1.0f, 4.0f)(rng));
+		const float depth = Policy::params.numerator_constant / dist + Policy::params.denominator_constant;
+		uint32_t word;
+		std::memcpy(&word, &depth, 4);
+		return word;
+	};
+}
+
+// the same distances through the inverse of the fitted curve
+depth_word_fn log_depth_words(const LogDepthExpFit &fit) {
+	return [fit](std::mt19937 &rng) {
+		const double dist = std::pow(10.0, std::uniform_real_distribution<double>(-1.0, 4.0)(rng));
+		const double z = (std::log(fit.numer / dist - fit.addend) - fit.intercept) / fit.slope;
+		return static_cast<uint32_t>(std::min(std::max(z, 0.0), 1.0) * 4294967295.0);
+	};
+}
+
+depth_word_fn uniform_words(uint32_t mask) {
+	return [mask](std::mt19937 &rng) { return static_cast<uint32_t>(rng()) & mask; };
+}
+} // namespace
+
+std::string benchmark_depth_span_per_game(uint32_t width, uint32_t height, int repeats) {
+	if (width == 0 || height == 0) return "depth span benchmark: empty frame";
+	repeats = std::max(repeats, 1);
+	// the constants are those of the game modules
+	const auto control = [](uint64_t depthval) {
+		const double normalizeddepth = static_cast<double>(depthval) / 1073741824.0;
+		return static_cast<float>(0.00310475 / (1.0 - normalizeddepth * 1.00787427));
+	};
+	const auto horizon = [](uint64_t depthval) {
+		const double normalizeddepth = static_cast<double>(depthval) / 1073741824.0;
+		return static_cast<float>(0.00313259 / (1.0 - normalizeddepth * 1.00787352));
+	};
+	const auto msfs2020 = [](uint64_t depthval) {
+		const float normalized_depth = 1.0f - static_cast<float>(static_cast<double>(depthval) / 4294967295.0);
+		return 1.0f * 50000.0f / (50000.0f - normalized_depth * (50000.0f - 1.0f));
+	};
+	const auto crysis = [](uint64_t depthval) {
+		const double znorm = static_cast<double>(depthval) / 16777215.0;
+		return static_cast<float>(0.25 / std::max(0.0000001, 1.0 - znorm * (1.0 - 0.25 / 5000.0)));
+	};
+	const auto dishonored = [](uint64_t depthval) {
+		const double normalizeddepth = static_cast<double>(depthval) / 16777215.0;
+		return static_cast<float>(5415.69378002 / (1.0 + 541167.20430436 * normalizeddepth));
+	};
+	const auto ets2 = [](uint64_t depthval) {
+		const float normalized_depth = static_cast<float>(static_cast<double>(depthval) / 16777215.0);
+		return 1.0f * 1000.0f / (1000.0f - normalized_depth * (1000.0f - 1.0f));
+	};
+	const LogDepthExpFit cyberpunk{ 1.28, 0.000077579959, 354.9329993, -83.84035513 };
+	const LogDepthExpFit residentevils{ 1.28, 0.0004253421645545, 354.8489261773826, -83.12790960252826 };
+	typedef ReverseZPolicy<100, 10000000> reversez_10km;
+	typedef ReverseZPolicy<150, 10003814> reversez_gta;
+	bench_depth_case cases[] = {
+		{ "15 games, e.g. AC*, Sekiro, Witcher3 (reverse-Z)", 4, 4, reversez_words<reversez_10km>(), make_reversez_game<reversez_10km>() },
+		{ "GTAV, RDR2 (reverse-Z, d32s8)", 8, 4, reversez_words<reversez_gta>(), make_reversez_game<reversez_gta>() },
+		{ "Cyberpunk2077 (log depth)", 4, 4, log_depth_words(cyberpunk), make_log_depth_game(cyberpunk) },
+		{ "ResidentEvils (log depth)", 4, 4, log_depth_words(residentevils), make_log_depth_game(residentevils) },
+		{ "Control (30-bit)", 4, 4, uniform_words((1u << 30) - 1u), make_scalar_span_game(control) },
+		{ "HorizonZeroDawn (30-bit)", 4, 4, uniform_words((1u << 30) - 1u), make_scalar_span_game(horizon) },
+		{ "MicrosoftFlightSimulator2020", 4, 4, uniform_words(0xFFFFFFFFu), make_scalar_span_game(msfs2020) },
+		{ "Crysis (24-bit, d24s8)", 4, 3, uniform_words(0xFFFFFFFFu), make_scalar_span_game(crysis) },
+		{ "  the same with a 24-bit LUT", 4, 3, uniform_words(0xFFFFFFFFu), make_lut_game(crysis) },
+		{ "DishonoredDOTO (24-bit, d24s8)", 4, 3, uniform_words(0xFFFFFFFFu), make_scalar_span_game(dishonored) },
+		{ "  the same with a 24-bit LUT", 4, 3, uniform_words(0xFFFFFFFFu), make_lut_game(dishonored) },
+		{ "EuroTruckSimulator2, MSFS2024 (24-bit, d24s8)", 4, 3, uniform_words(0xFFFFFFFFu), make_scalar_span_game(ets2) },
+		{ "  the same with a 24-bit LUT", 4, 3, uniform_words(0xFFFFFFFFu), make_lut_game(ets2) },
+	};
+
+	const size_t num_pixels = static_cast<size_t>(width) * height;
+	std::vector<float> per_pixel(num_pixels), span(num_pixels);
+	std::mt19937 rng(5);
+	char line[256];
+	snprintf(line, sizeof(line), "depth conversion of %u x %u, per-pixel virtual call against the span, mean of %d:", width, height, repeats);
+	std::string result(line);
+	for (const bench_depth_case &bc : cases) {
+		const size_t row_bytes = static_cast<size_t>(width) * bc.bytes_per_px;
+		std::vector<uint8_t> texels(row_bytes * height);
+		for (size_t ii = 0; ii < num_pixels; ++ii) {
+			const uint32_t word = bc.depth_word(rng);
+			// d24s8 keeps the stencil in the high byte and d32s8 in the second word; the conversions must ignore both
+			std::memcpy(texels.data() + ii * bc.bytes_per_px, &word, 4);
+			if (bc.bytes_per_px == 8) {
+				const uint32_t stencil = rng();
+				std::memcpy(texels.data() + ii * 8 + 4, &stencil, 4);
+			}
+		}
+		const bench_depth_game *const game = bc.game.get();
+		double pixel_ms = 0.0, span_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			for (uint32_t y = 0; y < height; ++y) {
+				const uint8_t *src_p = texels.data() + y * row_bytes;
+				float *dst = per_pixel.data() + static_cast<size_t>(y) * width;
+				for (uint32_t x = 0; x < width; ++x) {
+					const uint8_t *const src = src_p + x * bc.bytes_per_px;
+					uint64_t vi = 0;
+					for (int z = 0; z < bc.depth_bytes; ++z) {
+						vi += static_cast<uint64_t>(src[z]) << (8ull * z);
+					}
+					dst[x] = game->convert_to_physical_distance_depth_u64(vi);
+				}
+			}
+			pixel_ms += ms_since(start);
+			start = benchclock::now();
+			for (uint32_t y = 0; y < height; ++y) {
+				game->convert_depth_span(texels.data() + y * row_bytes, width, bc.bytes_per_px, bc.depth_bytes, span.data() + static_cast<size_t>(y) * width);
+			}
+			span_ms += ms_since(start);
+		}
+		double max_rel = 0.0;
+		for (size_t ii = 0; ii < num_pixels; ++ii) {
+			if (!std::isfinite(per_pixel[ii]) || per_pixel[ii] == 0.0f) continue;
+			max_rel = std::max(max_rel, std::abs(static_cast<double>(span[ii]) - per_pixel[ii]) / std::abs(static_cast<double>(per_pixel[ii])));
+		}
+		snprintf(line, sizeof(line), "\n  %-50s per-pixel %6.2f ms, span %6.2f ms (%.2fx), max rel diff %.2g",
+			bc.games, pixel_ms / repeats, span_ms / repeats, pixel_ms / span_ms, max_rel);
+		result += line;
+	}
+	return result;
+}
+
+std::string benchmark_log_depth_exp(uint32_t width, uint32_t height, int repeats) {
+	if (width == 0 || height == 0) return "log depth benchmark: empty frame";
+	repeats = std::max(repeats, 1);
+	const LogDepthExpFit fit{ 1.28, 0.000077579959, 354.9329993, -83.84035513 }; // Cyberpunk 2077
+	const size_t num_pixels = static_cast<size_t>(width) * height;
+	std::vector<uint32_t> depth(num_pixels);
+	std::vector<double> args(num_pixels), exps(num_pixels);
+	std::vector<float> argsf(num_pixels), expsf(num_pixels), meters(num_pixels);
+	std::mt19937 rng(7);
+	const depth_word_fn words = log_depth_words(fit);
+	for (size_t ii = 0; ii < num_pixels; ++ii) {
+		depth[ii] = words(rng);
+		args[ii] = fit.slope * (static_cast<double>(depth[ii]) / 4294967295.0) + fit.intercept;
+		argsf[ii] = static_cast<float>(args[ii]);
+	}
+	double ms[6] = {};
+	double checksum = 0.0;
+	for (int rep = 0; rep < repeats; ++rep) {
+		benchclock::time_point start = benchclock::now();
+		for (size_t ii = 0; ii < num_pixels; ++ii) exps[ii] = std::exp(args[ii]);
+		ms[0] += ms_since(start);
+		checksum += exps[num_pixels / 2];
+		start = benchclock::now();
+		for (size_t ii = 0; ii < num_pixels; ++ii) exps[ii] = exp_fast_approx(args[ii]);
+		ms[1] += ms_since(start);
+		checksum += exps[num_pixels / 2];
+		start = benchclock::now();
+		for (size_t ii = 0; ii < num_pixels; ++ii) expsf[ii] = exp_fast_approx_float(argsf[ii]);
+		ms[2] += ms_since(start);
+		checksum += expsf[num_pixels / 2];
+		start = benchclock::now();
+		for (size_t ii = 0; ii < num_pixels; ++ii) {
+			meters[ii] = static_cast<float>(fit.numer / (fit.addend + std::exp(fit.slope * (static_cast<double>(depth[ii]) / 4294967295.0) + fit.intercept)));
+		}
+		ms[3] += ms_since(start);
+		checksum += meters[num_pixels / 2];
+		start = benchclock::now();
+		for (size_t ii = 0; ii < num_pixels; ++ii) meters[ii] = fit.convert(depth[ii]);
+		ms[4] += ms_since(start);
+		checksum += meters[num_pixels / 2];
+		start = benchclock::now();
+		fit.convert_span(reinterpret_cast<const uint8_t *>(depth.data()), num_pixels, 4, 4, meters.data());
+		ms[5] += ms_since(start);
+		checksum += meters[num_pixels / 2];
+	}
+	const char *const names[6] = {
+		"std::exp", "exp_fast_approx", "exp_fast_approx_float",
+		"depth with std::exp", "depth with exp_fast_approx (convert)", "depth span (float, SIMD)",
+	};
+	const double mpix = num_pixels / 1e6;
+	char line[256];
+	snprintf(line, sizeof(line), "log depth exp on %u x %u, mean of %d (checksum %.3g):", width, height, repeats, checksum);
+	std::string result(line);
+	for (int ii = 0; ii < 6; ++ii) {
+		snprintf(line, sizeof(line), "\n  %-38s %7.2f ms, %7.0f Mpix/s (%.2fx std::exp)",
+			names[ii], ms[ii] / repeats, mpix * 1e3 * repeats / ms[ii], ms[(ii < 3) ? 0 : 3] / ms[ii]);
+		result += line;
+	}
+	return result;
+}
+
+std::string benchmark_bc_block_decoders(uint32_t width, uint32_t height, int repeats) {
+	if (width < 4 || height < 4) return "bc benchmark: frame smaller than a block";
+	repeats = std::max(repeats, 1);
+	const size_t blocks_x = width / 4, blocks_y = height / 4;
+	const size_t dst_stride = blocks_x * 16;
+	std::vector<uint8_t> blocks(blocks_x * blocks_y * 16), rgba(dst_stride * blocks_y * 4), expected(rgba.size());
+	std::mt19937 rng(9);
+	for (uint8_t &bb : blocks) bb = static_cast<uint8_t>(rng());
+	struct bc_format {
+		int bc;
+		size_t block_bytes;
+		bc_block_decode_fn bc_block_kernel_table::*fn;
+	};
+	static const bc_format formats[] = {
+		{ 1, 8, &bc_block_kernel_table::bc1 },
+		{ 3, 16, &bc_block_kernel_table::bc3 },
+		{ 4, 8, &bc_block_kernel_table::bc4 },
+		{ 5, 16, &bc_block_kernel_table::bc5 },
+	};
+	const SwizzleKernelISA best = swizzle_best_supported_isa();
+	const double mpix = static_cast<double>(blocks_x * blocks_y * 16) / 1e6;
+	char line[256];
+	snprintf(line, sizeof(line), "bc decode of %zu x %zu to rgba, one thread, mean of %d:", blocks_x * 4, blocks_y * 4, repeats);
+	std::string result(line);
+	for (const bc_format &fmt : formats) {
+		double per_pixel_ms = 0.0;
+		uint8_t block_rgba[64];
+		for (int rep = 0; rep < repeats; ++rep) {
+			const benchclock::time_point start = benchclock::now();
+			for (size_t by = 0; by < blocks_y; ++by) {
+				for (size_t bx = 0; bx < blocks_x; ++bx) {
+					bc_block_decode_per_pixel(fmt.bc, blocks.data() + (by * blocks_x + bx) * fmt.block_bytes, block_rgba);
+					uint8_t *const dst = expected.data() + by * 4 * dst_stride + bx * 16;
+					for (int y = 0; y < 4; ++y) std::memcpy(dst + y * dst_stride, block_rgba + y * 16, 16);
+				}
+			}
+			per_pixel_ms += ms_since(start);
+		}
+		snprintf(line, sizeof(line), "\n  bc%d per-pixel  %6.2f ms, %6.0f Mpix/s", fmt.bc, per_pixel_ms / repeats, mpix * 1e3 * repeats / per_pixel_ms);
+		result += line;
+		for (int isa = SwizzleISA_scalar; isa <= best; ++isa) {
+			// AVX2 shares the SSE4.1 block decoders
+			if (isa == SwizzleISA_AVX2) continue;
+			const bc_block_decode_fn decode = bc_block_kernels(static_cast<SwizzleKernelISA>(isa)).*fmt.fn;
+			double ms = 0.0;
+			for (int rep = 0; rep < repeats; ++rep) {
+				const benchclock::time_point start = benchclock::now();
+				for (size_t by = 0; by < blocks_y; ++by) {
+					for (size_t bx = 0; bx < blocks_x; ++bx) {
+						decode(blocks.data() + (by * blocks_x + bx) * fmt.block_bytes, rgba.data() + by * 4 * dst_stride + bx * 16, dst_stride);
+					}
+				}
+				ms += ms_since(start);
+			}
+			snprintf(line, sizeof(line), "\n  bc%d %-10s %6.2f ms, %6.0f Mpix/s (%.2fx)%s", fmt.bc, SwizzleKernelISANames[isa], ms / repeats,
+				mpix * 1e3 * repeats / ms, per_pixel_ms / ms, (rgba == expected) ? "" : " MISMATCH");
+			result += line;
+		}
+	}
+	return result;
+}
+
+namespace {
+// XXH32 of 4 bytes with seed 0, as the segmentation readback calls it (xxhash.h comes with ReShade, not this tree)
+inline uint32_t xxh32_4bytes(const uint8_t *src) {
+	uint32_t v;
+	std::memcpy(&v, src, 4);
+	const auto rotl = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+	uint32_t h = 0x165667B1u + 4u;
+	h += v * 0xC2B2AE3Du;
+	h = rotl(h, 17) * 0x27D4EB2Fu;
+	h ^= h >> 15;
+	h *= 0x85EBCA77u;
+	h ^= h >> 13;
+	h *= 0xC2B2AE3Du;
+	h ^= h >> 16;
+	return h;
+}
+
+// the IndexedSeg loop of copy_texture_into_packedbuf on one thread: each of the 4 channels of a 16-byte pixel is
+// hashed to an RGB color in its own quadrant of a (2 width) x (2 height) RGB24 image
+void seg_colors_per_pixel(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+	const size_t dst_stride = static_cast<size_t>(width) * 2 * 3;
+	for (size_t y = 0; y < height; ++y) {
+		const uint8_t *const src_p = src + y * width * 16;
+		for (size_t x = 0; x < width; ++x) {
+			for (size_t chC = 0; chC < 4; ++chC) {
+				const size_t chY = chC / 2, chX = chC % 2;
+				const uint32_t color = xxh32_4bytes(src_p + x * 16 + chC * 4);
+				std::memcpy(dst + (y + chY * height) * dst_stride + (x + chX * width) * 3, &color, 3);
+			}
+		}
+	}
+}
+
+void seg_colors_by_runs(const uint8_t *src, uint32_t width, uint32_t height, uint8_t *dst) {
+	const size_t dst_stride = static_cast<size_t>(width) * 2 * 3;
+	for (size_t y = 0; y < height; ++y) {
+		const uint8_t *const src_p = src + y * width * 16;
+		for (size_t x = 0; x < width;) {
+			const size_t run = seg_pixel_run_length(src_p + x * 16, width - x);
+			for (size_t chC = 0; chC < 4; ++chC) {
+				const size_t chY = chC / 2, chX = chC % 2;
+				const uint32_t color = xxh32_4bytes(src_p + x * 16 + chC * 4);
+				uint8_t *rowdst = dst + (y + chY * height) * dst_stride + (x + chX * width) * 3;
+				for (size_t ii = 0; ii < run; ++ii, rowdst += 3) std::memcpy(rowdst, &color, 3);
+			}
+			x += run;
+		}
+	}
+}
+} // namespace
+
+std::string benchmark_seg_pixel_runs(uint32_t width, uint32_t height, int repeats) {
+	if (width == 0 || height == 0) return "seg run benchmark: empty frame";
+	repeats = std::max(repeats, 1);
+	const size_t num_pixels = static_cast<size_t>(width) * height;
+	std::vector<uint8_t> seg(num_pixels * 16), colors(num_pixels * 4 * 3), expected(colors.size());
+	const double mpix = num_pixels / 1e6;
+	char line[256];
+	snprintf(line, sizeof(line), "seg pixel colors of %u x %u, one thread, mean of %d:", width, height, repeats);
+	std::string result(line);
+	// runs of identical draw/instance/primitive IDs with geometric lengths; mean 1 is the worst case of no runs at all
+	for (const double mean_run : { 1.0, 2.0, 20.0, 100.0 }) {
+		std::mt19937 rng(12);
+		std::geometric_distribution<size_t> extra(1.0 / mean_run);
+		uint32_t id[4] = {};
+		for (size_t ii = 0; ii < num_pixels;) {
+			for (uint32_t &word : id) word = rng();
+			const size_t run = std::min(1 + extra(rng), num_pixels - ii);
+			for (size_t jj = 0; jj < run; ++jj, ++ii) std::memcpy(seg.data() + ii * 16, id, 16);
+		}
+		seg_colors_per_pixel(seg.data(), width, height, expected.data()); // first touch
+		double per_pixel_ms = 0.0, runs_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			seg_colors_per_pixel(seg.data(), width, height, expected.data());
+			per_pixel_ms += ms_since(start);
+			start = benchclock::now();
+			seg_colors_by_runs(seg.data(), width, height, colors.data());
+			runs_ms += ms_since(start);
+		}
+		snprintf(line, sizeof(line), "\n  mean run %5.1f px: per pixel %7.2f ms (%5.0f Mpix/s), by runs %7.2f ms (%5.0f Mpix/s, %.2fx)%s",
+			mean_run, per_pixel_ms / repeats, mpix * 1e3 * repeats / per_pixel_ms, runs_ms / repeats, mpix * 1e3 * repeats / runs_ms,
+			per_pixel_ms / runs_ms, (colors == expected) ? "" : " MISMATCH");
+		result += line;
+	}
+	return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+// Micro-benchmarks of the conversion kernels behind the capture pipeline, for capture_bench. Each returns a
+// printable summary; none of them is built into the addon.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// times a memory-bound pass (bgra to rgb) and a compute-bound pass (per-pixel log depth) over a width x height frame
+// on a row_thread_pool of 1, 2, 4, ... max_threads threads, and reports each against one thread
+std::string benchmark_row_pool_scaling(uint32_t width, uint32_t height, size_t max_threads, int repeats = 5);
+
+// for every distinct depth conversion of the games in gcv_games, times the per-pixel path (one virtual call per texel,
+// as the copy path made before GameInterface::convert_depth_span) against the game's span override on a frame; the
+// 24-bit curves are also timed through a DepthLinearizationLUT, against their exact inlined span
+std::string benchmark_depth_span_per_game(uint32_t width, uint32_t height, int repeats = 5);
+
+// throughput of std::exp against exp_fast_approx and its float version, alone and inside the LogDepthExpFit conversion
+// (per pixel in double, per pixel in float, and the SIMD span) on a frame of log depth
+std::string benchmark_log_depth_exp(uint32_t width, uint32_t height, int repeats = 5);
+
+// BC1/BC3/BC4/BC5 textures of width x height decoded to RGBA by the old per-pixel decoder and by each supported
+// block decoder table, single-threaded
+std::string benchmark_bc_block_decoders(uint32_t width, uint32_t height, int repeats = 5);
+
+// the r32g32b32a32 segmentation colors of a width x height frame, each pixel's 4 IDs hashed per pixel against once per
+// run of identical pixels (seg_pixel_runs.h), single-threaded, on frames with mean run lengths from 1 to 100 pixels
+std::string benchmark_seg_pixel_runs(uint32_t width, uint32_t height, int repeats = 5);
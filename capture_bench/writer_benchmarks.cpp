@@ -0,0 +1,87 @@
+#include "capture_bench/writer_benchmarks.h"
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/parallel_rows.h"
+#include "gcv_utils/png_strip_encoder.h"
+#include "IGCSConnector/fpng.h"
+#include <stb_image_write.h>
+#include <cnpy.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+typedef std::chrono::steady_clock benchclock;
+
+static double ms_since(benchclock::time_point start) {
+	return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+}
+
+std::string benchmark_color_png_writers(const simple_packed_buf &rgb, int repeats) {
+	if (rgb.width == 0 || rgb.height == 0 || (rgb.pixfmt != BUF_PIX_FMT_RGB24 && rgb.pixfmt != BUF_PIX_FMT_RGBA)) {
+		return "png writer benchmark: needs an RGB24 or RGBA frame";
+	}
+	fpng::fpng_init();
+	double stb_ms = 0.0, fpng_ms = 0.0, fpng_slower_ms = 0.0, strips_ms = 0.0;
+	int stb_len = 0;
+	std::vector<uint8_t> fpng_png, fpng_slower_png, strips_png;
+	std::string errstr;
+	const png_row_fn fill_row = [&rgb](int j, unsigned char *dst) {
+		memcpy(dst, rgb.crowptr<uint8_t>(j), rgb.rowstride_bytes());
+	};
+	repeats = std::max(repeats, 1);
+	const uint32_t bpp = static_cast<uint32_t>(rgb.bytes_per_pixel());
+	for (int rep = 0; rep < repeats; ++rep) {
+		benchclock::time_point start = benchclock::now();
+		// stbi_write_png_to_mem is only declared in stb's implementation; the callback gets its whole output at once
+		stbi_write_png_to_func([](void *context, void * /*data*/, int size) { *static_cast<int *>(context) = size; }, &stb_len,
+			static_cast<int>(rgb.width), static_cast<int>(rgb.height), static_cast<int>(bpp), rgb.cdata<uint8_t>(), static_cast<int>(rgb.rowstride_bytes()));
+		stb_ms += ms_since(start);
+		start = benchclock::now();
+		fpng::fpng_encode_image_to_memory(rgb.cdata<uint8_t>(), static_cast<uint32_t>(rgb.width), static_cast<uint32_t>(rgb.height), bpp, fpng_png);
+		fpng_ms += ms_since(start);
+		start = benchclock::now();
+		fpng::fpng_encode_image_to_memory(rgb.cdata<uint8_t>(), static_cast<uint32_t>(rgb.width), static_cast<uint32_t>(rgb.height), bpp, fpng_slower_png, fpng::FPNG_ENCODE_SLOWER);
+		fpng_slower_ms += ms_since(start);
+		start = benchclock::now();
+		encode_png_in_strips(static_cast<int>(rgb.width), static_cast<int>(rgb.height), 8, static_cast<int>(bpp), fill_row, strips_png, errstr);
+		strips_ms += ms_since(start);
+	}
+	char buf[640];
+	snprintf(buf, sizeof(buf), "png of %zu x %zu x %u, mean of %d (fpng %s):\n  stb %.1f ms, %.2f MB\n  fpng %.1f ms, %.2f MB\n  fpng slower %.1f ms, %.2f MB\n"
+		"  zlib strips on %zu threads %.1f ms, %.2f MB%s",
+		static_cast<size_t>(rgb.width), static_cast<size_t>(rgb.height), bpp, repeats, fpng::fpng_cpu_supports_sse41() ? "sse4.1" : "scalar",
+		stb_ms / repeats, stb_len / 1e6, fpng_ms / repeats, fpng_png.size() / 1e6, fpng_slower_ms / repeats, fpng_slower_png.size() / 1e6,
+		writer_row_thread_pool().num_threads(), strips_ms / repeats, strips_png.size() / 1e6, errstr.empty() ? "" : (std::string(" (") + errstr + ")").c_str());
+	return std::string(buf);
+}
+
+std::string benchmark_npy_writers(const simple_packed_buf &srcBuf, const std::string &dirpath, int repeats) {
+	const size_t num_channels = srcBuf.bytes_per_pixel() / sizeof(float);
+	if (srcBuf.pixfmt != BUF_PIX_FMT_GRAYF32 && srcBuf.pixfmt != BUF_PIX_FMT_RGBAF32) return "npy writer benchmark: needs a float frame";
+	const std::vector<size_t> shape = (num_channels > 1) ? std::vector<size_t>{ srcBuf.height, srcBuf.width, num_channels } : std::vector<size_t>{ srcBuf.height, srcBuf.width };
+	const std::string cnpy_path = dirpath + std::string("/npy_bench_cnpy.npy"), own_path = dirpath + std::string("/npy_bench.npy");
+	double cnpy_ms = 0.0, own_ms = 0.0;
+	std::string errstr;
+	repeats = std::max(repeats, 1);
+	for (int rep = 0; rep < repeats; ++rep) {
+		benchclock::time_point start = benchclock::now();
+		cnpy::npy_save<float>(cnpy_path, srcBuf.cdata<float>(), shape);
+		cnpy_ms += ms_since(start);
+		start = benchclock::now();
+		save_packedbuf_as_npy(own_path, srcBuf, errstr);
+		own_ms += ms_since(start);
+	}
+	const cnpy::NpyArray a = cnpy::npy_load(cnpy_path), b = cnpy::npy_load(own_path);
+	const bool same = a.shape == b.shape && a.num_bytes() == b.num_bytes() && std::memcmp(a.data<uint8_t>(), b.data<uint8_t>(), a.num_bytes()) == 0;
+	std::error_code ec;
+	std::filesystem::remove(cnpy_path, ec);
+	std::filesystem::remove(own_path, ec);
+	const double mb = srcBuf.num_total_bytes() / 1e6;
+	char buf[320];
+	snprintf(buf, sizeof(buf), "npy of %zu x %zu x %zu float, %.1f MB, mean of %d:\n  cnpy %.2f ms (%.0f MB/s)\n  gathered write %.2f ms (%.0f MB/s)%s%s",
+		srcBuf.width, srcBuf.height, num_channels, mb, repeats, cnpy_ms / repeats, mb * 1e3 * repeats / std::max(cnpy_ms, 1e-9),
+		own_ms / repeats, mb * 1e3 * repeats / std::max(own_ms, 1e-9), same ? "" : "\n  arrays DIFFER", errstr.empty() ? "" : (std::string(" (") + errstr + ")").c_str());
+	return std::string(buf);
+}
@@ -0,0 +1,15 @@
+#pragma once
+// Benchmarks of the image writers for capture_bench, kept out of the addon's gcv_utils sources. Each returns a
+// printable summary.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "gcv_utils/simple_packed_buf.h"
+
+// times stb, fpng (fast and slower) and the strip encoder on the writer row pool on an RGB24 or RGBA frame;
+// returns write times and sizes
+std::string benchmark_color_png_writers(const simple_packed_buf &color, int repeats = 3);
+
+// times cnpy against save_packedbuf_as_npy (npy_writer.h) writing a GRAYF32 or RGBAF32 frame into dirpath, mean of
+// repeats, and checks both files hold the same array
+std::string benchmark_npy_writers(const simple_packed_buf &srcBuf, const std::string &dirpath, int repeats = 5);
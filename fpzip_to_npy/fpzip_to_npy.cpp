@@ -0,0 +1,94 @@
+// Converts depth saved as .fpzt (bands of fpzip streams, gcv_utils/fpzip_tiled.h) or as a single-stream .fpzip to a
+// plain float32 .npy, optionally only a region of it: from .fpzt only the bands of those rows are read and decompressed.
+// Build on Linux from the repository root:
+//   g++ -O2 -std=c++17 -pthread -I. -I3rdparty fpzip_to_npy/fpzip_to_npy.cpp gcv_utils/fpzip_tiled.cpp
+//       gcv_utils/npy_writer.cpp gcv_utils/parallel_rows.cpp gcv_utils/simple_packed_buf.cpp
+//       3rdparty/fpzip/*.cpp -lz -o fpzip_to_npy
+// Example: rows 500 to 700 of a 4K capture, decompressed on 8 threads:
+//   ./fpzip_to_npy capture_depth.fpzt --rows 500:700 --threads 8 -o rows.npy
+#include "gcv_utils/fpzip_tiled.h"
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/parallel_rows.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void print_usage() {
+	printf("usage: fpzip_to_npy INPUT.fpzt|INPUT.fpzip [options]\n"
+		"  -o FILE          output .npy (default: the input with .npy instead of its extension)\n"
+		"  --rows A:B       only rows [A, B); B empty or 0 means to the last row\n"
+		"  --cols A:B       only columns [A, B)\n"
+		"  --threads N      decompression threads for .fpzt, including this one (default all cores)\n"
+		"  --test           run the codec's self test and exit\n");
+}
+
+static bool parse_range(const char *value, size_t &begin, size_t &end) {
+	const char *colon = std::strchr(value, ':');
+	if (!colon) return false;
+	begin = std::strtoull(value, nullptr, 10);
+	end = std::strtoull(colon + 1, nullptr, 10);
+	return end == 0 || end > begin;
+}
+
+static bool has_suffix(const std::string &str, const std::string &suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+	std::string input, output;
+	size_t row_begin = 0, row_end = 0, col_begin = 0, col_end = 0;
+	size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	for (int ii = 1; ii < argc; ++ii) {
+		const std::string arg = argv[ii];
+		const bool has_value = (ii + 1 < argc);
+		if (arg == "--help" || arg == "-h") { print_usage(); return 0; }
+		else if (arg == "--test") { printf("fpzip tiled tests: %s\n", run_fpzip_tiled_tests().c_str()); return 0; }
+		else if (arg == "-o" && has_value) output = argv[++ii];
+		else if (arg == "--rows" && has_value) {
+			if (!parse_range(argv[++ii], row_begin, row_end)) { fprintf(stderr, "bad row range %s\n", argv[ii]); return 1; }
+		}
+		else if (arg == "--cols" && has_value) {
+			if (!parse_range(argv[++ii], col_begin, col_end)) { fprintf(stderr, "bad column range %s\n", argv[ii]); return 1; }
+		}
+		else if (arg == "--threads" && has_value) threads = static_cast<size_t>(std::max(1, std::atoi(argv[++ii])));
+		else if (input.empty() && arg[0] != '-') input = arg;
+		else { fprintf(stderr, "unknown option %s\n", arg.c_str()); print_usage(); return 1; }
+	}
+	if (input.empty()) { print_usage(); return 1; }
+	if (output.empty()) output = input.substr(0, input.find_last_of('.')) + std::string(".npy");
+
+	global_row_thread_pool().change_num_threads(threads);
+	const auto start = std::chrono::steady_clock::now();
+	simple_packed_buf depth;
+	std::string errstr;
+	bool ok = false;
+	if (has_suffix(input, ".fpzip")) {
+		// one stream: everything is decompressed, then cut to the region
+		simple_packed_buf whole;
+		ok = read_fpzip_file(input, whole, errstr);
+		if (ok) {
+			if (row_end == 0 || row_end > whole.height) row_end = whole.height;
+			if (col_end == 0 || col_end > whole.width) col_end = whole.width;
+			ok = row_begin < row_end && col_begin < col_end && depth.init_full(col_end - col_begin, row_end - row_begin, BUF_PIX_FMT_GRAYF32);
+			if (!ok) errstr += "empty region";
+			for (size_t row = row_begin; ok && row < row_end; ++row) {
+				std::memcpy(depth.rowptr<float>(row - row_begin), whole.crowptr<float>(row) + col_begin, depth.rowstride_bytes());
+			}
+		}
+	} else {
+		ok = read_fpzip_tiled_file(input, depth, errstr, row_begin, row_end, col_begin, col_end, global_row_thread_pool());
+	}
+	const double decode_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (ok) ok = save_packedbuf_as_npy(output, depth, errstr);
+	global_row_thread_pool().change_num_threads(1);
+	if (!ok) {
+		fprintf(stderr, "%s: %s\n", input.c_str(), errstr.c_str());
+		return 2;
+	}
+	printf("%s: %zu x %zu float32 in %.1f ms on %zu threads -> %s\n", input.c_str(), depth.width, depth.height, decode_ms, threads, output.c_str());
+	return 0;
+}
@@ -29,15 +29,11 @@ float GameAssassinsCreedOrigin::convert_to_physical_distance_depth_u64(uint64_t
 	// // These numbers were found by a curve fit, so are approximate,
 	// // but should be pretty accurate for any depth from centimeters to kilometers
 	// return 1.28 / (0.000077579959 + exp_fast_approx(354.9329993 * normalizeddepth - 83.84035513));
-	uint32_t depth_as_u32 = static_cast<uint32_t>(depthval);
-    float depth;
-    std::memcpy(&depth, &depth_as_u32, sizeof(float));
-
-    const float n = 0.1f;
-    const float f = 10000.0f;
-    const float numerator_constant = (-f * n) / (n - f);
-    const float denominator_constant = n / (n - f);
-    return numerator_constant / (depth - denominator_constant);
+	return ReverseZPolicy<100, 10000000>::convert(depthval);
+}
+
+void GameAssassinsCreedOrigin::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	ReverseZPolicy<100, 10000000>::convert_span(src, count, bytes_per_px, depth_bytes, dst);
 }
 
 uint64_t GameAssassinsCreedOrigin::get_scriptedcambuf_triggerbytes() const
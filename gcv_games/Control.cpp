@@ -10,6 +10,11 @@ float GameControl::convert_to_physical_distance_depth_u64(uint64_t depthval) con
 	return 0.00310475 / (1.0 - normalizeddepth * 1.00787427);
 }
 
+void GameControl::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+		[this](uint64_t depthval) { return GameControl::convert_to_physical_distance_depth_u64(depthval); });
+}
+
 std::string GameControlDX11::gamename_verbose() const { return "Control_DX11"; }
 std::string GameControlDX12::gamename_verbose() const { return "Control_DX12"; }
 
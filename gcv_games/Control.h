@@ -8,6 +8,7 @@ public:
 
 	virtual bool can_interpret_depth_buffer() const override;
 	virtual float convert_to_physical_distance_depth_u64(uint64_t depthval) const override;
+	virtual void convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const override;
 };
 
 class GameControlDX11 : public GameControl {
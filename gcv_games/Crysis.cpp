@@ -21,3 +21,8 @@ float GameCrysis::convert_to_physical_distance_depth_u64(uint64_t depthval) cons
 	const double znorm = static_cast<double>(depthval) / 16777215.0;
 	return static_cast<float>(NEAR_PLANE_DISTANCE / std::max(0.0000001, 1.0 - znorm * (1.0 - NEAR_PLANE_DISTANCE / FAR_PLANE_DISTANCE)));
 }
+
+void GameCrysis::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+		[this](uint64_t depthval) { return GameCrysis::convert_to_physical_distance_depth_u64(depthval); });
+}
@@ -24,3 +24,8 @@ float GameDishonoredDOTO::convert_to_physical_distance_depth_u64(uint64_t depthv
     const double normalizeddepth = static_cast<double>(depthval) / 16777215.0;
     return 5415.69378002 / (1.0 + 541167.20430436 * normalizeddepth);
 }
+
+void GameDishonoredDOTO::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+        [this](uint64_t depthval) { return GameDishonoredDOTO::convert_to_physical_distance_depth_u64(depthval); });
+}
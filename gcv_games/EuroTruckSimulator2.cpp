@@ -47,6 +47,11 @@ float GameEuroTruckSimulator2::convert_to_physical_distance_depth_u64(uint64_t d
     const float linear_depth = z_near * z_far / (z_far - normalized_depth * (z_far - z_near));
     return linear_depth;
 }
+
+void GameEuroTruckSimulator2::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+        [this](uint64_t depthval) { return GameEuroTruckSimulator2::convert_to_physical_distance_depth_u64(depthval); });
+}
 // Shared memory access for camera data
 class SharedMemoryCameraReader {
    private:
@@ -36,15 +36,7 @@ bool GameGTAV::can_interpret_depth_buffer() const {
 
 float GameGTAV::convert_to_physical_distance_depth_u64(uint64_t depthval) const {
 
-    uint32_t depth_as_u32 = static_cast<uint32_t>(depthval);
-    float depth;
-    std::memcpy(&depth, &depth_as_u32, sizeof(float));
-
-    const float n = 0.15f;
-    const float f = 10003.814f;
-    const float numerator_constant = (-f * n) / (n - f);
-    const float denominator_constant = n / (n - f);
-    return numerator_constant / (depth - denominator_constant);
+    return ReverseZPolicy<150, 10003814>::convert(depthval);
     // 将 u64 (实际上是 u32) 的位模式重新解释为 float
     // const double normalized_depth = static_cast<double>(depthval) / static_cast<double>(std::numeric_limits<uint32_t>::max());
     // const double near_plane = 10.0;
@@ -63,3 +55,7 @@ float GameGTAV::convert_to_physical_distance_depth_u64(uint64_t depthval) const
     // float d_lin = (exp(depth * log(1.0f + C)) - 1.0f) / C;
     // return (-f * n) / (d_lin * (f - n) - f);
 }
+
+void GameGTAV::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    ReverseZPolicy<150, 10003814>::convert_span(src, count, bytes_per_px, depth_bytes, dst);
+}
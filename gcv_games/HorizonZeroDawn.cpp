@@ -17,6 +17,11 @@ float GameHorizonZeroDawn::convert_to_physical_distance_depth_u64(uint64_t depth
     return 0.00313259 / (1.0 - normalizeddepth * 1.00787352);
 }
 
+void GameHorizonZeroDawn::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+        [this](uint64_t depthval) { return GameHorizonZeroDawn::convert_to_physical_distance_depth_u64(depthval); });
+}
+
 bool GameHorizonZeroDawn::get_camera_matrix(CamMatrixData& rcam, std::string& errstr) {
     rcam.extrinsic_status = CamMatrix_Uninitialized;
     if (!init_in_game()) return false;
@@ -35,6 +35,11 @@ float GameMicrosoftFlightSimulator2020::convert_to_physical_distance_depth_u64(u
 
     return linear_depth;
 }
+
+void GameMicrosoftFlightSimulator2020::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+        [this](uint64_t depthval) { return GameMicrosoftFlightSimulator2020::convert_to_physical_distance_depth_u64(depthval); });
+}
 uint64_t GameMicrosoftFlightSimulator2020::get_scriptedcambuf_triggerbytes() const {
     const double magic_double = 1.20040525131452021e-12;
     uint64_t magic_int;
@@ -21,6 +21,7 @@ class GameMicrosoftFlightSimulator2020 : public GameWithCameraDataInOneDLL {
     virtual uint64_t get_scriptedcambuf_triggerbytes() const override;
     virtual bool can_interpret_depth_buffer() const override;
     virtual float convert_to_physical_distance_depth_u64(uint64_t depthval) const override;
+    virtual void convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const override;
 };
 
 REGISTER_GAME_INTERFACE(GameMicrosoftFlightSimulator2020, 0, "flightsimulator.exe");
\ No newline at end of file
@@ -36,3 +36,8 @@ float GameMicrosoftFlightSimulator2024::convert_to_physical_distance_depth_u64(u
     const float linear_depth = z_near * z_far / (z_far - normalized_depth * (z_far - z_near));
     return linear_depth;
 }
+
+void GameMicrosoftFlightSimulator2024::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+        [this](uint64_t depthval) { return GameMicrosoftFlightSimulator2024::convert_to_physical_distance_depth_u64(depthval); });
+}
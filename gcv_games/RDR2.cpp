@@ -32,13 +32,9 @@ bool GameRDR2::can_interpret_depth_buffer() const {
 
 float GameRDR2::convert_to_physical_distance_depth_u64(uint64_t depthval) const {
 
-    uint32_t depth_as_u32 = static_cast<uint32_t>(depthval);
-    float depth;
-    std::memcpy(&depth, &depth_as_u32, sizeof(float));
-
-    const float n = 0.15f;
-    const float f = 10003.814f;
-    const float numerator_constant = (-f * n) / (n - f);
-    const float denominator_constant = n / (n - f);
-    return numerator_constant / (depth - denominator_constant);
+    return ReverseZPolicy<150, 10003814>::convert(depthval);
+}
+
+void GameRDR2::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+    ReverseZPolicy<150, 10003814>::convert_span(src, count, bytes_per_px, depth_bytes, dst);
 }
@@ -25,9 +25,15 @@ bool GameResidentEvils::copy_scriptedcambuf_to_matrix(uint8_t* buf, uint64_t buf
 bool GameResidentEvils::can_interpret_depth_buffer() const {
 	return true;
 }
+// This game has a logarithmic depth buffer with unknown constant(s).
+// These numbers were found by a curve fit, so are approximate.
+static constexpr LogDepthExpFit log_depth_fit{ 1.28, 0.0004253421645545, 354.8489261773826, -83.12790960252826 };
+
 float GameResidentEvils::convert_to_physical_distance_depth_u64(uint64_t depthval) const {
-	const double normalizeddepth = static_cast<double>(depthval) / 4294967295.0;
-	// This game has a logarithmic depth buffer with unknown constant(s).
-	// These numbers were found by a curve fit, so are approximate.
-	return 1.28 / (0.0004253421645545 + exp_fast_approx(354.8489261773826 * normalizeddepth - 83.12790960252826));
+	return log_depth_fit.convert(depthval);
+}
+
+// float math with vectorized exp_fast_approx; within a few 1e-5 of the double version, far below the fit error
+void GameResidentEvils::convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	log_depth_fit.convert_span(src, count, bytes_per_px, depth_bytes, dst);
 }
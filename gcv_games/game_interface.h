@@ -3,9 +3,12 @@
 #include "gcv_utils/simple_packed_buf.h"
 #include "game_interface_factory_registration.h"
 #include "gcv_utils/camera_data_struct.h"
+#include "gcv_utils/depth_utils.h"
 #include <Windows.h>
 #include <string>
+#include <cstring>
 namespace reshade { namespace api { struct effect_runtime; } }
+
 class GameInterface {
 protected:
 	HANDLE mygame_handle_exe = 0;
@@ -28,6 +31,11 @@ public:
 	// convert from integer depth to floating-point distance
 	virtual bool can_interpret_depth_buffer() const { return false; }
 	virtual float convert_to_physical_distance_depth_u64(uint64_t depthval) const { return 0.0f; }
+	// converts a row of count texels; games override this with convert_depth_span_with and their own conversion
+	virtual void convert_depth_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+		convert_depth_span_with(src, count, bytes_per_px, depth_bytes, dst,
+			[this](uint64_t depthval) { return convert_to_physical_distance_depth_u64(depthval); });
+	}
 
 	// memory scans
 	virtual bool scan_all_memory_for_scripted_cam_matrix(std::string& errstr) { errstr += "not implemented"; return false; }
@@ -0,0 +1,298 @@
+#include "bc_block_kernels.h"
+#include "pixel_unpack.h"
+#include <immintrin.h>
+#include <cstring>
+#include <vector>
+#include <random>
+
+// ---------------------------------------------------------------------------
+// per-block palettes, shared by the scalar and SSE4.1 decoders
+
+// 4 RGBA colors; the formulas are those of unpack_bc1_value
+static inline void bc1_palette(const uint8_t *src, bool always_four_colors, uint8_t palette[16]) {
+	uint16_t color_0, color_1;
+	memcpy(&color_0, src, 2);
+	memcpy(&color_1, src + 2, 2);
+	unpack_r5g6b5(color_0, palette);
+	unpack_r5g6b5(color_1, palette + 4);
+	const bool four_colors = always_four_colors || color_0 > color_1;
+	for (int c = 0; c < 3; ++c) {
+		palette[8 + c] = static_cast<uint8_t>(four_colors ? (2 * palette[c] + palette[4 + c]) / 3 : (palette[c] + palette[4 + c]) / 2);
+		palette[12 + c] = static_cast<uint8_t>(four_colors ? (palette[c] + 2 * palette[4 + c]) / 3 : 0);
+	}
+	palette[3] = 255;
+	palette[7] = 255;
+	palette[11] = 255;
+	palette[15] = four_colors ? 255 : 0;
+}
+
+// 8 values; the formulas are those of unpack_bc4_value
+static inline void bc4_palette(uint8_t value_0, uint8_t value_1, uint8_t palette[8]) {
+	palette[0] = value_0;
+	palette[1] = value_1;
+	if (value_0 > value_1) {
+		for (int i = 1; i < 7; ++i)
+			palette[1 + i] = static_cast<uint8_t>(((7 - i) * value_0 + i * value_1) / 7);
+	} else {
+		for (int i = 1; i < 5; ++i)
+			palette[1 + i] = static_cast<uint8_t>(((5 - i) * value_0 + i * value_1) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// the 16 3-bit indices of a bc4 channel, stored in bytes 2..7 of its 8 bytes
+static inline uint64_t bc4_indices(const uint8_t *src) {
+	uint64_t bits = 0;
+	memcpy(&bits, src + 2, 6);
+	return bits;
+}
+
+// ---------------------------------------------------------------------------
+// scalar
+
+static void scalar_bc1_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t palette[16];
+	bc1_palette(src, false, palette);
+	uint32_t color_i;
+	memcpy(&color_i, src + 4, 4);
+	for (int y = 0; y < 4; ++y, dst += dst_stride)
+		for (int x = 0; x < 4; ++x)
+			memcpy(dst + x * 4, palette + 4 * ((color_i >> (2 * (y * 4 + x))) & 0x3), 4);
+}
+
+static void scalar_bc3_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t alpha_palette[8];
+	bc4_palette(src[0], src[1], alpha_palette);
+	const uint64_t alpha_i = bc4_indices(src);
+	uint8_t palette[16];
+	bc1_palette(src + 8, true, palette);
+	uint32_t color_i;
+	memcpy(&color_i, src + 12, 4);
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		for (int x = 0; x < 4; ++x) {
+			memcpy(dst + x * 4, palette + 4 * ((color_i >> (2 * (y * 4 + x))) & 0x3), 3);
+			dst[x * 4 + 3] = alpha_palette[(alpha_i >> (3 * (y * 4 + x))) & 0x7];
+		}
+	}
+}
+
+static void scalar_bc4_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t palette[8];
+	bc4_palette(src[0], src[1], palette);
+	const uint64_t red_i = bc4_indices(src);
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		for (int x = 0; x < 4; ++x) {
+			const uint8_t value = palette[(red_i >> (3 * (y * 4 + x))) & 0x7];
+			dst[x * 4 + 0] = value;
+			dst[x * 4 + 1] = value;
+			dst[x * 4 + 2] = value;
+			dst[x * 4 + 3] = 255;
+		}
+	}
+}
+
+static void scalar_bc5_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t red_palette[8], green_palette[8];
+	bc4_palette(src[0], src[1], red_palette);
+	bc4_palette(src[8], src[9], green_palette);
+	const uint64_t red_i = bc4_indices(src);
+	const uint64_t green_i = bc4_indices(src + 8);
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		for (int x = 0; x < 4; ++x) {
+			dst[x * 4 + 0] = red_palette[(red_i >> (3 * (y * 4 + x))) & 0x7];
+			dst[x * 4 + 1] = green_palette[(green_i >> (3 * (y * 4 + x))) & 0x7];
+			dst[x * 4 + 2] = 0;
+			dst[x * 4 + 3] = 255;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.1: the palette sits in one register and each row of 4 pixels is a single pshufb of it.
+// The per-pixel indices of a row are spread into the 4 dword lanes with one pmulld
+// (lane x is shifted left so that a common right shift leaves pixel x's index at the bottom),
+// and pshufb mask bytes with the high bit set select zero.
+
+// lane x = 2-bit index of pixel x, from the 8 index bits of a bc1 row
+static inline __m128i sse41_bc1_row_indices(uint32_t row_bits) {
+	const __m128i spread = _mm_mullo_epi32(_mm_set1_epi32(static_cast<int>(row_bits)), _mm_setr_epi32(64, 16, 4, 1));
+	return _mm_and_si128(_mm_srli_epi32(spread, 6), _mm_set1_epi32(0x3));
+}
+
+// lane x = 3-bit index of pixel x, from the 12 index bits of a bc4 row
+static inline __m128i sse41_bc4_row_indices(uint32_t row_bits) {
+	const __m128i spread = _mm_mullo_epi32(_mm_set1_epi32(static_cast<int>(row_bits)), _mm_setr_epi32(512, 64, 8, 1));
+	return _mm_and_si128(_mm_srli_epi32(spread, 9), _mm_set1_epi32(0x7));
+}
+
+// pshufb mask selecting 4 palette bytes per pixel: index * 4 + {0, 1, 2, 3}
+static inline __m128i sse41_bc1_row_mask(uint32_t row_bits) {
+	return _mm_add_epi32(_mm_mullo_epi32(sse41_bc1_row_indices(row_bits), _mm_set1_epi32(0x04040404)), _mm_set1_epi32(0x03020100));
+}
+
+static void sse41_bc1_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t palette_bytes[16];
+	bc1_palette(src, false, palette_bytes);
+	const __m128i palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette_bytes));
+	uint32_t color_i;
+	memcpy(&color_i, src + 4, 4);
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		const __m128i row = _mm_shuffle_epi8(palette, sse41_bc1_row_mask((color_i >> (8 * y)) & 0xFF));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), row);
+	}
+}
+
+static void sse41_bc3_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t alpha_palette_bytes[16] = {};
+	bc4_palette(src[0], src[1], alpha_palette_bytes);
+	const __m128i alpha_palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(alpha_palette_bytes));
+	const uint64_t alpha_i = bc4_indices(src);
+	uint8_t palette_bytes[16];
+	bc1_palette(src + 8, true, palette_bytes);
+	const __m128i palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette_bytes));
+	uint32_t color_i;
+	memcpy(&color_i, src + 12, 4);
+	const __m128i alpha_bytes = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		const __m128i color = _mm_shuffle_epi8(palette, sse41_bc1_row_mask((color_i >> (8 * y)) & 0xFF));
+		// alpha index into byte 3 of each pixel, the other bytes select zero
+		const __m128i alpha_mask = _mm_or_si128(_mm_slli_epi32(sse41_bc4_row_indices(static_cast<uint32_t>(alpha_i >> (12 * y)) & 0xFFF), 24), _mm_set1_epi32(0x00808080));
+		const __m128i alpha = _mm_shuffle_epi8(alpha_palette, alpha_mask);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_blendv_epi8(color, alpha, alpha_bytes));
+	}
+}
+
+static void sse41_bc4_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	// entry 8 holds the opaque alpha
+	uint8_t palette_bytes[16] = {};
+	bc4_palette(src[0], src[1], palette_bytes);
+	palette_bytes[8] = 255;
+	const __m128i palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(palette_bytes));
+	const uint64_t red_i = bc4_indices(src);
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		// {i, i, i, 8} per pixel
+		const __m128i indices = sse41_bc4_row_indices(static_cast<uint32_t>(red_i >> (12 * y)) & 0xFFF);
+		const __m128i mask = _mm_or_si128(_mm_mullo_epi32(indices, _mm_set1_epi32(0x00010101)), _mm_set1_epi32(0x08000000));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(palette, mask));
+	}
+}
+
+static void sse41_bc5_block(const uint8_t *src, uint8_t *dst, size_t dst_stride) {
+	uint8_t red_palette_bytes[16] = {}, green_palette_bytes[16] = {};
+	bc4_palette(src[0], src[1], red_palette_bytes);
+	bc4_palette(src[8], src[9], green_palette_bytes);
+	const __m128i red_palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(red_palette_bytes));
+	const __m128i green_palette = _mm_loadu_si128(reinterpret_cast<const __m128i *>(green_palette_bytes));
+	const uint64_t red_i = bc4_indices(src);
+	const uint64_t green_i = bc4_indices(src + 8);
+	const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+	for (int y = 0; y < 4; ++y, dst += dst_stride) {
+		const __m128i red_mask = _mm_or_si128(sse41_bc4_row_indices(static_cast<uint32_t>(red_i >> (12 * y)) & 0xFFF), _mm_set1_epi32(static_cast<int>(0x80808000u)));
+		const __m128i green_mask = _mm_or_si128(_mm_slli_epi32(sse41_bc4_row_indices(static_cast<uint32_t>(green_i >> (12 * y)) & 0xFFF), 8), _mm_set1_epi32(static_cast<int>(0x80800080u)));
+		const __m128i row = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(red_palette, red_mask), _mm_shuffle_epi8(green_palette, green_mask)), opaque);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), row);
+	}
+}
+
+// ---------------------------------------------------------------------------
+// dispatch
+
+static const bc_block_kernel_table bc_block_tables[SwizzleISA_count] = {
+	{ scalar_bc1_block, scalar_bc3_block, scalar_bc4_block, scalar_bc5_block }, // scalar
+	{ sse41_bc1_block, sse41_bc3_block, sse41_bc4_block, sse41_bc5_block },     // sse4.1
+	{ sse41_bc1_block, sse41_bc3_block, sse41_bc4_block, sse41_bc5_block },     // avx2
+};
+
+const bc_block_kernel_table &bc_block_kernels(SwizzleKernelISA isa) {
+	if (isa < SwizzleISA_scalar || isa >= SwizzleISA_count || isa > swizzle_best_supported_isa())
+		return bc_block_tables[SwizzleISA_scalar];
+	return bc_block_tables[isa];
+}
+
+const bc_block_kernel_table &bc_block_kernels_best() {
+	return bc_block_tables[swizzle_best_supported_isa()];
+}
+
+// ---------------------------------------------------------------------------
+// reference and tests
+
+void bc_block_decode_per_pixel(int bc, const uint8_t *src, uint8_t dst[64]) {
+	uint8_t color_0_rgb[3], color_1_rgb[3];
+	const uint8_t *const color_src = (bc == 3) ? (src + 8) : src;
+	const uint16_t color_0 = static_cast<uint16_t>(color_src[0] | (color_src[1] << 8));
+	const uint16_t color_1 = static_cast<uint16_t>(color_src[2] | (color_src[3] << 8));
+	uint32_t color_i;
+	memcpy(&color_i, color_src + 4, 4);
+	unpack_r5g6b5(color_0, color_0_rgb);
+	unpack_r5g6b5(color_1, color_1_rgb);
+	const uint64_t first_i = bc4_indices(src);
+	const uint64_t second_i = bc4_indices(src + 8);
+	for (int p = 0; p < 16; ++p) {
+		uint8_t *const out = dst + p * 4;
+		switch (bc) {
+		case 1:
+			unpack_bc1_value(color_0_rgb, color_1_rgb, (color_i >> (2 * p)) & 0x3, out, color_0 > color_1);
+			break;
+		case 3:
+			unpack_bc1_value(color_0_rgb, color_1_rgb, (color_i >> (2 * p)) & 0x3, out);
+			unpack_bc4_value(src[0], src[1], (first_i >> (3 * p)) & 0x7, out + 3);
+			break;
+		case 4:
+			unpack_bc4_value(src[0], src[1], (first_i >> (3 * p)) & 0x7, out);
+			out[1] = out[0];
+			out[2] = out[0];
+			out[3] = 255;
+			break;
+		case 5:
+			unpack_bc4_value(src[0], src[1], (first_i >> (3 * p)) & 0x7, out);
+			unpack_bc4_value(src[8], src[9], (second_i >> (3 * p)) & 0x7, out + 1);
+			out[2] = 0;
+			out[3] = 255;
+			break;
+		}
+	}
+}
+
+std::string run_bc_block_kernel_tests() {
+	struct bc_test_entry {
+		int bc;
+		size_t block_bytes;
+		bc_block_decode_fn bc_block_kernel_table::*fn;
+	};
+	static const bc_test_entry entries[] = {
+		{ 1, 8, &bc_block_kernel_table::bc1 },
+		{ 3, 16, &bc_block_kernel_table::bc3 },
+		{ 4, 8, &bc_block_kernel_table::bc4 },
+		{ 5, 16, &bc_block_kernel_table::bc5 },
+	};
+	std::mt19937 rng(4321);
+	const SwizzleKernelISA best = swizzle_best_supported_isa();
+	uint8_t src[16];
+	uint8_t expected[64];
+	// decoded into a wider image so that writes outside the block would show up
+	const size_t dst_stride = 24;
+	uint8_t decoded[4 * dst_stride];
+	for (const bc_test_entry &entry : entries) {
+		for (int trial = 0; trial < 20000; ++trial) {
+			for (auto &bb : src) bb = static_cast<uint8_t>(rng());
+			// equal endpoints select the 3-color / 6-value modes; cover them for both halves of 16 byte blocks
+			if (trial % 8 == 1) { src[2] = src[0]; src[3] = src[1]; }
+			if (trial % 8 == 2) { src[10] = src[8]; src[11] = src[9]; }
+			if (trial % 8 == 3) { src[1] = src[0]; }
+			if (trial % 8 == 4) { src[9] = src[8]; }
+			bc_block_decode_per_pixel(entry.bc, src, expected);
+			for (int isa = SwizzleISA_scalar; isa <= best; ++isa) {
+				memset(decoded, 0xA5, sizeof(decoded));
+				(bc_block_tables[isa].*entry.fn)(src, decoded, dst_stride);
+				for (int y = 0; y < 4; ++y) {
+					if (memcmp(decoded + y * dst_stride, expected + y * 16, 16) != 0 || decoded[y * dst_stride + 16] != 0xA5) {
+						return std::string("failed: ") + SwizzleKernelISANames[isa] + std::string(" bc") + std::to_string(entry.bc)
+							+ std::string(" block differs from per-pixel decoder in trial ") + std::to_string(trial);
+					}
+				}
+			}
+		}
+	}
+	return std::string("ok (") + SwizzleKernelISANames[best] + std::string(")");
+}
@@ -0,0 +1,30 @@
+#pragma once
+// Block decoders used by bc1/bc3/bc4/bc5_block_copy in tex_buffer_utils. Each call decodes
+// one whole 4x4 block into 4 rows of 4 RGBA pixels, building the block's palette once
+// instead of once per pixel. The SSE4.1 table must produce bit-identical output to the
+// scalar table, and both must match unpack_bc1_value/unpack_bc4_value (see run_bc_block_kernel_tests).
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "pixel_swizzle_kernels.h"
+
+// writes 4 rows of 16 bytes, dst_stride bytes apart
+typedef void (*bc_block_decode_fn)(const uint8_t *src, uint8_t *dst, size_t dst_stride);
+
+struct bc_block_kernel_table {
+	bc_block_decode_fn bc1; // 8 byte blocks; 3-color blocks have transparent black
+	bc_block_decode_fn bc3; // 16 byte blocks: bc4-style alpha, then 4-color bc1 color
+	bc_block_decode_fn bc4; // 8 byte blocks, decoded as gray
+	bc_block_decode_fn bc5; // 16 byte blocks, red and green
+};
+
+// same ISA levels as the pixel swizzle kernels; AVX2 uses the SSE4.1 decoders
+const bc_block_kernel_table &bc_block_kernels(SwizzleKernelISA isa);
+const bc_block_kernel_table &bc_block_kernels_best();
+
+// the per-pixel decoding the bc*_block_copy loops did before the block decoders (bc is 1, 3, 4 or 5),
+// as 4 rows of 4 RGBA pixels; the tests and capture_bench compare the tables against it
+void bc_block_decode_per_pixel(int bc, const uint8_t *src, uint8_t dst[64]);
+
+// return error string if test failed; "ok" means every supported ISA matches the per-pixel decoder
+std::string run_bc_block_kernel_tests();
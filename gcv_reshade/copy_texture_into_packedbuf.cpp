@@ -5,9 +5,16 @@
  * Other portions Copyright (C) 2022 Jason Bunk
  */
 #include <reshade.hpp> 
+#include <cstring>
 #include "copy_texture_into_packedbuf.h"
 #include "tex_buffer_utils.h"
+#include "pixel_swizzle_kernels.h"
+#include "gcv_utils/parallel_rows.h"
 #include "xxhash.h"
+#include "gcv_utils/seg_pixel_runs.h"
+#include "gcv_utils/staging_pool.h"
+#include "gcv_utils/packedbuf_downscale.h"
+#include "gcv_utils/raw_frame_pool.h"
 #include "render_target_stats/reshade_tex_format_info.hpp"
 
 using namespace reshade::api;
@@ -19,9 +26,48 @@ T ceil_int(T x, T y) {
 	return (x + y - static_cast<T>(1)) / y;
 }
 
+// One band of output rows. Without downscaling, converted source rows go straight into dstBuf; otherwise they go into
+// a scratch band with factor times as many rows, which finish() reduces into dstBuf. So only one band per thread
+// is ever held at full resolution. dstBuf.pixfmt has to be set before finish() is called.
+class converted_band {
+	simple_packed_buf &dstBuf;
+	const size_t src_width;
+	const size_t factor;
+	const PackedBufDownscaleFilter filter;
+	const size_t out_row_begin;
+	size_t src_stride = 0;
+	uint8_t *scratch = nullptr;
+public:
+	const size_t src_row_begin;
+	const size_t src_row_end;
+
+	converted_band(simple_packed_buf &dstBuf_, size_t src_width_, size_t factor_, PackedBufDownscaleFilter filter_, size_t out_row_begin_, size_t out_row_end_)
+		: dstBuf(dstBuf_), src_width(src_width_), factor(factor_), filter(filter_), out_row_begin(out_row_begin_),
+		src_row_begin(out_row_begin_ * factor_), src_row_end(out_row_end_ * factor_)
+	{
+		if (factor > 1) {
+			// kept per worker thread, so bands after the first don't allocate
+			static thread_local std::vector<uint8_t> scratch_bytes;
+			src_stride = src_width * dstBuf.bytes_per_pixel();
+			if (scratch_bytes.size() < src_stride * (src_row_end - src_row_begin)) scratch_bytes.resize(src_stride * (src_row_end - src_row_begin));
+			scratch = scratch_bytes.data();
+		}
+	}
+	template<typename T> T *row(size_t src_y) {
+		if (factor <= 1) return dstBuf.rowptr<T>(src_y);
+		return reinterpret_cast<T *>(scratch + (src_y - src_row_begin) * src_stride);
+	}
+	void finish() {
+		if (factor <= 1 || src_row_end == src_row_begin) return;
+		downscale_packed_pixels(dstBuf.pixfmt, scratch, src_stride, src_width, src_row_end - src_row_begin, factor, filter,
+			dstBuf.rowptr<uint8_t>(out_row_begin), dstBuf.rowstride_bytes());
+	}
+};
+
 void depth_gray_bytesLE_to_f32(simple_packed_buf &dstBuf, const resource_desc &desc, const subresource_data &data,
 							size_t hint_srcbytes, size_t hint_srcbyteskeep, int hint_pitchadjusthack,
-							GameInterface* gamehandle, const depth_tex_settings &settings) {
+							GameInterface* gamehandle, const depth_tex_settings &settings, DepthFrameStats *depth_stats,
+							size_t downscale, PackedBufDownscaleFilter downscale_filter) {
 
 	//// ??????????????
 	//uint8_t* debug_ptr = static_cast<uint8_t*>(data.data);
@@ -80,162 +126,235 @@ void depth_gray_bytesLE_to_f32(simple_packed_buf &dstBuf, const resource_desc &d
 			return;
 		}
 	}
-	uint8_t *src_p = static_cast<uint8_t *>(data.data);
+	uint8_t *const src_data = static_cast<uint8_t *>(data.data);
 	if (!gamehandle_can_interpret_depth && !settings.debug_mode) {
 		dstBuf.pixfmt = BUF_PIX_FMT_GRAYU32;
 	}
 	constexpr uint64_t clipu32 = static_cast<uint64_t>(std::numeric_limits<uint32_t>::max());
 	uint64_t maxv = 0ull;
 	uint64_t minv = std::numeric_limits<uint64_t>::max();
-	float *dstfp;
-	uint32_t *dstup;
-	float *src_f;
-	uint8_t endianflip[8];
-	uint64_t vi;
-	size_t x, y, z;
-	for (y = 0; y < desc.texture.height; ++y, src_p += rowpitch) {
-		dstfp = dstBuf.rowptr<float>(y);
-		dstup = dstBuf.rowptr<uint32_t>(y);
-		if (dstfp == nullptr || dstup == nullptr) continue;
-		if (!settings.debug_mode) {
-			if (!settings.alreadyfloat) {
-				for (x = 0; x < desc.texture.width; ++x) {
-					const uint8_t *const src = src_p + x * srcpixbytes;
-					vi = 0;
-					for (z = 0; z < depthbytes2keep; ++z) {
-						vi += static_cast<uint64_t>(src[z]) << (8ull * z);
-					}
-					if (maxv < vi) maxv = vi;
-					if (minv > vi) minv = vi;
+	// raw min/max is only logged, so games that convert depth skip it unless it is printed
+	const bool want_minmax = settings.debug_mode || settings.more_verbose;
+	std::mutex minmax_mtx;
+	// stats are gathered from each row right after it was converted, while it is still in cache
+	const bool want_stats = depth_stats != nullptr && !settings.debug_mode;
+	if (want_stats) {
+		depth_stats->reset();
+		if (dstBuf.pixfmt == BUF_PIX_FMT_GRAYU32) {
+			// raw integers: histogram from 1 to 2^32, and there is no sky distance
+			depth_stats->hist_first_octave = 0;
+			depth_stats->sky_distance = std::numeric_limits<float>::infinity();
+		}
+	}
+	parallel_for_rows(dstBuf.height, 0, [&](size_t row_begin, size_t row_end) {
+		converted_band band(dstBuf, desc.texture.width, downscale, downscale_filter, row_begin, row_end);
+		uint64_t band_maxv = 0ull;
+		uint64_t band_minv = std::numeric_limits<uint64_t>::max();
+		DepthFrameStats band_stats;
+		if (want_stats) {
+			band_stats.hist_first_octave = depth_stats->hist_first_octave;
+			band_stats.sky_distance = depth_stats->sky_distance;
+		}
+		float *dstfp;
+		uint32_t *dstup;
+		float *src_f;
+		uint8_t endianflip[8];
+		uint64_t vi;
+		size_t x, y, z;
+		uint8_t *src_p = src_data + band.src_row_begin * rowpitch;
+		for (y = band.src_row_begin; y < band.src_row_end; ++y, src_p += rowpitch) {
+			dstfp = band.row<float>(y);
+			dstup = band.row<uint32_t>(y);
+			if (dstfp == nullptr || dstup == nullptr) continue;
+			if (!settings.debug_mode) {
+				if (!settings.alreadyfloat) {
 					if (gamehandle_can_interpret_depth) {
-						dstfp[x] = gamehandle->convert_to_physical_distance_depth_u64(vi);
-					} else {
-						dstup[x] = static_cast<uint32_t>(std::min(clipu32,vi));
+						// one call per row; the game's span loop inlines its own conversion
+						gamehandle->convert_depth_span(src_p, desc.texture.width, static_cast<int>(srcpixbytes), static_cast<int>(depthbytes2keep), dstfp);
 					}
-				}
-			} else {
-				if (settings.float_reverse_endian) {
-					for (x = 0; x < desc.texture.width; ++x) {
-						const uint8_t *const src = src_p + x * srcpixbytes;
-						endianflip[3] = src[0];
-						endianflip[2] = src[1];
-						endianflip[1] = src[2];
-						endianflip[0] = src[3];
-						dstfp[x] = *reinterpret_cast<float *>(endianflip);
+					if (!gamehandle_can_interpret_depth || want_minmax) {
+						for (x = 0; x < desc.texture.width; ++x) {
+							const uint8_t *const src = src_p + x * srcpixbytes;
+							vi = 0;
+							for (z = 0; z < depthbytes2keep; ++z) {
+								vi += static_cast<uint64_t>(src[z]) << (8ull * z);
+							}
+							if (band_maxv < vi) band_maxv = vi;
+							if (band_minv > vi) band_minv = vi;
+							if (!gamehandle_can_interpret_depth) {
+								dstup[x] = static_cast<uint32_t>(std::min(clipu32,vi));
+							}
+						}
 					}
-				}
-				else {
-					src_f = reinterpret_cast<float *>(src_p);
-					for (x = 0; x < desc.texture.width; ++x) {
-						dstfp[x] = src_f[x];
+				} else {
+					if (settings.float_reverse_endian) {
+						for (x = 0; x < desc.texture.width; ++x) {
+							const uint8_t *const src = src_p + x * srcpixbytes;
+							endianflip[3] = src[0];
+							endianflip[2] = src[1];
+							endianflip[1] = src[2];
+							endianflip[0] = src[3];
+							dstfp[x] = *reinterpret_cast<float *>(endianflip);
+						}
+					}
+					else {
+						src_f = reinterpret_cast<float *>(src_p);
+						for (x = 0; x < desc.texture.width; ++x) {
+							dstfp[x] = src_f[x];
+						}
 					}
 				}
+			} else {
+				vi = ceil_int<uint64_t>(desc.texture.width, srcpixbytes);
+				for (x = 0; x < desc.texture.width; ++x) {
+					const uint8_t *const src = src_p + x * srcpixbytes;
+					dstfp[x] = static_cast<float>(src[x / vi]);
+				}
 			}
-		} else {
-			vi = ceil_int<uint64_t>(desc.texture.width, srcpixbytes);
-			for (x = 0; x < desc.texture.width; ++x) {
-				const uint8_t *const src = src_p + x * srcpixbytes;
-				dstfp[x] = static_cast<float>(src[x / vi]);
+			if (want_stats && downscale <= 1) {
+				if (dstBuf.pixfmt == BUF_PIX_FMT_GRAYU32) band_stats.add_row(dstup, desc.texture.width);
+				else band_stats.add_row(dstfp, desc.texture.width);
 			}
 		}
-	}
+		band.finish();
+		if (want_stats && downscale > 1) {
+			// describe the frame that is saved, not the full-resolution rows it was reduced from
+			for (y = row_begin; y < row_end; ++y) {
+				if (dstBuf.pixfmt == BUF_PIX_FMT_GRAYU32) band_stats.add_row(dstBuf.rowptr<uint32_t>(y), dstBuf.width);
+				else band_stats.add_row(dstBuf.rowptr<float>(y), dstBuf.width);
+			}
+		}
+		std::lock_guard<std::mutex> lock(minmax_mtx);
+		maxv = std::max(maxv, band_maxv);
+		minv = std::min(minv, band_minv);
+		if (want_stats) depth_stats->merge(band_stats);
+	});
 	if (settings.debug_mode || settings.more_verbose) {
 		reshade::log_message(reshade::log_level::info, std::string(std::string("depth_gray_bytesLE_to_f32: min ") + std::to_string(minv) + std::string(", max ") + std::to_string(maxv)).c_str());
+		if (want_stats) {
+			reshade::log_message(reshade::log_level::info, std::string(std::string("depth frame stats: ") + depth_stats->summary()).c_str());
+		}
 	}
 }
 
+// runs one row kernel from pixel_swizzle_kernels over every row of the mapped texture
+static void swizzle_rows_into_packedbuf(simple_packed_buf &dstBuf, const resource_desc &desc, const subresource_data &data, swizzle_row_fn rowfn,
+	size_t downscale, PackedBufDownscaleFilter downscale_filter) {
+	const uint8_t *const data_p = static_cast<const uint8_t *>(data.data);
+	parallel_for_rows(dstBuf.height, 0, [&](size_t row_begin, size_t row_end) {
+		converted_band band(dstBuf, desc.texture.width, downscale, downscale_filter, row_begin, row_end);
+		for (size_t y = band.src_row_begin; y < band.src_row_end; ++y) {
+			rowfn(data_p + y * data.row_pitch, band.row<uint8_t>(y), desc.texture.width);
+		}
+		band.finish();
+	});
+}
+
+// the bc decoders write whole 4x4 blocks, so downscaled BC textures are decoded at full size first
+// (they are material textures, not the per-frame render targets that captures are reduced for)
+static bool bc_blocks_into_packedbuf(simple_packed_buf &dstBuf, const resource_desc &desc, const subresource_data &data,
+	void (*block_copy)(simple_packed_buf &, const resource_desc &, const subresource_data &), size_t downscale, PackedBufDownscaleFilter downscale_filter) {
+	if (downscale <= 1) {
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
+		block_copy(dstBuf, desc, data);
+		return true;
+	}
+	simple_packed_buf full;
+	if (!full.init_full(desc.texture.width, desc.texture.height, BUF_PIX_FMT_RGBA) || !dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
+	block_copy(full, desc, data);
+	return downscale_packed_pixels(BUF_PIX_FMT_RGBA, full.cdata<uint8_t>(), full.rowstride_bytes(), full.width, full.height, downscale, downscale_filter,
+		dstBuf.data<uint8_t>(), dstBuf.rowstride_bytes());
+}
+
+static PackedBufDownscaleFilter downscale_filter_for(TextureInterpretation tex_interp, const capture_region &region) {
+	switch (tex_interp) {
+	case TexInterp_Depth: return region.depth_filter;
+	case TexInterp_IndexedSeg: return PackedBufDownscale_Nearest; // ids can't be averaged
+	default: return PackedBufDownscale_Box;
+	}
+}
+
+// rows and columns of texels in the blocks textures of this format are stored as
+static uint32_t format_block_size(format fmt) {
+	switch (fmt) {
+	case format::bc1_typeless: case format::bc1_unorm: case format::bc1_unorm_srgb:
+	case format::bc3_typeless: case format::bc3_unorm: case format::bc3_unorm_srgb:
+	case format::bc4_typeless: case format::bc4_unorm: case format::bc4_snorm:
+	case format::bc5_typeless: case format::bc5_unorm: case format::bc5_snorm:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+// the part of the texture covered by region, widened to whole blocks for block-compressed formats; false if it is empty
+static bool capture_region_box(const capture_region &region, const resource_desc &desc, subresource_box &box) {
+	const uint64_t block = format_block_size(desc.texture.format);
+	const uint64_t left = region.x / block * block;
+	const uint64_t top = region.y / block * block;
+	const uint64_t right = region.width ? ceil_int<uint64_t>(static_cast<uint64_t>(region.x) + region.width, block) * block : desc.texture.width;
+	const uint64_t bottom = region.height ? ceil_int<uint64_t>(static_cast<uint64_t>(region.y) + region.height, block) * block : desc.texture.height;
+	box = {};
+	box.left = static_cast<uint32_t>(left);
+	box.top = static_cast<uint32_t>(top);
+	box.right = static_cast<uint32_t>(std::min<uint64_t>(right, desc.texture.width));
+	box.bottom = static_cast<uint32_t>(std::min<uint64_t>(bottom, desc.texture.height));
+	box.back = 1;
+	if (box.right <= box.left || box.bottom <= box.top) {
+		reshade::log_message(reshade::log_level::error, std::string(std::string("capture region at ") + std::to_string(region.x) + std::string(",") + std::to_string(region.y)
+			+ std::string(" is outside of the ") + std::to_string(desc.texture.width) + std::string(" x ") + std::to_string(desc.texture.height) + std::string(" texture")).c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool box_is_whole_texture(const subresource_box &box, const resource_desc &desc) {
+	return box.left == 0 && box.top == 0 && box.right == desc.texture.width && box.bottom == desc.texture.height;
+}
+
 bool copy_texture_image_given_ready_resource_into_packedbuf(
 	GameInterface *gamehandle, simple_packed_buf &dstBuf,
 	const resource_desc &desc, const subresource_data &data,
-	TextureInterpretation tex_interp, const depth_tex_settings& depth_settings)
+	TextureInterpretation tex_interp, const depth_tex_settings& depth_settings,
+	PackedBufChannelOrder channel_order, DepthFrameStats *depth_stats, PackedBufColorDepth color_depth,
+	size_t downscale, PackedBufDownscaleFilter downscale_filter)
 {
-	dstBuf.width = desc.texture.width;
-	dstBuf.height = desc.texture.height;
+	downscale = std::max<size_t>(downscale, 1);
+	dstBuf.width = desc.texture.width / downscale;
+	dstBuf.height = desc.texture.height / downscale;
+	if (dstBuf.width == 0 || dstBuf.height == 0) {
+		reshade::log_message(reshade::log_level::error, std::string(std::string("Failed to save texture: ") + std::to_string(desc.texture.width) + std::string(" x ")
+			+ std::to_string(desc.texture.height) + std::string(" is smaller than the downscale factor ") + std::to_string(downscale)).c_str());
+		return false;
+	}
 
-	uint8_t *data_p = static_cast<uint8_t *>(data.data);
+	const swizzle_kernel_table &kernels = swizzle_kernels_best();
 
 	switch (desc.texture.format)
 	{
 	case format::l8_unorm:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = src[0];
-				dst[1] = src[0];
-				dst[2] = src[0];
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.l8_to_rgb24, downscale, downscale_filter);
 		break;
 	case format::a8_unorm:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = 0;
-				dst[1] = 0;
-				dst[2] = 0;
-				dst[3] = src[0];
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.a8_to_rgba, downscale, downscale_filter);
 		break;
 	case format::r8_typeless:
 	case format::r8_unorm:
 	case format::r8_snorm:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = src[0];
-				dst[1] = 0;
-				dst[2] = 0;
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r8_to_rgb24, downscale, downscale_filter);
 		break;
 	case format::l8a8_unorm:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x * 2;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = src[0];
-				dst[1] = src[0];
-				dst[2] = src[0];
-				dst[3] = src[1];
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.l8a8_to_rgba, downscale, downscale_filter);
 		break;
 	case format::r8g8_typeless:
 	case format::r8g8_unorm:
 	case format::r8g8_snorm:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x * 2;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = src[0];
-				dst[1] = src[1];
-				dst[2] = 0;
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r8g8_to_rgb24, downscale, downscale_filter);
 		break;
 	case format::r8g8b8a8_typeless:
 	case format::r8g8b8a8_unorm:
@@ -244,19 +363,7 @@ bool copy_texture_image_given_ready_resource_into_packedbuf(
 	case format::r8g8b8x8_unorm:
 	case format::r8g8b8x8_unorm_srgb:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x * 4;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				dst[0] = src[0];
-				dst[1] = src[1];
-				dst[2] = src[2];
-				dst[3] = (tex_interp == TexInterp_RGB) ? 255 : src[3];
-			}
-		}
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, (tex_interp == TexInterp_RGB) ? kernels.rgba8_to_rgba_opaque : kernels.rgba8_to_rgba, downscale, downscale_filter);
 		break;
 	case format::b8g8r8a8_typeless:
 	case format::b8g8r8a8_unorm:
@@ -264,73 +371,79 @@ bool copy_texture_image_given_ready_resource_into_packedbuf(
 	case format::b8g8r8x8_typeless:
 	case format::b8g8r8x8_unorm:
 	case format::b8g8r8x8_unorm_srgb:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint8_t *const src = data_p + x * 4;
-				uint8_t *const dst = dstBuf.entryptr<uint8_t>(y, x);
-
-				// Swap red and blue channel
-				dst[0] = src[2];
-				dst[1] = src[1];
-				dst[2] = src[0];
-				dst[3] = (tex_interp == TexInterp_RGB) ? 255 : src[3];
-			}
+		if (channel_order == PackedBufOrder_Native) {
+			// keep channel order; the rgba8 kernels don't care which of the first 3 bytes is red
+			if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_BGRA)) return false;
+			swizzle_rows_into_packedbuf(dstBuf, desc, data, (tex_interp == TexInterp_RGB) ? kernels.rgba8_to_rgba_opaque : kernels.rgba8_to_rgba, downscale, downscale_filter);
+			break;
 		}
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
+		// Swap red and blue channel
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, (tex_interp == TexInterp_RGB) ? kernels.bgra8_to_rgba_opaque : kernels.bgra8_to_rgba, downscale, downscale_filter);
 		break;
 	case format::r10g10b10a2_uint: case format::b10g10r10a2_uint:
 	case format::r10g10b10a2_unorm: case format::b10g10r10a2_unorm:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) return false;
-		for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch)
-		{
-			for (size_t x = 0; x < desc.texture.width; ++x)
-			{
-				const uint32_t* const src = reinterpret_cast<uint32_t*>(data_p + x * 4);
-				uint8_t* const dst = dstBuf.entryptr<uint8_t>(y, x);
-				r10g10b10a2_to_r8g8b8(*src, dst);
-			}
+		if (color_depth == PackedBufColor_Full) {
+			if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB48)) return false;
+			swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r10g10b10a2_to_rgb48, downscale, downscale_filter);
+			break;
 		}
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) return false;
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r10g10b10a2_to_rgb24, downscale, downscale_filter);
+		break;
+	case format::r16g16b16a16_unorm:
+	case format::r16g16b16a16_uint:
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA64)) return false;
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.rgba16_to_rgba64, downscale, downscale_filter);
+		break;
+	case format::r16_float:
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_GRAYF32)) return false;
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r16f_to_grayf32, downscale, downscale_filter);
+		break;
+	case format::r16g16_typeless: // the default typed format of both typeless cases is float
+	case format::r16g16_float:
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGF32)) return false;
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.r16g16f_to_rgf32, downscale, downscale_filter);
+		break;
+	case format::r16g16b16a16_typeless:
+	case format::r16g16b16a16_float:
+		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBAF32)) return false;
+		swizzle_rows_into_packedbuf(dstBuf, desc, data, kernels.rgba16f_to_rgbaf32, downscale, downscale_filter);
 		break;
 	case format::bc1_typeless:
 	case format::bc1_unorm:
 	case format::bc1_unorm_srgb:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		bc1_block_copy(dstBuf, desc, data);
+		if (!bc_blocks_into_packedbuf(dstBuf, desc, data, bc1_block_copy, downscale, downscale_filter)) return false;
 		break;
 	case format::bc3_typeless:
 	case format::bc3_unorm:
 	case format::bc3_unorm_srgb:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		bc3_block_copy(dstBuf, desc, data);
+		if (!bc_blocks_into_packedbuf(dstBuf, desc, data, bc3_block_copy, downscale, downscale_filter)) return false;
 		break;
 	case format::bc4_typeless:
 	case format::bc4_unorm:
 	case format::bc4_snorm:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		bc4_block_copy(dstBuf, desc, data);
+		if (!bc_blocks_into_packedbuf(dstBuf, desc, data, bc4_block_copy, downscale, downscale_filter)) return false;
 		break;
 	case format::bc5_typeless:
 	case format::bc5_unorm:
 	case format::bc5_snorm:
-		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGBA)) return false;
-		bc5_block_copy(dstBuf, desc, data);
+		if (!bc_blocks_into_packedbuf(dstBuf, desc, data, bc5_block_copy, downscale, downscale_filter)) return false;
 		break;
 	case format::r24_unorm_x8_uint:
 	case format::r24_g8_typeless: // "DXGI_FORMAT_R24G8_TYPELESS: A two-component, 32-bit typeless format that supports 24 bits for the red channel and 8 bits for the green channel."
 		if (tex_interp != TexInterp_Depth || !dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_GRAYF32)) return false;
-		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 0, 3, 0, gamehandle, depth_settings);
+		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 0, 3, 0, gamehandle, depth_settings, depth_stats, downscale, downscale_filter);
 		break;
 	case format::r32_g8_typeless: // "DXGI_FORMAT_R32G8X24_TYPELESS: A two-component, 64-bit typeless format that supports 32 bits for the red channel, 8 bits for the green channel, and 24 bits are unused."
 	case format::r32_float_x8_uint:
 		if (tex_interp != TexInterp_Depth || !dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_GRAYF32)) return false;
-		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 8, 4, 0, gamehandle, depth_settings);
+		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 8, 4, 0, gamehandle, depth_settings, depth_stats, downscale, downscale_filter);
 		break;
 	case format::r32_float:
 	case format::r32_typeless:
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_GRAYF32)) return false;
-		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 0, 4, 0, gamehandle, depth_settings);
+		depth_gray_bytesLE_to_f32(dstBuf, desc, data, 0, 4, 0, gamehandle, depth_settings, depth_stats, downscale, downscale_filter);
 		break;
 	case format::r32g32b32a32_float:
 	case format::r32g32b32a32_uint:
@@ -340,24 +453,52 @@ bool copy_texture_image_given_ready_resource_into_packedbuf(
 		if (!dstBuf.set_pixfmt_and_alloc_bytes(BUF_PIX_FMT_RGB24)) {
 			return false;
 		} else {
-			uint32_t seg_idx_color;
-			uint8_t *const hash_color_channels = reinterpret_cast<uint8_t*>(&seg_idx_color);
-			size_t chC = 0;
-			for (size_t chY = 0; chY < 2; ++chY) {
-				for (size_t chX = 0; chX < 2; ++chX) {
-					data_p = static_cast<uint8_t*>(data.data);
-					for (size_t y = 0; y < desc.texture.height; ++y, data_p += data.row_pitch) {
-						for (size_t x = 0; x < desc.texture.width; ++x) {
-							seg_idx_color = XXH32(data_p + x * 16 + chC*4, 4, 0);
-							uint8_t* const dst = dstBuf.entryptr<uint8_t>(y + chY*desc.texture.height, x + chX*desc.texture.width);
-							dst[0] = hash_color_channels[0];
-							dst[1] = hash_color_channels[1];
-							dst[2] = hash_color_channels[2];
+			// the 4 channels go to the 4 quadrants of the output image
+			const uint8_t *const src_data = static_cast<const uint8_t *>(data.data);
+			if (downscale > 1) {
+				// nearest sample of each block; samples are spread out, so they are hashed one at a time
+				const size_t out_width = dstBuf.width / 2, out_height = dstBuf.height / 2;
+				parallel_for_rows(out_height, 0, [&](size_t row_begin, size_t row_end) {
+					uint32_t seg_idx_color;
+					uint8_t *const hash_color_channels = reinterpret_cast<uint8_t*>(&seg_idx_color);
+					for (size_t y = row_begin; y < row_end; ++y) {
+						const uint8_t *const src_p = src_data + y * downscale * data.row_pitch;
+						for (size_t x = 0; x < out_width; ++x) {
+							for (size_t chC = 0; chC < 4; ++chC) {
+								const size_t chY = chC / 2, chX = chC % 2;
+								seg_idx_color = XXH32(src_p + x * downscale * 16 + chC*4, 4, 0);
+								uint8_t* dst = dstBuf.entryptr<uint8_t>(y + chY*out_height, x + chX*out_width);
+								dst[0] = hash_color_channels[0];
+								dst[1] = hash_color_channels[1];
+								dst[2] = hash_color_channels[2];
+							}
 						}
 					}
-					chC++;
-				}
+				});
+				break;
 			}
+			// each run of identical pixels is hashed once (see seg_pixel_runs.h)
+			parallel_for_rows(desc.texture.height, 0, [&](size_t row_begin, size_t row_end) {
+				uint32_t seg_idx_color;
+				uint8_t *const hash_color_channels = reinterpret_cast<uint8_t*>(&seg_idx_color);
+				for (size_t y = row_begin; y < row_end; ++y) {
+					const uint8_t *const src_p = src_data + y * data.row_pitch;
+					for (size_t x = 0; x < desc.texture.width;) {
+						const size_t run = seg_pixel_run_length(src_p + x * 16, desc.texture.width - x);
+						for (size_t chC = 0; chC < 4; ++chC) {
+							const size_t chY = chC / 2, chX = chC % 2;
+							seg_idx_color = XXH32(src_p + x * 16 + chC*4, 4, 0);
+							uint8_t* dst = dstBuf.entryptr<uint8_t>(y + chY*desc.texture.height, x + chX*desc.texture.width);
+							for (size_t ii = 0; ii < run; ++ii, dst += 3) {
+								dst[0] = hash_color_channels[0];
+								dst[1] = hash_color_channels[1];
+								dst[2] = hash_color_channels[2];
+							}
+						}
+						x += run;
+					}
+				}
+			});
 		}
 		break;
 	default: {
@@ -373,15 +514,143 @@ bool copy_texture_image_given_ready_resource_into_packedbuf(
 }
 
 
-// adapted from reshade examples texture_overlay_addon.cpp
+// readback textures for the staging pool, and copies and fences for the readback ring
+class reshade_readback_device : public ReadbackDevice {
+	device *const dev;
+	command_queue *const queue;
+	const subresource_box *const source_box; // part of the source that submit_copy copies; nullptr for all of it
+public:
+	explicit reshade_readback_device(device *dev_, command_queue *queue_ = nullptr, const subresource_box *source_box_ = nullptr)
+		: dev(dev_), queue(queue_), source_box(source_box_) {}
+	uint64_t device_id() const override { return reinterpret_cast<uintptr_t>(dev); }
+	bool create_readback_texture(uint32_t fmt, uint32_t width, uint32_t height, uint64_t &handle) override {
+		resource created = { 0 };
+		if (!dev->create_resource(resource_desc(width, height, 1, 1, static_cast<format>(fmt), 1, memory_heap::gpu_to_cpu, resource_usage::copy_dest), nullptr, resource_usage::copy_dest, &created)) {
+			return false;
+		}
+		handle = created.handle;
+		return true;
+	}
+	void destroy_texture(uint64_t handle) override {
+		dev->destroy_resource(resource{ handle });
+	}
+	bool create_fence(uint64_t &handle) override {
+		fence created = { 0 };
+		if (!dev->create_fence(0, fence_flags::none, &created)) {
+			return false;
+		}
+		handle = created.handle;
+		return true;
+	}
+	void destroy_fence(uint64_t handle) override {
+		dev->destroy_fence(fence{ handle });
+	}
+	bool submit_copy(uint64_t source, uint64_t readback, uint64_t fence_handle, uint64_t value) override {
+		command_list *const cmd_list = queue->get_immediate_command_list();
+		cmd_list->barrier(resource{ source }, resource_usage::shader_resource, resource_usage::copy_source);
+		cmd_list->copy_texture_region(resource{ source }, 0, source_box, resource{ readback }, 0, nullptr);
+		cmd_list->barrier(resource{ source }, resource_usage::copy_source, resource_usage::shader_resource);
+		if (fence_handle == 0) {
+			queue->wait_idle();
+			return true;
+		}
+		// the signal goes on the queue, so the copy recorded above has to be submitted first
+		queue->flush_immediate_command_list();
+		return queue->signal(fence{ fence_handle }, value);
+	}
+	uint64_t completed_fence_value(uint64_t fence_handle) override {
+		return dev->get_completed_fence_value(fence{ fence_handle });
+	}
+	bool wait_fence(uint64_t fence_handle, uint64_t value) override {
+		return dev->wait(fence{ fence_handle }, value);
+	}
+	bool map_readback(uint64_t readback, const uint8_t *&data, uint32_t &row_pitch) override {
+		subresource_data mapped_data = {};
+		if (!dev->map_texture_region(resource{ readback }, 0, nullptr, map_access::read_only, &mapped_data) || mapped_data.data == nullptr) {
+			return false;
+		}
+		data = static_cast<const uint8_t *>(mapped_data.data);
+		row_pitch = mapped_data.row_pitch;
+		return true;
+	}
+	void unmap_readback(uint64_t readback) override {
+		dev->unmap_texture_region(resource{ readback }, 0);
+	}
+};
 
-bool copy_texture_image_needing_resource_barrier_into_packedbuf(
-	GameInterface *gamehandle, simple_packed_buf &dstBuf,
-	reshade::api::command_queue *queue, reshade::api::resource tex,
-	TextureInterpretation tex_interp, const depth_tex_settings &depth_settings)
+void release_staging_textures_of_device(reshade::api::device *device) {
+	reshade_readback_device staging(device);
+	global_staging_pool().evict_device(staging);
+}
+
+// converts a finished ring slot the same way the synchronous path converts a mapped staging texture
+// (slots hold only the region, so only the downscale is left to apply)
+static ReadbackRing::consume_fn packedbuf_consumer(TextureInterpretation tex_interp, const depth_tex_settings &depth_settings,
+	PackedBufChannelOrder channel_order, const packedbuf_readback_fn &consume, const capture_region &region)
+{
+	const size_t downscale = region.downscale;
+	const PackedBufDownscaleFilter downscale_filter = downscale_filter_for(tex_interp, region);
+	return [&depth_settings, &consume, tex_interp, channel_order, downscale, downscale_filter](const ReadbackFrame &frame) {
+		const resource_desc desc(frame.width, frame.height, 1, 1, static_cast<format>(frame.format), 1, memory_heap::gpu_to_cpu, resource_usage::copy_dest);
+		subresource_data mapped_data = {};
+		mapped_data.data = const_cast<uint8_t *>(frame.data);
+		mapped_data.row_pitch = frame.row_pitch;
+		mapped_data.slice_pitch = frame.row_pitch * frame.height;
+		simple_packed_buf dstBuf;
+		if (copy_texture_image_given_ready_resource_into_packedbuf(nullptr, dstBuf, desc, mapped_data, tex_interp, depth_settings, channel_order, nullptr, PackedBufColor_8bit,
+			downscale, downscale_filter)) {
+			consume(*frame.tag, dstBuf);
+		}
+	};
+}
+
+bool submit_texture_readback(ReadbackRing &ring, reshade::api::command_queue *queue, reshade::api::resource tex,
+	TextureInterpretation tex_interp, const depth_tex_settings &depth_settings, PackedBufChannelOrder channel_order,
+	const ReadbackFrameTag &tag, const packedbuf_readback_fn &consume, const capture_region &region)
+{
+	device *const device = queue->get_device();
+	const resource_desc desc = device->get_resource_desc(tex);
+	if (desc.heap != memory_heap::gpu_only || (desc.usage & resource_usage::copy_source) != resource_usage::copy_source) {
+		return false;
+	}
+	subresource_box box;
+	if (!capture_region_box(region, desc, box)) {
+		return false;
+	}
+	reshade_readback_device readback(device, queue, box_is_whole_texture(box, desc) ? nullptr : &box);
+	return ring.submit(readback, global_staging_pool(), static_cast<uint32_t>(format_to_default_typed(desc.texture.format)),
+		box.right - box.left, box.bottom - box.top, tex.handle, tag, packedbuf_consumer(tex_interp, depth_settings, channel_order, consume, region));
+}
+
+size_t drain_texture_readbacks(ReadbackRing &ring, reshade::api::command_queue *queue,
+	TextureInterpretation tex_interp, const depth_tex_settings &depth_settings, PackedBufChannelOrder channel_order,
+	const packedbuf_readback_fn &consume, const capture_region &region)
+{
+	reshade_readback_device readback(queue->get_device(), queue);
+	return ring.drain(readback, global_staging_pool(), packedbuf_consumer(tex_interp, depth_settings, channel_order, consume, region));
+}
+
+void release_texture_readbacks(ReadbackRing &ring, reshade::api::device *device) {
+	reshade_readback_device readback(device);
+	ring.release(readback, global_staging_pool());
+}
+
+// adapted from reshade examples texture_overlay_addon.cpp
+// Copies the region of tex into a staging texture (or maps tex itself when the CPU can read it), waits for the GPU,
+// and hands the mapped region to use_mapped before unmapping.
+static bool with_mapped_texture_region(reshade::api::command_queue *queue, reshade::api::resource tex,
+	TextureInterpretation tex_interp, const capture_region &region,
+	const std::function<bool(const resource_desc &desc, const subresource_data &data)> &use_mapped)
 {
 	device *const device = queue->get_device();
 	resource_desc desc = device->get_resource_desc(tex);
+	reshade_readback_device staging(device);
+
+	subresource_box box;
+	if (!capture_region_box(region, desc, box)) {
+		return false;
+	}
+	const bool cropped = !box_is_whole_texture(box, desc);
 
 	resource intermediate;
 	if (desc.heap != memory_heap::gpu_only)
@@ -401,8 +670,11 @@ bool copy_texture_image_needing_resource_barrier_into_packedbuf(
 		//const reshade::api::format dstfmt = (desc.texture.format == reshade::api::format::r32_g8_typeless) ? reshade::api::format::r32_float : format_to_default_typed(desc.texture.format);
 		const reshade::api::format dstfmt = format_to_default_typed(desc.texture.format);
 		desc.texture.format = dstfmt;
+		// only the region is copied, into a staging texture of its size
+		desc.texture.width = box.right - box.left;
+		desc.texture.height = box.bottom - box.top;
 
-		if (!device->create_resource(resource_desc(desc.texture.width, desc.texture.height, 1, 1, dstfmt, 1, memory_heap::gpu_to_cpu, resource_usage::copy_dest), nullptr, resource_usage::copy_dest, &intermediate))
+		if (!global_staging_pool().acquire(staging, static_cast<uint32_t>(dstfmt), desc.texture.width, desc.texture.height, intermediate.handle))
 		{
 			reshade::log_message(reshade::log_level::error, "Failed to create system memory texture for texture dumping!");
 			return false;
@@ -410,7 +682,7 @@ bool copy_texture_image_needing_resource_barrier_into_packedbuf(
 
 		command_list *const cmd_list = queue->get_immediate_command_list();
 		cmd_list->barrier(tex, resource_usage::shader_resource, resource_usage::copy_source);
-		cmd_list->copy_texture_region(tex, 0, nullptr, intermediate, 0, nullptr);
+		cmd_list->copy_texture_region(tex, 0, cropped ? &box : nullptr, intermediate, 0, nullptr);
 		cmd_list->barrier(tex, resource_usage::copy_source, resource_usage::shader_resource);
 	}
 
@@ -420,14 +692,72 @@ bool copy_texture_image_needing_resource_barrier_into_packedbuf(
 	subresource_data mapped_data = {};
 	if (device->map_texture_region(intermediate, 0, nullptr, map_access::read_only, &mapped_data))
 	{
-		wasok = copy_texture_image_given_ready_resource_into_packedbuf(gamehandle, dstBuf, desc, mapped_data, tex_interp, depth_settings);
+		subresource_data region_data = mapped_data;
+		if (intermediate == tex && cropped) {
+			// read in place: start at the region's top left block and only convert its width and height
+			region_data.data = static_cast<uint8_t *>(mapped_data.data) + (box.top / format_block_size(desc.texture.format)) * static_cast<size_t>(mapped_data.row_pitch)
+				+ format_row_pitch(desc.texture.format, box.left);
+			desc.texture.width = box.right - box.left;
+			desc.texture.height = box.bottom - box.top;
+		}
+		wasok = use_mapped(desc, region_data);
 		device->unmap_texture_region(intermediate, 0);
 	} else {
 		reshade::log_message(reshade::log_level::error, "Failed to save texture: mapped_data.data == nullptr");
 	}
 
 	if (intermediate != tex)
-		device->destroy_resource(intermediate);
+		global_staging_pool().release(staging, intermediate.handle);
 
 	return wasok;
-}
\ No newline at end of file
+}
+
+bool copy_texture_image_needing_resource_barrier_into_packedbuf(
+	GameInterface *gamehandle, simple_packed_buf &dstBuf,
+	reshade::api::command_queue *queue, reshade::api::resource tex,
+	TextureInterpretation tex_interp, const depth_tex_settings &depth_settings,
+	PackedBufChannelOrder channel_order, DepthFrameStats *depth_stats, PackedBufColorDepth color_depth,
+	const capture_region &region)
+{
+	return with_mapped_texture_region(queue, tex, tex_interp, region, [&](const resource_desc &desc, const subresource_data &data) {
+		return copy_texture_image_given_ready_resource_into_packedbuf(gamehandle, dstBuf, desc, data, tex_interp, depth_settings, channel_order, depth_stats, color_depth,
+			region.downscale, downscale_filter_for(tex_interp, region));
+	});
+}
+
+bool copy_texture_image_needing_resource_barrier_into_raw_rows(
+	reshade::api::command_queue *queue, reshade::api::resource tex, TextureInterpretation tex_interp,
+	raw_texture_rows &raw, const capture_region &region)
+{
+	return with_mapped_texture_region(queue, tex, tex_interp, region, [&](const resource_desc &desc, const subresource_data &data) {
+		const size_t num_rows = ceil_int<size_t>(desc.texture.height, format_block_size(desc.texture.format));
+		const size_t row_bytes = format_row_pitch(desc.texture.format, desc.texture.width);
+		if (num_rows == 0 || row_bytes == 0 || row_bytes > data.row_pitch) {
+			reshade::log_message(reshade::log_level::error, std::string(std::string("Failed to save texture: can't copy rows of format ") + reshade::api::fmtnames.at(desc.texture.format)).c_str());
+			return false;
+		}
+		// the rows keep the mapped pitch, so this is one memcpy; the last one stops at the region's edge
+		raw.bytes = global_raw_frame_pool().acquire((num_rows - 1) * data.row_pitch + row_bytes);
+		std::memcpy(raw.bytes.data(), data.data, raw.bytes.size());
+		raw.format = static_cast<uint32_t>(desc.texture.format);
+		raw.width = desc.texture.width;
+		raw.height = desc.texture.height;
+		raw.row_pitch = data.row_pitch;
+		return true;
+	});
+}
+
+bool convert_raw_texture_rows_into_packedbuf(
+	GameInterface *gamehandle, simple_packed_buf &dstBuf, const raw_texture_rows &raw,
+	TextureInterpretation tex_interp, const depth_tex_settings &depth_settings,
+	PackedBufChannelOrder channel_order, DepthFrameStats *depth_stats, PackedBufColorDepth color_depth,
+	const capture_region &region)
+{
+	const resource_desc desc(raw.width, raw.height, 1, 1, static_cast<format>(raw.format), 1, memory_heap::gpu_to_cpu, resource_usage::copy_dest);
+	subresource_data data = {};
+	data.data = const_cast<uint8_t *>(raw.bytes.data());
+	data.row_pitch = raw.row_pitch;
+	data.slice_pitch = static_cast<uint32_t>(raw.bytes.size());
+	return copy_texture_image_given_ready_resource_into_packedbuf(gamehandle, dstBuf, desc, data, tex_interp, depth_settings, channel_order, depth_stats, color_depth,
+		region.downscale, downscale_filter_for(tex_interp, region));
+}
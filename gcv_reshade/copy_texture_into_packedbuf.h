@@ -3,8 +3,13 @@
 #include <reshade.hpp> 
 #include <vector>
 #include <string>
+#include <functional>
 #include "gcv_games/game_interface.h"
 #include "gcv_utils/simple_packed_buf.h"
+#include "gcv_utils/depth_frame_stats.h"
+#include "gcv_utils/readback_ring.h"
+#include "gcv_utils/packedbuf_downscale.h"
+#include "gcv_utils/raw_frame_pool.h"
 
 struct depth_tex_settings {
 	int depthbyteskeep = 0;
@@ -22,7 +27,75 @@ enum TextureInterpretation {
 	TexInterp_IndexedSeg,
 };
 
+// Channel order of 8-bit color captures in the packed buffer.
+// The image writers expect RGB order; consumers that want BGRA anyway (the ffmpeg recorder)
+// can ask for the texture's native order so bgra8 textures are copied row by row without swizzling.
+enum PackedBufChannelOrder {
+	PackedBufOrder_RGB = 0, // bgra8 textures are swizzled into BUF_PIX_FMT_RGBA
+	PackedBufOrder_Native,  // bgra8 textures become BUF_PIX_FMT_BGRA, rgba8 stay BUF_PIX_FMT_RGBA
+};
+
+// Bits per channel kept from color textures with more than 8 bits.
+// 16-bit unorm textures always keep their 16 bits (BUF_PIX_FMT_RGBA64).
+enum PackedBufColorDepth {
+	PackedBufColor_8bit = 0, // r10g10b10a2 textures are truncated into BUF_PIX_FMT_RGB24
+	PackedBufColor_Full,     // r10g10b10a2 textures are widened into BUF_PIX_FMT_RGB48
+};
+
+// Part of the texture to capture, and an integer factor to shrink it by. Only the region is copied off the GPU;
+// the reduction is done band by band during conversion, so the full-resolution packed buffer is never allocated.
+// The defaults capture the whole texture unchanged.
+struct capture_region {
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint32_t width = 0;  // 0: up to the right edge of the texture
+	uint32_t height = 0; // 0: up to the bottom edge
+	uint32_t downscale = 1; // rows and columns left over at the edge that don't fill a whole block are dropped
+	// color is always box filtered and indexed segmentation always takes the nearest sample
+	PackedBufDownscaleFilter depth_filter = PackedBufDownscale_Min;
+
+	bool is_full_frame() const { return x == 0 && y == 0 && width == 0 && height == 0 && downscale <= 1; }
+};
+
 bool copy_texture_image_needing_resource_barrier_into_packedbuf(
 	GameInterface *gamehandle, simple_packed_buf &dstBuf,
 	reshade::api::command_queue* queue, reshade::api::resource tex,
-	TextureInterpretation tex_interp, const depth_tex_settings &debug_settings);
+	TextureInterpretation tex_interp, const depth_tex_settings &debug_settings,
+	PackedBufChannelOrder channel_order = PackedBufOrder_RGB,
+	DepthFrameStats *depth_stats = nullptr, // filled in for depth textures, in the same pass as the conversion
+	PackedBufColorDepth color_depth = PackedBufColor_8bit,
+	const capture_region &region = capture_region());
+
+// The same capture split in two, so the render thread only waits for the copy: the first half maps the region and
+// memcpys its rows as they are into raw (a buffer from global_raw_frame_pool(), given back by whoever converts it),
+// the second half converts raw exactly like the call above would have, on any thread.
+// depth_settings.adjustpitchhack > 0 reads past the mapped rows, which raw doesn't have; use the call above for it.
+bool copy_texture_image_needing_resource_barrier_into_raw_rows(
+	reshade::api::command_queue *queue, reshade::api::resource tex, TextureInterpretation tex_interp,
+	raw_texture_rows &raw, const capture_region &region = capture_region());
+bool convert_raw_texture_rows_into_packedbuf(
+	GameInterface *gamehandle, simple_packed_buf &dstBuf, const raw_texture_rows &raw,
+	TextureInterpretation tex_interp, const depth_tex_settings &debug_settings,
+	PackedBufChannelOrder channel_order = PackedBufOrder_RGB,
+	DepthFrameStats *depth_stats = nullptr,
+	PackedBufColorDepth color_depth = PackedBufColor_8bit,
+	const capture_region &region = capture_region());
+
+// readback textures are reused between captures (gcv_utils/staging_pool.h); call from destroy_device
+void release_staging_textures_of_device(reshade::api::device *device);
+
+// Asynchronous readback for per-frame captures: the copy goes into a slot of the ring (gcv_utils/readback_ring.h)
+// and is converted a few frames later, once its fence has signaled, instead of after queue->wait_idle().
+// consume gets each finished frame with its tag, oldest first, from inside submit or drain.
+// submit returns false without touching the ring for textures the synchronous path reads directly (not gpu_only).
+typedef std::function<void(const ReadbackFrameTag &tag, simple_packed_buf &buf)> packedbuf_readback_fn;
+// Frames are cropped to region when copied and reduced when converted, so every frame in flight, and the drain
+// that follows them, has to use the same region.
+bool submit_texture_readback(ReadbackRing &ring, reshade::api::command_queue *queue, reshade::api::resource tex,
+	TextureInterpretation tex_interp, const depth_tex_settings &debug_settings, PackedBufChannelOrder channel_order,
+	const ReadbackFrameTag &tag, const packedbuf_readback_fn &consume, const capture_region &region = capture_region());
+size_t drain_texture_readbacks(ReadbackRing &ring, reshade::api::command_queue *queue,
+	TextureInterpretation tex_interp, const depth_tex_settings &debug_settings, PackedBufChannelOrder channel_order,
+	const packedbuf_readback_fn &consume, const capture_region &region = capture_region());
+// drops whatever is in flight and frees the ring's fence; call before the device is destroyed
+void release_texture_readbacks(ReadbackRing &ring, reshade::api::device *device);
@@ -1,42 +1,60 @@
 #include "grabbers.h"
 #include "copy_texture_into_packedbuf.h"
+#include "pixel_swizzle_kernels.h"
+#include <algorithm>
 #include <cmath>
 #include <cstring>
  
 bool grab_bgra_frame(reshade::api::command_queue* q, reshade::api::resource tex,
-                     std::vector<uint8_t>& out_bgra, int& w, int& h) {
+                     std::vector<uint8_t>& out_bgra, int& w, int& h, const capture_region& region) {
   simple_packed_buf pbuf;
   depth_tex_settings depth_cfg{};
+  // ask for the texture's own channel order: bgra8 back buffers then need no swizzle at all
   if (!copy_texture_image_needing_resource_barrier_into_packedbuf(
-          nullptr, pbuf, q, tex, TexInterp_RGB, depth_cfg)) {
+          nullptr, pbuf, q, tex, TexInterp_RGB, depth_cfg, PackedBufOrder_Native, nullptr, PackedBufColor_8bit, region)) {
     return false;
   }
+  return packedbuf_to_bgra(pbuf, out_bgra, w, h);
+}
+
+bool packedbuf_to_bgra(simple_packed_buf& pbuf, std::vector<uint8_t>& out_bgra, int& w, int& h) {
   w = (int)pbuf.width; h = (int)pbuf.height;
   const size_t row_bgra = (size_t)w * 4;
-  out_bgra.resize((size_t)h * row_bgra);
 
+  if (pbuf.pixfmt == BUF_PIX_FMT_BGRA) {
+    // rows are packed exactly like out_bgra, hand over the storage instead of copying
+    out_bgra.swap(pbuf.bytes);
+    out_bgra.resize((size_t)h * row_bgra);
+    return true;
+  }
+  out_bgra.resize((size_t)h * row_bgra);
   if (pbuf.pixfmt == BUF_PIX_FMT_RGBA) {
+    // swapping red and blue is symmetric, so the bgra->rgba kernel also does rgba->bgra
+    swizzle_kernels_best().bgra8_to_rgba(pbuf.cdata<uint8_t>(), out_bgra.data(), (size_t)w * (size_t)h);
+    return true;
+  } else if (pbuf.pixfmt == BUF_PIX_FMT_RGB24) {
     for (int y = 0; y < h; ++y) {
       const uint8_t* src = pbuf.rowptr<uint8_t>(y);
       uint8_t* dst = out_bgra.data() + (size_t)y * row_bgra;
       for (int x = 0; x < w; ++x) {
-        const uint8_t r = src[4*x+0], g = src[4*x+1], b = src[4*x+2], a = src[4*x+3];
-        dst[4*x+0] = b; dst[4*x+1] = g; dst[4*x+2] = r; dst[4*x+3] = a;
+        const uint8_t r = src[3*x+0], g = src[3*x+1], b = src[3*x+2];
+        dst[4*x+0] = b; dst[4*x+1] = g; dst[4*x+2] = r; dst[4*x+3] = 255;
       }
     }
     return true;
-  } else if (pbuf.pixfmt == BUF_PIX_FMT_RGB24) {
+  } else if (pbuf.pixfmt == BUF_PIX_FMT_RGBA64) {
+    // 16-bit unorm back buffers: the recorder only takes 8 bits, keep the high byte
     for (int y = 0; y < h; ++y) {
-      const uint8_t* src = pbuf.rowptr<uint8_t>(y);
+      const uint16_t* src = pbuf.rowptr<uint16_t>(y);
       uint8_t* dst = out_bgra.data() + (size_t)y * row_bgra;
       for (int x = 0; x < w; ++x) {
-        const uint8_t r = src[3*x+0], g = src[3*x+1], b = src[3*x+2];
-        dst[4*x+0] = b; dst[4*x+1] = g; dst[4*x+2] = r; dst[4*x+3] = 255;
+        dst[4*x+0] = (uint8_t)(src[4*x+2] >> 8); dst[4*x+1] = (uint8_t)(src[4*x+1] >> 8);
+        dst[4*x+2] = (uint8_t)(src[4*x+0] >> 8); dst[4*x+3] = 255;
       }
     }
     return true;
   } else {
-    reshade::log_message(reshade::log_level::error, "grab_bgra_frame: unsupported pixfmt");
+    reshade::log_message(reshade::log_level::error, "packedbuf_to_bgra: unsupported pixfmt");
     return false;
   }
 }
@@ -51,8 +69,10 @@ bool grab_depth_gray8(reshade::api::command_queue* q,
 {
   simple_packed_buf pbuf;
   depth_tex_settings depth_cfg{};
+  // min/max and percentiles come from the stats gathered during the copy, not from extra passes
+  DepthFrameStats stats;
   if (!copy_texture_image_needing_resource_barrier_into_packedbuf(
-          nullptr, pbuf, q, depth_tex, TexInterp_Depth, depth_cfg)) {
+          nullptr, pbuf, q, depth_tex, TexInterp_Depth, depth_cfg, PackedBufOrder_RGB, &stats)) {
     return false;
   }
 
@@ -88,36 +108,26 @@ bool grab_depth_gray8(reshade::api::command_queue* q,
       return true;
     }
     case BUF_PIX_FMT_GRAYU32: {
-      // 1) 统计 vmin/vmax（已有）
-      uint32_t vmin = UINT32_MAX, vmax = 0;
-      for (int y = 0; y < h; ++y) {
-        const uint32_t* src = pbuf.rowptr<uint32_t>(y);
-        for (int x = 0; x < w; ++x) {
-          uint32_t v = src[x];
-          if (v < vmin) vmin = v;
-          if (v > vmax) vmax = v;
-        }
-      }
-      const double span = (vmax > vmin) ? double(vmax - vmin) : 1.0;
+      // 1) vmin/vmax：取自拷贝时顺便统计的 DepthFrameStats，不再单独遍历
+      const double vmin = (double)stats.min_value, vmax = (double)stats.max_value;
+      const double span = (vmax > vmin) ? (vmax - vmin) : 1.0;
 
-      // 2) 轻量级“百分位裁剪”：均匀抽样，算 p5/p95，避免极端值把对比度拉平
+      // 2) 百分位裁剪：均匀抽样的精确整数值算 p5/p95，避免极端值把对比度拉平。
+      //    DepthFrameStats 的伪对数直方图在 u32 高端的 bin 太粗，近处的对比度会被压没，这里不用它
       constexpr int STRIDE = 8; // 抽样步长
-      std::vector<float> samples;
+      std::vector<uint32_t> samples;
       samples.reserve((w/STRIDE + 1) * (h/STRIDE + 1));
       for (int y = 0; y < h; y += STRIDE) {
         const uint32_t* src = pbuf.rowptr<uint32_t>(y);
-        for (int x = 0; x < w; x += STRIDE) {
-          double t0 = (double(src[x]) - double(vmin)) / span; // 0..1
-          samples.push_back((float)t0);
-        }
+        for (int x = 0; x < w; x += STRIDE) samples.push_back(src[x]);
       }
       if (!samples.empty()) {
         std::nth_element(samples.begin(), samples.begin() + samples.size()/20, samples.end());
-        float p05 = samples[samples.size()/20];               // 5%
+        double p05 = samples[samples.size()/20];               // 5%
         std::nth_element(samples.begin(), samples.begin() + samples.size()*95/100, samples.end());
-        float p95 = samples[samples.size()*95/100];           // 95%
+        double p95 = samples[samples.size()*95/100];           // 95%
         // 避免 p95==p05
-        if (p95 - p05 < 1e-6f) { p05 = std::max(0.f, p05 - 0.05f); p95 = std::min(1.f, p95 + 0.05f); }
+        if (p95 - p05 < 1e-6 * span) { p05 -= 0.05 * span; p95 += 0.05 * span; }
 
         // 3) 可调参数
         const bool  invert = true;   // 近黑远白（需要近白远黑则置 false）
@@ -128,10 +138,8 @@ bool grab_depth_gray8(reshade::api::command_queue* q,
           const uint32_t* src = pbuf.rowptr<uint32_t>(y);
           uint8_t* dst = out_gray.data() + (size_t)y * (size_t)w;
           for (int x = 0; x < w; ++x) {
-            // 归一化到 [0,1]
-            float t = float((double(src[x]) - double(vmin)) / span);
-            // 百分位裁剪并线性拉伸
-            t = (t - p05) / (p95 - p05);
+            // 百分位裁剪并线性拉伸到 [0,1]，用 double 保住 u32 的精度
+            float t = float((double(src[x]) - p05) / (p95 - p05));
             if (t < 0.f) t = 0.f; else if (t > 1.f) t = 1.f;
             // 极性
             if (invert) t = 1.0f - t;
@@ -1,6 +1,8 @@
 #pragma once
 #include <vector> 
 #include <reshade.hpp>
+#include "gcv_utils/simple_packed_buf.h"
+#include "copy_texture_into_packedbuf.h"
 
 // parameters from depth to grayscale
 struct DepthToneParams {
@@ -9,11 +11,16 @@ struct DepthToneParams {
   float log_alpha = 6.0f;  // log enhance
 };
 
-// Read RGBA/RGB to BGRA (A=255) and output continuous memory
+// Read RGBA/RGB to BGRA (A=255) and output continuous memory; w and h are those of the region after downscaling
 bool grab_bgra_frame(reshade::api::command_queue* q,
                      reshade::api::resource color_tex,
                      std::vector<uint8_t>& out_bgra,
-                     int& w, int& h);
+                     int& w, int& h,
+                     const capture_region& region = capture_region());
+
+// Same conversion for a color capture read some other way (the asynchronous readback ring);
+// takes over pbuf's storage when it is already BGRA
+bool packedbuf_to_bgra(simple_packed_buf& pbuf, std::vector<uint8_t>& out_bgra, int& w, int& h);
 
 // Read the depth texture and map it to grayscale (far white, near black, with clip and logarithmic enhancement)
 bool grab_depth_gray8(reshade::api::command_queue* q,
@@ -1,12 +1,14 @@
 // Copyright (C) 2022 Jason Bunk
 #include "image_writer_thread_pool.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <memory>
 
 #include "gcv_games/game_interface_factory.h"
 #include "gcv_utils/miscutils.h"
+#include "gcv_utils/parallel_rows.h"
 #include "segmentation/segmentation_app_data.hpp"
-using moodycamel::ConcurrentQueue;
 
 std::string image_writer_thread_pool::output_filepath_creates_outdir_if_needed(const std::string& base_filename) {
     wchar_t file_prefix[MAX_PATH] = L"";
@@ -20,17 +22,9 @@ std::string image_writer_thread_pool::output_filepath_creates_outdir_if_needed(c
     return dump_path.string();
 }
 
-void image_writer_thread_pool::flush_queue_by_deleting_waiting() {
-    queue_item_image2write* img2write = nullptr;
-    while (images2writequeue.try_dequeue(img2write)) {
-        delete img2write;
-        img2write = nullptr;
-    }
-}
-
 void image_writer_thread_pool::cleanup_clear_all() {
     change_num_threads(0);
-    flush_queue_by_deleting_waiting();
+    write_queue.delete_waiting();
     print_waiting_log_messages();
 }
 
@@ -38,59 +32,58 @@ image_writer_thread_pool::~image_writer_thread_pool() {
     cleanup_clear_all();
 }
 
-void image_writer_thread_loop(ConcurrentQueue<queue_item_image2write*>* images2writequeue,
-                              logqueue* errlogqueue,
-                              std::atomic<int>* keeplooping) {
-    queue_item_image2write* img2write = nullptr;
-    while (keeplooping->load() > 0) {
-        img2write = nullptr;
-        if (images2writequeue->try_dequeue(img2write) && img2write != nullptr) {
-            std::string logdesc(std::string(" img \'") + img2write->filepath_noexten + std::string("\' of type ") + std::to_string(img2write->mybuf.pixfmt) + std::string(" with writer(s) ") + std::to_string(img2write->writers) + std::string(" "));
-            if (!img2write->write_to_disk(logdesc)) {
-                errlogqueue->enqueue(reshade::log_level::error, std::string("FAILED to save") + logdesc);
-            } else {
-                errlogqueue->enqueue(reshade::log_level::info, std::string("Saved") + logdesc);
-            }
-            delete img2write;
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
+void image_writer_thread_pool::write_queued_image(queue_item_image2write& img2write) {
+    std::string convertdesc;
+    bool converted = true;
+    if (img2write.convert_before_write) {
+        // each writer converts on its own core; the global row pool is left to the render thread
+        const serial_rows_on_this_thread serial_rows;
+        converted = img2write.convert_before_write(img2write, convertdesc);
+    }
+    std::string logdesc(std::string(" img \'") + img2write.filepath_noexten + std::string("\' of type ") + std::to_string(img2write.mybuf.pixfmt) + std::string(" with writer(s) ") + std::to_string(img2write.writers) + std::string(" "));
+    if (!converted) {
+        enqueue(reshade::log_level::error, std::string("FAILED to convert") + logdesc + convertdesc);
+    } else if (img2write.writers == ImageWriter_none) {
+        enqueue(reshade::log_level::info, std::string("Skipped") + logdesc + convertdesc);
+    } else if (!img2write.write_to_disk(logdesc)) {
+        enqueue(reshade::log_level::error, std::string("FAILED to save") + logdesc);
+    } else {
+        enqueue(reshade::log_level::info, std::string("Saved") + logdesc);
     }
 }
 
-void image_writer_thread_pool::create_threads(size_t howmany) {
-    if ((num_threads() + howmany) > 9000) {
-        reshade::log_message(reshade::log_level::error,
-                             std::string(std::string("create_threads() bad num threads ") + std::to_string(num_threads() + howmany)).c_str());
+void image_writer_thread_pool::change_num_threads(size_t new_num) {
+    if (new_num == 0) {
+        write_queue.stop();
         return;
     }
-    for (size_t ii = 0; ii < howmany; ++ii) {
-        threadkeepalives.push_back(new std::atomic<int>(1));
-        workthreads.emplace_back(image_writer_thread_loop, &images2writequeue, this, threadkeepalives.back());
-    }
-    reshade::log_message(reshade::log_level::info, std::string(std::string("created ") + std::to_string(howmany) + std::string(" image writer threads")).c_str());
-}
-
-void image_writer_thread_pool::join_and_delete_threads(size_t howmany) {
-    if (workthreads.empty() || howmany == 0)
+    if (new_num > 9000) {
+        reshade::log_message(reshade::log_level::error, std::string(std::string("change_num_threads() bad num threads ") + std::to_string(new_num)).c_str());
         return;
-    for (int64_t ii = static_cast<int64_t>(std::min(howmany, workthreads.size())) - 1; ii >= 0; --ii) {
-        threadkeepalives.back()->store(0);
-        workthreads.back().join();
-        workthreads.pop_back();
-        delete threadkeepalives.back();
-        threadkeepalives.pop_back();
+    }
+    write_queue_limits.min_threads = new_num;
+    write_queue_limits.max_threads = std::max(write_queue_limits.max_threads, new_num);
+    const bool was_running = write_queue.running();
+    write_queue.start(write_queue_limits, [this](queue_item_image2write& item) { write_queued_image(item); });
+    if (!was_running) {
+        reshade::log_message(reshade::log_level::info, std::string(std::string("started ") + std::to_string(new_num) + std::string(" to ")
+            + std::to_string(write_queue_limits.max_threads) + std::string(" image writer threads")).c_str());
     }
 }
 
-void image_writer_thread_pool::change_num_threads(size_t new_num) {
-    if (new_num == workthreads.size())
-        return;
-    if (new_num > workthreads.size()) {
-        create_threads(new_num - workthreads.size());
-    } else {
-        join_and_delete_threads(workthreads.size() - new_num);
+bool image_writer_thread_pool::enqueue_for_writers(queue_item_image2write* qume, uint64_t waiting_bytes) {
+    if (!write_queue.running()) change_num_threads(std::max<size_t>(write_queue_limits.min_threads, 1));
+    else write_queue.set_limits(write_queue_limits);
+    const std::string filepath = qume->filepath_noexten;
+    const WriteQueuePushResult pushed = write_queue.push(qume, waiting_bytes);
+    if (pushed == WriteQueuePush_DroppedNewest) {
+        reshade::log_message(reshade::log_level::error, std::string(std::string("writer queue full, dropped ") + filepath).c_str());
+        return false;
+    } else if (pushed == WriteQueuePush_QueuedDroppedOldest) {
+        // their saves already returned true; the queue's dropped_oldest counter and this line are all that is left
+        reshade::log_message(reshade::log_level::error, std::string(std::string("writer queue full, dropped the oldest waiting images for ") + filepath).c_str());
     }
+    return true;
 }
 
 bool image_writer_thread_pool::init_on_startup() {
@@ -128,17 +121,48 @@ bool image_writer_thread_pool::get_camera_matrix(CamMatrixData& rcam, std::strin
     return game->get_camera_matrix(rcam, errstr);
 }
 
+uint64_t image_writer_thread_pool::rgb_png_writer() const {
+    if (rgb_high_bit_depth) return ImageWriter_png16;
+    if (png_in_strips) return ImageWriter_png_strips;
+    return rgb_fast_png ? ImageWriter_fpng : ImageWriter_STB_png;
+}
+
+uint64_t image_writer_thread_pool::depth_png_writer() const {
+    if (depth_preview_16bit) return ImageWriter_png16;
+    return png_in_strips ? ImageWriter_png_strips : ImageWriter_STB_png;
+}
+
+uint64_t image_writer_thread_pool::depth_fpzip_writer() const {
+    return depth_fpzip_tiled ? ImageWriter_fpzip_tiled : ImageWriter_fpzip;
+}
+
+uint64_t image_writer_thread_pool::depth_epr_writer() const {
+    return depth_epr_lz4 ? ImageWriter_epr_lz4 : ImageWriter_epr;
+}
+
+bool image_writer_thread_pool::keep_converted_image(queue_item_image2write& qume, TextureInterpretation tex_interp, bool drop_broken_depth, std::string& dropped_why) {
+    if ((qume.writers & ImageWriter_exr) && tex_interp == TexInterp_RGB && qume.mybuf.pixfmt != BUF_PIX_FMT_RGBAF32) {
+        // 8-bit render targets have nothing to add beyond the png
+        qume.writers &= ~static_cast<uint64_t>(ImageWriter_exr);
+    }
+    if (drop_broken_depth && tex_interp == TexInterp_Depth && qume.depth_stats.looks_broken()) {
+        const uint64_t num_dropped = ++num_depth_frames_dropped;
+        dropped_why = std::string("dropped depth frame ") + qume.filepath_noexten
+            + std::string(" (") + std::to_string(num_dropped) + std::string(" so far): ") + qume.depth_stats.summary();
+        return false;
+    }
+    return true;
+}
+
 bool image_writer_thread_pool::save_texture_image_needing_resource_barrier_copy(
     const std::string& base_filename, uint64_t image_writers,
     reshade::api::command_queue* queue, reshade::api::resource tex,
-    TextureInterpretation tex_interp) {
+    TextureInterpretation tex_interp, const capture_region& region) {
     if (tex == 0) {
         reshade::log_message(reshade::log_level::error, std::string(std::string("texture null: failed to save ") + base_filename).c_str());
         return false;
     }
 
-    if (num_threads() == 0) change_num_threads(3);
-    if (num_threads() == 0) return false;
     init_in_game();
     queue_item_image2write* qume = new queue_item_image2write(image_writers,
                                                               output_filepath_creates_outdir_if_needed(base_filename));
@@ -146,22 +170,53 @@ bool image_writer_thread_pool::save_texture_image_needing_resource_barrier_copy(
         reshade::log_message(reshade::log_level::error, "failed to allocate new queue entry");
         return false;
     }
-    if (!copy_texture_image_needing_resource_barrier_into_packedbuf(
-            game, qume->mybuf, queue, tex, tex_interp, depth_settings)) {
-        delete qume;
-        return false;
-    }
-    if (!images2writequeue.enqueue(qume)) {
-        delete qume;
-        return false;
+    qume->depth_quant = depth_quantization;
+    qume->epr_settings = epr_lz4_settings;
+    const PackedBufColorDepth color_depth = (image_writers & ImageWriter_png16) ? PackedBufColor_Full : PackedBufColor_8bit;
+    uint64_t waiting_bytes = 0;
+    if (convert_on_writer_threads && !(tex_interp == TexInterp_Depth && depth_settings.adjustpitchhack > 0)) {
+        std::shared_ptr<raw_texture_rows> raw = std::make_shared<raw_texture_rows>();
+        if (!copy_texture_image_needing_resource_barrier_into_raw_rows(queue, tex, tex_interp, *raw, region)) {
+            delete qume;
+            return false;
+        }
+        waiting_bytes = raw->bytes.size();
+        // settings are taken as they are now, not as they are when a writer thread gets to the image
+        GameInterface* const gamehandle = game;
+        const depth_tex_settings settings = depth_settings;
+        const bool drop_broken_depth = drop_broken_depth_frames;
+        qume->convert_before_write = [this, raw, gamehandle, settings, tex_interp, color_depth, region, drop_broken_depth](queue_item_image2write& item, std::string& errstr) {
+            const bool converted = convert_raw_texture_rows_into_packedbuf(gamehandle, item.mybuf, *raw, tex_interp, settings, PackedBufOrder_RGB,
+                (tex_interp == TexInterp_Depth) ? &item.depth_stats : nullptr, color_depth, region);
+            global_raw_frame_pool().release(std::move(raw->bytes));
+            if (!converted) return false;
+            std::string dropped_why;
+            if (!keep_converted_image(item, tex_interp, drop_broken_depth, dropped_why)) {
+                item.writers = ImageWriter_none;
+                errstr += dropped_why;
+            }
+            return true;
+        };
+    } else {
+        if (!copy_texture_image_needing_resource_barrier_into_packedbuf(
+                game, qume->mybuf, queue, tex, tex_interp, depth_settings, PackedBufOrder_RGB,
+                (tex_interp == TexInterp_Depth) ? &qume->depth_stats : nullptr, color_depth, region)) {
+            delete qume;
+            return false;
+        }
+        std::string dropped_why;
+        if (!keep_converted_image(*qume, tex_interp, drop_broken_depth_frames, dropped_why)) {
+            reshade::log_message(reshade::log_level::info, dropped_why.c_str());
+            delete qume;
+            return true;
+        }
+        waiting_bytes = qume->mybuf.num_total_bytes();
     }
-    return true;
+    return enqueue_for_writers(qume, waiting_bytes);
 }
 
 bool image_writer_thread_pool::save_segmentation_app_indexed_image_needing_resource_barrier_copy(
     const std::string& base_filename, reshade::api::command_queue* queue, nlohmann::json& metajson) {
-    if (num_threads() == 0) change_num_threads(3);
-    if (num_threads() == 0) return false;
     init_in_game();
     queue_item_image2write* qseg = new queue_item_image2write(ImageWriter_STB_png, output_filepath_creates_outdir_if_needed(base_filename + std::string("semseg")));
     queue_item_image2write* qtri = new queue_item_image2write(ImageWriter_STB_png, output_filepath_creates_outdir_if_needed(base_filename + std::string("trireg")));
@@ -176,13 +231,7 @@ bool image_writer_thread_pool::save_segmentation_app_indexed_image_needing_resou
         delete qtri;
         return false;
     }
-    if (!images2writequeue.enqueue(qseg)) {
-        delete qseg;
-        return false;
-    }
-    if (!images2writequeue.enqueue(qtri)) {
-        delete qtri;
-        return false;
-    }
-    return true;
+    const bool seg_queued = enqueue_for_writers(qseg, qseg->mybuf.num_total_bytes());
+    const bool tri_queued = enqueue_for_writers(qtri, qtri->mybuf.num_total_bytes());
+    return seg_queued && tri_queued;
 }
\ No newline at end of file
@@ -7,21 +7,21 @@
 #include <atomic>
 #include <string>
 #include <Windows.h>
-#include <concurrentqueue.h>
 #include "gcv_games/game_interface.h"
 #include "gcv_utils/image_queue_entry.h"
+#include "gcv_utils/image_write_queue.h"
 #include "gcv_utils/log_queue_thread_safe.h"
 #include "copy_texture_into_packedbuf.h"
 
 class __declspec(uuid("3cc75b62-7d40-444c-aef8-574977a58346")) image_writer_thread_pool : public logqueue {
-	std::vector<std::thread> workthreads;
-	std::vector<std::atomic<int> *> threadkeepalives;
-	moodycamel::ConcurrentQueue<queue_item_image2write *> images2writequeue;
+	image_write_queue write_queue;
 	GameInterface *game = nullptr;
 
-	void create_threads(size_t howmany);
-	void join_and_delete_threads(size_t howmany);
-	void flush_queue_by_deleting_waiting();
+	void write_queued_image(queue_item_image2write &img2write);
+	// starts the writers if needed; false (and logged) if the queue's policy dropped the image
+	bool enqueue_for_writers(queue_item_image2write *qume, uint64_t waiting_bytes);
+	// after conversion: leaves out writers with nothing to add, and returns false (saying why) for frames not worth writing
+	bool keep_converted_image(queue_item_image2write &qume, TextureInterpretation tex_interp, bool drop_broken_depth, std::string &dropped_why);
 public:
 	std::chrono::steady_clock::time_point init_time;
 	depth_tex_settings depth_settings;
@@ -29,6 +29,32 @@ public:
 
 	bool camcoordsinitialized = false;
 	bool grabcamcoords = false;
+	// skip depth frames with nothing usable in them (DepthFrameStats::looks_broken), e.g. while recording through loading screens
+	bool drop_broken_depth_frames = false;
+	std::atomic<uint64_t> num_depth_frames_dropped{0};
+	// keep all bits of 10-bit color buffers in RGB snapshots (16-bit png instead of 8-bit)
+	bool rgb_high_bit_depth = false;
+	// also write RGB snapshots as .exr when the render target is half-float (linear HDR color)
+	bool rgb_float_exr = false;
+	// write 8-bit RGB snapshots with fpng instead of stb (ImageWriter_fpng): much faster, similar size
+	bool rgb_fast_png = false;
+	// depth previews as 16-bit grayscale png instead of 8-bit (finer steps, larger files)
+	bool depth_preview_16bit = false;
+	// also write metric depth as 16-bit png codes (ImageWriter_png16depth) with these near/far/units; also goes into meta.json
+	bool depth_png16_codes = false;
+	DepthQuantization depth_quantization;
+	// lossless depth as bands of fpzip streams compressed on the writer row pool (ImageWriter_fpzip_tiled, .fpzt) instead of one .fpzip stream
+	bool depth_fpzip_tiled = false;
+	// raw depth as byte-shuffled LZ4 bands (ImageWriter_epr_lz4, .epr v2) instead of uncompressed .epr v1; float16 is lossy
+	bool depth_epr_lz4 = false;
+	EprLz4Settings epr_lz4_settings;
+	// deflate 8-bit pngs (RGB and depth previews) in strips of rows on the writer row pool (ImageWriter_png_strips), for 8K and panorama captures
+	bool png_in_strips = false;
+	// the render thread only copies the texture's rows out; conversion to the packed buffer happens on the writer threads,
+	// each converting its image's rows serially (serial_rows_on_this_thread) rather than on the global row pool
+	bool convert_on_writer_threads = false;
+	// capacity of the queue in front of the writer threads, what happens when it is full, and how many writers run
+	WriteQueueLimits write_queue_limits;
 
 	// methods from GameInterface
 	bool init_on_startup();
@@ -42,17 +68,25 @@ public:
         return game;
     }
 	std::string output_filepath_creates_outdir_if_needed(const std::string &base_filename);
+	// png writers of RGB snapshots and depth previews, from the options above
+	uint64_t rgb_png_writer() const;
+	uint64_t depth_png_writer() const;
+	uint64_t depth_fpzip_writer() const;
+	uint64_t depth_epr_writer() const;
 
 	~image_writer_thread_pool();
 	void cleanup_clear_all();
 
-	size_t num_threads() const { return workthreads.size(); }
+	size_t num_threads() const { return write_queue.num_threads(); }
+	// 0 stops the writers; otherwise they run with at least new_num threads
 	void change_num_threads(size_t new_num);
+	WriteQueueStats write_queue_stats() const { return write_queue.stats(); }
 
+	// a depth frame dropped because of drop_broken_depth_frames still returns true
 	bool save_texture_image_needing_resource_barrier_copy(
 		const std::string &base_filename, uint64_t image_writers,
 		reshade::api::command_queue *queue, reshade::api::resource tex,
-		TextureInterpretation tex_interp);
+		TextureInterpretation tex_interp, const capture_region &region = capture_region());
 
 	bool save_segmentation_app_indexed_image_needing_resource_barrier_copy(
 		const std::string& base_filename, reshade::api::command_queue* queue, nlohmann::json & metajson);
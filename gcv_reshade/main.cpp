@@ -26,6 +26,20 @@
 #include "grabbers.h"
 #include "hud_renderer.h"
 #include "image_writer_thread_pool.h"
+#include "pixel_swizzle_kernels.h"
+#include "bc_block_kernels.h"
+#include "gcv_utils/parallel_rows.h"
+#include "gcv_utils/depth_utils.h"
+#include "gcv_utils/depth_quantize.h"
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/epr_lz4.h"
+#include "gcv_utils/image_write_queue.h"
+#include "gcv_utils/depth_frame_stats.h"
+#include "gcv_utils/seg_pixel_runs.h"
+#include "gcv_utils/staging_pool.h"
+#include "gcv_utils/readback_ring.h"
+#include "gcv_utils/packedbuf_downscale.h"
+#include "gcv_utils/raw_frame_pool.h"
 #include "recorder.h"
 #include "render_target_stats/render_target_stats_tracking.hpp"
 #include "segmentation/reshade_hooks.hpp"
@@ -183,14 +197,81 @@ static int g_copy_fail_in_row = 0;
 static const int g_copy_fail_stop_threshold = 60;
 static DepthToneParams g_depth_tone;  // clip/log parameter
 
+// Color frames of a recording are read back through this ring a few frames late, instead of
+// stalling the game in queue->wait_idle() on every capture. Each frame is pushed to the recorder
+// together with the camera pose it was captured with.
+static std::unique_ptr<ReadbackRing> g_color_ring;
+static int g_color_ring_depth = 3;  // 0: wait for the GPU on every frame, as before
+// when all frames in flight are still on the GPU: wait for the oldest, or skip capturing this frame
+static ReadbackBackPressure g_color_ring_back_pressure = ReadbackRing_WaitOldest;
+static const depth_tex_settings g_color_readback_settings{};
+
+// Part of the frame to capture, and how much to shrink it, for snapshots and recordings.
+// A recording keeps the region it started with, so all of its frames have the same size.
+static capture_region g_capture_region;
+static capture_region g_rec_region;
+enum RecFrameFlags : uint32_t {
+    RecFrame_LogCamera = 1,  // the camera was read in time, log it with the frame
+};
+
+// a crop or downscale changes the image the camera intrinsics refer to, so captures record it next to the camera
+static void capture_region_into_json(const capture_region& region, Json& j) {
+    if (region.is_full_frame()) return;
+    j["capture_region"] = {{"x", region.x}, {"y", region.y}, {"width", region.width}, {"height", region.height}, {"downscale", region.downscale}};
+}
+
+static void push_recorded_color_frame(const ReadbackFrameTag& tag, simple_packed_buf& pbuf) {
+    std::vector<uint8_t> bgra;
+    int w = 0, h = 0;
+    if (!g_rec || !packedbuf_to_bgra(pbuf, bgra, w, h)) return;
+    g_rec->push_color(bgra.data(), w, h);
+    if (tag.flags & RecFrame_LogCamera) {
+        Json camj;
+        if (tag.camera_ok) {
+            tag.camera.into_json(camj);
+        } else {
+            camj["cam_status"] = "uninitialized";
+        }
+        capture_region_into_json(g_rec_region, camj);
+        g_rec->log_camera_json(tag.frame_index, tag.time_us, camj, w, h);
+    }
+}
+
+// frames still in flight go to the recorder before anything captured after them
+static void drain_color_readback(reshade::api::command_queue* q) {
+    if (g_color_ring) {
+        drain_texture_readbacks(*g_color_ring, q, TexInterp_RGB, g_color_readback_settings, PackedBufOrder_Native, push_recorded_color_frame, g_rec_region);
+    }
+}
+
 static void on_init(reshade::api::device* device) {
     auto& shdata = device->create_private_data<image_writer_thread_pool>();
     reshade::log_message(reshade::log_level::info, std::string(std::string("tests: ") + run_utils_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("pixel swizzle kernel tests: ") + run_pixel_swizzle_kernel_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("parallel_for_rows tests: ") + run_parallel_for_rows_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("reverse-Z depth tests: ") + run_reversez_depth_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("log depth tests: ") + run_log_depth_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("depth frame stats tests: ") + run_depth_frame_stats_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("seg pixel run tests: ") + run_seg_pixel_run_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("staging pool tests: ") + run_staging_pool_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("readback ring tests: ") + run_readback_ring_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("packed buffer downscale tests: ") + run_packedbuf_downscale_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("raw frame pool tests: ") + run_raw_frame_pool_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("exr writer tests: ") + run_exr_writer_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("depth quantize tests: ") + run_depth_quantize_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("png16 depth tests: ") + run_png16depth_tests()).c_str());
+    reshade::log_message(reshade::log_level::info, std::string(std::string("npy writer tests: ") + run_npy_writer_tests()).c_str());
+    // conversions are memory bound, a few threads are enough and leave the rest to the game
+    global_row_thread_pool().change_num_threads(std::min<size_t>(8, std::max(1u, std::thread::hardware_concurrency())));
+    // compression bands of the image being written; the writer threads themselves already spread over cores
+    writer_row_thread_pool().change_num_threads(std::min<size_t>(4, std::max(1u, std::thread::hardware_concurrency() / 2)));
     shdata.init_time = hiresclock::now();
 }
 static void on_destroy(reshade::api::device* device) {
     device->get_private_data<image_writer_thread_pool>().change_num_threads(0);
     device->get_private_data<image_writer_thread_pool>().print_waiting_log_messages();
+    global_row_thread_pool().change_num_threads(1);
+    writer_row_thread_pool().change_num_threads(1);
 
     if (g_rec) {
         g_rec->stop();
@@ -200,6 +281,15 @@ static void on_destroy(reshade::api::device* device) {
         fclose(g_actions_csv);
         g_actions_csv = nullptr;
     }
+    if (g_color_ring) {
+        reshade::log_message(reshade::log_level::info, std::string(std::string("color readback ring: ") + g_color_ring->stats().summary()).c_str());
+        release_texture_readbacks(*g_color_ring, device);
+        g_color_ring.reset();
+    }
+    // after the recorder stopped, nothing reads back textures of this device anymore
+    reshade::log_message(reshade::log_level::info, std::string(std::string("staging pool: ") + global_staging_pool().stats().summary()).c_str());
+    release_staging_textures_of_device(device);
+    global_raw_frame_pool().clear();
     device->destroy_private_data<image_writer_thread_pool>();
 }
 
@@ -240,10 +330,18 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
                 RecorderConfig cfg{g_video_fps, g_rec_dir, true};  // constructor init
                 g_rec = std::make_unique<Recorder>(cfg);
                 g_rec->start();
+                if (g_color_ring_depth > 0) {
+                    g_color_ring = std::make_unique<ReadbackRing>(g_color_ring_depth);
+                    g_color_ring->back_pressure = g_color_ring_back_pressure;
+                }
+                g_rec_region = g_capture_region;
 
                 g_rec_idx = 0;
                 g_last_cap_us = 0;
                 g_copy_fail_in_row = 0;
+                // loading screens and menus would otherwise leave blank depth frames in the recording
+                shdata.drop_broken_depth_frames = true;
+                shdata.num_depth_frames_dropped = 0;
 
                 reshade::log_message(reshade::log_level::info, ("REC start (mode " + std::to_string(g_recording_mode) + "): " + g_rec_dir).c_str());
             }
@@ -252,10 +350,17 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
         // stop record
         if (ctrl_down && (runtime->is_key_pressed(VK_F10) || runtime->is_key_pressed(VK_F8)) && g_recording_mode != 0) {
             g_recording_mode = 0;
+            drain_color_readback(runtime->get_command_queue());
+            if (g_color_ring) {
+                reshade::log_message(reshade::log_level::info, ("color readback ring: " + g_color_ring->stats().summary()).c_str());
+                release_texture_readbacks(*g_color_ring, runtime->get_device());
+                g_color_ring.reset();
+            }
             if (g_rec) {
                 g_rec->stop();
                 g_rec.reset();
             }
+            shdata.drop_broken_depth_frames = false;
             if (g_actions_csv) {
                 fclose(g_actions_csv);
                 g_actions_csv = nullptr;
@@ -303,6 +408,7 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
                         camj["cam_status"] = "uninitialized";
                         if (!cam_err.empty()) camj["err"] = cam_err;
                     }
+                    capture_region_into_json(g_rec_region, camj);
 
                     const int64_t now_us_control_2 = std::chrono::duration_cast<std::chrono::microseconds>(hiresclock::now() - shdata.init_time).count();
                     const int64_t delta_us_control = now_us_control_2 - now_us_control_1;
@@ -336,7 +442,8 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
                                     writers,
                                     q2,
                                     depth_res,
-                                    TexInterp_Depth);
+                                    TexInterp_Depth,
+                                    g_rec_region);
                             if (!ok_depth) {
                                 reshade::log_message(reshade::log_level::warning,
                                                      "record: failed to save per-frame depth (.npy/.fpzip)");
@@ -383,19 +490,37 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
                     if (GetAsyncKeyState(VK_ESCAPE) & 0x8000) keymask_modifiers |= (1u << ESCAPE_BIT);
                     if (GetAsyncKeyState(VK_TAB) & 0x8000) keymask_modifiers |= (1u << TAB_BIT);
 
-                    if (grab_bgra_frame(q, color_res, bgra, w, h)) {
+                    ReadbackFrameTag color_tag;
+                    color_tag.frame_index = g_rec_idx;
+                    color_tag.time_us = now_us;
+                    color_tag.camera = cam;
+                    color_tag.camera_ok = cam_ok;
+                    color_tag.flags = (delta_depth_ok && delta_control_ok) ? RecFrame_LogCamera : 0;
+                    const uint64_t ring_dropped_before = g_color_ring ? g_color_ring->stats().dropped : 0;
+                    if (g_color_ring && submit_texture_readback(*g_color_ring, q, color_res, TexInterp_RGB, g_color_readback_settings,
+                                                                PackedBufOrder_Native, color_tag, push_recorded_color_frame, g_rec_region)) {
+                        // reaches the recorder, with its camera, once the copy has landed a few frames from now
                         g_copy_fail_in_row = 0;
-                        // hud::draw_keys_bgra(bgra.data(), w, h, keymask);
-                        // 不画了
-                        g_rec->push_color(bgra.data(), w, h);
                         color_ok = true;
-                    }
+                    } else if (g_color_ring && g_color_ring->stats().dropped != ring_dropped_before) {
+                        // the ring was full and drops new frames: this one is not captured, and the render thread does not wait
+                    } else {
+                        // no ring, or it could not take the texture (not copyable, or the copy failed): wait for the GPU
+                        drain_color_readback(q);
+                        if (grab_bgra_frame(q, color_res, bgra, w, h, g_rec_region)) {
+                            g_copy_fail_in_row = 0;
+                            // hud::draw_keys_bgra(bgra.data(), w, h, keymask);
+                            // 不画了
+                            g_rec->push_color(bgra.data(), w, h);
+                            color_ok = true;
+                        }
 
-                    if (delta_depth_ok && delta_control_ok) {
-                        g_rec->log_camera_json(/*idx=*/g_rec_idx,
-                                               /*time_us=*/now_us,
-                                               /*cam_json=*/camj,
-                                               /*img_w=*/w, /*img_h=*/h);
+                        if (delta_depth_ok && delta_control_ok) {
+                            g_rec->log_camera_json(/*idx=*/g_rec_idx,
+                                                   /*time_us=*/now_us,
+                                                   /*cam_json=*/camj,
+                                                   /*img_w=*/w, /*img_h=*/h);
+                        }
                     }
 
                     if (g_recording_mode == 2) {  // Logic 2: save control signals
@@ -425,7 +550,7 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
 #if RENDERDOC_FOR_SHADERS
         if (shdata.depth_settings.more_verbose || shdata.depth_settings.debug_mode) {
             if (shdata.save_texture_image_needing_resource_barrier_copy(basefilen + std::string("semsegrawbuffer"),
-                                                                        ImageWriter_STB_png, cmdqueue, segmapp.r_accum_bonus.rsc, TexInterp_IndexedSeg)) {
+                                                                        ImageWriter_STB_png, cmdqueue, segmapp.r_accum_bonus.rsc, TexInterp_IndexedSeg, g_capture_region)) {
                 capmessage << "semsegrawbuffer good; ";
             } else {
                 capmessage << "semsegrawbuffer failed; ";
@@ -445,6 +570,7 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
         if (shdata.get_camera_matrix(gamecam, errstr)) {
             gamecam.into_json(metajson);
             metajson["time_us"] = microelapsedstr;
+            capture_region_into_json(g_capture_region, metajson);
         } else {
             capmessage << "camjson: failed to get any camera data";
             capgood = false;
@@ -455,6 +581,9 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
         }
         capmessage << "; ";
 
+        if (shdata.depth_png16_codes && shdata.game_knows_depthbuffer()) {
+            shdata.depth_quantization.into_json(metajson["depth_png16"]);
+        }
         if (!metajson.empty()) {
             std::ofstream outjson(shdata.output_filepath_creates_outdir_if_needed(basefilen + std::string("meta.json")));
             if (outjson.is_open() && outjson.good()) {
@@ -469,7 +598,8 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
         if (g_recording_mode == 0) {
             const int64_t now_us_depth_11 = std::chrono::duration_cast<std::chrono::microseconds>(hiresclock::now() - shdata.init_time).count();
             if (shdata.save_texture_image_needing_resource_barrier_copy(basefilen + std::string("RGB"),
-                                                                        ImageWriter_STB_png, cmdqueue, device->get_resource_from_view(rtv), TexInterp_RGB)) {
+                                                                        shdata.rgb_png_writer() | (shdata.rgb_float_exr ? ImageWriter_exr : 0),
+                                                                        cmdqueue, device->get_resource_from_view(rtv), TexInterp_RGB, g_capture_region)) {
                 const int64_t now_us_depth_21 = std::chrono::duration_cast<std::chrono::microseconds>(hiresclock::now() - shdata.init_time).count();
                 const int64_t delta_us_depth1 = now_us_depth_21 - now_us_depth_11;
                 reshade::log_message(reshade::log_level::info,
@@ -480,8 +610,8 @@ static void on_reshade_finish_effects(reshade::api::effect_runtime* runtime,
                                          ("Frame skipped1111: Δt=%lld us", std::to_string(delta_us_depth1).c_str()));
                 }
                 if (shdata.save_texture_image_needing_resource_barrier_copy(basefilen + std::string("depth"),
-                                                                            ImageWriter_STB_png | ImageWriter_epr | ImageWriter_numpy | (shdata.game_knows_depthbuffer() ? ImageWriter_fpzip : 0),
-                                                                            cmdqueue, genericdepdata.selected_depth_stencil, TexInterp_Depth)) {
+                                                                            shdata.depth_png_writer() | shdata.depth_epr_writer() | ImageWriter_numpy | (shdata.game_knows_depthbuffer() ? (shdata.depth_fpzip_writer() | (shdata.depth_png16_codes ? ImageWriter_png16depth : 0)) : 0),
+                                                                            cmdqueue, genericdepdata.selected_depth_stencil, TexInterp_Depth, g_capture_region)) {
                     capmessage << "RGB and depth good";
                 } else {
                     capmessage << "RGB good, but failed to capture depth";
@@ -543,6 +673,85 @@ static void draw_settings_overlay(reshade::api::effect_runtime* runtime) {
         ImGui::SliderInt("Depth map: bytes per pix", &shdata.depth_settings.depthbytes, 0, 8);
         ImGui::SliderInt("Depth map: bytes per pix to keep", &shdata.depth_settings.depthbyteskeep, 0, 8);
     }
+    ImGui::Checkbox("RGB: keep 10-bit color (16-bit png)", &shdata.rgb_high_bit_depth);
+    ImGui::Checkbox("RGB: fast 8-bit png (fpng)", &shdata.rgb_fast_png);
+    ImGui::Checkbox("RGB: also save half-float render targets as .exr", &shdata.rgb_float_exr);
+    ImGui::Checkbox("Depth map: 16-bit png preview", &shdata.depth_preview_16bit);
+    ImGui::Checkbox("PNG: deflate in parallel strips (8K / panorama captures)", &shdata.png_in_strips);
+    ImGui::Checkbox("Depth map: tiled fpzip (.fpzt, compressed on the writer row threads)", &shdata.depth_fpzip_tiled);
+    ImGui::Checkbox("Depth map: LZ4-compressed .epr (v2, fast to load)", &shdata.depth_epr_lz4);
+    if (shdata.depth_epr_lz4) {
+        bool epr_half = (shdata.epr_lz4_settings.dtype == EprDtype_f16);
+        if (ImGui::Checkbox("Depth .epr: float16 (lossy, smaller)", &epr_half)) {
+            shdata.epr_lz4_settings.dtype = epr_half ? EprDtype_f16 : EprDtype_f32;
+        }
+        ImGui::SliderInt("Depth .epr: LZ4 acceleration (higher is faster, larger)", &shdata.epr_lz4_settings.acceleration, 1, 16);
+    }
+    ImGui::Checkbox("Depth map: also save 16-bit depth codes (_u16.png, for training)", &shdata.depth_png16_codes);
+    if (shdata.depth_png16_codes) {
+        int quant_mode_idx = static_cast<int>(shdata.depth_quantization.mode);
+        if (ImGui::Combo("Depth codes: spacing", &quant_mode_idx, "linear\0" "log\0")) {
+            shdata.depth_quantization.mode = static_cast<DepthQuantMode>(quant_mode_idx);
+        }
+        ImGui::InputDouble("Depth codes: near", &shdata.depth_quantization.near_depth);
+        ImGui::InputDouble("Depth codes: far", &shdata.depth_quantization.far_depth);
+        if (shdata.depth_quantization.mode == DepthQuant_Linear) {
+            ImGui::InputDouble("Depth codes: codes per meter (1000 = millimeters)", &shdata.depth_quantization.units_per_depth_unit);
+        }
+        std::string quant_err;
+        if (!shdata.depth_quantization.valid(quant_err)) {
+            ImGui::Text("%s", quant_err.c_str());
+        }
+    }
+    ImGui::Text("Readback staging textures: %s", global_staging_pool().stats().summary().c_str());
+    // the "Frame delta" logs show the render thread's share of a snapshot either way
+    ImGui::Checkbox("Snapshots: convert on writer threads (render thread only copies rows)", &shdata.convert_on_writer_threads);
+    if (shdata.convert_on_writer_threads) {
+        ImGui::Text("Raw row buffers: %s", global_raw_frame_pool().stats().summary().c_str());
+    }
+    int write_policy_idx = static_cast<int>(shdata.write_queue_limits.policy);
+    if (ImGui::Combo("Writer queue: when full", &write_policy_idx, "wait (render thread stalls)\0" "drop oldest\0" "drop newest\0")) {
+        shdata.write_queue_limits.policy = static_cast<WriteQueuePolicy>(write_policy_idx);
+    }
+    uint64_t write_queue_items = shdata.write_queue_limits.max_items;
+    if (ImGui::InputScalar("Writer queue: max images", ImGuiDataType_U64, &write_queue_items)) {
+        shdata.write_queue_limits.max_items = static_cast<size_t>(write_queue_items);
+    }
+    uint64_t write_queue_mb = shdata.write_queue_limits.max_bytes >> 20;
+    if (ImGui::InputScalar("Writer queue: max MB", ImGuiDataType_U64, &write_queue_mb)) {
+        shdata.write_queue_limits.max_bytes = write_queue_mb << 20;
+    }
+    int writer_threads[2] = { static_cast<int>(shdata.write_queue_limits.min_threads), static_cast<int>(shdata.write_queue_limits.max_threads) };
+    if (ImGui::SliderInt2("Writer threads: min, max (more start while images wait)", writer_threads, 1, 16)) {
+        shdata.write_queue_limits.min_threads = static_cast<size_t>(writer_threads[0]);
+        shdata.write_queue_limits.max_threads = static_cast<size_t>(std::max(writer_threads[0], writer_threads[1]));
+    }
+    ImGui::Text("Writer queue: %s", shdata.write_queue_stats().summary().c_str());
+    ImGui::SliderInt("Recording: color frames in flight (0 = wait for the GPU)", &g_color_ring_depth, 0, 8);
+    bool drop_when_behind = g_color_ring_back_pressure == ReadbackRing_DropNewest;
+    if (ImGui::Checkbox("Recording: skip color frames while the GPU is behind (instead of waiting)", &drop_when_behind)) {
+        g_color_ring_back_pressure = drop_when_behind ? ReadbackRing_DropNewest : ReadbackRing_WaitOldest;
+        if (g_color_ring) g_color_ring->back_pressure = g_color_ring_back_pressure;
+    }
+    if (g_color_ring) {
+        ImGui::Text("Color readback: %s", g_color_ring->stats().summary().c_str());
+    }
+    // a recording keeps the region it was started with
+    ImGui::InputScalar("Capture region: x", ImGuiDataType_U32, &g_capture_region.x);
+    ImGui::InputScalar("Capture region: y", ImGuiDataType_U32, &g_capture_region.y);
+    ImGui::InputScalar("Capture region: width (0 = to the edge)", ImGuiDataType_U32, &g_capture_region.width);
+    ImGui::InputScalar("Capture region: height (0 = to the edge)", ImGuiDataType_U32, &g_capture_region.height);
+    int downscale_idx = (g_capture_region.downscale >= 4) ? 2 : ((g_capture_region.downscale >= 2) ? 1 : 0);
+    if (ImGui::Combo("Capture: downscale", &downscale_idx, "1x\0" "2x\0" "4x\0")) {
+        g_capture_region.downscale = 1u << downscale_idx;
+    }
+    if (g_capture_region.downscale > 1) {
+        // color is box filtered; depth edges must not be blended into distances that exist nowhere in the scene
+        int depth_filter_idx = static_cast<int>(g_capture_region.depth_filter) - static_cast<int>(PackedBufDownscale_Nearest);
+        if (ImGui::Combo("Capture: depth downscale", &depth_filter_idx, "nearest\0" "min\0" "max\0")) {
+            g_capture_region.depth_filter = static_cast<PackedBufDownscaleFilter>(depth_filter_idx + static_cast<int>(PackedBufDownscale_Nearest));
+        }
+    }
     ImGui::Checkbox("Grab camera coordinates every frame?", &shdata.grabcamcoords);
     if (shdata.grabcamcoords) {
         CamMatrixData lcam;
@@ -0,0 +1,481 @@
+#include "pixel_swizzle_kernels.h"
+#include "pixel_unpack.h"
+#include "gcv_utils/cpu_features.h"
+#include <immintrin.h>
+#include <cstring>
+#include <vector>
+#include <random>
+
+// ---------------------------------------------------------------------------
+// scalar reference kernels (these are the loops that used to live in the
+// copy_texture_image_given_ready_resource_into_packedbuf switch)
+
+static void scalar_l8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, dst += 3) {
+		dst[0] = src[x];
+		dst[1] = src[x];
+		dst[2] = src[x];
+	}
+}
+static void scalar_r8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, dst += 3) {
+		dst[0] = src[x];
+		dst[1] = 0;
+		dst[2] = 0;
+	}
+}
+static void scalar_r8g8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 2, dst += 3) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = 0;
+	}
+}
+static void scalar_r10g10b10a2_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 4, dst += 3) {
+		uint32_t packed;
+		memcpy(&packed, src, 4);
+		r10g10b10a2_to_r8g8b8(packed, dst);
+	}
+}
+static void scalar_r10g10b10a2_to_rgb48(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 4, dst += 6) {
+		uint32_t packed;
+		uint16_t rgb[3];
+		memcpy(&packed, src, 4);
+		r10g10b10a2_to_r16g16b16(packed, rgb);
+		memcpy(dst, rgb, 6);
+	}
+}
+static void scalar_rgba16_to_rgba64(const uint8_t *src, uint8_t *dst, size_t width) {
+	memcpy(dst, src, width * 8);
+}
+static void scalar_halfs_to_floats(const uint8_t *src, uint8_t *dst, size_t count) {
+	for (size_t x = 0; x < count; ++x, src += 2, dst += 4) {
+		uint16_t half;
+		memcpy(&half, src, 2);
+		const float value = half_to_float(half);
+		memcpy(dst, &value, 4);
+	}
+}
+static void scalar_r16f_to_grayf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	scalar_halfs_to_floats(src, dst, width);
+}
+static void scalar_r16g16f_to_rgf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	scalar_halfs_to_floats(src, dst, width * 2);
+}
+static void scalar_rgba16f_to_rgbaf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	scalar_halfs_to_floats(src, dst, width * 4);
+}
+static void scalar_a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, dst += 4) {
+		dst[0] = 0;
+		dst[1] = 0;
+		dst[2] = 0;
+		dst[3] = src[x];
+	}
+}
+static void scalar_l8a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 2, dst += 4) {
+		dst[0] = src[0];
+		dst[1] = src[0];
+		dst[2] = src[0];
+		dst[3] = src[1];
+	}
+}
+static void scalar_rgba8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	memcpy(dst, src, width * 4);
+}
+static void scalar_rgba8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 4, dst += 4) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst[3] = 255;
+	}
+}
+static void scalar_bgra8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 4, dst += 4) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = src[3];
+	}
+}
+static void scalar_bgra8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	for (size_t x = 0; x < width; ++x, src += 4, dst += 4) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = 255;
+	}
+}
+
+// ---------------------------------------------------------------------------
+// SSE4.1 kernels: 16-byte shuffles; leftover pixels at the end of each row go through the scalar kernel
+
+#define Z_ -1 // pshufb index with the high bit set writes a zero byte
+
+static void sse41_l8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i m1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i m2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, dst += 48) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(v, m0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_shuffle_epi8(v, m1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_shuffle_epi8(v, m2));
+	}
+	scalar_l8_to_rgb24(src + x, dst, width - x);
+}
+static void sse41_r8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i m0 = _mm_setr_epi8(0, Z_, Z_, 1, Z_, Z_, 2, Z_, Z_, 3, Z_, Z_, 4, Z_, Z_, 5);
+	const __m128i m1 = _mm_setr_epi8(Z_, Z_, 6, Z_, Z_, 7, Z_, Z_, 8, Z_, Z_, 9, Z_, Z_, 10, Z_);
+	const __m128i m2 = _mm_setr_epi8(Z_, 11, Z_, Z_, 12, Z_, Z_, 13, Z_, Z_, 14, Z_, Z_, 15, Z_, Z_);
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, dst += 48) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(v, m0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_shuffle_epi8(v, m1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_shuffle_epi8(v, m2));
+	}
+	scalar_r8_to_rgb24(src + x, dst, width - x);
+}
+static void sse41_r8g8_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	// 16 pixels = 32 source bytes = 48 destination bytes
+	const __m128i ma0 = _mm_setr_epi8(0, 1, Z_, 2, 3, Z_, 4, 5, Z_, 6, 7, Z_, 8, 9, Z_, 10);
+	const __m128i ma1 = _mm_setr_epi8(11, Z_, 12, 13, Z_, 14, 15, Z_, Z_, Z_, Z_, Z_, Z_, Z_, Z_, Z_);
+	const __m128i mb1 = _mm_setr_epi8(Z_, Z_, Z_, Z_, Z_, Z_, Z_, Z_, 0, 1, Z_, 2, 3, Z_, 4, 5);
+	const __m128i mb2 = _mm_setr_epi8(Z_, 6, 7, Z_, 8, 9, Z_, 10, 11, Z_, 12, 13, Z_, 14, 15, Z_);
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, src += 32, dst += 48) {
+		const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(va, ma0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_shuffle_epi8(va, ma1), _mm_shuffle_epi8(vb, mb1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_shuffle_epi8(vb, mb2));
+	}
+	scalar_r8g8_to_rgb24(src, dst, width - x);
+}
+
+// 4 packed 10:10:10:2 pixels -> 4 rgb triplets in the low 12 bytes
+static inline __m128i sse41_r10g10b10a2_quad(__m128i v) {
+	const __m128i lowbyte = _mm_set1_epi32(0xFF);
+	const __m128i r = _mm_and_si128(_mm_srli_epi32(v, 2), lowbyte);
+	const __m128i g = _mm_and_si128(_mm_srli_epi32(v, 12), lowbyte);
+	const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 22), lowbyte);
+	const __m128i rgbx = _mm_or_si128(r, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(b, 16)));
+	return _mm_shuffle_epi8(rgbx, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z_, Z_, Z_, Z_));
+}
+// four vectors of 12 useful bytes -> 48 contiguous bytes
+static inline void sse41_store_4x12(uint8_t *dst, __m128i p0, __m128i p1, __m128i p2, __m128i p3) {
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),      _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+}
+static void sse41_r10g10b10a2_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, src += 64, dst += 48) {
+		sse41_store_4x12(dst,
+			sse41_r10g10b10a2_quad(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))),
+			sse41_r10g10b10a2_quad(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16))),
+			sse41_r10g10b10a2_quad(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32))),
+			sse41_r10g10b10a2_quad(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48))));
+	}
+	scalar_r10g10b10a2_to_rgb24(src, dst, width - x);
+}
+// 2 packed 10:10:10:2 pixels -> 2 rgb48 pixels in the low 12 bytes; rg holds r | g << 16 per pixel
+static inline __m128i sse41_rgb48_pair(__m128i rg, __m128i b) {
+	const __m128i pairs = _mm_unpacklo_epi32(rg, b); // r g b 0 per pixel
+	// widen 10 to 16 bits by bit replication in every word, as r10g10b10a2_to_r16g16b16 does
+	const __m128i wide = _mm_or_si128(_mm_slli_epi16(pairs, 6), _mm_srli_epi16(pairs, 4));
+	return _mm_shuffle_epi8(wide, _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, Z_, Z_, Z_, Z_));
+}
+static void sse41_r10g10b10a2_to_rgb48(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i tenbits = _mm_set1_epi32(0x3FF);
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, src += 32, dst += 48) {
+		__m128i p[4];
+		for (int ii = 0; ii < 2; ++ii) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16 * ii));
+			const __m128i rg = _mm_or_si128(_mm_and_si128(v, tenbits), _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 10), tenbits), 16));
+			const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 20), tenbits);
+			p[2 * ii] = sse41_rgb48_pair(rg, b);
+			p[2 * ii + 1] = sse41_rgb48_pair(_mm_unpackhi_epi64(rg, rg), _mm_unpackhi_epi64(b, b));
+		}
+		sse41_store_4x12(dst, p[0], p[1], p[2], p[3]);
+	}
+	scalar_r10g10b10a2_to_rgb48(src, dst, width - x);
+}
+static void sse41_a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, dst += 64) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+		const __m128i lo = _mm_unpacklo_epi8(zero, v); // 16-bit lanes with alpha in the high byte
+		const __m128i hi = _mm_unpackhi_epi8(zero, v);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),      _mm_unpacklo_epi16(zero, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi16(zero, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_unpacklo_epi16(zero, hi));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 48), _mm_unpackhi_epi16(zero, hi));
+	}
+	scalar_a8_to_rgba(src + x, dst, width - x);
+}
+static void sse41_l8a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i m0 = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+	const __m128i m1 = _mm_setr_epi8(8, 8, 8, 9, 10, 10, 10, 11, 12, 12, 12, 13, 14, 14, 14, 15);
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, src += 16, dst += 32) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),      _mm_shuffle_epi8(v, m0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_shuffle_epi8(v, m1));
+	}
+	scalar_l8a8_to_rgba(src, dst, width - x);
+}
+static void sse41_rgba8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+	size_t x = 0;
+	for (; x + 4 <= width; x += 4, src += 16, dst += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(v, alpha));
+	}
+	scalar_rgba8_to_rgba_opaque(src, dst, width - x);
+}
+static void sse41_bgra8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i m = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t x = 0;
+	for (; x + 4 <= width; x += 4, src += 16, dst += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_shuffle_epi8(v, m));
+	}
+	scalar_bgra8_to_rgba(src, dst, width - x);
+}
+static void sse41_bgra8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m128i m = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+	size_t x = 0;
+	for (; x + 4 <= width; x += 4, src += 16, dst += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(_mm_shuffle_epi8(v, m), alpha));
+	}
+	scalar_bgra8_to_rgba_opaque(src, dst, width - x);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels: only the 4-byte-per-pixel outputs benefit from 256-bit lanes,
+// because vpshufb cannot move bytes across 128-bit lanes; 3 and 6-byte outputs reuse SSE4.1.
+
+static void avx2_r10g10b10a2_to_rgb24(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m256i lowbyte = _mm256_set1_epi32(0xFF);
+	const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z_, Z_, Z_, Z_,
+	                                      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z_, Z_, Z_, Z_);
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, src += 64, dst += 48) {
+		__m256i q[2];
+		for (int ii = 0; ii < 2; ++ii) {
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32 * ii));
+			const __m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 2), lowbyte);
+			const __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 12), lowbyte);
+			const __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 22), lowbyte);
+			q[ii] = _mm256_shuffle_epi8(_mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16))), pack);
+		}
+		sse41_store_4x12(dst, _mm256_castsi256_si128(q[0]), _mm256_extracti128_si256(q[0], 1),
+		                      _mm256_castsi256_si128(q[1]), _mm256_extracti128_si256(q[1], 1));
+	}
+	scalar_r10g10b10a2_to_rgb24(src, dst, width - x);
+}
+static void avx2_a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, dst += 32) {
+		const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_slli_epi32(_mm256_cvtepu8_epi32(v), 24));
+	}
+	scalar_a8_to_rgba(src + x, dst, width - x);
+}
+static void avx2_l8a8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m256i m = _mm256_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7,
+	                                   0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+	size_t x = 0;
+	for (; x + 16 <= width; x += 16, src += 32, dst += 64) {
+		// spread 8 source pixels per 128-bit lane so the in-lane shuffle can double them
+		const __m256i v0 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+		const __m256i v1 = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16)));
+		const __m256i l0 = _mm256_packus_epi32(v0, v0); // lane k: pixels 4k..4k+3 twice
+		const __m256i l1 = _mm256_packus_epi32(v1, v1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst),      _mm256_shuffle_epi8(l0, m));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32), _mm256_shuffle_epi8(l1, m));
+	}
+	sse41_l8a8_to_rgba(src, dst, width - x);
+}
+static void avx2_rgba8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(v, alpha));
+	}
+	scalar_rgba8_to_rgba_opaque(src, dst, width - x);
+}
+static void avx2_bgra8_to_rgba(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m256i m = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+	                                   2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_shuffle_epi8(v, m));
+	}
+	scalar_bgra8_to_rgba(src, dst, width - x);
+}
+static void avx2_bgra8_to_rgba_opaque(const uint8_t *src, uint8_t *dst, size_t width) {
+	const __m256i m = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+	                                   2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+	size_t x = 0;
+	for (; x + 8 <= width; x += 8, src += 32, dst += 32) {
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_or_si256(_mm256_shuffle_epi8(v, m), alpha));
+	}
+	scalar_bgra8_to_rgba_opaque(src, dst, width - x);
+}
+
+// F16C: 8 halves per vcvtph2ps
+static void f16c_halfs_to_floats(const uint8_t *src, uint8_t *dst, size_t count) {
+	size_t x = 0;
+	for (; x + 8 <= count; x += 8, src += 16, dst += 32) {
+		const __m128i halfs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		_mm256_storeu_ps(reinterpret_cast<float *>(dst), _mm256_cvtph_ps(halfs));
+	}
+	scalar_halfs_to_floats(src, dst, count - x);
+}
+static void f16c_r16f_to_grayf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	f16c_halfs_to_floats(src, dst, width);
+}
+static void f16c_r16g16f_to_rgf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	f16c_halfs_to_floats(src, dst, width * 2);
+}
+static void f16c_rgba16f_to_rgbaf32(const uint8_t *src, uint8_t *dst, size_t width) {
+	f16c_halfs_to_floats(src, dst, width * 4);
+}
+
+#undef Z_
+
+// ---------------------------------------------------------------------------
+// dispatch
+
+static const swizzle_kernel_table swizzle_tables[SwizzleISA_count] = {
+	{ // scalar
+		scalar_l8_to_rgb24, scalar_r8_to_rgb24, scalar_r8g8_to_rgb24, scalar_r10g10b10a2_to_rgb24,
+		scalar_a8_to_rgba, scalar_l8a8_to_rgba, scalar_rgba8_to_rgba, scalar_rgba8_to_rgba_opaque,
+		scalar_bgra8_to_rgba, scalar_bgra8_to_rgba_opaque,
+		scalar_r10g10b10a2_to_rgb48, scalar_rgba16_to_rgba64,
+		scalar_r16f_to_grayf32, scalar_r16g16f_to_rgf32, scalar_rgba16f_to_rgbaf32,
+	},
+	{ // sse4.1
+		sse41_l8_to_rgb24, sse41_r8_to_rgb24, sse41_r8g8_to_rgb24, sse41_r10g10b10a2_to_rgb24,
+		sse41_a8_to_rgba, sse41_l8a8_to_rgba, scalar_rgba8_to_rgba, sse41_rgba8_to_rgba_opaque,
+		sse41_bgra8_to_rgba, sse41_bgra8_to_rgba_opaque,
+		sse41_r10g10b10a2_to_rgb48, scalar_rgba16_to_rgba64,
+		scalar_r16f_to_grayf32, scalar_r16g16f_to_rgf32, scalar_rgba16f_to_rgbaf32,
+	},
+	{ // avx2
+		sse41_l8_to_rgb24, sse41_r8_to_rgb24, sse41_r8g8_to_rgb24, avx2_r10g10b10a2_to_rgb24,
+		avx2_a8_to_rgba, avx2_l8a8_to_rgba, scalar_rgba8_to_rgba, avx2_rgba8_to_rgba_opaque,
+		avx2_bgra8_to_rgba, avx2_bgra8_to_rgba_opaque,
+		sse41_r10g10b10a2_to_rgb48, scalar_rgba16_to_rgba64,
+		f16c_r16f_to_grayf32, f16c_r16g16f_to_rgf32, f16c_rgba16f_to_rgbaf32,
+	},
+};
+
+static SwizzleKernelISA detect_best_isa() {
+	const cpu_features &feats = get_cpu_features();
+	if (feats.avx2 && feats.f16c) return SwizzleISA_AVX2;
+	if (feats.sse41) return SwizzleISA_SSE41;
+	return SwizzleISA_scalar;
+}
+
+SwizzleKernelISA swizzle_best_supported_isa() {
+	static const SwizzleKernelISA best = detect_best_isa();
+	return best;
+}
+
+const swizzle_kernel_table &swizzle_kernels(SwizzleKernelISA isa) {
+	if (isa < SwizzleISA_scalar || isa >= SwizzleISA_count || isa > swizzle_best_supported_isa())
+		return swizzle_tables[SwizzleISA_scalar];
+	return swizzle_tables[isa];
+}
+
+const swizzle_kernel_table &swizzle_kernels_best() {
+	return swizzle_tables[swizzle_best_supported_isa()];
+}
+
+// ---------------------------------------------------------------------------
+// tests
+
+struct swizzle_kernel_test_entry {
+	const char *name;
+	swizzle_row_fn swizzle_kernel_table::*fn;
+	size_t dst_bytes_per_pixel;
+};
+static const swizzle_kernel_test_entry swizzle_kernel_test_entries[] = {
+	{ "l8_to_rgb24",          &swizzle_kernel_table::l8_to_rgb24,          3 },
+	{ "r8_to_rgb24",          &swizzle_kernel_table::r8_to_rgb24,          3 },
+	{ "r8g8_to_rgb24",        &swizzle_kernel_table::r8g8_to_rgb24,        3 },
+	{ "r10g10b10a2_to_rgb24", &swizzle_kernel_table::r10g10b10a2_to_rgb24, 3 },
+	{ "a8_to_rgba",           &swizzle_kernel_table::a8_to_rgba,           4 },
+	{ "l8a8_to_rgba",         &swizzle_kernel_table::l8a8_to_rgba,         4 },
+	{ "rgba8_to_rgba",        &swizzle_kernel_table::rgba8_to_rgba,        4 },
+	{ "rgba8_to_rgba_opaque", &swizzle_kernel_table::rgba8_to_rgba_opaque, 4 },
+	{ "bgra8_to_rgba",        &swizzle_kernel_table::bgra8_to_rgba,        4 },
+	{ "bgra8_to_rgba_opaque", &swizzle_kernel_table::bgra8_to_rgba_opaque, 4 },
+	{ "r10g10b10a2_to_rgb48", &swizzle_kernel_table::r10g10b10a2_to_rgb48, 6 },
+	{ "rgba16_to_rgba64",     &swizzle_kernel_table::rgba16_to_rgba64,     8 },
+	{ "r16f_to_grayf32",      &swizzle_kernel_table::r16f_to_grayf32,      4 },
+	{ "r16g16f_to_rgf32",     &swizzle_kernel_table::r16g16f_to_rgf32,     8 },
+	{ "rgba16f_to_rgbaf32",   &swizzle_kernel_table::rgba16f_to_rgbaf32,   16 },
+};
+
+std::string run_pixel_swizzle_kernel_tests() {
+	const size_t widths[] = { 1, 3, 7, 8, 15, 16, 17, 31, 33, 63, 64, 65, 100, 1920 };
+	std::mt19937 rng(12345);
+	std::vector<uint8_t> src, dstref, dsttest;
+	const swizzle_kernel_table &reftable = swizzle_tables[SwizzleISA_scalar];
+	const SwizzleKernelISA best = swizzle_best_supported_isa();
+	for (int isa = SwizzleISA_scalar + 1; isa <= best; ++isa) {
+		const swizzle_kernel_table &testtable = swizzle_tables[isa];
+		for (const swizzle_kernel_test_entry &entry : swizzle_kernel_test_entries) {
+			const swizzle_row_fn reffn = reftable.*entry.fn;
+			const swizzle_row_fn testfn = testtable.*entry.fn;
+			for (size_t width : widths) {
+				// source is oversized so every kernel can read its widest input (8 bytes/pixel)
+				src.resize(width * 8);
+				for (auto &bb : src) bb = static_cast<uint8_t>(rng());
+				// prefill with different garbage to catch bytes the kernel forgets to write
+				dstref.assign(width * entry.dst_bytes_per_pixel, 0x5A);
+				dsttest.assign(width * entry.dst_bytes_per_pixel, 0xA5);
+				reffn(src.data(), dstref.data(), width);
+				testfn(src.data(), dsttest.data(), width);
+				if (dstref != dsttest) {
+					return std::string("failed: ") + SwizzleKernelISANames[isa] + std::string(" ")
+						+ entry.name + std::string(" differs from scalar at width ") + std::to_string(width);
+				}
+			}
+		}
+	}
+	// every half value, including denormals, infinities and NaNs
+	src.resize(65536 * 2);
+	for (size_t ii = 0; ii < 65536; ++ii) {
+		const uint16_t half = static_cast<uint16_t>(ii);
+		memcpy(src.data() + ii * 2, &half, 2);
+	}
+	dstref.assign(65536 * 4, 0x5A);
+	reftable.rgba16f_to_rgbaf32(src.data(), dstref.data(), 16384);
+	for (int isa = SwizzleISA_scalar + 1; isa <= best; ++isa) {
+		dsttest.assign(65536 * 4, 0xA5);
+		swizzle_tables[isa].rgba16f_to_rgbaf32(src.data(), dsttest.data(), 16384);
+		if (dstref != dsttest) {
+			return std::string("failed: ") + SwizzleKernelISANames[isa] + std::string(" rgba16f_to_rgbaf32 differs from scalar over all halves");
+		}
+	}
+	return std::string("ok (") + SwizzleKernelISANames[best] + std::string(")");
+}
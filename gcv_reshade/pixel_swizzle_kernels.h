@@ -0,0 +1,54 @@
+#pragma once
+// Row kernels used by copy_texture_into_packedbuf to convert mapped texture rows
+// into simple_packed_buf rows. Each kernel converts one row of "width" pixels;
+// the scalar table is the reference implementation, the SSE4.1/AVX2 tables
+// must produce bit-identical output (see run_pixel_swizzle_kernel_tests).
+#include <stdint.h>
+#include <string>
+
+enum SwizzleKernelISA {
+	SwizzleISA_scalar = 0,
+	SwizzleISA_SSE41,
+	SwizzleISA_AVX2,
+	SwizzleISA_count,
+};
+constexpr const char* SwizzleKernelISANames[] = {
+	"scalar",
+	"sse4.1",
+	"avx2",
+};
+
+typedef void (*swizzle_row_fn)(const uint8_t *src, uint8_t *dst, size_t width);
+
+struct swizzle_kernel_table {
+	// destination BUF_PIX_FMT_RGB24
+	swizzle_row_fn l8_to_rgb24;
+	swizzle_row_fn r8_to_rgb24;
+	swizzle_row_fn r8g8_to_rgb24;
+	swizzle_row_fn r10g10b10a2_to_rgb24;
+	// destination BUF_PIX_FMT_RGBA
+	swizzle_row_fn a8_to_rgba;
+	swizzle_row_fn l8a8_to_rgba;
+	swizzle_row_fn rgba8_to_rgba;        // alpha kept
+	swizzle_row_fn rgba8_to_rgba_opaque; // alpha forced to 255
+	swizzle_row_fn bgra8_to_rgba;
+	swizzle_row_fn bgra8_to_rgba_opaque;
+	// destination BUF_PIX_FMT_RGB48 / BUF_PIX_FMT_RGBA64
+	swizzle_row_fn r10g10b10a2_to_rgb48; // 10 bits widened to 16, alpha dropped
+	swizzle_row_fn rgba16_to_rgba64;     // plain copy
+	// half floats to BUF_PIX_FMT_GRAYF32 / BUF_PIX_FMT_RGF32 / BUF_PIX_FMT_RGBAF32
+	swizzle_row_fn r16f_to_grayf32;
+	swizzle_row_fn r16g16f_to_rgf32;
+	swizzle_row_fn rgba16f_to_rgbaf32;
+};
+
+// highest ISA supported by this CPU and OS (checked once via CPUID/XGETBV);
+// the AVX2 level also requires F16C, which every AVX2 CPU has
+SwizzleKernelISA swizzle_best_supported_isa();
+
+// kernels for a specific ISA; requesting an unsupported ISA returns the scalar table
+const swizzle_kernel_table &swizzle_kernels(SwizzleKernelISA isa);
+const swizzle_kernel_table &swizzle_kernels_best();
+
+// return error string if test failed; "ok" means every supported ISA matches scalar
+std::string run_pixel_swizzle_kernel_tests();
@@ -0,0 +1,116 @@
+/*
+ * Source: reshade addon examples: texture_dump/save_texture.cpp
+ * Copyright (C) 2021 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause OR MIT
+ */
+#include "pixel_unpack.h"
+#include <cstring>
+
+void unpack_r5g6b5(uint16_t data, uint8_t rgb[3])
+{
+	uint32_t temp;
+	temp = (data >> 11) * 255 + 16;
+	rgb[0] = static_cast<uint8_t>((temp / 32 + temp) / 32);
+	temp = ((data & 0x07E0) >> 5) * 255 + 32;
+	rgb[1] = static_cast<uint8_t>((temp / 64 + temp) / 64);
+	temp = (data & 0x001F) * 255 + 16;
+	rgb[2] = static_cast<uint8_t>((temp / 32 + temp) / 32);
+}
+
+#define TENBITS_MASK ((1u << 10u) - 1u)
+void r10g10b10a2_to_r8g8b8(uint32_t data, uint8_t rgb[3]) {
+	rgb[0] = static_cast<uint8_t>((data & TENBITS_MASK) >> 2u);
+	rgb[1] = static_cast<uint8_t>((data & (TENBITS_MASK << 10u)) >> 12u);
+	rgb[2] = static_cast<uint8_t>((data & (TENBITS_MASK << 20u)) >> 22u);
+}
+
+// bit replication maps 0 -> 0 and 1023 -> 65535, and is within 1 of v * 65535 / 1023
+static inline uint16_t widen_10_to_16(uint32_t v) {
+	return static_cast<uint16_t>((v << 6u) | (v >> 4u));
+}
+void r10g10b10a2_to_r16g16b16(uint32_t data, uint16_t rgb[3]) {
+	rgb[0] = widen_10_to_16(data & TENBITS_MASK);
+	rgb[1] = widen_10_to_16((data >> 10u) & TENBITS_MASK);
+	rgb[2] = widen_10_to_16((data >> 20u) & TENBITS_MASK);
+}
+
+// exact for every half, including denormals; NaNs keep their payload and become quiet, as with F16C
+float half_to_float(uint16_t half) {
+	const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16u;
+	const uint32_t exponent = (half >> 10u) & 0x1Fu;
+	const uint32_t mantissa = half & 0x3FFu;
+	uint32_t bits;
+	if (exponent == 0x1Fu) {
+		bits = sign | 0x7F800000u | (mantissa << 13u) | (mantissa != 0 ? 0x400000u : 0u);
+	} else if (exponent != 0) {
+		bits = sign | ((exponent + 112u) << 23u) | (mantissa << 13u);
+	} else {
+		// zero or denormal: mantissa * 2^-24 is exact in float
+		const float magnitude = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+		memcpy(&bits, &magnitude, sizeof(float));
+		bits |= sign;
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(float));
+	return result;
+}
+
+void unpack_bc1_value(const uint8_t color_0[3], const uint8_t color_1[3], uint32_t color_index, uint8_t result[4], bool not_degenerate)
+{
+	switch (color_index)
+	{
+	case 0:
+		for (int c = 0; c < 3; ++c)
+			result[c] = color_0[c];
+		result[3] = 255;
+		break;
+	case 1:
+		for (int c = 0; c < 3; ++c)
+			result[c] = color_1[c];
+		result[3] = 255;
+		break;
+	case 2:
+		for (int c = 0; c < 3; ++c)
+			result[c] = not_degenerate ? (2 * color_0[c] + color_1[c]) / 3 : (color_0[c] + color_1[c]) / 2;
+		result[3] = 255;
+		break;
+	case 3:
+		for (int c = 0; c < 3; ++c)
+			result[c] = not_degenerate ? (color_0[c] + 2 * color_1[c]) / 3 : 0;
+		result[3] = not_degenerate ? 255 : 0;
+		break;
+	}
+}
+
+void unpack_bc4_value(uint8_t alpha_0, uint8_t alpha_1, uint32_t alpha_index, uint8_t *result)
+{
+	const bool interpolation_type = alpha_0 > alpha_1;
+
+	switch (alpha_index)
+	{
+	case 0:
+		*result = alpha_0;
+		break;
+	case 1:
+		*result = alpha_1;
+		break;
+	case 2:
+		*result = interpolation_type ? (6 * alpha_0 + 1 * alpha_1) / 7 : (4 * alpha_0 + 1 * alpha_1) / 5;
+		break;
+	case 3:
+		*result = interpolation_type ? (5 * alpha_0 + 2 * alpha_1) / 7 : (3 * alpha_0 + 2 * alpha_1) / 5;
+		break;
+	case 4:
+		*result = interpolation_type ? (4 * alpha_0 + 3 * alpha_1) / 7 : (2 * alpha_0 + 3 * alpha_1) / 5;
+		break;
+	case 5:
+		*result = interpolation_type ? (3 * alpha_0 + 4 * alpha_1) / 7 : (1 * alpha_0 + 4 * alpha_1) / 5;
+		break;
+	case 6:
+		*result = interpolation_type ? (2 * alpha_0 + 5 * alpha_1) / 7 : 0;
+		break;
+	case 7:
+		*result = interpolation_type ? (1 * alpha_0 + 6 * alpha_1) / 7 : 255;
+		break;
+	}
+}
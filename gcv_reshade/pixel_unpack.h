@@ -0,0 +1,16 @@
+#pragma once
+/*
+ * Source: reshade addon examples: texture_dump/save_texture.cpp
+ * Copyright (C) 2021 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause OR MIT
+ */
+// Per-pixel unpacking of packed and block-compressed texel formats. Kept apart from tex_buffer_utils.h,
+// which needs reshade.hpp, so the row and block kernels also build into capture_bench.
+#include <stdint.h>
+
+void unpack_r5g6b5(uint16_t data, uint8_t rgb[3]);
+void r10g10b10a2_to_r8g8b8(uint32_t data, uint8_t rgb[3]);
+void r10g10b10a2_to_r16g16b16(uint32_t data, uint16_t rgb[3]); // keeps all 10 bits
+float half_to_float(uint16_t half);
+void unpack_bc1_value(const uint8_t color_0[3], const uint8_t color_1[3], uint32_t color_index, uint8_t result[4], bool not_degenerate = true);
+void unpack_bc4_value(uint8_t alpha_0, uint8_t alpha_1, uint32_t alpha_index, uint8_t *result);
@@ -0,0 +1,575 @@
+#include "gcv_utils/capture_benchmark.h"
+#include "gcv_utils/parallel_rows.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <unordered_map>
+
+typedef std::chrono::steady_clock benchclock;
+
+static int64_t bench_now_us() {
+	static const benchclock::time_point epoch = benchclock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(benchclock::now() - epoch).count();
+}
+
+// cheap per-pixel noise, so images don't compress unrealistically well
+static inline uint32_t synth_noise(uint32_t x, uint32_t y, uint32_t seed) {
+	uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u ^ seed * 0xC2B2AE3Du;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	return h;
+}
+
+bool fill_synthetic_texture(SyntheticTextureKind kind, BufPixelFormat pixfmt, size_t width, size_t height, uint32_t seed, simple_packed_buf &tex) {
+	if (width == 0 || height == 0 || !tex.init_full(width, height, pixfmt)) return false;
+	const float fw = static_cast<float>(width), fh = static_cast<float>(height);
+	switch (kind) {
+	case SynthTex_Color:
+		for (uint32_t y = 0; y < height; ++y) {
+			for (uint32_t x = 0; x < width; ++x) {
+				const float noise = static_cast<float>(synth_noise(x, y, seed) & 15u) / 255.0f;
+				const float rgb[3] = {
+					std::min(1.0f, x / fw * 0.9f + noise),
+					std::min(1.0f, y / fh * 0.9f + noise),
+					std::min(1.0f, 0.5f + 0.4f * std::sin((x + y + seed) * 0.02f) + noise),
+				};
+				switch (pixfmt) {
+				case BUF_PIX_FMT_RGBA:
+				case BUF_PIX_FMT_BGRA: {
+					uint8_t *px = tex.entryptr<uint8_t>(y, x);
+					const bool bgr = (pixfmt == BUF_PIX_FMT_BGRA);
+					for (int c = 0; c < 3; ++c) px[bgr ? 2 - c : c] = static_cast<uint8_t>(rgb[c] * 255.0f + 0.5f);
+					px[3] = 255;
+					break;
+				}
+				case BUF_PIX_FMT_RGB48:
+				case BUF_PIX_FMT_RGBA64: {
+					// 10-bit values widened like r10g10b10a2_to_rgb48 does
+					uint16_t *px = tex.entryptr<uint16_t>(y, x);
+					for (int c = 0; c < 3; ++c) {
+						const uint16_t v10 = static_cast<uint16_t>(rgb[c] * 1023.0f + 0.5f);
+						px[c] = static_cast<uint16_t>((v10 << 6) | (v10 >> 4));
+					}
+					if (pixfmt == BUF_PIX_FMT_RGBA64) px[3] = 0xffff;
+					break;
+				}
+				case BUF_PIX_FMT_RGBAF32: {
+					// linear HDR: highlights go past 1
+					float *px = tex.entryptr<float>(y, x);
+					for (int c = 0; c < 3; ++c) px[c] = rgb[c] * rgb[c] * 4.0f;
+					px[3] = 1.0f;
+					break;
+				}
+				default:
+					return false;
+				}
+			}
+		}
+		return true;
+	case SynthTex_Depth: {
+		if (pixfmt != BUF_PIX_FMT_GRAYF32) return false;
+		// a floor 1.7 m below the camera up to the horizon at a third of the height, sky above it
+		const float horizon = fh / 3.0f;
+		for (uint32_t y = 0; y < height; ++y) {
+			float *row = tex.rowptr<float>(y);
+			const float below = (static_cast<float>(y) + 0.5f) - horizon;
+			const float floor_distance = (below > 0.0f) ? 1.7f * fh / below : 1e4f;
+			for (uint32_t x = 0; x < width; ++x) {
+				const float jitter = 1.0f + static_cast<float>(synth_noise(x, y, seed) & 255u) * 1e-5f;
+				row[x] = std::min(1e4f, floor_distance * jitter);
+			}
+		}
+		return true;
+	}
+	case SynthTex_Seg:
+		if (pixfmt != BUF_PIX_FMT_GRAYU32) return false;
+		// rectangles of varying size, each one instance
+		for (uint32_t y = 0; y < height; ++y) {
+			uint32_t *row = tex.rowptr<uint32_t>(y);
+			const uint32_t band = y / 48u;
+			const uint32_t cell_width = 24u + (synth_noise(band, 0, seed) % 96u);
+			for (uint32_t x = 0; x < width; ++x) row[x] = synth_noise(x / cell_width, band, seed) & 0xffffu;
+		}
+		return true;
+	}
+	return false;
+}
+
+SimulatedCaptureDevice::SimulatedCaptureDevice() {
+	gpu_thread = std::thread(&SimulatedCaptureDevice::gpu_loop, this);
+}
+
+SimulatedCaptureDevice::~SimulatedCaptureDevice() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv_work.notify_all();
+	cv_fence.notify_all();
+	gpu_thread.join();
+}
+
+// copies land in submission order, each once its latency has passed
+void SimulatedCaptureDevice::gpu_loop() {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		cv_work.wait(lock, [this] { return stopping || !pending.empty(); });
+		if (stopping) return;
+		const pending_copy next = pending.front();
+		const int64_t wait_us = next.done_at_us - bench_now_us();
+		if (wait_us > 0) {
+			cv_work.wait_for(lock, std::chrono::microseconds(wait_us), [this] { return stopping; });
+			continue;
+		}
+		texture &src = textures[next.source];
+		texture &dst = textures[next.readback];
+		// map nodes stay where they are, and neither texture is resized or destroyed while its copy is pending
+		lock.unlock();
+		const size_t rows = std::min(src.buf.height, dst.buf.height);
+		const size_t row_bytes = std::min(src.buf.rowstride_bytes(), dst.buf.rowstride_bytes());
+		for (size_t y = 0; y < rows; ++y) {
+			std::memcpy(dst.buf.rowptr<uint8_t>(y), src.buf.crowptr<uint8_t>(y), row_bytes);
+		}
+		lock.lock();
+		pending.pop_front();
+		--dst.pending_copies;
+		fence_state &ff = fences[next.fence];
+		ff.completed = std::max(ff.completed, next.fence_value);
+		cv_fence.notify_all();
+	}
+}
+
+uint64_t SimulatedCaptureDevice::add_source(SyntheticTextureKind kind, BufPixelFormat pixfmt, uint32_t width, uint32_t height, uint32_t seed) {
+	texture tt;
+	if (!fill_synthetic_texture(kind, pixfmt, width, height, seed, tt.buf)) return 0;
+	std::lock_guard<std::mutex> lock(mtx);
+	const uint64_t handle = next_handle++;
+	textures[handle] = std::move(tt);
+	return handle;
+}
+
+bool SimulatedCaptureDevice::create_readback_texture(uint32_t format, uint32_t width, uint32_t height, uint64_t &handle) {
+	texture tt;
+	if (width == 0 || height == 0 || !tt.buf.init_full(width, height, static_cast<BufPixelFormat>(format))) return false;
+	std::lock_guard<std::mutex> lock(mtx);
+	handle = next_handle++;
+	textures[handle] = std::move(tt);
+	return true;
+}
+
+void SimulatedCaptureDevice::destroy_texture(uint64_t handle) {
+	std::lock_guard<std::mutex> lock(mtx);
+	textures.erase(handle);
+}
+
+bool SimulatedCaptureDevice::create_fence(uint64_t &fence) {
+	if (!fences_supported) return false;
+	std::lock_guard<std::mutex> lock(mtx);
+	fence = next_handle++;
+	fences[fence] = fence_state();
+	return true;
+}
+
+void SimulatedCaptureDevice::destroy_fence(uint64_t fence) {
+	std::lock_guard<std::mutex> lock(mtx);
+	fences.erase(fence);
+}
+
+bool SimulatedCaptureDevice::submit_copy(uint64_t source, uint64_t readback, uint64_t fence, uint64_t value) {
+	std::unique_lock<std::mutex> lock(mtx);
+	if (textures.count(source) == 0 || textures.count(readback) == 0) return false;
+	if (fence != 0 && fences.count(fence) == 0) return false;
+	++textures[readback].pending_copies;
+	fence_state &ff = fences[fence];
+	if (fence == 0) {
+		// no fences: wait for the GPU to finish everything, like queue->wait_idle()
+		const uint64_t idle_value = ++ff.highest_submitted;
+		pending.push_back(pending_copy{ source, readback, 0, idle_value, bench_now_us() + copy_latency_us });
+		cv_work.notify_all();
+		cv_fence.wait(lock, [&] { return stopping || fences[0].completed >= idle_value; });
+		return fences[0].completed >= idle_value;
+	}
+	ff.highest_submitted = std::max(ff.highest_submitted, value);
+	pending.push_back(pending_copy{ source, readback, fence, value, bench_now_us() + copy_latency_us });
+	cv_work.notify_all();
+	return true;
+}
+
+uint64_t SimulatedCaptureDevice::completed_fence_value(uint64_t fence) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = fences.find(fence);
+	return (found != fences.end()) ? found->second.completed : 0;
+}
+
+bool SimulatedCaptureDevice::wait_fence(uint64_t fence, uint64_t value) {
+	std::unique_lock<std::mutex> lock(mtx);
+	if (fences.count(fence) == 0 || value > fences[fence].highest_submitted) return false; // would never signal
+	cv_fence.wait(lock, [&] { return stopping || fences.count(fence) == 0 || fences[fence].completed >= value; });
+	return fences.count(fence) != 0 && fences[fence].completed >= value;
+}
+
+bool SimulatedCaptureDevice::map_readback(uint64_t readback, const uint8_t *&data, uint32_t &row_pitch) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = textures.find(readback);
+	if (found == textures.end()) return false;
+	if (found->second.pending_copies != 0) ++num_early_maps;
+	data = found->second.buf.cdata<uint8_t>();
+	row_pitch = static_cast<uint32_t>(found->second.buf.rowstride_bytes());
+	return true;
+}
+
+void SimulatedCaptureDevice::unmap_readback(uint64_t /*readback*/) {}
+
+capture_convert_fn synthetic_frame_converter(size_t downscale, PackedBufDownscaleFilter depth_filter) {
+	downscale = std::max<size_t>(downscale, 1);
+	return [downscale, depth_filter](const ReadbackFrame &frame, simple_packed_buf &dst, DepthFrameStats *depth_stats) {
+		const BufPixelFormat pixfmt = static_cast<BufPixelFormat>(frame.format);
+		if (!dst.init_full(frame.width / downscale, frame.height / downscale, pixfmt) || dst.width == 0 || dst.height == 0) return false;
+		const PackedBufDownscaleFilter filter = (pixfmt == BUF_PIX_FMT_GRAYF32) ? depth_filter
+			: ((pixfmt == BUF_PIX_FMT_GRAYU32) ? PackedBufDownscale_Nearest : PackedBufDownscale_Box);
+		const bool want_stats = depth_stats != nullptr && pixfmt == BUF_PIX_FMT_GRAYF32;
+		if (want_stats) depth_stats->reset();
+		std::mutex stats_mtx;
+		parallel_for_rows(dst.height, 0, [&](size_t row_begin, size_t row_end) {
+			if (downscale <= 1) {
+				for (size_t y = row_begin; y < row_end; ++y) {
+					std::memcpy(dst.rowptr<uint8_t>(y), frame.data + y * frame.row_pitch, dst.rowstride_bytes());
+				}
+			} else {
+				downscale_packed_pixels(pixfmt, frame.data + row_begin * downscale * frame.row_pitch, frame.row_pitch, frame.width,
+					(row_end - row_begin) * downscale, downscale, filter, dst.rowptr<uint8_t>(row_begin), dst.rowstride_bytes());
+			}
+			if (want_stats) {
+				DepthFrameStats band_stats;
+				band_stats.hist_first_octave = depth_stats->hist_first_octave;
+				band_stats.sky_distance = depth_stats->sky_distance;
+				for (size_t y = row_begin; y < row_end; ++y) band_stats.add_row(dst.rowptr<float>(y), dst.width);
+				std::lock_guard<std::mutex> lock(stats_mtx);
+				depth_stats->merge(band_stats);
+			}
+		});
+		return true;
+	};
+}
+
+CaptureBenchTimings CaptureBenchTimings::of(std::vector<double> samples) {
+	CaptureBenchTimings tt;
+	tt.count = samples.size();
+	if (samples.empty()) return tt;
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (const double v : samples) sum += v;
+	tt.mean = sum / static_cast<double>(samples.size());
+	tt.p50 = samples[samples.size() / 2];
+	tt.p99 = samples[std::min(samples.size() - 1, (samples.size() * 99) / 100)];
+	tt.max = samples.back();
+	return tt;
+}
+
+static std::string bench_fmt(double v, int decimals = 1) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+	return std::string(buf);
+}
+
+std::string CaptureBenchTimings::summary() const {
+	return std::string("mean ") + bench_fmt(mean) + std::string(" us, p50 ") + bench_fmt(p50) + std::string(" us, p99 ") + bench_fmt(p99)
+		+ std::string(" us, max ") + bench_fmt(max) + std::string(" us (") + std::to_string(count) + std::string(" samples)");
+}
+
+std::string CaptureBenchResult::summary() const {
+	return std::string("render thread per capture: ") + render_thread.summary()
+		+ std::string("\nend-to-end latency: ") + end_to_end.summary()
+		+ std::string("\n") + std::to_string(frames_rendered) + std::string(" frames in ") + bench_fmt(wall_seconds, 2) + std::string(" s, ")
+		+ std::to_string(images_captured) + std::string(" images captured, ") + std::to_string(images_written) + std::string(" written, ")
+		+ std::to_string(images_failed) + std::string(" failed")
+		+ std::string("\nsustained: ") + bench_fmt(packed_mb_per_s()) + std::string(" MB/s converted, ") + bench_fmt(file_mb_per_s()) + std::string(" MB/s to disk")
+		+ std::string("\nreadback: ") + ring.summary() + std::string(", ") + std::to_string(early_maps) + std::string(" early maps")
+		+ std::string("\nwriter queue: ") + write_queue.summary();
+}
+
+// the writer queue of image_writer_thread_pool, without the reshade parts; times each frame until its files are written
+// (or until it is converted, without write_files)
+class bench_writer {
+	image_write_queue queue;
+	std::mutex mtx;
+	std::unordered_map<const queue_item_image2write *, int64_t> captured_us_of;
+	const bool write_files;
+
+	void write(queue_item_image2write &item) {
+		std::string errstr;
+		bool ok = true;
+		if (item.convert_before_write) {
+			// like image_writer_thread_pool::write_queued_image, writers convert serially
+			const serial_rows_on_this_thread serial_rows;
+			ok = item.convert_before_write(item, errstr);
+		}
+		const uint64_t converted_bytes = (ok && item.convert_before_write) ? item.mybuf.num_total_bytes() : 0;
+		if (ok && write_files) ok = item.write_to_disk(errstr);
+		const int64_t done_us = bench_now_us();
+		std::lock_guard<std::mutex> lock(mtx);
+		const auto captured = captured_us_of.find(&item);
+		const double latency = (captured != captured_us_of.end()) ? static_cast<double>(done_us - captured->second) : 0.0;
+		if (captured != captured_us_of.end()) captured_us_of.erase(captured);
+		packed_bytes += converted_bytes;
+		if (ok) {
+			++written;
+			latencies.push_back(latency);
+		} else {
+			++failed;
+		}
+	}
+public:
+	std::vector<double> latencies;
+	uint64_t written = 0;
+	uint64_t failed = 0;
+	uint64_t packed_bytes = 0; // of frames converted on the writer threads
+
+	bench_writer(const WriteQueueLimits &limits, bool write_files_) : write_files(write_files_) {
+		queue.start(limits, [this](queue_item_image2write &item) { write(item); });
+	}
+	~bench_writer() { finish(); }
+
+	// with WriteQueue_BlockProducer, blocks while the queue is full, like a disk that can't keep up;
+	// false if the queue dropped the image
+	bool push(queue_item_image2write *item, uint64_t bytes, int64_t captured_us) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			captured_us_of[item] = captured_us;
+		}
+		if (queue.push(item, bytes) == WriteQueuePush_DroppedNewest) {
+			std::lock_guard<std::mutex> lock(mtx);
+			captured_us_of.erase(item);
+			return false;
+		}
+		return true;
+	}
+	// writes everything still waiting, then stops the threads
+	void finish() {
+		queue.wait_until_idle();
+		queue.stop();
+		std::lock_guard<std::mutex> lock(mtx);
+		captured_us_of.clear();
+	}
+	WriteQueueStats stats() const { return queue.stats(); }
+};
+
+struct bench_stream {
+	SyntheticTextureKind kind;
+	BufPixelFormat pixfmt;
+	const char *name;
+	uint64_t writers;
+	uint64_t source = 0;
+	std::unique_ptr<ReadbackRing> ring;
+};
+
+CaptureBenchResult run_capture_benchmark(const CaptureBenchConfig &cfg, const capture_convert_fn &convert_) {
+	const capture_convert_fn convert = convert_ ? convert_ : synthetic_frame_converter(cfg.downscale, cfg.depth_filter);
+	CaptureBenchResult result;
+	SimulatedCaptureDevice dev;
+	dev.copy_latency_us = cfg.gpu_latency_us;
+	StagingPool pool;
+
+	std::vector<bench_stream> streams;
+	if (cfg.capture_color) streams.push_back(bench_stream{ SynthTex_Color, cfg.color_format, "RGB", cfg.color_writers, 0, nullptr });
+	if (cfg.capture_depth) streams.push_back(bench_stream{ SynthTex_Depth, BUF_PIX_FMT_GRAYF32, "depth", cfg.depth_writers, 0, nullptr });
+	if (cfg.capture_seg) streams.push_back(bench_stream{ SynthTex_Seg, BUF_PIX_FMT_GRAYU32, "semseg", cfg.seg_writers, 0, nullptr });
+	// snapshots wait for each copy, so one slot is enough
+	const bool synchronous = (cfg.mode == CaptureBench_Snapshot || cfg.ring_depth == 0);
+	for (bench_stream &ss : streams) {
+		ss.source = dev.add_source(ss.kind, ss.pixfmt, cfg.width, cfg.height, static_cast<uint32_t>(ss.kind));
+		if (ss.source == 0) {
+			++result.images_failed;
+			return result;
+		}
+		ss.ring = std::make_unique<ReadbackRing>(synchronous ? 1 : cfg.ring_depth);
+		ss.ring->back_pressure = cfg.back_pressure;
+	}
+
+	WriteQueueLimits write_limits;
+	write_limits.max_items = cfg.max_queued_writes;
+	write_limits.max_bytes = cfg.max_queued_bytes;
+	write_limits.policy = cfg.write_policy;
+	write_limits.min_threads = std::max<size_t>(cfg.num_writer_threads, 1);
+	write_limits.max_threads = std::max(cfg.max_writer_threads, write_limits.min_threads);
+	bench_writer writer(write_limits, !cfg.out_dir.empty());
+	RawFramePool raw_pool;
+	std::vector<double> render_times;
+	std::vector<double> convert_latencies; // without out_dir, frames end once they are converted
+	const auto consumer_of = [&](const bench_stream &ss) -> ReadbackRing::consume_fn {
+		const bench_stream *const stream = &ss;
+		return [&, stream](const ReadbackFrame &frame) {
+			char namebuf[64];
+			snprintf(namebuf, sizeof(namebuf), "capbench_%06llu_%s", static_cast<unsigned long long>(frame.tag->frame_index), stream->name);
+			queue_item_image2write *item = new queue_item_image2write(stream->writers,
+				cfg.out_dir.empty() ? std::string(namebuf) : (cfg.out_dir + std::string("/") + std::string(namebuf)));
+			if (cfg.convert_on_writers) {
+				// what copy_texture_image_needing_resource_barrier_into_raw_rows leaves for the writer threads
+				std::shared_ptr<raw_texture_rows> raw = std::make_shared<raw_texture_rows>();
+				raw->bytes = raw_pool.acquire(static_cast<size_t>(frame.row_pitch) * frame.height);
+				std::memcpy(raw->bytes.data(), frame.data, raw->bytes.size());
+				raw->format = frame.format;
+				raw->width = frame.width;
+				raw->height = frame.height;
+				raw->row_pitch = frame.row_pitch;
+				const ReadbackFrameTag tag = *frame.tag;
+				const bool depth = (stream->kind == SynthTex_Depth);
+				item->convert_before_write = [&convert, &raw_pool, raw, tag, depth](queue_item_image2write &qitem, std::string &/*errstr*/) {
+					const ReadbackFrame rawframe{ &tag, raw->format, raw->width, raw->height, raw->bytes.data(), raw->row_pitch };
+					const bool converted = convert(rawframe, qitem.mybuf, depth ? &qitem.depth_stats : nullptr);
+					raw_pool.release(std::move(raw->bytes));
+					return converted;
+				};
+				if (!writer.push(item, raw->bytes.size(), frame.tag->time_us)) ++result.images_failed;
+				return;
+			}
+			if (!convert(frame, item->mybuf, (stream->kind == SynthTex_Depth) ? &item->depth_stats : nullptr)) {
+				++result.images_failed;
+				delete item;
+				return;
+			}
+			result.packed_bytes += item->mybuf.num_total_bytes();
+			if (cfg.out_dir.empty()) {
+				convert_latencies.push_back(static_cast<double>(bench_now_us() - frame.tag->time_us));
+				delete item;
+				return;
+			}
+			if (!writer.push(item, item->mybuf.num_total_bytes(), frame.tag->time_us)) ++result.images_failed;
+		};
+	};
+	std::vector<ReadbackRing::consume_fn> consumers;
+	for (const bench_stream &ss : streams) consumers.push_back(consumer_of(ss));
+
+	const benchclock::time_point start = benchclock::now();
+	const int64_t start_us = bench_now_us();
+	const std::chrono::duration<double, std::micro> period(cfg.fps > 0.0 ? 1e6 / cfg.fps : 0.0);
+	for (uint64_t ii = 0; ii < cfg.num_frames; ++ii) {
+		if (cfg.fps > 0.0) std::this_thread::sleep_until(start + std::chrono::duration_cast<benchclock::duration>(period * static_cast<double>(ii)));
+		if (cfg.frame_work_us > 0.0) {
+			// the game's own work on the render thread
+			const int64_t work_until = bench_now_us() + static_cast<int64_t>(cfg.frame_work_us);
+			while (bench_now_us() < work_until) {}
+		}
+		++result.frames_rendered;
+		if (cfg.capture_every > 1 && ii % cfg.capture_every != 0) continue;
+
+		const int64_t capture_begin = bench_now_us();
+		ReadbackFrameTag tag;
+		tag.frame_index = ii;
+		tag.time_us = capture_begin;
+		for (size_t ss = 0; ss < streams.size(); ++ss) {
+			if (streams[ss].ring->submit(dev, pool, static_cast<uint32_t>(streams[ss].pixfmt), cfg.width, cfg.height, streams[ss].source, tag, consumers[ss])) {
+				++result.images_captured;
+			}
+			if (synchronous) streams[ss].ring->drain(dev, pool, consumers[ss]);
+		}
+		render_times.push_back(static_cast<double>(bench_now_us() - capture_begin));
+	}
+	for (size_t ss = 0; ss < streams.size(); ++ss) {
+		streams[ss].ring->drain(dev, pool, consumers[ss]);
+	}
+	writer.finish();
+	result.wall_seconds = static_cast<double>(bench_now_us() - start_us) * 1e-6;
+
+	for (bench_stream &ss : streams) {
+		const ReadbackRingStats st = ss.ring->stats();
+		result.ring.submitted += st.submitted;
+		result.ring.consumed += st.consumed;
+		result.ring.dropped += st.dropped;
+		result.ring.stalls += st.stalls;
+		result.ring.failed += st.failed;
+		ss.ring->release(dev, pool);
+	}
+	pool.evict_device(dev);
+	result.early_maps = dev.early_maps();
+	result.render_thread = CaptureBenchTimings::of(render_times);
+	result.raw_pool = raw_pool.stats();
+	result.packed_bytes += writer.packed_bytes;
+	result.write_queue = writer.stats();
+	if (cfg.out_dir.empty() && !cfg.convert_on_writers) {
+		result.images_written = convert_latencies.size();
+		result.end_to_end = CaptureBenchTimings::of(convert_latencies);
+	} else {
+		result.images_written = writer.written;
+		// images dropped from the front of the queue were pushed fine; they count as failed once they are gone
+		result.images_failed += writer.failed + result.write_queue.dropped_oldest;
+		result.end_to_end = CaptureBenchTimings::of(writer.latencies);
+		std::error_code ec;
+		if (cfg.out_dir.empty()) return result;
+		for (const auto &entry : std::filesystem::directory_iterator(cfg.out_dir, ec)) {
+			if (entry.is_regular_file(ec) && entry.path().filename().string().rfind("capbench_", 0) == 0) result.file_bytes += entry.file_size(ec);
+		}
+	}
+	return result;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_capture_benchmark_tests() {
+	CaptureBenchConfig cfg;
+	cfg.width = 64;
+	cfg.height = 48;
+	cfg.fps = 0.0;
+	cfg.num_frames = 24;
+	cfg.capture_seg = true;
+	cfg.gpu_latency_us = 300;
+	cfg.ring_depth = 2;
+	{
+		// converted frames must be the source pixels, and every frame of every stream must come out
+		simple_packed_buf reference;
+		if (!fill_synthetic_texture(SynthTex_Color, cfg.color_format, cfg.width, cfg.height, SynthTex_Color, reference)) RETURNFAILST("synthetic color");
+		const capture_convert_fn plain = synthetic_frame_converter(1, PackedBufDownscale_Min);
+		std::string error;
+		const capture_convert_fn checked = [&](const ReadbackFrame &frame, simple_packed_buf &dst, DepthFrameStats *depth_stats) {
+			if (!plain(frame, dst, depth_stats)) return false;
+			if (dst.pixfmt == reference.pixfmt && dst.bytes != reference.bytes) error = std::string("pixels of frame ") + std::to_string(frame.tag->frame_index);
+			if (depth_stats != nullptr && (!depth_stats->gathered() || depth_stats->num_sky == 0)) error = "depth stats";
+			return true;
+		};
+		const CaptureBenchResult res = run_capture_benchmark(cfg, checked);
+		if (!error.empty()) RETURNFAILST(std::string("recording: ") + error);
+		if (res.images_captured != 3 * cfg.num_frames || res.images_written != res.images_captured || res.images_failed != 0
+			|| res.early_maps != 0 || res.ring.consumed != res.images_captured || res.end_to_end.count != res.images_captured) {
+			RETURNFAILST(std::string("recording: ") + res.summary());
+		}
+	}
+	{
+		// snapshots read back every frame before returning, downscaled
+		cfg.mode = CaptureBench_Snapshot;
+		cfg.num_frames = 6;
+		cfg.downscale = 4;
+		std::string error;
+		const capture_convert_fn plain = synthetic_frame_converter(cfg.downscale, cfg.depth_filter);
+		const capture_convert_fn checked = [&](const ReadbackFrame &frame, simple_packed_buf &dst, DepthFrameStats *depth_stats) {
+			if (!plain(frame, dst, depth_stats)) return false;
+			if (dst.width != cfg.width / 4 || dst.height != cfg.height / 4) error = "downscaled size";
+			return true;
+		};
+		const CaptureBenchResult res = run_capture_benchmark(cfg, checked);
+		if (!error.empty()) RETURNFAILST(std::string("snapshot: ") + error);
+		if (res.images_written != 3 * cfg.num_frames || res.early_maps != 0 || res.ring.stalls != 0) RETURNFAILST(std::string("snapshot: ") + res.summary());
+	}
+	{
+		// converted on the writers from raw copies, the same frames come out, and the raw buffers are reused
+		cfg.convert_on_writers = true;
+		std::string error;
+		const capture_convert_fn plain = synthetic_frame_converter(cfg.downscale, cfg.depth_filter);
+		const capture_convert_fn checked = [&](const ReadbackFrame &frame, simple_packed_buf &dst, DepthFrameStats *depth_stats) {
+			if (!plain(frame, dst, depth_stats)) return false;
+			if (dst.width != cfg.width / 4 || dst.height != cfg.height / 4) error = "downscaled size";
+			if (depth_stats != nullptr && !depth_stats->gathered()) error = "depth stats";
+			return true;
+		};
+		const CaptureBenchResult res = run_capture_benchmark(cfg, checked);
+		if (!error.empty()) RETURNFAILST(std::string("snapshot on writers: ") + error);
+		if (res.images_written != 3 * cfg.num_frames || res.images_failed != 0 || res.early_maps != 0 || res.raw_pool.hits == 0) {
+			RETURNFAILST(std::string("snapshot on writers: ") + res.summary() + std::string(", raw buffers ") + res.raw_pool.summary());
+		}
+	}
+	return std::string("ok");
+}
@@ -0,0 +1,173 @@
+#pragma once
+// Headless runs of the capture pipeline: readback through ReadbackRing, conversion into packed buffers
+// band by band, and writing on a pool of writer threads, with a simulated GPU standing in for the game.
+// The addon only reaches the device through ReadbackDevice/StagingDevice, so SimulatedCaptureDevice
+// implements those: it serves synthetic color, depth and segmentation textures and copies them on a
+// thread of its own after a configurable delay, like a GPU that runs behind the CPU.
+// Not part of the addon: capture_bench/capture_bench.cpp drives it from the command line (it builds on Linux),
+// and runs run_capture_benchmark_tests with --tests.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include "gcv_utils/readback_ring.h"
+#include "gcv_utils/simple_packed_buf.h"
+#include "gcv_utils/packedbuf_downscale.h"
+#include "gcv_utils/depth_frame_stats.h"
+#include "gcv_utils/image_queue_entry.h"
+#include "gcv_utils/raw_frame_pool.h"
+#include "gcv_utils/image_write_queue.h"
+
+enum SyntheticTextureKind {
+	SynthTex_Color = 0,
+	SynthTex_Depth,
+	SynthTex_Seg,
+};
+
+// Synthetic textures are stored in the layout of a packed buffer format, which is also their "texture format"
+// for the staging pool and the ring: BGRA/RGBA/RGB48/RGBA64/RGBAF32 color, GRAYF32 depth, GRAYU32 instance ids.
+// Color has smooth gradients with noise, depth is a floor plane receding towards a sky at 1e4, and
+// segmentation is made of rectangles of one id, so each compresses and hashes roughly like a game frame.
+// Returns false for formats a kind has no content for (e.g. GRAYF32 color).
+bool fill_synthetic_texture(SyntheticTextureKind kind, BufPixelFormat pixfmt, size_t width, size_t height, uint32_t seed, simple_packed_buf &tex);
+
+class SimulatedCaptureDevice : public ReadbackDevice {
+	struct texture {
+		simple_packed_buf buf;
+		uint32_t pending_copies = 0; // mapping a texture with copies still pending counts as an early map
+	};
+	struct pending_copy {
+		uint64_t source;
+		uint64_t readback;
+		uint64_t fence;
+		uint64_t fence_value;
+		int64_t done_at_us;
+	};
+	struct fence_state {
+		uint64_t completed = 0;
+		uint64_t highest_submitted = 0;
+	};
+	std::map<uint64_t, texture> textures;
+	std::deque<pending_copy> pending;
+	std::mutex mtx;
+	std::condition_variable cv_work;
+	std::condition_variable cv_fence;
+	std::thread gpu_thread;
+	bool stopping = false;
+	uint64_t next_handle = 1;
+	std::map<uint64_t, fence_state> fences; // each ring counts its own fence values; 0 stands in for wait_idle
+	uint64_t num_early_maps = 0;
+
+	void gpu_loop();
+public:
+	int64_t copy_latency_us = 1000; // from submit_copy until the fence passes; copies also take their memcpy time
+	bool fences_supported = true;
+
+	SimulatedCaptureDevice();
+	~SimulatedCaptureDevice();
+
+	// a texture the "game" renders into; returns its handle (0 if the format has no synthetic content)
+	uint64_t add_source(SyntheticTextureKind kind, BufPixelFormat pixfmt, uint32_t width, uint32_t height, uint32_t seed = 0);
+	uint64_t early_maps() const { return num_early_maps; }
+
+	uint64_t device_id() const override { return 0x5157; }
+	bool create_readback_texture(uint32_t format, uint32_t width, uint32_t height, uint64_t &handle) override;
+	void destroy_texture(uint64_t handle) override;
+	bool create_fence(uint64_t &fence) override;
+	void destroy_fence(uint64_t fence) override;
+	bool submit_copy(uint64_t source, uint64_t readback, uint64_t fence, uint64_t value) override;
+	uint64_t completed_fence_value(uint64_t fence) override;
+	bool wait_fence(uint64_t fence, uint64_t value) override;
+	bool map_readback(uint64_t readback, const uint8_t *&data, uint32_t &row_pitch) override;
+	void unmap_readback(uint64_t readback) override;
+};
+
+// converts one finished readback into the buffer that is written, filling depth_stats if it is not null;
+// in the addon this is copy_texture_into_packedbuf
+typedef std::function<bool(const ReadbackFrame &frame, simple_packed_buf &dst, DepthFrameStats *depth_stats)> capture_convert_fn;
+
+// Converts frames of the synthetic formats: rows are copied, or reduced by downscale on the way, band by band on
+// the row pool, and depth frames get DepthFrameStats like in the addon. Nothing is swizzled, because the synthetic
+// textures already have their packed layout; the swizzle kernels are covered by run_pixel_swizzle_kernel_tests.
+capture_convert_fn synthetic_frame_converter(size_t downscale, PackedBufDownscaleFilter depth_filter);
+
+enum CaptureBenchMode {
+	CaptureBench_Snapshot = 0, // every capture waits for its copy on the render thread, like a key press
+	CaptureBench_Recording,    // captures go through an N-deep ReadbackRing, like a recording
+};
+
+struct CaptureBenchConfig {
+	CaptureBenchMode mode = CaptureBench_Recording;
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+	double fps = 30.0; // rate of rendered frames; 0 renders as fast as the pipeline allows
+	uint64_t num_frames = 300;
+	uint32_t capture_every = 1; // capture one of every this many frames
+	BufPixelFormat color_format = BUF_PIX_FMT_BGRA;
+	bool capture_color = true;
+	bool capture_depth = true;
+	bool capture_seg = false;
+	size_t ring_depth = 3; // 0 waits for every copy, like the synchronous readback
+	ReadbackBackPressure back_pressure = ReadbackRing_WaitOldest;
+	int64_t gpu_latency_us = 2000;
+	double frame_work_us = 0.0; // render-thread time spent on the frame itself, outside of the capture
+	size_t downscale = 1;
+	PackedBufDownscaleFilter depth_filter = PackedBufDownscale_Min;
+	// the render thread only memcpys finished readbacks into raw buffers; writer threads convert them
+	// (image_writer_thread_pool::convert_on_writer_threads)
+	bool convert_on_writers = false;
+	size_t num_writer_threads = 3;
+	size_t max_writer_threads = 0; // more writers start while frames wait, up to this; 0 keeps num_writer_threads
+	size_t max_queued_writes = 64; // what happens once this many frames (or bytes) wait to be written is write_policy
+	uint64_t max_queued_bytes = uint64_t(2) << 30;
+	WriteQueuePolicy write_policy = WriteQueue_BlockProducer;
+	std::string out_dir; // empty: converted frames are dropped instead of written
+	uint64_t color_writers = ImageWriter_STB_png;
+	uint64_t depth_writers = ImageWriter_numpy;
+	uint64_t seg_writers = ImageWriter_STB_png;
+};
+
+// times in microseconds
+struct CaptureBenchTimings {
+	size_t count = 0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+
+	static CaptureBenchTimings of(std::vector<double> samples);
+	std::string summary() const;
+};
+
+struct CaptureBenchResult {
+	CaptureBenchTimings render_thread; // capture work per captured frame: copies, waits, conversions of finished frames
+	CaptureBenchTimings end_to_end;    // from the capture until its files are written (or it is converted, without out_dir)
+	RawFramePoolStats raw_pool;        // raw buffers of convert_on_writers
+	double wall_seconds = 0.0;
+	uint64_t frames_rendered = 0;
+	uint64_t images_captured = 0;
+	uint64_t images_written = 0;
+	uint64_t images_failed = 0; // including images the writer queue dropped
+	uint64_t packed_bytes = 0; // converted packed buffers
+	uint64_t file_bytes = 0;   // on disk
+	uint64_t early_maps = 0;   // slots mapped before their copy finished; must be 0
+	ReadbackRingStats ring; // summed over the rings of color, depth and segmentation
+	WriteQueueStats write_queue;
+
+	double packed_mb_per_s() const { return wall_seconds > 0.0 ? packed_bytes / wall_seconds / 1e6 : 0.0; }
+	double file_mb_per_s() const { return wall_seconds > 0.0 ? file_bytes / wall_seconds / 1e6 : 0.0; }
+	std::string summary() const;
+};
+
+// Renders cfg.num_frames frames paced at cfg.fps on the calling thread, capturing as configured, then drains
+// the rings and waits for every write. convert defaults to synthetic_frame_converter.
+CaptureBenchResult run_capture_benchmark(const CaptureBenchConfig &cfg, const capture_convert_fn &convert = capture_convert_fn());
+
+// return error string if test failed; "ok" means a short headless recording and snapshot run came out complete and in order
+std::string run_capture_benchmark_tests();
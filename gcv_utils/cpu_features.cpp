@@ -0,0 +1,55 @@
+#include "gcv_utils/cpu_features.h"
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+
+// MSVC intrinsics, or their GCC/Clang equivalents for the Linux capture_bench build
+static void cpuid_leaf(int regs[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+	__cpuidex(regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv_xcr0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return eax | (static_cast<uint64_t>(edx) << 32);
+#endif
+}
+
+static cpu_features detect_cpu_features() {
+	cpu_features feats;
+	int regs[4];
+	cpuid_leaf(regs, 0, 0);
+	const int max_leaf = regs[0];
+	if (max_leaf < 1) return feats;
+	cpuid_leaf(regs, 1, 0);
+	const bool has_ssse3  = (regs[2] & (1 << 9)) != 0;
+	const bool has_sse41  = (regs[2] & (1 << 19)) != 0;
+	const bool has_osxsave = (regs[2] & (1 << 27)) != 0;
+	const bool has_avx    = (regs[2] & (1 << 28)) != 0;
+	const bool has_f16c   = (regs[2] & (1 << 29)) != 0;
+	feats.sse41 = has_ssse3 && has_sse41;
+	if (!has_osxsave || !has_avx) return feats;
+	// the OS must save the upper halves of the ymm registers on context switch
+	if ((xgetbv_xcr0() & 0x6) != 0x6) return feats;
+	feats.f16c = has_f16c;
+	if (max_leaf < 7) return feats;
+	cpuid_leaf(regs, 7, 0);
+	feats.avx2 = feats.sse41 && (regs[1] & (1 << 5)) != 0;
+	return feats;
+}
+
+const cpu_features &get_cpu_features() {
+	static const cpu_features feats = detect_cpu_features();
+	return feats;
+}
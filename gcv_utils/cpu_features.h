@@ -0,0 +1,11 @@
+#pragma once
+// CPU/OS support for the instruction sets used by the hand-written SIMD kernels.
+// Detected once via CPUID/XGETBV; kernels compiled for AVX2 must only run when avx2 is set.
+
+struct cpu_features {
+	bool sse41 = false; // SSSE3 and SSE4.1
+	bool avx2 = false;  // AVX2, and the OS saves ymm registers
+	bool f16c = false;  // half <-> float conversions (vcvtph2ps), and the OS saves ymm registers
+};
+
+const cpu_features &get_cpu_features();
@@ -0,0 +1,251 @@
+#include "gcv_utils/depth_frame_stats.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+void DepthFrameStats::reset() {
+	const int first_octave = hist_first_octave;
+	const float sky = sky_distance;
+	*this = DepthFrameStats();
+	hist_first_octave = first_octave;
+	sky_distance = sky;
+}
+
+// biased exponent and the top 5 mantissa bits, minus those of the histogram's first edge
+static inline int hist_bin_from_bits(float value, int first_bin_bits) {
+	if (!(value > 0.0f)) return 0;
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(float));
+	const int bin = static_cast<int>(bits >> 18) - first_bin_bits;
+	return std::min(std::max(bin, 0), DepthFrameStats::hist_bins - 1);
+}
+
+int DepthFrameStats::hist_bin_of(float value) const {
+	return hist_bin_from_bits(value, (127 + hist_first_octave) << 5);
+}
+
+float DepthFrameStats::hist_bin_lower_edge(int bin) const {
+	const uint32_t bits = static_cast<uint32_t>(bin + ((127 + hist_first_octave) << 5)) << 18;
+	float edge;
+	std::memcpy(&edge, &bits, sizeof(float));
+	return edge;
+}
+
+// folds a row's finite min/max into the frame's; num_finite() must not include the row yet
+static inline void merge_minmax(DepthFrameStats &stats, uint64_t finite_before, uint64_t row_finite, float row_min, float row_max) {
+	if (row_finite == 0) return;
+	if (finite_before == 0) {
+		stats.min_value = row_min;
+		stats.max_value = row_max;
+	} else {
+		stats.min_value = std::min(stats.min_value, row_min);
+		stats.max_value = std::max(stats.max_value, row_max);
+	}
+}
+
+void DepthFrameStats::add_row(const float *row, size_t count) {
+	const uint64_t finite_before = num_finite();
+	float row_min = std::numeric_limits<float>::max();
+	float row_max = std::numeric_limits<float>::lowest();
+	uint64_t row_nan = 0, row_inf = 0, row_sky = 0;
+	// neighboring pixels mostly share a bin, so count runs in a register instead of
+	// incrementing the same histogram entry back to back
+	// members are copied to locals, otherwise every histogram store forces them to be reloaded
+	const int first_bin_bits = (127 + hist_first_octave) << 5;
+	const float sky = sky_distance;
+	int run_bin = 0;
+	uint32_t run_length = 0;
+	for (size_t x = 0; x < count; ++x) {
+		const float v = row[x];
+		uint32_t bits;
+		std::memcpy(&bits, &v, sizeof(float));
+		if ((bits & 0x7f800000u) == 0x7f800000u) {
+			if (bits & 0x007fffffu) ++row_nan;
+			else ++row_inf;
+			continue;
+		}
+		row_min = std::min(row_min, v);
+		row_max = std::max(row_max, v);
+		row_sky += (v >= sky);
+		const int bin = hist_bin_from_bits(v, first_bin_bits);
+		if (bin != run_bin) {
+			hist[run_bin] += run_length;
+			run_bin = bin;
+			run_length = 0;
+		}
+		++run_length;
+	}
+	hist[run_bin] += run_length;
+	num_pixels += count;
+	num_nan += row_nan;
+	num_inf += row_inf;
+	num_sky += row_sky;
+	merge_minmax(*this, finite_before, count - row_nan - row_inf, row_min, row_max);
+}
+
+void DepthFrameStats::add_row(const uint32_t *row, size_t count) {
+	const uint64_t finite_before = num_finite();
+	uint32_t row_min = std::numeric_limits<uint32_t>::max();
+	uint32_t row_max = 0;
+	uint64_t row_sky = 0;
+	// members are copied to locals, otherwise every histogram store forces them to be reloaded
+	const int first_bin_bits = (127 + hist_first_octave) << 5;
+	const float sky = sky_distance;
+	int run_bin = 0;
+	uint32_t run_length = 0;
+	for (size_t x = 0; x < count; ++x) {
+		const uint32_t v = row[x];
+		row_min = std::min(row_min, v);
+		row_max = std::max(row_max, v);
+		const float fv = static_cast<float>(v);
+		row_sky += (fv >= sky);
+		const int bin = hist_bin_from_bits(fv, first_bin_bits);
+		if (bin != run_bin) {
+			hist[run_bin] += run_length;
+			run_bin = bin;
+			run_length = 0;
+		}
+		++run_length;
+	}
+	hist[run_bin] += run_length;
+	num_pixels += count;
+	num_sky += row_sky;
+	merge_minmax(*this, finite_before, count, static_cast<float>(row_min), static_cast<float>(row_max));
+}
+
+void DepthFrameStats::merge(const DepthFrameStats &other) {
+	const uint64_t finite_before = num_finite();
+	num_pixels += other.num_pixels;
+	num_nan += other.num_nan;
+	num_inf += other.num_inf;
+	num_sky += other.num_sky;
+	for (int b = 0; b < hist_bins; ++b) {
+		hist[b] += other.hist[b];
+	}
+	merge_minmax(*this, finite_before, other.num_finite(), other.min_value, other.max_value);
+}
+
+float DepthFrameStats::percentile(double fraction) const {
+	const uint64_t finite = num_finite();
+	if (finite == 0) return 0.0f;
+	const double target = std::min(std::max(fraction, 0.0), 1.0) * static_cast<double>(finite);
+	uint64_t cumulative = 0;
+	for (int b = 0; b < hist_bins; ++b) {
+		if (hist[b] == 0) continue;
+		if (static_cast<double>(cumulative + hist[b]) >= target) {
+			// the first and last bins also hold everything outside the histogram range
+			const double lo = (b == 0) ? min_value : hist_bin_lower_edge(b);
+			const double hi = (b == hist_bins - 1) ? max_value : hist_bin_lower_edge(b + 1);
+			const double t = (target - static_cast<double>(cumulative)) / static_cast<double>(hist[b]);
+			const float value = static_cast<float>(lo + t * (hi - lo));
+			return std::min(std::max(value, min_value), max_value);
+		}
+		cumulative += hist[b];
+	}
+	return max_value;
+}
+
+std::string DepthFrameStats::summary() const {
+	return std::to_string(num_pixels) + std::string(" px, min ") + std::to_string(min_value)
+		+ std::string(", max ") + std::to_string(max_value)
+		+ std::string(", p1 ") + std::to_string(percentile(0.01))
+		+ std::string(", p50 ") + std::to_string(percentile(0.5))
+		+ std::string(", p99 ") + std::to_string(percentile(0.99))
+		+ std::string(", nan ") + std::to_string(num_nan)
+		+ std::string(", inf ") + std::to_string(num_inf)
+		+ std::string(", sky ") + std::to_string(num_sky)
+		+ (all_identical() ? std::string(", all identical") : std::string());
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+// bin from frexp, independent of the float bit layout used by hist_bin_of
+static int reference_hist_bin(const DepthFrameStats &stats, float value) {
+	if (!(value > 0.0f)) return 0;
+	int exponent;
+	const double mantissa = std::frexp(static_cast<double>(value), &exponent); // [0.5, 1)
+	const int octave = exponent - 1;
+	const int sub = static_cast<int>(std::floor((2.0 * mantissa - 1.0) * DepthFrameStats::hist_bins_per_octave));
+	const int bin = (octave - stats.hist_first_octave) * DepthFrameStats::hist_bins_per_octave + sub;
+	return std::min(std::max(bin, 0), DepthFrameStats::hist_bins - 1);
+}
+
+std::string run_depth_frame_stats_tests() {
+	const size_t width = 333, height = 97;
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> logdist(-12.0f, 24.0f);
+	std::uniform_int_distribution<int> kind(0, 99);
+	std::vector<float> frame(width * height);
+	for (float &v : frame) {
+		const int k = kind(rng);
+		if (k == 0) v = std::numeric_limits<float>::quiet_NaN();
+		else if (k == 1) v = std::numeric_limits<float>::infinity();
+		else if (k == 2) v = 0.0f;
+		else if (k == 3) v = 10000.0f;
+		else v = std::exp2(logdist(rng));
+	}
+
+	// whole frame at once vs. bands merged in a different order
+	DepthFrameStats whole;
+	whole.add_row(frame.data(), frame.size());
+	DepthFrameStats merged;
+	for (size_t band = 0; band < 4; ++band) {
+		DepthFrameStats bandstats;
+		for (size_t y = (3 - band) * height / 4; y < (4 - band) * height / 4; ++y) {
+			bandstats.add_row(frame.data() + y * width, width);
+		}
+		merged.merge(bandstats);
+	}
+	if (std::memcmp(whole.hist, merged.hist, sizeof(whole.hist)) != 0 || whole.num_pixels != merged.num_pixels
+		|| whole.min_value != merged.min_value || whole.max_value != merged.max_value) {
+		RETURNFAILST("merged bands differ from whole frame");
+	}
+
+	DepthFrameStats reference;
+	std::vector<float> finite;
+	for (const float v : frame) {
+		if (v != v) { ++reference.num_nan; continue; }
+		if (std::isinf(v)) { ++reference.num_inf; continue; }
+		if (v >= reference.sky_distance) ++reference.num_sky;
+		++reference.hist[reference_hist_bin(reference, v)];
+		finite.push_back(v);
+	}
+	if (std::memcmp(whole.hist, reference.hist, sizeof(whole.hist)) != 0) RETURNFAILST("histogram bins differ from frexp reference");
+	if (whole.num_nan != reference.num_nan || whole.num_inf != reference.num_inf || whole.num_sky != reference.num_sky) {
+		RETURNFAILST("nan/inf/sky counts");
+	}
+	std::sort(finite.begin(), finite.end());
+	if (whole.min_value != finite.front() || whole.max_value != finite.back()) RETURNFAILST("min/max");
+	for (int b = 1; b < DepthFrameStats::hist_bins; ++b) {
+		if (whole.hist_bin_of(whole.hist_bin_lower_edge(b)) != b) RETURNFAILST(std::string("lower edge of bin ") + std::to_string(b));
+	}
+	for (const double fraction : { 0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99 }) {
+		const float exact = finite[static_cast<size_t>(fraction * static_cast<double>(finite.size() - 1))];
+		const float approx = whole.percentile(fraction);
+		if (std::abs(whole.hist_bin_of(approx) - whole.hist_bin_of(exact)) > 1) {
+			RETURNFAILST(std::string("percentile ") + std::to_string(fraction) + std::string(": ") + std::to_string(approx)
+				+ std::string(" vs exact ") + std::to_string(exact));
+		}
+	}
+
+	// a cleared depth buffer, as seen on loading screens
+	std::vector<float> cleared(width, 10000.0f);
+	DepthFrameStats loading;
+	for (size_t y = 0; y < height; ++y) loading.add_row(cleared.data(), width);
+	if (!loading.all_identical() || !loading.looks_broken() || whole.looks_broken()) RETURNFAILST("all-identical frame check");
+	if (loading.num_sky != width * height || loading.percentile(0.5) != 10000.0f) RETURNFAILST("constant frame sky/percentile");
+
+	// raw integer depth uses the histogram from 1 up to 2^32
+	std::vector<uint32_t> raw(width);
+	for (size_t x = 0; x < width; ++x) raw[x] = static_cast<uint32_t>(x * 12345679u);
+	DepthFrameStats rawstats;
+	rawstats.hist_first_octave = 0;
+	rawstats.sky_distance = std::numeric_limits<float>::infinity();
+	rawstats.add_row(raw.data(), raw.size());
+	const uint32_t rawmax = *std::max_element(raw.begin(), raw.end());
+	if (rawstats.min_value != 0.0f || rawstats.max_value != static_cast<float>(rawmax) || rawstats.num_sky != 0) RETURNFAILST("raw u32 min/max");
+	return std::string("ok");
+}
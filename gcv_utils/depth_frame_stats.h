@@ -0,0 +1,44 @@
+#pragma once
+// Statistics of one depth frame, gathered row by row while the depth is converted
+// (see depth_gray_bytesLE_to_f32) so visualization and frame checks need no extra pass.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+struct DepthFrameStats {
+	// pseudo-log histogram: 32 bins per octave, each octave split linearly (the top 5 mantissa bits),
+	// 32 octaves starting at 2^hist_first_octave; smaller values land in bin 0, larger in the last bin
+	static constexpr int hist_bins = 1024;
+	static constexpr int hist_bins_per_octave = 32;
+	int hist_first_octave = -10; // distances from ~1 mm to ~4000 km; raw integer depth uses 0
+	float sky_distance = 9999.0f; // at or beyond this counts as sky; most games here put the far plane at 10 km
+
+	uint64_t num_pixels = 0;
+	uint64_t num_nan = 0;
+	uint64_t num_inf = 0;
+	uint64_t num_sky = 0; // finite values >= sky_distance; these are in the histogram too
+	float min_value = 0.0f; // over finite values; only valid if num_finite() > 0
+	float max_value = 0.0f;
+	uint32_t hist[hist_bins] = {};
+
+	void reset();
+	void add_row(const float *row, size_t count);
+	void add_row(const uint32_t *row, size_t count); // raw depth the game could not interpret
+	void merge(const DepthFrameStats &other); // both must use the same hist_first_octave
+
+	bool gathered() const { return num_pixels > 0; }
+	uint64_t num_finite() const { return num_pixels - num_nan - num_inf; }
+	bool all_identical() const { return num_pixels > 0 && num_finite() == num_pixels && min_value == max_value; }
+	// nothing usable in it, e.g. the cleared depth buffer of a loading screen
+	bool looks_broken() const { return num_pixels == 0 || num_finite() == 0 || all_identical(); }
+
+	int hist_bin_of(float value) const;
+	float hist_bin_lower_edge(int bin) const;
+	// value below which the given fraction [0,1] of finite pixels lie, interpolated within a histogram bin
+	float percentile(double fraction) const;
+
+	std::string summary() const;
+};
+
+// return error string if test failed; "ok" means histogram, merge and percentiles match a brute-force reference
+std::string run_depth_frame_stats_tests();
@@ -0,0 +1,128 @@
+#include "gcv_utils/depth_quantize.h"
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+bool DepthQuantization::valid(std::string &errstr) const {
+	if (!(far_depth > near_depth) || !std::isfinite(near_depth) || !std::isfinite(far_depth)) {
+		errstr += "depth quantization: far must be beyond near";
+		return false;
+	}
+	if (mode == DepthQuant_Log && !(near_depth > 0.0)) {
+		errstr += "depth quantization: log codes need near > 0";
+		return false;
+	}
+	if (mode == DepthQuant_Linear && (!(units_per_depth_unit > 0.0) || (far_depth - near_depth) * units_per_depth_unit > double(max_code - 1))) {
+		errstr += std::string("depth quantization: ") + std::to_string(far_depth - near_depth) + std::string(" between near and far do not fit in 65534 codes of 1/")
+			+ std::to_string(units_per_depth_unit) + std::string("; use coarser units or log codes");
+		return false;
+	}
+	return true;
+}
+
+double DepthQuantization::scale() const {
+	if (mode == DepthQuant_Log) return std::log(far_depth / near_depth) / double(max_code - 1);
+	return 1.0 / units_per_depth_unit;
+}
+
+// code 1 is near
+double DepthQuantization::offset() const {
+	if (mode == DepthQuant_Log) return std::log(near_depth) - scale();
+	return near_depth - scale();
+}
+
+uint16_t DepthQuantization::encode(float depth) const {
+	uint8_t be[2];
+	encode_row_be(&depth, 1, be);
+	return static_cast<uint16_t>((be[0] << 8) | be[1]);
+}
+
+double DepthQuantization::decode(uint16_t code) const {
+	if (code == no_depth_code) return std::nan("");
+	if (mode == DepthQuant_Log) return std::exp(offset() + scale() * code);
+	return offset() + scale() * code;
+}
+
+void DepthQuantization::encode_row_be(const float *src, size_t count, uint8_t *dst) const {
+	const double codes_per_unit = 1.0 / scale();
+	const double origin = (mode == DepthQuant_Log) ? std::log(near_depth) : near_depth;
+	const double last_code = (mode == DepthQuant_Log) ? double(max_code)
+		: std::min(double(max_code), 1.0 + std::round((far_depth - near_depth) * codes_per_unit));
+	for (size_t ii = 0; ii < count; ++ii) {
+		const float depth = src[ii];
+		uint16_t code = no_depth_code;
+		// NaN fails the first test
+		if (depth > 0.0f && depth <= 3.4e38f) {
+			const double value = (mode == DepthQuant_Log) ? std::log(static_cast<double>(depth)) : static_cast<double>(depth);
+			code = static_cast<uint16_t>(std::clamp(1.0 + std::round((value - origin) * codes_per_unit), 1.0, last_code));
+		}
+		dst[ii * 2] = static_cast<uint8_t>(code >> 8);
+		dst[ii * 2 + 1] = static_cast<uint8_t>(code);
+	}
+}
+
+void DepthQuantization::into_json(nlohmann::json &rj) const {
+	rj["mode"] = (mode == DepthQuant_Log) ? "log" : "linear";
+	rj["near"] = near_depth;
+	rj["far"] = far_depth;
+	if (mode == DepthQuant_Linear) rj["codes_per_unit"] = units_per_depth_unit;
+	rj["scale"] = scale();
+	rj["offset"] = offset();
+	rj["formula"] = (mode == DepthQuant_Log) ? "depth = exp(offset + scale * code); code 0: no depth"
+		: "depth = offset + scale * code; code 0: no depth";
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_depth_quantize_tests() {
+	std::string errstr;
+	DepthQuantization linear;
+	linear.mode = DepthQuant_Linear;
+	linear.near_depth = 0.5;
+	linear.far_depth = 60.0;
+	linear.units_per_depth_unit = 1000.0;
+	DepthQuantization logq;
+	logq.mode = DepthQuant_Log;
+	if (!linear.valid(errstr) || !logq.valid(errstr)) RETURNFAILST(errstr);
+
+	// every depth within range comes back within half a step: half a millimeter, or half the relative log step
+	const double log_step = logq.scale();
+	for (double depth = 0.5; depth <= 60.0; depth *= 1.0007) {
+		const float fdepth = static_cast<float>(depth);
+		const double lin_err = std::abs(linear.decode(linear.encode(fdepth)) - fdepth);
+		if (lin_err > 0.5 / linear.units_per_depth_unit + 1e-9) RETURNFAILST(std::string("linear error ") + std::to_string(lin_err) + std::string(" at ") + std::to_string(depth));
+	}
+	for (double depth = logq.near_depth; depth <= logq.far_depth; depth *= 1.0013) {
+		const float fdepth = static_cast<float>(depth);
+		const double rel_err = std::abs(std::log(logq.decode(logq.encode(fdepth)) / fdepth));
+		if (rel_err > 0.5 * log_step + 1e-9) RETURNFAILST(std::string("log error ") + std::to_string(rel_err) + std::string(" at ") + std::to_string(depth));
+	}
+	// near is code 1, far the last code; beyond them values clamp
+	if (linear.encode(0.5f) != 1 || logq.encode(0.1f) != 1 || logq.encode(10000.0f) != DepthQuantization::max_code) RETURNFAILST("near/far codes");
+	if (linear.encode(0.01f) != 1 || logq.encode(0.001f) != 1) RETURNFAILST("below near");
+	if (linear.encode(1e6f) != linear.encode(60.0f) || logq.encode(1e9f) != DepthQuantization::max_code) RETURNFAILST("beyond far");
+	const float no_depth[] = { std::nanf(""), INFINITY, -INFINITY, 0.0f, -3.0f };
+	for (const float depth : no_depth) {
+		if (linear.encode(depth) != DepthQuantization::no_depth_code || logq.encode(depth) != DepthQuantization::no_depth_code) RETURNFAILST(std::string("no-depth value ") + std::to_string(depth));
+	}
+	// the formula in the metadata reproduces decode
+	nlohmann::json meta;
+	linear.into_json(meta);
+	if (std::abs(meta["offset"].get<double>() + meta["scale"].get<double>() * 1234.0 - linear.decode(1234)) > 1e-9) RETURNFAILST("linear metadata");
+	meta.clear();
+	logq.into_json(meta);
+	if (std::abs(std::exp(meta["offset"].get<double>() + meta["scale"].get<double>() * 4321.0) - logq.decode(4321)) > 1e-9) RETURNFAILST("log metadata");
+
+	std::vector<uint8_t> be(4);
+	const float pair[2] = { 1.0f, 2.0f };
+	linear.encode_row_be(pair, 2, be.data());
+	if (((be[0] << 8) | be[1]) != linear.encode(1.0f) || ((be[2] << 8) | be[3]) != linear.encode(2.0f)) RETURNFAILST("big-endian row");
+
+	DepthQuantization toowide = linear;
+	toowide.far_depth = 100.0;
+	if (toowide.valid(errstr)) RETURNFAILST("accepted 99.5 m of millimeters");
+	DepthQuantization lognear0 = logq;
+	lognear0.near_depth = 0.0;
+	if (lognear0.valid(errstr)) RETURNFAILST("accepted log codes from 0");
+	return "ok";
+}
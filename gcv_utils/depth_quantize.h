@@ -0,0 +1,42 @@
+#pragma once
+// Metric depth as 16-bit png codes (ImageWriter_png16depth), a compact format most training pipelines can read.
+// Code 0 means no depth (NaN, infinite or not positive); codes 1..65535 cover [near, far], clamped at both ends:
+//   linear: depth = offset + scale * code, one code per unit (e.g. 1000 units per meter = millimeters)
+//   log:    depth = exp(offset + scale * code), the same relative step everywhere between near and far
+// The scale and offset are written next to the codes, in a tEXt chunk of the png and in meta.json.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <nlohmann/json.hpp>
+
+enum DepthQuantMode {
+	DepthQuant_Linear = 0,
+	DepthQuant_Log,
+};
+
+struct DepthQuantization {
+	DepthQuantMode mode = DepthQuant_Log;
+	double near_depth = 0.1;    // in the units of the depth buffer (meters when the game can interpret it)
+	double far_depth = 10000.0; // the far plane of most games here; the sky clamps to the last code
+	double units_per_depth_unit = 1000.0; // linear only: codes per depth unit; 1000 stores meters as millimeters
+
+	static constexpr uint16_t no_depth_code = 0;
+	static constexpr uint16_t max_code = 65535;
+
+	// log needs 0 < near < far, linear needs near < far within 65534 units
+	bool valid(std::string &errstr) const;
+	double scale() const;
+	double offset() const;
+
+	uint16_t encode(float depth) const;
+	double decode(uint16_t code) const;
+	// codes of count depths, as big-endian png samples
+	void encode_row_be(const float *src, size_t count, uint8_t *dst) const;
+
+	// mode, near, far, units, scale, offset and the formula, as written to the png and meta.json
+	void into_json(nlohmann::json &rj) const;
+};
+
+// return error string if test failed; "ok" means linear codes came back within half a unit and log codes
+// within half a step, with no-depth and out-of-range values mapped to their codes
+std::string run_depth_quantize_tests();
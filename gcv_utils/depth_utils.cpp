@@ -1,4 +1,10 @@
 #include "depth_utils.h" 
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <random>
+#include <immintrin.h>
+#include "gcv_utils/cpu_features.h"
 
 // source: Nicol Schraudolph, Edward Kmett
 // Academic paper: "A Fast, Compact Approximation of the Exponential Function", Nicol N. Schraudolph, 1999
@@ -6,7 +12,333 @@
 // License of Edward Kmett's code: BSD 3-clause
 
 double exp_fast_approx(double a) {
-  union { double d; long long x; } u;
-  u.x = (long long)(6497320848556798LL * a + 0x3fef127e83d16f12LL);
-  return u.d;
+	union { double d; long long x; } u;
+	u.x = (long long)(6497320848556798LL * a + 0x3fef127e83d16f12LL);
+	return u.d;
+}
+
+
+// 8 depth words from texels bytes_per_px (4 or 8) apart; for 8 byte texels (d32s8) the depth is the low half
+static inline __m256i avx2_load8_depth_words(const uint8_t *p, int bytes_per_px) {
+	if (bytes_per_px == 4) return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	const __m256 lo = _mm256_loadu_ps(reinterpret_cast<const float *>(p));
+	const __m256 hi = _mm256_loadu_ps(reinterpret_cast<const float *>(p + 32));
+	// [lo0 lo2 hi0 hi2 | lo4 lo6 hi4 hi6] -> [lo0 lo2 lo4 lo6 hi0 hi2 hi4 hi6]
+	const __m256 evens = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+	return _mm256_castpd_si256(_mm256_permute4x64_pd(_mm256_castps_pd(evens), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+static inline __m128i sse2_load4_depth_words(const uint8_t *p, int bytes_per_px) {
+	if (bytes_per_px == 4) return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	const __m128 lo = _mm_loadu_ps(reinterpret_cast<const float *>(p));
+	const __m128 hi = _mm_loadu_ps(reinterpret_cast<const float *>(p + 16));
+	return _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static size_t reversez_span_avx2(const uint8_t *src, size_t count, int bytes_per_px, float numer, float denom, float *dst) {
+	const __m256 vnumer = _mm256_set1_ps(numer);
+	const __m256 vdenom = _mm256_set1_ps(denom);
+	size_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		const __m256 depth = _mm256_castsi256_ps(avx2_load8_depth_words(src + x * bytes_per_px, bytes_per_px));
+		_mm256_storeu_ps(dst + x, _mm256_div_ps(vnumer, _mm256_sub_ps(depth, vdenom)));
+	}
+	return x;
+}
+
+void ReverseZDepth::convert_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	size_t x = 0;
+	if (depth_bytes == 4 && (bytes_per_px == 4 || bytes_per_px == 8) && get_cpu_features().avx2) {
+		x = reversez_span_avx2(src, count, bytes_per_px, numerator_constant, denominator_constant, dst);
+	}
+	for (; x < count; ++x) {
+		const uint8_t *const texel = src + x * bytes_per_px;
+		uint64_t vi = 0;
+		for (int z = 0; z < depth_bytes; ++z) {
+			vi += static_cast<uint64_t>(texel[z]) << (8ull * z);
+		}
+		dst[x] = convert(vi);
+	}
+}
+
+// Schraudolph in float: the exponent/mantissa bits are 2^23/ln(2) * a plus the bias of 1.0f,
+// lowered by the same correction as the double version (its 64-bit constant shifted down by 29 bits)
+#define EXPF_APPROX_SCALE 12102203.16156148f
+#define EXPF_APPROX_BIAS 1064866805
+#define EXPF_APPROX_MIN (-87.0f)
+#define EXPF_APPROX_MAX 88.0f
+
+float exp_fast_approx_float(float a) {
+	a = std::min(std::max(a, EXPF_APPROX_MIN), EXPF_APPROX_MAX);
+	const int32_t bits = static_cast<int32_t>(a * EXPF_APPROX_SCALE) + EXPF_APPROX_BIAS;
+	float result;
+	std::memcpy(&result, &bits, sizeof(float));
+	return result;
+}
+
+static inline __m128 exp_fast_approx_sse2(__m128 a) {
+	a = _mm_min_ps(_mm_max_ps(a, _mm_set1_ps(EXPF_APPROX_MIN)), _mm_set1_ps(EXPF_APPROX_MAX));
+	const __m128i bits = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(a, _mm_set1_ps(EXPF_APPROX_SCALE))), _mm_set1_epi32(EXPF_APPROX_BIAS));
+	return _mm_castsi128_ps(bits);
+}
+
+static inline __m256 exp_fast_approx_avx2(__m256 a) {
+	a = _mm256_min_ps(_mm256_max_ps(a, _mm256_set1_ps(EXPF_APPROX_MIN)), _mm256_set1_ps(EXPF_APPROX_MAX));
+	const __m256i bits = _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(a, _mm256_set1_ps(EXPF_APPROX_SCALE))), _mm256_set1_epi32(EXPF_APPROX_BIAS));
+	return _mm256_castsi256_ps(bits);
+}
+
+// unsigned 32-bit to float in two exact halves, so the one rounding matches a scalar (float)uint32_t
+static inline __m128 sse2_u32_to_float(__m128i v) {
+	const __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(v, 16));
+	const __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(v, _mm_set1_epi32(0xFFFF)));
+	return _mm_add_ps(_mm_mul_ps(hi, _mm_set1_ps(65536.0f)), lo);
+}
+
+static inline __m256 avx2_u32_to_float(__m256i v) {
+	const __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+	const __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xFFFF)));
+	return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+}
+
+#define LOGDEPTH_INV_U32MAX (1.0f / 4294967295.0f)
+
+float LogDepthExpFit::convert_float(uint32_t depthval) const {
+	const float normalizeddepth = static_cast<float>(depthval) * LOGDEPTH_INV_U32MAX;
+	const float expval = exp_fast_approx_float(normalizeddepth * static_cast<float>(slope) + static_cast<float>(intercept));
+	return static_cast<float>(numer) / (static_cast<float>(addend) + expval);
+}
+
+void LogDepthExpFit::convert_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const {
+	size_t x = 0;
+	if (depth_bytes == 4 && (bytes_per_px == 4 || bytes_per_px == 8)) {
+		if (get_cpu_features().avx2) {
+			const __m256 vinv = _mm256_set1_ps(LOGDEPTH_INV_U32MAX);
+			const __m256 vslope = _mm256_set1_ps(static_cast<float>(slope));
+			const __m256 vintercept = _mm256_set1_ps(static_cast<float>(intercept));
+			const __m256 vnumer = _mm256_set1_ps(static_cast<float>(numer));
+			const __m256 vaddend = _mm256_set1_ps(static_cast<float>(addend));
+			for (; x + 8 <= count; x += 8) {
+				const __m256 normalizeddepth = _mm256_mul_ps(avx2_u32_to_float(avx2_load8_depth_words(src + x * bytes_per_px, bytes_per_px)), vinv);
+				const __m256 expval = exp_fast_approx_avx2(_mm256_add_ps(_mm256_mul_ps(normalizeddepth, vslope), vintercept));
+				_mm256_storeu_ps(dst + x, _mm256_div_ps(vnumer, _mm256_add_ps(vaddend, expval)));
+			}
+		} else {
+			// SSE2 is always there on x64
+			const __m128 vinv = _mm_set1_ps(LOGDEPTH_INV_U32MAX);
+			const __m128 vslope = _mm_set1_ps(static_cast<float>(slope));
+			const __m128 vintercept = _mm_set1_ps(static_cast<float>(intercept));
+			const __m128 vnumer = _mm_set1_ps(static_cast<float>(numer));
+			const __m128 vaddend = _mm_set1_ps(static_cast<float>(addend));
+			for (; x + 4 <= count; x += 4) {
+				const __m128 normalizeddepth = _mm_mul_ps(sse2_u32_to_float(sse2_load4_depth_words(src + x * bytes_per_px, bytes_per_px)), vinv);
+				const __m128 expval = exp_fast_approx_sse2(_mm_add_ps(_mm_mul_ps(normalizeddepth, vslope), vintercept));
+				_mm_storeu_ps(dst + x, _mm_div_ps(vnumer, _mm_add_ps(vaddend, expval)));
+			}
+		}
+		for (; x < count; ++x) {
+			uint32_t depthval;
+			std::memcpy(&depthval, src + x * bytes_per_px, sizeof(uint32_t));
+			dst[x] = convert_float(depthval);
+		}
+		return;
+	}
+	// unusual layouts keep the double-precision path
+	for (; x < count; ++x) {
+		const uint8_t *const texel = src + x * bytes_per_px;
+		uint64_t vi = 0;
+		for (int z = 0; z < depth_bytes; ++z) {
+			vi += static_cast<uint64_t>(texel[z]) << (8ull * z);
+		}
+		dst[x] = convert(vi);
+	}
+}
+
+static inline double rel_error(double approx, double exact) {
+	const double denom = std::max(std::abs(exact), 1e-30);
+	return std::abs(approx - exact) / denom;
+}
+
+bool DepthLinearizationLUT::build(const std::function<double(uint64_t)> &exact, uint32_t bits, double max_rel_error) {
+	buckets.clear();
+	table.clear();
+	num_inputs = 0;
+	if (bits < 2 || bits > 24) return false;
+	bucket_bits = bits / 2;
+	const uint64_t maxinput = (1ull << bits) - 1ull;
+	const uint32_t bucket_len = 1u << bucket_bits;
+	const uint64_t num_buckets = 1ull << (bits - bucket_bits);
+	// end points past the last input are clamped; the error check below still sees them
+	auto exact_clamped = [&](uint64_t v) { return exact(std::min(v, maxinput)); };
+	buckets.resize(num_buckets);
+	std::vector<float> candidate;
+	for (uint64_t bb = 0; bb < num_buckets; ++bb) {
+		const uint64_t start = bb << bucket_bits;
+		// halve the segment length until interpolation is good enough (shift 0 is exact at every input)
+		for (int32_t shift = static_cast<int32_t>(bucket_bits); shift >= 0; --shift) {
+			const uint32_t seglen = 1u << shift;
+			const uint32_t numseg = bucket_len >> shift;
+			candidate.resize(numseg + 1);
+			for (uint32_t ii = 0; ii <= numseg; ++ii) {
+				candidate[ii] = static_cast<float>(exact_clamped(start + static_cast<uint64_t>(ii) * seglen));
+			}
+			bool good = true;
+			if (shift > 0) {
+				// linear interpolation error of a smooth curve peaks inside the segment; check quarter points
+				const uint32_t probes[3] = { seglen / 4, seglen / 2, seglen - seglen / 4 };
+				const float invstep = 1.0f / static_cast<float>(seglen);
+				for (uint32_t ii = 0; ii < numseg && good; ++ii) {
+					for (const uint32_t pp : probes) {
+						if (pp == 0 || pp >= seglen) continue;
+						const uint64_t v = start + static_cast<uint64_t>(ii) * seglen + pp;
+						if (v > maxinput) continue;
+						const float t = static_cast<float>(pp) * invstep;
+						const float approx = candidate[ii] + (candidate[ii + 1] - candidate[ii]) * t;
+						if (rel_error(approx, exact(v)) > max_rel_error) {
+							good = false;
+							break;
+						}
+					}
+				}
+			}
+			if (good || shift == 0) {
+				buckets[bb].offset = static_cast<uint32_t>(table.size());
+				buckets[bb].shift = static_cast<uint32_t>(shift);
+				buckets[bb].invstep = 1.0f / static_cast<float>(seglen);
+				table.insert(table.end(), candidate.begin(), candidate.end());
+				break;
+			}
+		}
+	}
+	num_inputs = maxinput + 1ull;
+	return true;
+}
+
+double depth_lut_max_rel_error(const DepthLinearizationLUT &lut, const std::function<double(uint64_t)> &exact, uint64_t num_inputs, uint64_t stride) {
+	double maxerr = 0.0;
+	for (uint64_t v = 0; v < num_inputs; v += stride) {
+		if (!lut.covers(v)) return std::numeric_limits<double>::infinity();
+		maxerr = std::max(maxerr, rel_error(static_cast<double>(lut.lookup(v)), exact(v)));
+	}
+	return maxerr;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_depth_lut_tests() {
+	struct lut_test_case {
+		const char *name;
+		uint32_t bits;
+		double max_rel_error;
+		std::function<double(uint64_t)> exact;
+	};
+	// the curves of the 24-bit games that use the table, plus a 16-bit one
+	const lut_test_case cases[] = {
+		{ "crysis", 24, 1e-5, [](uint64_t v) { return 0.25 / std::max(0.0000001, 1.0 - (static_cast<double>(v) / 16777215.0) * (1.0 - 0.25 / 5000.0)); } },
+		{ "dishonored", 24, 1e-5, [](uint64_t v) { return 5415.69378002 / (1.0 + 541167.20430436 * (static_cast<double>(v) / 16777215.0)); } },
+		{ "ets2", 24, 1e-5, [](uint64_t v) { return 1000.0 / (1000.0 - (static_cast<double>(v) / 16777215.0) * 999.0); } },
+		{ "reversez16", 16, 1e-5, [](uint64_t v) { return 0.1 / std::max(1e-7, static_cast<double>(v) / 65535.0); } },
+	};
+	for (const lut_test_case &tc : cases) {
+		DepthLinearizationLUT lut;
+		if (!lut.build(tc.exact, tc.bits, tc.max_rel_error)) RETURNFAILST(std::string("build ") + tc.name);
+		// every input; too slow for on_init at 24 bits, so capture_bench --tests runs it
+		const double err = depth_lut_max_rel_error(lut, tc.exact, 1ull << tc.bits);
+		// float rounding of the table entries adds a little on top of the interpolation bound
+		if (!(err <= tc.max_rel_error * 1.05)) {
+			RETURNFAILST(std::string(tc.name) + std::string(" max rel error ") + std::to_string(err)
+				+ std::string(" with ") + std::to_string(lut.num_entries()) + std::string(" entries"));
+		}
+	}
+	return std::string("ok");
+}
+
+std::string run_reversez_depth_tests() {
+	typedef ReverseZPolicy<150, 10003814> gta_planes;
+	// the policy constants must match the hand-written float constants games used before
+	{
+		const float n = 0.15f;
+		const float f = 10003.814f;
+		if (gta_planes::params.numerator_constant != (-f * n) / (n - f)
+			|| gta_planes::params.denominator_constant != n / (n - f)) RETURNFAILST("ReverseZPolicy constants");
+	}
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> unitdist(0.0f, 1.0f);
+	const size_t widths[] = { 1, 7, 8, 9, 31, 1920 };
+	for (const int bytes_per_px : { 4, 8 }) {
+		for (const size_t width : widths) {
+			std::vector<uint8_t> src(width * bytes_per_px);
+			for (size_t x = 0; x < width; ++x) {
+				// mostly valid depths, plus the edges (0 is the far plane, 1 the near plane)
+				const float depth = (x % 5 == 0) ? static_cast<float>(x % 2) : unitdist(rng);
+				std::memcpy(src.data() + x * bytes_per_px, &depth, sizeof(float));
+				if (bytes_per_px == 8) std::memset(src.data() + x * bytes_per_px + 4, 0xA5, 4); // stencil and padding
+			}
+			std::vector<float> dst(width);
+			gta_planes::convert_span(src.data(), width, bytes_per_px, 4, dst.data());
+			for (size_t x = 0; x < width; ++x) {
+				uint32_t depthbits;
+				std::memcpy(&depthbits, src.data() + x * bytes_per_px, 4);
+				const float expected = gta_planes::convert(depthbits);
+				if (std::memcmp(&expected, &dst[x], sizeof(float)) != 0) {
+					RETURNFAILST(std::string("span mismatch at ") + std::to_string(x) + std::string(" of width ") + std::to_string(width)
+						+ std::string(" with ") + std::to_string(bytes_per_px) + std::string(" bytes per pixel"));
+				}
+			}
+		}
+	}
+	return std::string(get_cpu_features().avx2 ? "ok (avx2)" : "ok (scalar)");
+}
+
+std::string run_log_depth_tests(bool full_sweep) {
+	// Cyberpunk 2077 and the RE engine fits
+	const LogDepthExpFit fits[] = {
+		{ 1.28, 0.000077579959, 354.9329993, -83.84035513 },
+		{ 1.28, 0.0004253421645545, 354.8489261773826, -83.12790960252826 },
+	};
+	double maxerr_vs_double_approx = 0.0;
+	double maxerr_vs_exact = 0.0;
+	double maxerr_double_approx_vs_exact = 0.0;
+	const size_t width = 4099; // not a multiple of 8 so the scalar tail runs too
+	std::vector<uint8_t> src(width * 8);
+	std::vector<float> dst(width);
+	for (const LogDepthExpFit &fit : fits) {
+		for (const int bytes_per_px : { 4, 8 }) {
+			// sweep the whole u32 range, the interesting part of the curve is only a narrow band of it
+			const uint64_t rowstep = (1ull << 32) / (full_sweep ? 64 : 4);
+			for (uint64_t rowstart = 0; rowstart < (1ull << 32); rowstart += rowstep) {
+				for (size_t x = 0; x < width; ++x) {
+					const uint32_t depthval = static_cast<uint32_t>(rowstart + x * 257ull);
+					std::memcpy(src.data() + x * bytes_per_px, &depthval, sizeof(uint32_t));
+					if (bytes_per_px == 8) std::memset(src.data() + x * bytes_per_px + 4, 0xA5, 4);
+				}
+				fit.convert_span(src.data(), width, bytes_per_px, 4, dst.data());
+				for (size_t x = 0; x < width; ++x) {
+					uint32_t depthval;
+					std::memcpy(&depthval, src.data() + x * bytes_per_px, sizeof(uint32_t));
+					const float expected = fit.convert_float(depthval);
+					if (std::memcmp(&expected, &dst[x], sizeof(float)) != 0) {
+						RETURNFAILST(std::string("span lane differs from convert_float at depth ") + std::to_string(depthval));
+					}
+					if (!full_sweep) continue;
+					const double exact = fit.numer / (fit.addend + std::exp(fit.slope * (static_cast<double>(depthval) / 4294967295.0) + fit.intercept));
+					// below a millimeter the curve fit itself is meaningless
+					if (exact < 0.001) continue;
+					maxerr_vs_double_approx = std::max(maxerr_vs_double_approx, rel_error(dst[x], fit.convert(depthval)));
+					maxerr_vs_exact = std::max(maxerr_vs_exact, rel_error(dst[x], exact));
+					maxerr_double_approx_vs_exact = std::max(maxerr_double_approx_vs_exact, rel_error(fit.convert(depthval), exact));
+				}
+			}
+		}
+	}
+	if (!full_sweep) return std::string(get_cpu_features().avx2 ? "ok (avx2)" : "ok (sse2)");
+	// the float version must not be noticeably worse than the double approximation games used before
+	if (maxerr_vs_exact > maxerr_double_approx_vs_exact * 1.01 + 1e-4) {
+		RETURNFAILST(std::string("float span max rel error vs std::exp ") + std::to_string(maxerr_vs_exact)
+			+ std::string(", double approx has ") + std::to_string(maxerr_double_approx_vs_exact));
+	}
+	return std::string(get_cpu_features().avx2 ? "ok (avx2)" : "ok (sse2)")
+		+ std::string(", max rel error vs double approx ") + std::to_string(maxerr_vs_double_approx)
+		+ std::string(", vs std::exp ") + std::to_string(maxerr_vs_exact)
+		+ std::string(" (double approx vs std::exp ") + std::to_string(maxerr_double_approx_vs_exact) + std::string(")");
 }
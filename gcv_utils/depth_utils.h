@@ -1,3 +1,141 @@
-#pragma once 
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstring>
 
-double exp_fast_approx(double a);
\ No newline at end of file
+// Assembles the little-endian depth value of each texel in a row (bytes_per_px apart, low depth_bytes kept)
+// and converts it with convertfn. Games pass a lambda calling their own conversion with a qualified name,
+// so it inlines into the loop instead of costing a virtual call per pixel.
+template<typename ConvertFn>
+inline void convert_depth_span_with(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst, ConvertFn convertfn) {
+	uint32_t v32;
+	if (bytes_per_px == 4 && depth_bytes == 4) {
+		for (size_t x = 0; x < count; ++x) {
+			std::memcpy(&v32, src + x * 4, 4);
+			dst[x] = convertfn(static_cast<uint64_t>(v32));
+		}
+	} else if (bytes_per_px == 4 && depth_bytes == 3) {
+		for (size_t x = 0; x < count; ++x) {
+			std::memcpy(&v32, src + x * 4, 4);
+			dst[x] = convertfn(static_cast<uint64_t>(v32 & 0xFFFFFFu));
+		}
+	} else if (bytes_per_px == 8 && depth_bytes == 4) {
+		for (size_t x = 0; x < count; ++x) {
+			std::memcpy(&v32, src + x * 8, 4);
+			dst[x] = convertfn(static_cast<uint64_t>(v32));
+		}
+	} else {
+		for (size_t x = 0; x < count; ++x) {
+			const uint8_t *const texel = src + x * bytes_per_px;
+			uint64_t vi = 0;
+			for (int z = 0; z < depth_bytes; ++z) {
+				vi += static_cast<uint64_t>(texel[z]) << (8ull * z);
+			}
+			dst[x] = convertfn(vi);
+		}
+	}
+}
+
+double exp_fast_approx(double a);
+// float counterpart of exp_fast_approx, matching each lane of the SSE2/AVX2 versions used by LogDepthExpFit;
+// a is clamped to [-87, 88] so the result stays a finite, normal float
+float exp_fast_approx_float(float a);
+
+// Logarithmic depth buffers whose constants were found by a curve fit:
+// distance = numer / (addend + exp(slope * z + intercept)), with z = depth / (2^32 - 1).
+struct LogDepthExpFit {
+	double numer;
+	double addend;
+	double slope;
+	double intercept;
+
+	// double precision with the scalar exp_fast_approx, as the games always computed it
+	inline float convert(uint64_t depthval) const {
+		const double normalizeddepth = static_cast<double>(depthval) / 4294967295.0;
+		return static_cast<float>(numer / (addend + exp_fast_approx(slope * normalizeddepth + intercept)));
+	}
+	// the same curve in float; this is what every lane of convert_span computes
+	float convert_float(uint32_t depthval) const;
+	// converts a row of count texels, bytes_per_px apart, whose low depth_bytes hold the depth;
+	// 8 pixels per AVX2 instruction (4 with SSE2) for 4 and 8 byte texels
+	void convert_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const;
+};
+
+// Reverse-Z float depth buffer (1 at the near plane, 0 at the far plane) to distance,
+// computed in float the same way the per-game conversions always did.
+struct ReverseZDepth {
+	float numerator_constant;
+	float denominator_constant;
+	constexpr ReverseZDepth(float n, float f)
+		: numerator_constant((-f * n) / (n - f)), denominator_constant(n / (n - f)) {}
+
+	inline float convert(uint64_t depthval) const {
+		const uint32_t depth_as_u32 = static_cast<uint32_t>(depthval);
+		float depth;
+		std::memcpy(&depth, &depth_as_u32, sizeof(float));
+		return numerator_constant / (depth - denominator_constant);
+	}
+	// converts a row of count texels, bytes_per_px apart, whose low depth_bytes hold the float;
+	// AVX2 for 4 and 8 byte texels (d32 and d32s8) when the CPU has it, bit-identical to convert()
+	void convert_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) const;
+};
+
+// Compile-time near/far planes in millimeters, e.g. ReverseZPolicy<100, 10000000> for 0.1 and 10000.
+template<uint32_t NearMM, uint32_t FarMM>
+struct ReverseZPolicy {
+	static constexpr ReverseZDepth params{ static_cast<float>(NearMM) / 1000.0f, static_cast<float>(FarMM) / 1000.0f };
+
+	static float convert(uint64_t depthval) { return params.convert(depthval); }
+	static void convert_span(const uint8_t *src, size_t count, int bytes_per_px, int depth_bytes, float *dst) {
+		params.convert_span(src, count, bytes_per_px, depth_bytes, dst);
+	}
+};
+
+// Piecewise-linear lookup table for depth buffers that hold a 16 or 24-bit integer. A lookup is no faster than a
+// divide, so games whose curve is a plain rational function inline it exactly instead (capture_bench
+// --depth-span-bench times both); the table is for conversions too costly to run per pixel.
+// The input range is split into 2^(bits/2) buckets; each bucket picks its own segment length
+// (a power of two) so that linear interpolation stays within the requested relative error.
+// Steep parts of the curve get short segments, flat parts only need the bucket's two end points.
+class DepthLinearizationLUT {
+	struct bucket {
+		uint32_t offset; // index of the bucket's first entry in table
+		uint32_t shift;  // log2 of segment length
+		float invstep;   // 1 / segment length
+	};
+	std::vector<bucket> buckets;
+	std::vector<float> table;
+	uint64_t num_inputs = 0;
+	uint32_t bucket_bits = 0;
+public:
+	// exact: the conversion to approximate, for inputs [0, 2^bits - 1]; returns false for unsupported bits
+	bool build(const std::function<double(uint64_t)> &exact, uint32_t bits, double max_rel_error = 1e-5);
+
+	bool covers(uint64_t depthval) const { return depthval < num_inputs; }
+	size_t num_entries() const { return table.size(); }
+
+	// caller checks covers(depthval)
+	inline float lookup(uint64_t depthval) const {
+		const bucket &b = buckets[depthval >> bucket_bits];
+		const uint32_t local = static_cast<uint32_t>(depthval & ((1ull << bucket_bits) - 1ull));
+		const float *const e = table.data() + b.offset + (local >> b.shift);
+		const float t = static_cast<float>(local & ((1u << b.shift) - 1u)) * b.invstep;
+		return e[0] + (e[1] - e[0]) * t;
+	}
+};
+
+// largest relative error of lut against exact, checking every stride-th input
+double depth_lut_max_rel_error(const DepthLinearizationLUT &lut, const std::function<double(uint64_t)> &exact, uint64_t num_inputs, uint64_t stride = 1);
+
+// return error string if test failed; "ok" means every table was within its error bound at every input
+std::string run_depth_lut_tests();
+
+// return error string if test failed; "ok" means the SIMD reverse-Z span matches the scalar conversion
+std::string run_reversez_depth_tests();
+
+// return error string if test failed; "ok" means every SIMD lane of the span matched convert_float on a few rows.
+// full_sweep (capture_bench --tests) checks rows across the whole u32 range and also reports the max relative error
+// of the float span against the double approximation and against std::exp, so each game can judge if it is acceptable
+std::string run_log_depth_tests(bool full_sweep = false);
@@ -0,0 +1,618 @@
+#include "gcv_utils/epr_lz4.h"
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/fpzip_tiled.h"
+#include "lz4/lz4.h"
+#include <zlib.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+
+static const char epr_v2_magic[4] = { 'E', 'P', 'R', '2' };
+static constexpr size_t epr_default_band_rows = 64;
+static constexpr uint64_t epr_max_side = 1 << 16;
+static constexpr uint8_t epr_filter_byte_shuffle = 1;
+static constexpr uint8_t epr_codec_lz4 = 0, epr_codec_lz4hc = 1;
+
+static void put_u32(uint8_t *dst, uint32_t val) {
+	for (int bb = 0; bb < 4; ++bb) dst[bb] = static_cast<uint8_t>(val >> (8 * bb));
+}
+static void put_u64(uint8_t *dst, uint64_t val) {
+	for (int bb = 0; bb < 8; ++bb) dst[bb] = static_cast<uint8_t>(val >> (8 * bb));
+}
+static uint32_t get_u32(const uint8_t *src) {
+	uint32_t val = 0;
+	for (int bb = 0; bb < 4; ++bb) val |= static_cast<uint32_t>(src[bb]) << (8 * bb);
+	return val;
+}
+static uint64_t get_u64(const uint8_t *src) {
+	uint64_t val = 0;
+	for (int bb = 0; bb < 8; ++bb) val |= static_cast<uint64_t>(src[bb]) << (8 * bb);
+	return val;
+}
+
+static uint32_t crc32_of(const uint8_t *data, size_t size) {
+	uLong crc = crc32(0L, Z_NULL, 0);
+	while (size > 0) {
+		const uInt chunk = static_cast<uInt>(std::min<size_t>(size, 1u << 30));
+		crc = crc32(crc, data, chunk);
+		data += chunk;
+		size -= chunk;
+	}
+	return static_cast<uint32_t>(crc);
+}
+
+// IEEE half, rounded to nearest even; NaN stays NaN, beyond 65504 becomes infinite
+static uint16_t float_to_half_bits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+	const uint32_t absbits = bits & 0x7fffffffu;
+	if (absbits >= 0x7f800000u) return sign | 0x7c00u | ((absbits > 0x7f800000u) ? 0x200u : 0u);
+	if (absbits >= 0x477ff000u) return sign | 0x7c00u; // 65520 and above round to infinity
+	if (absbits < 0x38800000u) {
+		// below 2^-14: a subnormal half of 2^-24 steps
+		if (absbits <= 0x33000000u) return sign;
+		const uint32_t mant = (absbits & 0x7fffffu) | 0x800000u;
+		const uint32_t shift = 126u - (absbits >> 23);
+		uint32_t half = mant >> shift;
+		const uint32_t rem = mant & ((1u << shift) - 1u), halfway = 1u << (shift - 1u);
+		if (rem > halfway || (rem == halfway && (half & 1u))) ++half;
+		return sign | static_cast<uint16_t>(half);
+	}
+	uint32_t half = (absbits - 0x38000000u) >> 13; // rebias the exponent from 127 to 15
+	const uint32_t rem = absbits & 0x1fffu;
+	if (rem > 0x1000u || (rem == 0x1000u && (half & 1u))) ++half; // a carry into the exponent is still right
+	return sign | static_cast<uint16_t>(half);
+}
+
+static float half_bits_to_float(uint16_t half) {
+	const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+	const uint32_t exponent = (half >> 10) & 0x1fu;
+	uint32_t mant = half & 0x3ffu, bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000u | (mant << 13);
+	} else if (exponent == 0) {
+		if (mant == 0) {
+			bits = sign;
+		} else {
+			uint32_t shifts = 0;
+			while (!(mant & 0x400u)) { mant <<= 1; ++shifts; }
+			bits = sign | ((113u - shifts) << 23) | ((mant & 0x3ffu) << 13);
+		}
+	} else {
+		bits = sign | ((exponent + 112u) << 23) | (mant << 13);
+	}
+	float value;
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+// all 65536 halves as floats, built once: a lookup beats the branches of half_bits_to_float when decoding frames
+static const float *half_to_float_table() {
+	static const std::vector<float> table = [] {
+		std::vector<float> values(0x10000);
+		for (uint32_t hh = 0; hh < 0x10000u; ++hh) values[hh] = half_bits_to_float(static_cast<uint16_t>(hh));
+		return values;
+	}();
+	return table.data();
+}
+
+// Plane b of dst holds byte b of every element. 16 elements at a time with SSE2: byte b of each lane is masked out
+// and packed down; unshuffling interleaves the planes back with unpacks.
+template<size_t N>
+static void byte_shuffle(const uint8_t *src, size_t count, uint8_t *dst);
+template<size_t N>
+static void byte_unshuffle(const uint8_t *src, size_t count, uint8_t *dst);
+
+template<>
+void byte_shuffle<4>(const uint8_t *src, size_t count, uint8_t *dst) {
+	const __m128i lowbyte = _mm_set1_epi32(0xFF);
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		const __m128i *const p = reinterpret_cast<const __m128i *>(src + ii * 4);
+		const __m128i v0 = _mm_loadu_si128(p), v1 = _mm_loadu_si128(p + 1), v2 = _mm_loadu_si128(p + 2), v3 = _mm_loadu_si128(p + 3);
+		for (int bb = 0; bb < 4; ++bb) {
+			const __m128i shift = _mm_cvtsi32_si128(8 * bb);
+			const __m128i lo = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(v0, shift), lowbyte), _mm_and_si128(_mm_srl_epi32(v1, shift), lowbyte));
+			const __m128i hi = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(v2, shift), lowbyte), _mm_and_si128(_mm_srl_epi32(v3, shift), lowbyte));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + bb * count + ii), _mm_packus_epi16(lo, hi));
+		}
+	}
+	for (; ii < count; ++ii) {
+		for (size_t bb = 0; bb < 4; ++bb) dst[bb * count + ii] = src[ii * 4 + bb];
+	}
+}
+
+template<>
+void byte_shuffle<2>(const uint8_t *src, size_t count, uint8_t *dst) {
+	const __m128i lowbyte = _mm_set1_epi16(0xFF);
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		const __m128i *const p = reinterpret_cast<const __m128i *>(src + ii * 2);
+		const __m128i v0 = _mm_loadu_si128(p), v1 = _mm_loadu_si128(p + 1);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + ii), _mm_packus_epi16(_mm_and_si128(v0, lowbyte), _mm_and_si128(v1, lowbyte)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + count + ii), _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8)));
+	}
+	for (; ii < count; ++ii) {
+		dst[ii] = src[ii * 2];
+		dst[count + ii] = src[ii * 2 + 1];
+	}
+}
+
+template<>
+void byte_unshuffle<4>(const uint8_t *src, size_t count, uint8_t *dst) {
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + ii));
+		const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + count + ii));
+		const __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * count + ii));
+		const __m128i b3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * count + ii));
+		const __m128i b01lo = _mm_unpacklo_epi8(b0, b1), b01hi = _mm_unpackhi_epi8(b0, b1);
+		const __m128i b23lo = _mm_unpacklo_epi8(b2, b3), b23hi = _mm_unpackhi_epi8(b2, b3);
+		__m128i *const p = reinterpret_cast<__m128i *>(dst + ii * 4);
+		_mm_storeu_si128(p, _mm_unpacklo_epi16(b01lo, b23lo));
+		_mm_storeu_si128(p + 1, _mm_unpackhi_epi16(b01lo, b23lo));
+		_mm_storeu_si128(p + 2, _mm_unpacklo_epi16(b01hi, b23hi));
+		_mm_storeu_si128(p + 3, _mm_unpackhi_epi16(b01hi, b23hi));
+	}
+	for (; ii < count; ++ii) {
+		for (size_t bb = 0; bb < 4; ++bb) dst[ii * 4 + bb] = src[bb * count + ii];
+	}
+}
+
+template<>
+void byte_unshuffle<2>(const uint8_t *src, size_t count, uint8_t *dst) {
+	size_t ii = 0;
+	for (; ii + 16 <= count; ii += 16) {
+		const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + ii));
+		const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + count + ii));
+		__m128i *const p = reinterpret_cast<__m128i *>(dst + ii * 2);
+		_mm_storeu_si128(p, _mm_unpacklo_epi8(b0, b1));
+		_mm_storeu_si128(p + 1, _mm_unpackhi_epi8(b0, b1));
+	}
+	for (; ii < count; ++ii) {
+		dst[ii * 2] = src[ii];
+		dst[ii * 2 + 1] = src[count + ii];
+	}
+}
+
+static size_t epr_dtype_size(EprDtype dtype) {
+	return (dtype == EprDtype_f16) ? 2 : 4;
+}
+
+struct EprV2Info {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	EprDtype dtype = EprDtype_f32;
+	uint32_t band_rows = 0;
+	uint32_t num_bands = 0;
+	const uint8_t *table = nullptr;
+
+	size_t band_first_row(size_t band) const { return band * band_rows; }
+	size_t band_num_rows(size_t band) const { return std::min<size_t>(band_rows, height - band_first_row(band)); }
+	uint64_t band_offset(size_t band) const { return get_u64(table + band * epr_v2_band_entry_bytes); }
+	uint32_t band_size(size_t band) const { return get_u32(table + band * epr_v2_band_entry_bytes + 8); }
+	uint32_t band_crc(size_t band) const { return get_u32(table + band * epr_v2_band_entry_bytes + 12); }
+};
+
+// the header and band table, and each band's LZ4 block
+static bool compress_epr_bands(const simple_packed_buf &srcBuf, const EprLz4Settings &settings, row_thread_pool &pool,
+	std::vector<uint8_t> &head, std::vector<std::vector<uint8_t>> &bands, std::string &errstr)
+{
+	if (srcBuf.pixfmt != BUF_PIX_FMT_GRAYF32) {
+		errstr += std::string("epr v2: only writes f32 depth data; refusing buf format ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	if (srcBuf.width == 0 || srcBuf.height == 0 || srcBuf.width > epr_max_side || srcBuf.height > epr_max_side) {
+		errstr += std::string("epr v2: cannot write a frame of ") + std::to_string(srcBuf.width) + "x" + std::to_string(srcBuf.height);
+		return false;
+	}
+	const size_t band_rows = std::min((settings.band_rows == 0) ? epr_default_band_rows : settings.band_rows, srcBuf.height);
+	const size_t num_bands = (srcBuf.height + band_rows - 1) / band_rows;
+	const size_t elem_bytes = epr_dtype_size(settings.dtype);
+	const int acceleration = std::max(1, settings.acceleration);
+	bands.resize(num_bands);
+	std::vector<uint32_t> crcs(num_bands);
+	std::vector<char> band_ok(num_bands, 0);
+	pool.parallel_for_rows(num_bands, 1, [&](size_t band_begin, size_t band_end) {
+		thread_local std::vector<uint8_t> shuffled;
+		thread_local std::vector<uint16_t> halves;
+		for (size_t band = band_begin; band < band_end; ++band) {
+			const size_t first_row = band * band_rows;
+			const size_t count = std::min(band_rows, srcBuf.height - first_row) * srcBuf.width;
+			const float *src = srcBuf.crowptr<float>(first_row);
+			shuffled.resize(count * elem_bytes);
+			if (settings.dtype == EprDtype_f16) {
+				halves.resize(count);
+				for (size_t ii = 0; ii < count; ++ii) halves[ii] = float_to_half_bits(src[ii]);
+				byte_shuffle<2>(reinterpret_cast<const uint8_t*>(halves.data()), count, shuffled.data());
+			} else {
+				byte_shuffle<4>(reinterpret_cast<const uint8_t*>(src), count, shuffled.data());
+			}
+			std::vector<uint8_t> &block = bands[band];
+			block.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(shuffled.size()))));
+			const int len = LZ4_compress_fast(reinterpret_cast<const char*>(shuffled.data()), reinterpret_cast<char*>(block.data()),
+				static_cast<int>(shuffled.size()), static_cast<int>(block.size()), acceleration);
+			block.resize(static_cast<size_t>(std::max(len, 0)));
+			crcs[band] = crc32_of(block.data(), block.size());
+			band_ok[band] = (len > 0);
+		}
+	});
+	for (size_t band = 0; band < num_bands; ++band) {
+		if (!band_ok[band]) {
+			errstr += std::string("epr v2: LZ4 failed in band ") + std::to_string(band);
+			return false;
+		}
+	}
+	head.assign(epr_v2_header_bytes + num_bands * epr_v2_band_entry_bytes, 0);
+	memcpy(head.data(), epr_v2_magic, 4);
+	put_u32(head.data() + 4, epr_v2_version);
+	put_u32(head.data() + 8, static_cast<uint32_t>(srcBuf.width));
+	put_u32(head.data() + 12, static_cast<uint32_t>(srcBuf.height));
+	head[16] = static_cast<uint8_t>(settings.dtype);
+	head[17] = epr_filter_byte_shuffle;
+	head[18] = epr_codec_lz4;
+	put_u32(head.data() + 20, static_cast<uint32_t>(band_rows));
+	put_u32(head.data() + 24, static_cast<uint32_t>(num_bands));
+	uint64_t offset = head.size();
+	for (size_t band = 0; band < num_bands; ++band) {
+		uint8_t *entry = head.data() + epr_v2_header_bytes + band * epr_v2_band_entry_bytes;
+		put_u64(entry, offset);
+		put_u32(entry + 8, static_cast<uint32_t>(bands[band].size()));
+		put_u32(entry + 12, crcs[band]);
+		offset += bands[band].size();
+	}
+	put_u32(head.data() + 28, crc32_of(head.data(), head.size()));
+	return true;
+}
+
+bool encode_epr_v2(const simple_packed_buf &srcBuf, std::vector<uint8_t> &epr, std::string &errstr,
+	const EprLz4Settings &settings, row_thread_pool &pool)
+{
+	std::vector<uint8_t> head;
+	std::vector<std::vector<uint8_t>> bands;
+	if (!compress_epr_bands(srcBuf, settings, pool, head, bands, errstr)) return false;
+	epr = std::move(head);
+	for (const std::vector<uint8_t> &block : bands) epr.insert(epr.end(), block.begin(), block.end());
+	return true;
+}
+
+bool save_packedbuf_as_epr_v2(const std::string &filepath, const simple_packed_buf &srcBuf, const EprLz4Settings &settings, std::string &errstr) {
+	std::vector<uint8_t> head;
+	std::vector<std::vector<uint8_t>> bands;
+	if (!compress_epr_bands(srcBuf, settings, writer_row_thread_pool(), head, bands, errstr)) return false;
+	std::vector<file_write_span> spans;
+	spans.reserve(1 + bands.size());
+	spans.push_back({ head.data(), head.size() });
+	for (const std::vector<uint8_t> &block : bands) spans.push_back({ block.data(), block.size() });
+	return write_spans_to_file(filepath, spans.data(), spans.size(), errstr);
+}
+
+static bool parse_epr_v2_header(const uint8_t *data, size_t size, EprV2Info &info, std::string &errstr) {
+	if (get_u32(data + 4) != epr_v2_version || data[16] > EprDtype_f16 || data[17] != epr_filter_byte_shuffle
+		|| (data[18] != epr_codec_lz4 && data[18] != epr_codec_lz4hc)) {
+		errstr += std::string("epr v2: unsupported version ") + std::to_string(get_u32(data + 4)) + std::string(", dtype, filter or codec");
+		return false;
+	}
+	info.width = get_u32(data + 8);
+	info.height = get_u32(data + 12);
+	info.dtype = static_cast<EprDtype>(data[16]);
+	info.band_rows = get_u32(data + 20);
+	info.num_bands = get_u32(data + 24);
+	if (info.width == 0 || info.height == 0 || info.width > epr_max_side || info.height > epr_max_side
+		|| info.band_rows == 0 || info.num_bands != (info.height + info.band_rows - 1) / info.band_rows) {
+		errstr += "epr v2: inconsistent frame size or bands";
+		return false;
+	}
+	const size_t head_bytes = epr_v2_header_bytes + static_cast<size_t>(info.num_bands) * epr_v2_band_entry_bytes;
+	if (size < head_bytes) {
+		errstr += "epr v2: band table is cut off";
+		return false;
+	}
+	// the CRC covers the header with its own field as zeros, and the band table
+	uint8_t header[epr_v2_header_bytes];
+	memcpy(header, data, epr_v2_header_bytes);
+	put_u32(header + 28, 0);
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, header, epr_v2_header_bytes);
+	crc = crc32(crc, data + epr_v2_header_bytes, static_cast<uInt>(head_bytes - epr_v2_header_bytes));
+	if (static_cast<uint32_t>(crc) != get_u32(data + 28)) {
+		errstr += "epr v2: header checksum mismatch";
+		return false;
+	}
+	info.table = data + epr_v2_header_bytes;
+	for (size_t band = 0; band < info.num_bands; ++band) {
+		if (info.band_offset(band) < head_bytes || info.band_offset(band) + info.band_size(band) > size || info.band_size(band) == 0) {
+			errstr += std::string("epr v2: band ") + std::to_string(band) + std::string(" lies outside the file");
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool decode_epr_v2(const uint8_t *epr, size_t size, simple_packed_buf &dstBuf, std::string &errstr, row_thread_pool &pool) {
+	EprV2Info info;
+	if (!parse_epr_v2_header(epr, size, info, errstr)) return false;
+	if (!dstBuf.init_full(info.width, info.height, BUF_PIX_FMT_GRAYF32)) {
+		errstr += "epr v2: failed to allocate the frame";
+		return false;
+	}
+	std::vector<std::string> band_err(info.num_bands);
+	pool.parallel_for_rows(info.num_bands, 1, [&](size_t band_begin, size_t band_end) {
+		thread_local std::vector<uint8_t> shuffled;
+		thread_local std::vector<uint16_t> halves;
+		for (size_t band = band_begin; band < band_end; ++band) {
+			const uint8_t *block = epr + info.band_offset(band);
+			const uint32_t block_size = info.band_size(band);
+			if (crc32_of(block, block_size) != info.band_crc(band)) {
+				band_err[band] = "checksum mismatch";
+				continue;
+			}
+			const size_t count = info.band_num_rows(band) * info.width;
+			shuffled.resize(count * epr_dtype_size(info.dtype));
+			const int len = LZ4_decompress_safe(reinterpret_cast<const char*>(block), reinterpret_cast<char*>(shuffled.data()),
+				static_cast<int>(block_size), static_cast<int>(shuffled.size()));
+			if (len != static_cast<int>(shuffled.size())) {
+				band_err[band] = "damaged LZ4 block";
+				continue;
+			}
+			float *dst = dstBuf.rowptr<float>(info.band_first_row(band));
+			if (info.dtype == EprDtype_f16) {
+				halves.resize(count);
+				byte_unshuffle<2>(shuffled.data(), count, reinterpret_cast<uint8_t*>(halves.data()));
+				const float *const table = half_to_float_table();
+				for (size_t ii = 0; ii < count; ++ii) dst[ii] = table[halves[ii]];
+			} else {
+				byte_unshuffle<4>(shuffled.data(), count, reinterpret_cast<uint8_t*>(dst));
+			}
+		}
+	});
+	for (size_t band = 0; band < info.num_bands; ++band) {
+		if (!band_err[band].empty()) {
+			errstr += std::string("epr v2: band ") + std::to_string(band) + std::string(": ") + band_err[band];
+			return false;
+		}
+	}
+	return true;
+}
+
+bool decode_epr(const uint8_t *epr, size_t size, simple_packed_buf &dstBuf, std::string &errstr, row_thread_pool &pool) {
+	if (size >= epr_v2_header_bytes && memcmp(epr, epr_v2_magic, 4) == 0) return decode_epr_v2(epr, size, dstBuf, errstr, pool);
+	// v1: the size_t width and height of a 64-bit build, then the floats
+	if (size < 16) {
+		errstr += "epr: file too short";
+		return false;
+	}
+	const uint64_t width = get_u64(epr), height = get_u64(epr + 8);
+	if (width == 0 || height == 0 || width > epr_max_side || height > epr_max_side || size != 16 + width * height * sizeof(float)) {
+		errstr += "epr: neither v2 nor a v1 file of a matching size";
+		return false;
+	}
+	if (!dstBuf.init_full(static_cast<size_t>(width), static_cast<size_t>(height), BUF_PIX_FMT_GRAYF32)) {
+		errstr += "epr: failed to allocate the frame";
+		return false;
+	}
+	memcpy(dstBuf.data<uint8_t>(), epr + 16, dstBuf.num_total_bytes());
+	return true;
+}
+
+bool read_epr_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr, row_thread_pool &pool) {
+	std::ifstream ifs(filepath, std::ios::binary | std::ios::ate);
+	if (!ifs) {
+		errstr += std::string("epr: failed to open ") + filepath;
+		return false;
+	}
+	std::vector<uint8_t> epr(static_cast<size_t>(ifs.tellg()));
+	ifs.seekg(0);
+	ifs.read(reinterpret_cast<char*>(epr.data()), epr.size());
+	if (!ifs) {
+		errstr += std::string("epr: failed to read ") + filepath;
+		return false;
+	}
+	return decode_epr(epr.data(), epr.size(), dstBuf, errstr, pool);
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_epr_lz4_tests() {
+	// every half survives the trip through float, and floats round to the nearest half (ties to even)
+	for (uint32_t hh = 0; hh < 0x10000u; ++hh) {
+		const float value = half_bits_to_float(static_cast<uint16_t>(hh));
+		const uint16_t back = float_to_half_bits(value);
+		if (std::isnan(value) ? ((back & 0x7c00u) != 0x7c00u || (back & 0x3ffu) == 0) : (back != hh)) RETURNFAILST(std::string("half ") + std::to_string(hh));
+	}
+	std::mt19937 rng(7);
+	for (int ii = 0; ii < 200000; ++ii) {
+		uint32_t bits = rng();
+		float value;
+		memcpy(&value, &bits, 4);
+		if (!std::isfinite(value) || std::abs(value) >= 65520.0f) continue;
+		const double exact = value;
+		const double got = half_bits_to_float(float_to_half_bits(value));
+		// neighbours of the result must not be closer
+		const uint16_t hb = float_to_half_bits(value);
+		for (int step : { -1, 1 }) {
+			const uint16_t nb = static_cast<uint16_t>(hb + step);
+			if ((nb & 0x7c00u) == 0x7c00u || ((hb & 0x7fffu) == 0 && step < 0)) continue;
+			if (std::abs(static_cast<double>(half_bits_to_float(nb)) - exact) < std::abs(got - exact)) RETURNFAILST(std::string("rounding of ") + std::to_string(value));
+		}
+	}
+	if (half_bits_to_float(float_to_half_bits(1e6f)) != std::numeric_limits<float>::infinity() || float_to_half_bits(65504.0f) != 0x7bffu) RETURNFAILST("half range");
+
+	// the planes are laid out as the header comment says, on and off the SIMD path
+	std::vector<uint8_t> elems(4 * 53), planes(elems.size()), unplanes(elems.size());
+	for (size_t ii = 0; ii < elems.size(); ++ii) elems[ii] = static_cast<uint8_t>(rng());
+	byte_shuffle<4>(elems.data(), 53, planes.data());
+	byte_unshuffle<4>(planes.data(), 53, unplanes.data());
+	for (size_t ii = 0; ii < 4 * 53; ++ii) {
+		if (planes[(ii % 4) * 53 + ii / 4] != elems[ii] || unplanes[ii] != elems[ii]) RETURNFAILST("4-byte shuffle");
+	}
+	byte_shuffle<2>(elems.data(), 106, planes.data());
+	byte_unshuffle<2>(planes.data(), 106, unplanes.data());
+	for (size_t ii = 0; ii < 2 * 106; ++ii) {
+		if (planes[(ii % 2) * 106 + ii / 2] != elems[ii] || unplanes[ii] != elems[ii]) RETURNFAILST("2-byte shuffle");
+	}
+
+	row_thread_pool pool;
+	pool.change_num_threads(3);
+	const size_t sizes[][3] = { { 1, 1, 0 }, { 37, 29, 8 }, { 160, 90, 0 }, { 131, 200, 64 } };
+	for (const auto &size : sizes) {
+		simple_packed_buf depth;
+		if (!depth.init_full(size[0], size[1], BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init");
+		for (size_t ii = 0; ii < depth.height; ++ii) {
+			float *row = depth.rowptr<float>(ii);
+			for (size_t jj = 0; jj < depth.width; ++jj) row[jj] = 0.3f + 0.02f * static_cast<float>(ii * ii) + 0.5f * std::sin(0.07f * static_cast<float>(jj));
+		}
+		if (depth.height > 3 && depth.width > 3) {
+			depth.rowptr<float>(1)[2] = std::numeric_limits<float>::quiet_NaN();
+			depth.rowptr<float>(2)[3] = std::numeric_limits<float>::infinity();
+			depth.rowptr<float>(3)[1] = -0.0f;
+		}
+		const std::string which = std::to_string(size[0]) + "x" + std::to_string(size[1]) + ": ";
+		for (const EprDtype dtype : { EprDtype_f32, EprDtype_f16 }) {
+			EprLz4Settings settings;
+			settings.dtype = dtype;
+			settings.band_rows = size[2];
+			std::vector<uint8_t> epr;
+			std::string errstr;
+			if (!encode_epr_v2(depth, epr, errstr, settings, pool)) RETURNFAILST(which + errstr);
+			simple_packed_buf back;
+			if (!decode_epr(epr.data(), epr.size(), back, errstr, pool)) RETURNFAILST(which + errstr);
+			if (back.width != depth.width || back.height != depth.height) RETURNFAILST(which + "size");
+			if (dtype == EprDtype_f32 && back.bytes != depth.bytes) RETURNFAILST(which + "float32 not bit-exact");
+			if (dtype == EprDtype_f16) {
+				for (size_t ii = 0; ii < depth.width * depth.height; ++ii) {
+					const float orig = depth.cdata<float>()[ii], got = back.cdata<float>()[ii];
+					if (std::isnan(orig) != std::isnan(got) || (!std::isnan(orig) && std::abs(got - orig) > std::abs(orig) / 2048.0f + 1e-7f)) RETURNFAILST(which + std::string("float16 of ") + std::to_string(orig));
+				}
+			}
+		}
+	}
+
+	// v1 files still decode
+	simple_packed_buf depth, back;
+	if (!depth.init_full(48, 40, BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init");
+	for (size_t ii = 0; ii < depth.width * depth.height; ++ii) depth.data<float>()[ii] = static_cast<float>(ii % 97) * 0.25f;
+	std::vector<uint8_t> v1(16 + depth.num_total_bytes());
+	put_u64(v1.data(), depth.width);
+	put_u64(v1.data() + 8, depth.height);
+	memcpy(v1.data() + 16, depth.bytes.data(), depth.num_total_bytes());
+	std::string errstr, expected_err;
+	if (!decode_epr(v1.data(), v1.size(), back, errstr, pool) || back.bytes != depth.bytes) RETURNFAILST(std::string("v1: ") + errstr);
+	v1.pop_back();
+	if (decode_epr(v1.data(), v1.size(), back, expected_err, pool)) RETURNFAILST("accepted a truncated v1 file");
+
+	// damaged v2 files are refused
+	EprLz4Settings settings;
+	settings.band_rows = 16;
+	std::vector<uint8_t> epr;
+	if (!encode_epr_v2(depth, epr, errstr, settings, pool)) RETURNFAILST(errstr);
+	std::vector<uint8_t> bad = epr;
+	bad[12] ^= 1; // height
+	if (decode_epr(bad.data(), bad.size(), back, expected_err, pool)) RETURNFAILST("accepted a damaged header");
+	bad = epr;
+	bad.back() ^= 0x10;
+	if (decode_epr(bad.data(), bad.size(), back, expected_err, pool)) RETURNFAILST("accepted a damaged band");
+	bad.assign(epr.begin(), epr.end() - 1);
+	if (decode_epr(bad.data(), bad.size(), back, expected_err, pool)) RETURNFAILST("accepted a truncated file");
+
+	// through a file
+	std::error_code ec;
+	const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "gcv_epr_lz4_tests";
+	std::filesystem::create_directories(dir, ec);
+	const std::string path = (dir / "test.epr").string();
+	if (!save_packedbuf_as_epr_v2(path, depth, settings, errstr)) RETURNFAILST(errstr);
+	if (!read_epr_file(path, back, errstr, pool) || back.bytes != depth.bytes) RETURNFAILST(std::string("file: ") + errstr);
+	std::filesystem::remove_all(dir, ec);
+	return "ok";
+}
+
+std::string benchmark_epr_lz4(const simple_packed_buf &depth, int repeats) {
+	typedef std::chrono::steady_clock benchclock;
+	const auto ms_since = [](benchclock::time_point start) {
+		return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+	};
+	if (depth.pixfmt != BUF_PIX_FMT_GRAYF32) return "epr benchmark: needs a float depth frame";
+	repeats = std::max(repeats, 1);
+	const double raw_mb = depth.num_total_bytes() / 1e6;
+	std::string result = std::string("depth of ") + std::to_string(depth.width) + " x " + std::to_string(depth.height) + std::string(", mean of ")
+		+ std::to_string(repeats) + std::string(", ") + std::to_string(writer_row_thread_pool().num_threads()) + std::string(" writer row threads, in memory:");
+	std::string errstr;
+	simple_packed_buf back;
+	const auto report = [&](const char *name, size_t bytes, double enc_ms, double dec_ms, bool lossless_ok) {
+		char line[256];
+		snprintf(line, sizeof(line), "\n  %-22s %7.2f MB (%5.2fx), encode %7.1f ms (%5.0f MB/s), decode %7.1f ms (%5.0f MB/s)%s",
+			name, bytes / 1e6, raw_mb * 1e6 / std::max<size_t>(bytes, 1), enc_ms / repeats, raw_mb * 1e3 * repeats / std::max(enc_ms, 1e-9),
+			dec_ms / repeats, raw_mb * 1e3 * repeats / std::max(dec_ms, 1e-9), lossless_ok ? "" : " MISMATCH");
+		result += line;
+	};
+
+	// EPR v1 and npy are the pixels behind a header: copies both ways
+	std::vector<uint8_t> raw;
+	double enc_ms = 0.0, dec_ms = 0.0;
+	for (int rep = 0; rep < repeats; ++rep) {
+		benchclock::time_point start = benchclock::now();
+		raw.resize(16 + depth.num_total_bytes());
+		put_u64(raw.data(), depth.width);
+		put_u64(raw.data() + 8, depth.height);
+		memcpy(raw.data() + 16, depth.bytes.data(), depth.num_total_bytes());
+		enc_ms += ms_since(start);
+		start = benchclock::now();
+		decode_epr(raw.data(), raw.size(), back, errstr);
+		dec_ms += ms_since(start);
+	}
+	report("EPR v1 / npy (raw)", raw.size(), enc_ms, dec_ms, back.bytes == depth.bytes);
+
+	const size_t fpzip_bands[2] = { depth.height, 0 };
+	for (const size_t band_rows : fpzip_bands) {
+		std::vector<uint8_t> fpzt;
+		enc_ms = dec_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			encode_fpzip_tiled(depth, fpzt, errstr, band_rows);
+			enc_ms += ms_since(start);
+			start = benchclock::now();
+			decode_fpzip_tiled(fpzt.data(), fpzt.size(), back, errstr);
+			dec_ms += ms_since(start);
+		}
+		report((band_rows != 0) ? "fpzip, one stream" : "fpzip, 64-row bands", fpzt.size(), enc_ms, dec_ms, back.bytes == depth.bytes);
+	}
+
+	struct { const char *name; EprDtype dtype; int acceleration; } variants[] = {
+		{ "EPR v2 f32 LZ4", EprDtype_f32, 1 },
+		{ "EPR v2 f32 LZ4 accel 8", EprDtype_f32, 8 },
+		{ "EPR v2 f16 LZ4 (lossy)", EprDtype_f16, 1 },
+	};
+	for (const auto &variant : variants) {
+		EprLz4Settings settings;
+		settings.dtype = variant.dtype;
+		settings.acceleration = variant.acceleration;
+		std::vector<uint8_t> epr;
+		enc_ms = dec_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			encode_epr_v2(depth, epr, errstr, settings);
+			enc_ms += ms_since(start);
+			start = benchclock::now();
+			decode_epr(epr.data(), epr.size(), back, errstr);
+			dec_ms += ms_since(start);
+		}
+		report(variant.name, epr.size(), enc_ms, dec_ms, variant.dtype == EprDtype_f16 || back.bytes == depth.bytes);
+	}
+	// the floor for decoding: one copy of the frame
+	std::vector<uint8_t> copy(depth.num_total_bytes());
+	benchclock::time_point start = benchclock::now();
+	for (int rep = 0; rep < repeats; ++rep) memcpy(copy.data(), depth.bytes.data(), copy.size());
+	char line[96];
+	snprintf(line, sizeof(line), "\n  memcpy of the frame: %.1f ms (%.0f MB/s)", ms_since(start) / repeats, raw_mb * 1e3 * repeats / std::max(ms_since(start), 1e-9));
+	result += line;
+	if (!errstr.empty()) result += std::string("\n  (") + errstr + ")";
+	return result;
+}
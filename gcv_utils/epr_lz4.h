@@ -0,0 +1,50 @@
+#pragma once
+// EPR v2: raw depth (ImageWriter_epr_lz4, .epr) compressed fast enough for recording and decompressed at close to
+// memcpy speed for dataset loaders. Bands of rows are byte-shuffled (all first bytes of the floats, then all second
+// bytes, ...) so the slowly changing sign/exponent bytes sit together, then compressed with LZ4 on the writer row pool.
+// Layout, all little-endian:
+//   64-byte header: "EPR2", version 2, width, height, dtype (0 float32, 1 float16), filter (1 byte shuffle),
+//     codec (0 LZ4; 1 LZ4 HC, the same block format), band_rows, num_bands, CRC-32 of header and band table, zeros
+//   per band: uint64 offset from the start of the file, uint32 compressed size, uint32 CRC-32 of the compressed bytes
+//   the LZ4 blocks, top to bottom
+// EPR v1 (save_packedbuf_to_epr) is a size_t width and height, then the float32 pixels; decode_epr reads both.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "gcv_utils/simple_packed_buf.h"
+#include "gcv_utils/parallel_rows.h"
+
+static constexpr uint32_t epr_v2_version = 2;
+static constexpr size_t epr_v2_header_bytes = 64;
+static constexpr size_t epr_v2_band_entry_bytes = 16;
+
+enum EprDtype {
+	EprDtype_f32 = 0,
+	EprDtype_f16 = 1, // lossy: 11 significant bits, up to 65504 (depth beyond is infinite)
+};
+
+struct EprLz4Settings {
+	EprDtype dtype = EprDtype_f32;
+	int acceleration = 1;  // LZ4 acceleration: 1 compresses best, higher values trade size for speed
+	size_t band_rows = 0;  // 0 picks 64 rows
+};
+
+bool encode_epr_v2(const simple_packed_buf &srcBuf, std::vector<uint8_t> &epr, std::string &errstr,
+	const EprLz4Settings &settings = EprLz4Settings(), row_thread_pool &pool = writer_row_thread_pool());
+
+bool save_packedbuf_as_epr_v2(const std::string &filepath, const simple_packed_buf &srcBuf, const EprLz4Settings &settings, std::string &errstr);
+
+// EPR v1 or v2 into dstBuf (GRAYF32); v2 bands are checked against their CRC-32 and decompressed on the pool
+bool decode_epr(const uint8_t *epr, size_t size, simple_packed_buf &dstBuf, std::string &errstr,
+	row_thread_pool &pool = writer_row_thread_pool());
+
+bool read_epr_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr,
+	row_thread_pool &pool = writer_row_thread_pool());
+
+// return error string if test failed; "ok" means float32 frames came back bit-exact and float16 within half a step,
+// v1 files still decoded, and damaged files were refused
+std::string run_epr_lz4_tests();
+
+// sizes and MB/s both ways of EPR v1 / npy (raw), fpzip as one stream and in bands, and EPR v2, on the writer row pool
+std::string benchmark_epr_lz4(const simple_packed_buf &depth, int repeats = 3);
@@ -0,0 +1,442 @@
+#include "gcv_utils/fpzip_tiled.h"
+#include "gcv_utils/npy_writer.h"
+#include <fpzip/fpzip.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+static const char fpzip_tiled_magic[4] = { 'F', 'P', 'Z', 'T' };
+static constexpr size_t fpzip_tiled_default_band_rows = 64;
+static constexpr uint32_t fpzip_tiled_max_side = 1 << 16;
+
+size_t FpzipTiledInfo::band_num_rows(size_t band) const {
+	return std::min<size_t>(band_rows, height - band_first_row(band));
+}
+
+static void put_u32(uint8_t *dst, uint32_t val) {
+	for (int bb = 0; bb < 4; ++bb) dst[bb] = static_cast<uint8_t>(val >> (8 * bb));
+}
+static void put_u64(uint8_t *dst, uint64_t val) {
+	for (int bb = 0; bb < 8; ++bb) dst[bb] = static_cast<uint8_t>(val >> (8 * bb));
+}
+static uint32_t get_u32(const uint8_t *src) {
+	uint32_t val = 0;
+	for (int bb = 0; bb < 4; ++bb) val |= static_cast<uint32_t>(src[bb]) << (8 * bb);
+	return val;
+}
+static uint64_t get_u64(const uint8_t *src) {
+	uint64_t val = 0;
+	for (int bb = 0; bb < 8; ++bb) val |= static_cast<uint64_t>(src[bb]) << (8 * bb);
+	return val;
+}
+
+// room for a stream of num_floats; fpzip grows noise-like floats by a little at most
+static size_t fpzip_stream_bound(size_t num_floats) {
+	return num_floats * sizeof(float) + num_floats / 4 + 1024;
+}
+
+// one fpzip stream of a nx x ny float array into dst; returns its length, or 0 if it failed
+static size_t fpzip_compress_to(const float *src, size_t nx, size_t ny, uint8_t *dst, size_t capacity) {
+	FPZ *fpz = fpzip_write_to_buffer(dst, capacity);
+	fpz->type = FPZIP_TYPE_FLOAT;
+	fpz->prec = 0;
+	fpz->nx = static_cast<int>(nx);
+	fpz->ny = static_cast<int>(ny);
+	fpz->nz = 1;
+	fpz->nf = 1;
+	const size_t written = fpzip_write_header(fpz) ? fpzip_write(fpz, src) : 0;
+	fpzip_write_close(fpz);
+	return written;
+}
+
+// Decompresses a stream that must hold a nx x ny float array. fpzip reads its buffer without a bound, so the stream
+// is copied with some zeros after it: a stream that ends early then fails the length check instead of reading on.
+static bool fpzip_decompress_from(const uint8_t *src, size_t size, size_t nx, size_t ny, float *dst, std::string &errstr) {
+	thread_local std::vector<uint8_t> padded;
+	padded.assign(size + 64, 0);
+	memcpy(padded.data(), src, size);
+	FPZ *fpz = fpzip_read_from_buffer(padded.data());
+	bool ok = fpzip_read_header(fpz) != 0;
+	if (!ok) {
+		errstr += std::string("fpzip: bad stream header: ") + std::string(fpzip_errstr[fpzip_errno]);
+	} else if (fpz->type != FPZIP_TYPE_FLOAT || fpz->nx != static_cast<int>(nx) || fpz->ny != static_cast<int>(ny) || fpz->nz != 1 || fpz->nf != 1) {
+		errstr += std::string("fpzip: stream of ") + std::to_string(fpz->nx) + "x" + std::to_string(fpz->ny) + std::string(" where ")
+			+ std::to_string(nx) + "x" + std::to_string(ny) + std::string(" floats were expected");
+		ok = false;
+	} else {
+		const size_t consumed = fpzip_read(fpz, dst);
+		if (consumed == 0 || consumed > size) {
+			errstr += std::string("fpzip: damaged stream");
+			ok = false;
+		}
+	}
+	fpzip_read_close(fpz);
+	return ok;
+}
+
+// the header and offset table, and each band's stream
+static bool compress_fpzip_bands(const simple_packed_buf &srcBuf, size_t band_rows, row_thread_pool &pool,
+	std::vector<uint8_t> &head, std::vector<std::vector<uint8_t>> &bands, std::string &errstr)
+{
+	if (srcBuf.pixfmt != BUF_PIX_FMT_GRAYF32) {
+		errstr += std::string("fpzip tiled: only writes float depth; refusing buf format ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	if (srcBuf.width == 0 || srcBuf.height == 0 || srcBuf.width > fpzip_tiled_max_side || srcBuf.height > fpzip_tiled_max_side) {
+		errstr += std::string("fpzip tiled: cannot write a frame of ") + std::to_string(srcBuf.width) + "x" + std::to_string(srcBuf.height);
+		return false;
+	}
+	if (band_rows == 0) band_rows = fpzip_tiled_default_band_rows;
+	band_rows = std::min(band_rows, srcBuf.height);
+	const size_t num_bands = (srcBuf.height + band_rows - 1) / band_rows;
+	bands.resize(num_bands);
+	std::vector<char> band_ok(num_bands, 0);
+	pool.parallel_for_rows(num_bands, 1, [&](size_t band_begin, size_t band_end) {
+		for (size_t band = band_begin; band < band_end; ++band) {
+			const size_t first_row = band * band_rows;
+			const size_t num_rows = std::min(band_rows, srcBuf.height - first_row);
+			std::vector<uint8_t> &stream = bands[band];
+			stream.resize(fpzip_stream_bound(srcBuf.width * num_rows));
+			const size_t len = fpzip_compress_to(srcBuf.crowptr<float>(first_row), srcBuf.width, num_rows, stream.data(), stream.size());
+			stream.resize(len);
+			band_ok[band] = (len > 0);
+		}
+	});
+	for (size_t band = 0; band < num_bands; ++band) {
+		if (!band_ok[band]) {
+			errstr += std::string("fpzip tiled: compression failed in band ") + std::to_string(band) + std::string(": ") + std::string(fpzip_errstr[fpzip_errno]);
+			return false;
+		}
+	}
+	head.assign(fpzip_tiled_header_bytes + (num_bands + 1) * sizeof(uint64_t), 0);
+	memcpy(head.data(), fpzip_tiled_magic, 4);
+	put_u32(head.data() + 4, fpzip_tiled_version);
+	put_u32(head.data() + 8, static_cast<uint32_t>(srcBuf.width));
+	put_u32(head.data() + 12, static_cast<uint32_t>(srcBuf.height));
+	put_u32(head.data() + 16, static_cast<uint32_t>(band_rows));
+	put_u32(head.data() + 20, static_cast<uint32_t>(num_bands));
+	put_u32(head.data() + 24, 1);
+	uint64_t offset = head.size();
+	for (size_t band = 0; band <= num_bands; ++band) {
+		put_u64(head.data() + fpzip_tiled_header_bytes + band * sizeof(uint64_t), offset);
+		if (band < num_bands) offset += bands[band].size();
+	}
+	return true;
+}
+
+bool encode_fpzip_tiled(const simple_packed_buf &srcBuf, std::vector<uint8_t> &fpzt, std::string &errstr,
+	size_t band_rows, row_thread_pool &pool)
+{
+	std::vector<uint8_t> head;
+	std::vector<std::vector<uint8_t>> bands;
+	if (!compress_fpzip_bands(srcBuf, band_rows, pool, head, bands, errstr)) return false;
+	fpzt = std::move(head);
+	for (const std::vector<uint8_t> &stream : bands) fpzt.insert(fpzt.end(), stream.begin(), stream.end());
+	return true;
+}
+
+bool save_packedbuf_as_fpzip_tiled(const std::string &filepath, const simple_packed_buf &srcBuf, std::string &errstr) {
+	std::vector<uint8_t> head;
+	std::vector<std::vector<uint8_t>> bands;
+	if (!compress_fpzip_bands(srcBuf, 0, writer_row_thread_pool(), head, bands, errstr)) return false;
+	std::vector<file_write_span> spans;
+	spans.reserve(1 + bands.size());
+	spans.push_back({ head.data(), head.size() });
+	for (const std::vector<uint8_t> &stream : bands) spans.push_back({ stream.data(), stream.size() });
+	return write_spans_to_file(filepath, spans.data(), spans.size(), errstr);
+}
+
+// the 32 bytes before the offset table
+static bool parse_fpzip_tiled_fixed_header(const uint8_t *data, size_t size, FpzipTiledInfo &info, std::string &errstr) {
+	info = FpzipTiledInfo();
+	if (size < fpzip_tiled_header_bytes || memcmp(data, fpzip_tiled_magic, 4) != 0) {
+		errstr += "fpzip tiled: not an .fpzt file";
+		return false;
+	}
+	if (get_u32(data + 4) != fpzip_tiled_version || get_u32(data + 24) != 1) {
+		errstr += std::string("fpzip tiled: unsupported version ") + std::to_string(get_u32(data + 4)) + std::string(" or channels");
+		return false;
+	}
+	info.width = get_u32(data + 8);
+	info.height = get_u32(data + 12);
+	info.band_rows = get_u32(data + 16);
+	info.num_bands = get_u32(data + 20);
+	if (info.width == 0 || info.height == 0 || info.width > fpzip_tiled_max_side || info.height > fpzip_tiled_max_side
+		|| info.band_rows == 0 || info.num_bands != (info.height + info.band_rows - 1) / info.band_rows) {
+		errstr += "fpzip tiled: inconsistent frame size or bands";
+		return false;
+	}
+	return true;
+}
+
+bool parse_fpzip_tiled_header(const uint8_t *data, size_t size, uint64_t file_size, FpzipTiledInfo &info, std::string &errstr) {
+	if (!parse_fpzip_tiled_fixed_header(data, size, info, errstr)) return false;
+	const size_t head_bytes = fpzip_tiled_header_bytes + (static_cast<size_t>(info.num_bands) + 1) * sizeof(uint64_t);
+	if (size < head_bytes) {
+		errstr += "fpzip tiled: offset table is cut off";
+		return false;
+	}
+	info.offsets.resize(info.num_bands + 1);
+	for (size_t band = 0; band <= info.num_bands; ++band) {
+		info.offsets[band] = get_u64(data + fpzip_tiled_header_bytes + band * sizeof(uint64_t));
+		if ((band == 0 && info.offsets[0] != head_bytes) || (band > 0 && info.offsets[band] <= info.offsets[band - 1])) {
+			errstr += std::string("fpzip tiled: bad offset of band ") + std::to_string(band);
+			return false;
+		}
+	}
+	if (file_size != 0 && info.offsets.back() != file_size) {
+		errstr += std::string("fpzip tiled: bands end at ") + std::to_string(info.offsets.back()) + std::string(" in a file of ") + std::to_string(file_size) + " bytes";
+		return false;
+	}
+	return true;
+}
+
+// clamps the region to the frame and allocates dstBuf for it; row_end/col_end 0 mean to the end
+static bool fpzip_tiled_region(const FpzipTiledInfo &info, size_t &row_begin, size_t &row_end, size_t &col_begin, size_t &col_end,
+	simple_packed_buf &dstBuf, std::string &errstr)
+{
+	if (row_end == 0 || row_end > info.height) row_end = info.height;
+	if (col_end == 0 || col_end > info.width) col_end = info.width;
+	if (row_begin >= row_end || col_begin >= col_end) {
+		errstr += "fpzip tiled: empty region";
+		return false;
+	}
+	return dstBuf.init_full(col_end - col_begin, row_end - row_begin, BUF_PIX_FMT_GRAYF32);
+}
+
+// decodes the bands the region touches; the stream of a band starts at bands + info.offsets[band] - bands_offset
+static bool decode_fpzip_bands(const FpzipTiledInfo &info, const uint8_t *bands, uint64_t bands_offset,
+	size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, simple_packed_buf &dstBuf, row_thread_pool &pool, std::string &errstr)
+{
+	const size_t first_band = row_begin / info.band_rows, end_band = (row_end - 1) / info.band_rows + 1;
+	std::vector<std::string> band_err(end_band - first_band);
+	pool.parallel_for_rows(end_band - first_band, 1, [&](size_t idx_begin, size_t idx_end) {
+		thread_local std::vector<float> scratch;
+		for (size_t idx = idx_begin; idx < idx_end; ++idx) {
+			const size_t band = first_band + idx;
+			const size_t band_row0 = info.band_first_row(band), num_rows = info.band_num_rows(band);
+			const uint8_t *stream = bands + (info.offsets[band] - bands_offset);
+			const size_t stream_len = static_cast<size_t>(info.offsets[band + 1] - info.offsets[band]);
+			const size_t copy_begin = std::max(row_begin, band_row0), copy_end = std::min(row_end, band_row0 + num_rows);
+			// whole bands of full rows go straight into the destination
+			if (col_begin == 0 && col_end == info.width && copy_begin == band_row0 && copy_end == band_row0 + num_rows) {
+				fpzip_decompress_from(stream, stream_len, info.width, num_rows, dstBuf.rowptr<float>(band_row0 - row_begin), band_err[idx]);
+				continue;
+			}
+			scratch.resize(static_cast<size_t>(info.width) * num_rows);
+			if (!fpzip_decompress_from(stream, stream_len, info.width, num_rows, scratch.data(), band_err[idx])) continue;
+			for (size_t row = copy_begin; row < copy_end; ++row) {
+				memcpy(dstBuf.rowptr<float>(row - row_begin), scratch.data() + (row - band_row0) * info.width + col_begin, (col_end - col_begin) * sizeof(float));
+			}
+		}
+	});
+	for (size_t idx = 0; idx < band_err.size(); ++idx) {
+		if (!band_err[idx].empty()) {
+			errstr += std::string("band ") + std::to_string(first_band + idx) + std::string(": ") + band_err[idx];
+			return false;
+		}
+	}
+	return true;
+}
+
+bool decode_fpzip_tiled(const uint8_t *fpzt, size_t size, simple_packed_buf &dstBuf, std::string &errstr,
+	size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, row_thread_pool &pool)
+{
+	FpzipTiledInfo info;
+	if (!parse_fpzip_tiled_header(fpzt, size, size, info, errstr)) return false;
+	if (!fpzip_tiled_region(info, row_begin, row_end, col_begin, col_end, dstBuf, errstr)) return false;
+	return decode_fpzip_bands(info, fpzt, 0, row_begin, row_end, col_begin, col_end, dstBuf, pool, errstr);
+}
+
+bool read_fpzip_tiled_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr,
+	size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, row_thread_pool &pool)
+{
+	std::ifstream ifs(filepath, std::ios::binary | std::ios::ate);
+	if (!ifs) {
+		errstr += std::string("fpzip tiled: failed to open ") + filepath;
+		return false;
+	}
+	const uint64_t file_size = static_cast<uint64_t>(ifs.tellg());
+	std::vector<uint8_t> head(fpzip_tiled_header_bytes);
+	ifs.seekg(0);
+	ifs.read(reinterpret_cast<char*>(head.data()), head.size());
+	FpzipTiledInfo info;
+	if (!ifs || !parse_fpzip_tiled_fixed_header(head.data(), head.size(), info, errstr)) {
+		if (!ifs) errstr += std::string("fpzip tiled: ") + filepath + std::string(" is too short");
+		return false;
+	}
+	// the header again with the offset table
+	head.resize(fpzip_tiled_header_bytes + (static_cast<size_t>(info.num_bands) + 1) * sizeof(uint64_t));
+	ifs.read(reinterpret_cast<char*>(head.data()) + fpzip_tiled_header_bytes, head.size() - fpzip_tiled_header_bytes);
+	if (!ifs || !parse_fpzip_tiled_header(head.data(), head.size(), file_size, info, errstr)) {
+		if (!ifs) errstr += std::string("fpzip tiled: offset table of ") + filepath + std::string(" is cut off");
+		return false;
+	}
+	if (!fpzip_tiled_region(info, row_begin, row_end, col_begin, col_end, dstBuf, errstr)) return false;
+	// only the bands of the rows asked for
+	const size_t first_band = row_begin / info.band_rows, end_band = (row_end - 1) / info.band_rows + 1;
+	std::vector<uint8_t> bands(static_cast<size_t>(info.offsets[end_band] - info.offsets[first_band]));
+	ifs.seekg(static_cast<std::streamoff>(info.offsets[first_band]));
+	ifs.read(reinterpret_cast<char*>(bands.data()), bands.size());
+	if (!ifs) {
+		errstr += std::string("fpzip tiled: failed to read bands of ") + filepath;
+		return false;
+	}
+	return decode_fpzip_bands(info, bands.data(), info.offsets[first_band], row_begin, row_end, col_begin, col_end, dstBuf, pool, errstr);
+}
+
+bool read_fpzip_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr) {
+	FILE *file = fopen(filepath.c_str(), "rb");
+	if (!file) {
+		errstr += std::string("fpzip: failed to open ") + filepath;
+		return false;
+	}
+	FPZ *fpz = fpzip_read_from_file(file);
+	bool ok = fpzip_read_header(fpz) != 0;
+	if (!ok) {
+		errstr += std::string("fpzip: bad header in ") + filepath + std::string(": ") + std::string(fpzip_errstr[fpzip_errno]);
+	} else if (fpz->type != FPZIP_TYPE_FLOAT || fpz->nz != 1 || fpz->nf != 1 || fpz->nx <= 0 || fpz->ny <= 0
+		|| fpz->nx > static_cast<int>(fpzip_tiled_max_side) || fpz->ny > static_cast<int>(fpzip_tiled_max_side)) {
+		errstr += filepath + std::string(" is not a 2D float fpzip stream");
+		ok = false;
+	} else if (!dstBuf.init_full(fpz->nx, fpz->ny, BUF_PIX_FMT_GRAYF32) || fpzip_read(fpz, dstBuf.data<float>()) == 0) {
+		errstr += std::string("fpzip: failed to decompress ") + filepath + std::string(": ") + std::string(fpzip_errstr[fpzip_errno]);
+		ok = false;
+	}
+	fpzip_read_close(fpz);
+	fclose(file);
+	return ok;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+static bool same_floats(const simple_packed_buf &a, const simple_packed_buf &b, size_t row0, size_t col0) {
+	for (size_t ii = 0; ii < b.height; ++ii) {
+		if (memcmp(a.crowptr<float>(row0 + ii) + col0, b.crowptr<float>(ii), b.width * sizeof(float)) != 0) return false;
+	}
+	return true;
+}
+
+std::string run_fpzip_tiled_tests() {
+	row_thread_pool pool;
+	pool.change_num_threads(3);
+	const size_t sizes[][3] = { { 1, 1, 0 }, { 37, 29, 8 }, { 64, 64, 64 }, { 130, 75, 16 }, { 200, 161, 0 } };
+	for (const auto &size : sizes) {
+		simple_packed_buf depth;
+		if (!depth.init_full(size[0], size[1], BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init");
+		for (size_t ii = 0; ii < depth.height; ++ii) {
+			float *row = depth.rowptr<float>(ii);
+			for (size_t jj = 0; jj < depth.width; ++jj) row[jj] = 0.5f + 0.01f * static_cast<float>(ii * ii) + std::sin(0.1f * static_cast<float>(jj));
+		}
+		if (depth.height > 3 && depth.width > 3) {
+			depth.rowptr<float>(1)[2] = std::numeric_limits<float>::quiet_NaN();
+			depth.rowptr<float>(2)[3] = std::numeric_limits<float>::infinity();
+			depth.rowptr<float>(3)[1] = -0.0f;
+		}
+		const std::string which = std::to_string(size[0]) + "x" + std::to_string(size[1]) + "/" + std::to_string(size[2]) + ": ";
+		std::vector<uint8_t> fpzt;
+		std::string errstr;
+		if (!encode_fpzip_tiled(depth, fpzt, errstr, size[2], pool)) RETURNFAILST(which + errstr);
+		simple_packed_buf back;
+		if (!decode_fpzip_tiled(fpzt.data(), fpzt.size(), back, errstr, 0, 0, 0, 0, pool)) RETURNFAILST(which + errstr);
+		if (back.width != depth.width || back.height != depth.height || back.bytes != depth.bytes) RETURNFAILST(which + "whole frame");
+		// a region across band edges, and a single row
+		const size_t r0 = depth.height / 3, r1 = std::max(r0 + 1, depth.height - depth.height / 4), c0 = depth.width / 5, c1 = std::max(c0 + 1, depth.width / 2);
+		if (!decode_fpzip_tiled(fpzt.data(), fpzt.size(), back, errstr, r0, r1, c0, c1, pool)) RETURNFAILST(which + errstr);
+		if (back.width != c1 - c0 || back.height != r1 - r0 || !same_floats(depth, back, r0, c0)) RETURNFAILST(which + "region");
+		if (!decode_fpzip_tiled(fpzt.data(), fpzt.size(), back, errstr, depth.height - 1, depth.height, 0, 0, pool)) RETURNFAILST(which + errstr);
+		if (back.height != 1 || !same_floats(depth, back, depth.height - 1, 0)) RETURNFAILST(which + "last row");
+	}
+
+	// damaged files are refused before or while decoding
+	simple_packed_buf depth, back;
+	if (!depth.init_full(48, 40, BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init");
+	for (size_t ii = 0; ii < depth.width * depth.height; ++ii) depth.data<float>()[ii] = static_cast<float>(ii % 97) * 0.25f;
+	std::vector<uint8_t> fpzt;
+	std::string errstr, expected_err;
+	if (!encode_fpzip_tiled(depth, fpzt, errstr, 16, pool)) RETURNFAILST(errstr);
+	std::vector<uint8_t> bad(fpzt.begin(), fpzt.end() - 1);
+	if (decode_fpzip_tiled(bad.data(), bad.size(), back, expected_err)) RETURNFAILST("accepted a truncated file");
+	bad = fpzt;
+	bad[0] = 'X';
+	if (decode_fpzip_tiled(bad.data(), bad.size(), back, expected_err)) RETURNFAILST("accepted a bad magic");
+	bad = fpzt;
+	put_u64(bad.data() + fpzip_tiled_header_bytes + 8, get_u64(bad.data() + fpzip_tiled_header_bytes + 16) + 1);
+	if (decode_fpzip_tiled(bad.data(), bad.size(), back, expected_err)) RETURNFAILST("accepted offsets out of order");
+	bad = fpzt;
+	bad[get_u64(bad.data() + fpzip_tiled_header_bytes + 8)] ^= 0xff; // the fpzip magic of band 1
+	if (decode_fpzip_tiled(bad.data(), bad.size(), back, expected_err, 0, 0, 0, 0, pool)) RETURNFAILST("accepted a damaged band");
+	// the damaged band is not read for rows before it
+	if (!decode_fpzip_tiled(bad.data(), bad.size(), back, errstr, 0, 16, 0, 0, pool) || !same_floats(depth, back, 0, 0)) RETURNFAILST("rows before a damaged band");
+	// through a file, reading only some bands
+	std::error_code ec;
+	const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "gcv_fpzip_tiled_tests";
+	std::filesystem::create_directories(dir, ec);
+	const std::string path = (dir / "test.fpzt").string();
+	if (!save_packedbuf_as_fpzip_tiled(path, depth, errstr)) RETURNFAILST(errstr);
+	if (!read_fpzip_tiled_file(path, back, errstr, 0, 0, 0, 0, pool) || back.bytes != depth.bytes) RETURNFAILST(std::string("file: ") + errstr);
+	if (!read_fpzip_tiled_file(path, back, errstr, 17, 33, 5, 40, pool) || back.width != 35 || back.height != 16 || !same_floats(depth, back, 17, 5)) RETURNFAILST(std::string("file region: ") + errstr);
+	if (read_fpzip_tiled_file((dir / "missing.fpzt").string(), back, expected_err)) RETURNFAILST("read a missing file");
+	std::filesystem::remove_all(dir, ec);
+	simple_packed_buf rgba;
+	if (!rgba.init_full(4, 4, BUF_PIX_FMT_RGBA)) RETURNFAILST("init rgba");
+	if (encode_fpzip_tiled(rgba, fpzt, expected_err, 0, pool)) RETURNFAILST("compressed 8-bit color");
+	return "ok";
+}
+
+std::string benchmark_fpzip_tiled(const simple_packed_buf &depth, int repeats) {
+	typedef std::chrono::steady_clock benchclock;
+	const auto ms_since = [](benchclock::time_point start) {
+		return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+	};
+	if (depth.pixfmt != BUF_PIX_FMT_GRAYF32) return "fpzip benchmark: needs a float depth frame";
+	repeats = std::max(repeats, 1);
+	const double raw_mb = depth.num_total_bytes() / 1e6;
+	std::string result = std::string("fpzip of ") + std::to_string(depth.width) + " x " + std::to_string(depth.height) + std::string(" float, mean of ")
+		+ std::to_string(repeats) + std::string(", ") + std::to_string(writer_row_thread_pool().num_threads()) + std::string(" writer row threads:");
+	char line[256];
+
+	std::vector<uint8_t> single(fpzip_stream_bound(depth.width * depth.height));
+	simple_packed_buf back;
+	back.init_full(depth.width, depth.height, BUF_PIX_FMT_GRAYF32);
+	size_t single_len = 0;
+	double enc_ms = 0.0, dec_ms = 0.0;
+	std::string errstr;
+	for (int rep = 0; rep < repeats; ++rep) {
+		benchclock::time_point start = benchclock::now();
+		single_len = fpzip_compress_to(depth.cdata<float>(), depth.width, depth.height, single.data(), single.size());
+		enc_ms += ms_since(start);
+		start = benchclock::now();
+		fpzip_decompress_from(single.data(), single_len, depth.width, depth.height, back.data<float>(), errstr);
+		dec_ms += ms_since(start);
+	}
+	snprintf(line, sizeof(line), "\n  single stream: %.2f MB (%.2fx), compress %.1f ms (%.0f MB/s), decompress %.1f ms (%.0f MB/s)%s",
+		single_len / 1e6, raw_mb * 1e6 / std::max<size_t>(single_len, 1), enc_ms / repeats, raw_mb * 1e3 * repeats / enc_ms,
+		dec_ms / repeats, raw_mb * 1e3 * repeats / dec_ms, (back.bytes == depth.bytes) ? "" : " MISMATCH");
+	result += line;
+
+	const size_t band_rows[] = { 16, 32, 64, 128, 256 };
+	for (const size_t rows : band_rows) {
+		std::vector<uint8_t> fpzt;
+		enc_ms = dec_ms = 0.0;
+		for (int rep = 0; rep < repeats; ++rep) {
+			benchclock::time_point start = benchclock::now();
+			encode_fpzip_tiled(depth, fpzt, errstr, rows);
+			enc_ms += ms_since(start);
+			start = benchclock::now();
+			decode_fpzip_tiled(fpzt.data(), fpzt.size(), back, errstr);
+			dec_ms += ms_since(start);
+		}
+		snprintf(line, sizeof(line), "\n  bands of %3zu rows: %.2f MB (%.2fx), compress %.1f ms (%.0f MB/s), decompress %.1f ms (%.0f MB/s)%s",
+			rows, fpzt.size() / 1e6, raw_mb * 1e6 / std::max<size_t>(fpzt.size(), 1), enc_ms / repeats, raw_mb * 1e3 * repeats / enc_ms,
+			dec_ms / repeats, raw_mb * 1e3 * repeats / dec_ms, (back.bytes == depth.bytes) ? "" : " MISMATCH");
+		result += line;
+	}
+	if (!errstr.empty()) result += std::string("\n  (") + errstr + ")";
+	return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+// Lossless float depth in bands of rows (ImageWriter_fpzip_tiled, .fpzt): every band is its own fpzip stream, so bands
+// are compressed on the writer row pool at once, and readers can decompress them in parallel or fetch only the rows they need.
+// Layout, all little-endian:
+//   32-byte header: "FPZT", version, width, height, band_rows, num_bands, channels (1), reserved (0)
+//   num_bands + 1 uint64 byte offsets of the bands from the start of the file; the last is the file size
+//   the bands, top to bottom, each a complete fpzip stream (with its own fpzip header) of band_rows rows (fewer at the end)
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "gcv_utils/simple_packed_buf.h"
+#include "gcv_utils/parallel_rows.h"
+
+static constexpr uint32_t fpzip_tiled_version = 1;
+static constexpr size_t fpzip_tiled_header_bytes = 32;
+
+struct FpzipTiledInfo {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t band_rows = 0;
+	uint32_t num_bands = 0;
+	std::vector<uint64_t> offsets; // num_bands + 1
+
+	size_t band_first_row(size_t band) const { return band * band_rows; }
+	size_t band_num_rows(size_t band) const;
+};
+
+// band_rows 0 picks 64 rows; the first row of each band is predicted without the row above it, so smaller bands cost size
+bool encode_fpzip_tiled(const simple_packed_buf &srcBuf, std::vector<uint8_t> &fpzt, std::string &errstr,
+	size_t band_rows = 0, row_thread_pool &pool = writer_row_thread_pool());
+
+bool save_packedbuf_as_fpzip_tiled(const std::string &filepath, const simple_packed_buf &srcBuf, std::string &errstr);
+
+// checks the header and the offset table in data; with file_size not 0, also that the bands end at the end of the file
+bool parse_fpzip_tiled_header(const uint8_t *data, size_t size, uint64_t file_size, FpzipTiledInfo &info, std::string &errstr);
+
+// Decompresses rows [row_begin, row_end) and columns [col_begin, col_end) of an .fpzt held in memory into dstBuf
+// (GRAYF32 of the region), only the bands the rows touch, in parallel on the pool. row_end/col_end 0 mean to the end.
+bool decode_fpzip_tiled(const uint8_t *fpzt, size_t size, simple_packed_buf &dstBuf, std::string &errstr,
+	size_t row_begin = 0, size_t row_end = 0, size_t col_begin = 0, size_t col_end = 0,
+	row_thread_pool &pool = writer_row_thread_pool());
+
+// The same from a file, reading only the header, the offset table and the bands the rows touch.
+bool read_fpzip_tiled_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr,
+	size_t row_begin = 0, size_t row_end = 0, size_t col_begin = 0, size_t col_end = 0,
+	row_thread_pool &pool = writer_row_thread_pool());
+
+// a single-stream .fpzip from save_packedbuf_f32_using_fpzip, as GRAYF32
+bool read_fpzip_file(const std::string &filepath, simple_packed_buf &dstBuf, std::string &errstr);
+
+// return error string if test failed; "ok" means frames of several sizes and band heights came back bit-exact,
+// whole and by regions, including NaN and infinite depth, and damaged files were refused
+std::string run_fpzip_tiled_tests();
+
+// times the single fpzip stream against bands of a few heights on the writer row pool: size and MB/s both ways
+std::string benchmark_fpzip_tiled(const simple_packed_buf &depth, int repeats = 3);
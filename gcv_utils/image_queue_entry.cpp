@@ -1,24 +1,35 @@
 // Copyright (C) 2022 Jason Bunk
 #include "gcv_utils/image_queue_entry.h" 
-#include <cnpy.h>
+#include "gcv_utils/npy_writer.h"
+#include "gcv_utils/fpzip_tiled.h"
 #include <fpzip/fpzip.h>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
+#include "IGCSConnector/fpng.h"
+#include "gcv_utils/png_strip_encoder.h"
 #include <vector>
 #include <cmath>
 #include <algorithm>
 #include <queue>
+#include <functional>
+#include <cstring>
+#include <random>
+#include <limits>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
 
 #define RobustNth 50
 
+// RobustNth-th smallest and largest values, the reference for robust_min_max_by_selection (see run_depth_preview_png_tests)
 template<typename FT>
-bool pack_32bitgray_into_8bitrgb(const simple_packed_buf& srcBuf, simple_packed_buf & dstBuf) {
-	if (!dstBuf.init_full(srcBuf.width, srcBuf.height, BUF_PIX_FMT_RGB24)) return false;
+void robust_min_max_by_heap(const simple_packed_buf& srcBuf, double &fmin, double &fmax) {
 	int ii, jj;
 	const FT* rowsrc;
-	uint8_t* rowdst;
 	std::priority_queue<FT, std::vector<FT>, std::greater<FT> > kthLargest;
 	std::priority_queue<FT, std::vector<FT>, std::less<FT> > kthSmallest;
 	for (ii = 0; ii < srcBuf.height; ++ii) {
@@ -40,42 +51,521 @@ bool pack_32bitgray_into_8bitrgb(const simple_packed_buf& srcBuf, simple_packed_
 			}
 		}
 	}
-	const double fmax = static_cast<double>(kthLargest.top());
-	const double fmin = static_cast<double>(kthSmallest.top());
-	const double frescale = 255.0 / std::max(0.000000000001, fmax - fmin);
-	double dblval;
-	uint8_t thiscolor;
-	for (ii = 0; ii < srcBuf.height; ++ii) {
-		rowsrc = srcBuf.crowptr<FT>(ii);
-		rowdst = dstBuf.rowptr<uint8_t>(ii);
-		for (jj = 0; jj < srcBuf.width; ++jj) {
-			dblval = static_cast<double>(rowsrc[jj]);
-			thiscolor = std::clamp(std::lround((dblval - fmin) * frescale), 0l, 255l);
-			rowdst[jj * 3] = thiscolor;
-			rowdst[jj * 3 + 1] = thiscolor;
-			rowdst[jj * 3 + 2] = thiscolor;
+	fmax = static_cast<double>(kthLargest.top());
+	fmin = static_cast<double>(kthSmallest.top());
+}
+
+// Same result as robust_min_max_by_heap, in a pass that mostly compares each value with two thresholds.
+// The thresholds start at the RobustNth-th smallest and largest of every 8th value of every 8th row: a subset's
+// RobustNth-th smallest is never below the whole frame's, so only values beyond them are collected. Should a
+// collection grow to a few thousand anyway, nth_element cuts it back to the RobustNth best and tightens its threshold.
+// NaNs are left out; returns false if nothing else is left.
+template<typename FT>
+bool robust_min_max_by_selection(const simple_packed_buf& srcBuf, double &fmin, double &fmax) {
+	const size_t trim_at = 64 * RobustNth;
+	const size_t sample_step = 8;
+	std::vector<FT> lows, highs;
+	for (size_t ii = 0; ii < srcBuf.height; ii += sample_step) {
+		const FT *rowsrc = srcBuf.crowptr<FT>(ii);
+		for (size_t jj = 0; jj < srcBuf.width; jj += sample_step) {
+			if (rowsrc[jj] == rowsrc[jj]) lows.push_back(rowsrc[jj]);
+		}
+	}
+	const auto trim = [](std::vector<FT> &vals, auto cmp) {
+		std::nth_element(vals.begin(), vals.begin() + (RobustNth - 1), vals.end(), cmp);
+		vals.resize(RobustNth);
+		return vals[RobustNth - 1];
+	};
+	const bool thresholds = (lows.size() >= RobustNth);
+	FT lo_thresh = FT(), hi_thresh = FT();
+	if (thresholds) {
+		highs = lows;
+		lo_thresh = trim(lows, std::less<FT>());
+		hi_thresh = trim(highs, std::greater<FT>());
+	}
+	// values equal to a threshold can't change which value is RobustNth-th, so they are skipped
+	lows.clear();
+	highs.clear();
+	lows.reserve(trim_at + srcBuf.width);
+	highs.reserve(trim_at + srcBuf.width);
+	for (size_t ii = 0; ii < srcBuf.height; ++ii) {
+		const FT *rowsrc = srcBuf.crowptr<FT>(ii);
+		if (!thresholds) {
+			// too few values to sample: the heaps ended up holding all of them
+			for (size_t jj = 0; jj < srcBuf.width; ++jj) {
+				if (rowsrc[jj] != rowsrc[jj]) continue;
+				lows.push_back(rowsrc[jj]);
+				highs.push_back(rowsrc[jj]);
+			}
+			continue;
+		}
+		for (size_t jj = 0; jj < srcBuf.width; ++jj) {
+			// NaNs compare false both ways
+			const FT val = rowsrc[jj];
+			if (val < lo_thresh) lows.push_back(val);
+			if (val > hi_thresh) highs.push_back(val);
+		}
+		if (lows.size() >= trim_at) lo_thresh = trim(lows, std::less<FT>());
+		if (highs.size() >= trim_at) hi_thresh = trim(highs, std::greater<FT>());
+	}
+	if (!thresholds) {
+		if (lows.empty()) return false;
+		if (lows.size() < RobustNth) {
+			fmin = static_cast<double>(*std::max_element(lows.begin(), lows.end()));
+			fmax = static_cast<double>(*std::min_element(highs.begin(), highs.end()));
+			return true;
+		}
+	}
+	// fewer than RobustNth values beyond a threshold means the threshold itself is the RobustNth-th
+	fmin = static_cast<double>((lows.size() >= RobustNth) ? trim(lows, std::less<FT>()) : lo_thresh);
+	fmax = static_cast<double>((highs.size() >= RobustNth) ? trim(highs, std::greater<FT>()) : hi_thresh);
+	return true;
+}
+
+// robust range of a depth frame, always by exact selection: the percentiles of DepthFrameStats are interpolated in
+// histogram bins of 1/32 octave, fine for telling broken frames apart but not the RobustNth-th value itself
+template<typename FT>
+void robust_depth_range(const simple_packed_buf& srcBuf, double &fmin, double &fmax) {
+	if (!robust_min_max_by_selection<FT>(srcBuf, fmin, fmax)) {
+		fmin = fmax = 0.0;
+	}
+}
+
+// keeps the high byte of each 16-bit channel
+bool pack_16bit_color_into_8bit(const simple_packed_buf& srcBuf, simple_packed_buf & dstBuf) {
+	if (!dstBuf.init_full(srcBuf.width, srcBuf.height, (srcBuf.pixfmt == BUF_PIX_FMT_RGBA64) ? BUF_PIX_FMT_RGBA : BUF_PIX_FMT_RGB24)) return false;
+	const uint16_t *src = srcBuf.cdata<uint16_t>();
+	uint8_t *dst = dstBuf.data<uint8_t>();
+	const size_t num_channels = dstBuf.num_total_bytes();
+	for (size_t ii = 0; ii < num_channels; ++ii) {
+		dst[ii] = static_cast<uint8_t>(src[ii] >> 8);
+	}
+	return true;
+}
+
+// stbi_write_png_to_mem for rows that are made one at a time, so no whole image is needed besides the filtered rows
+// for zlib. stb only writes 8-bit pngs, but its filters work on bytes with a pixel stride, so 16-bit samples filter
+// as pixels of 2*channels bytes. 8-bit images come out byte for byte like stbi_write_png_to_mem.
+static unsigned char *write_png_rows_to_mem(int x, int y, int bit_depth, int channels, const png_row_fn &fill_row, int *out_len) {
+	static const int ctypes[5] = { -1, 0, 4, 2, 6 };
+	const int n = channels * bit_depth / 8;
+	const size_t row_bytes = static_cast<size_t>(x) * n;
+	// the previous row and this one, one after the other, since the filters look back a row
+	std::vector<unsigned char> rows(row_bytes * 2);
+	std::vector<unsigned char> filt((row_bytes + 1) * y);
+	std::vector<signed char> line_buffer(row_bytes);
+	for (int j = 0; j < y; ++j) {
+		if (j > 0) memcpy(rows.data(), rows.data() + row_bytes, row_bytes);
+		fill_row(j, rows.data() + row_bytes);
+		// row 0 is encoded as the first row of a one-row image, later rows as row 1 of the two in the buffer
+		unsigned char *const pixels = (j == 0) ? (rows.data() + row_bytes) : rows.data();
+		const int line = (j == 0) ? 0 : 1;
+		// same per-row filter choice as stbi_write_png_to_mem: the smallest sum of absolute residuals
+		int best_filter = 0, best_filter_val = 0x7fffffff;
+		for (int filter_type = 0; filter_type < 5; ++filter_type) {
+			stbiw__encode_png_line(pixels, static_cast<int>(row_bytes), x, 2, line, n, filter_type, line_buffer.data());
+			int est = 0;
+			for (size_t i = 0; i < row_bytes; ++i) {
+				est += abs(line_buffer[i]);
+			}
+			if (est < best_filter_val) {
+				best_filter_val = est;
+				best_filter = filter_type;
+			}
+		}
+		stbiw__encode_png_line(pixels, static_cast<int>(row_bytes), x, 2, line, n, best_filter, line_buffer.data());
+		filt[j * (row_bytes + 1)] = static_cast<unsigned char>(best_filter);
+		memcpy(filt.data() + j * (row_bytes + 1) + 1, line_buffer.data(), row_bytes);
+	}
+	int zlen = 0;
+	unsigned char *zlib = stbi_zlib_compress(filt.data(), static_cast<int>(filt.size()), &zlen, stbi_write_png_compression_level);
+	if (!zlib) return nullptr;
+
+	*out_len = 8 + 12 + 13 + 12 + zlen + 12;
+	unsigned char *out = static_cast<unsigned char *>(STBIW_MALLOC(*out_len));
+	if (!out) {
+		STBIW_FREE(zlib);
+		return nullptr;
+	}
+	static const unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
+	unsigned char *o = out;
+	memcpy(o, sig, 8); o += 8;
+	stbiw__wp32(o, 13);
+	stbiw__wptag(o, "IHDR");
+	stbiw__wp32(o, x);
+	stbiw__wp32(o, y);
+	*o++ = static_cast<unsigned char>(bit_depth);
+	*o++ = static_cast<unsigned char>(ctypes[channels]);
+	*o++ = 0;
+	*o++ = 0;
+	*o++ = 0;
+	stbiw__wpcrc(&o, 13);
+	stbiw__wp32(o, zlen);
+	stbiw__wptag(o, "IDAT");
+	memcpy(o, zlib, zlen);
+	o += zlen;
+	STBIW_FREE(zlib);
+	stbiw__wpcrc(&o, zlen);
+	stbiw__wp32(o, 0);
+	stbiw__wptag(o, "IEND");
+	stbiw__wpcrc(&o, 0);
+	return out;
+}
+
+// RGB48/RGBA64 color with all 16 bits
+static unsigned char *write_png16_to_mem(const simple_packed_buf &srcBuf, int *out_len) {
+	const int channels = (srcBuf.pixfmt == BUF_PIX_FMT_RGBA64) ? 4 : 3;
+	return write_png_rows_to_mem(static_cast<int>(srcBuf.width), static_cast<int>(srcBuf.height), 16, channels, [&](int j, unsigned char *dst) {
+		const uint16_t *src = srcBuf.crowptr<uint16_t>(j);
+		for (size_t ii = 0; ii < srcBuf.width * channels; ++ii) {
+			dst[ii * 2] = static_cast<unsigned char>(src[ii] >> 8);
+			dst[ii * 2 + 1] = static_cast<unsigned char>(src[ii]);
+		}
+	}, out_len);
+}
+
+// grayscale png rows of 8 or 16 bits of depth (GRAYF32 or GRAYU32) over its robust range
+template<typename FT>
+static png_row_fn depth_preview_rows(const simple_packed_buf &srcBuf, int bit_depth) {
+	double fmin, fmax;
+	robust_depth_range<FT>(srcBuf, fmin, fmax);
+	const long maxcode = (bit_depth == 16) ? 65535l : 255l;
+	const double frescale = static_cast<double>(maxcode) / std::max(0.000000000001, fmax - fmin);
+	return [&srcBuf, bit_depth, fmin, maxcode, frescale](int j, unsigned char *dst) {
+		const FT *src = srcBuf.crowptr<FT>(j);
+		for (size_t ii = 0; ii < srcBuf.width; ++ii) {
+			const long code = std::clamp(std::lround((static_cast<double>(src[ii]) - fmin) * frescale), 0l, maxcode);
+			if (bit_depth == 16) {
+				dst[ii * 2] = static_cast<unsigned char>(code >> 8);
+				dst[ii * 2 + 1] = static_cast<unsigned char>(code);
+			} else {
+				dst[ii] = static_cast<unsigned char>(code);
+			}
 		}
+	};
+}
+
+// depth as a grayscale png preview of 8 or 16 bits, converted a row at a time
+template<typename FT>
+static unsigned char *depth_preview_png_to_mem(const simple_packed_buf &srcBuf, int bit_depth, int *out_len) {
+	return write_png_rows_to_mem(static_cast<int>(srcBuf.width), static_cast<int>(srcBuf.height), bit_depth, 1,
+		depth_preview_rows<FT>(srcBuf, bit_depth), out_len);
+}
+
+static bool write_png_mem_to_file(const std::string &filepath, unsigned char *png, int len, std::string &errstr) {
+	if (!png) {
+		errstr += std::string("png: failed to encode ") + filepath;
+		return false;
+	}
+	std::ofstream ofs(filepath, std::ios::binary);
+	ofs.write(reinterpret_cast<const char*>(png), len);
+	STBIW_FREE(png);
+	if (!ofs.good()) {
+		errstr += std::string("png: failed to write ") + filepath;
+		return false;
 	}
 	return true;
 }
 
+static bool write_bytes_to_file(const std::string &filepath, const std::vector<uint8_t> &bytes, const char *what, std::string &errstr) {
+	std::ofstream ofs(filepath, std::ios::binary);
+	ofs.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+	if (!ofs.good()) {
+		errstr += std::string(what) + std::string(": failed to write ") + filepath;
+		return false;
+	}
+	return true;
+}
+
+static uint8_t linear_to_srgb8(float value) {
+	const float linear = std::clamp(value, 0.0f, 1.0f); // also maps NaN to 0
+	const float encoded = (linear <= 0.0031308f) ? (12.92f * linear) : (1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f);
+	return static_cast<uint8_t>(std::lround(encoded * 255.0f));
+}
+
+// linear float color (e.g. scRGB back buffers) as an 8-bit sRGB preview; values outside [0,1] are clipped.
+// Two-channel targets (RGF32, e.g. r16g16_float) become RGB24 with blue at 0.
+bool pack_float_color_into_8bit(const simple_packed_buf& srcBuf, simple_packed_buf & dstBuf) {
+	const bool two_channel = srcBuf.pixfmt == BUF_PIX_FMT_RGF32;
+	if (!dstBuf.init_full(srcBuf.width, srcBuf.height, two_channel ? BUF_PIX_FMT_RGB24 : BUF_PIX_FMT_RGBA)) return false;
+	const float *src = srcBuf.cdata<float>();
+	uint8_t *dst = dstBuf.data<uint8_t>();
+	const size_t num_pixels = srcBuf.width * srcBuf.height;
+	if (two_channel) {
+		for (size_t ii = 0; ii < num_pixels; ++ii, src += 2, dst += 3) {
+			dst[0] = linear_to_srgb8(src[0]);
+			dst[1] = linear_to_srgb8(src[1]);
+			dst[2] = 0;
+		}
+		return true;
+	}
+	for (size_t ii = 0; ii < num_pixels; ++ii, src += 4, dst += 4) {
+		for (int c = 0; c < 3; ++c) {
+			dst[c] = linear_to_srgb8(src[c]);
+		}
+		dst[3] = static_cast<uint8_t>(std::lround(std::clamp(src[3], 0.0f, 1.0f) * 255.0f));
+	}
+	return true;
+}
+
+// color buffers as 8-bit RGB or RGBA rows in png channel order: srcBuf itself if it already is, otherwise converted
+// into scratch; nullptr for buffers that are not color, or if the conversion failed
+static const simple_packed_buf *packedbuf_as_8bit_rgb(const simple_packed_buf &srcBuf, simple_packed_buf &scratch) {
+	switch (srcBuf.pixfmt) {
+	case BUF_PIX_FMT_RGB24: case BUF_PIX_FMT_RGBA:
+		return &srcBuf;
+	case BUF_PIX_FMT_RGBAF32: case BUF_PIX_FMT_RGF32:
+		return pack_float_color_into_8bit(srcBuf, scratch) ? &scratch : nullptr;
+	case BUF_PIX_FMT_RGB48: case BUF_PIX_FMT_RGBA64:
+		return pack_16bit_color_into_8bit(srcBuf, scratch) ? &scratch : nullptr;
+	case BUF_PIX_FMT_BGRA:
+		// png wants RGB order; BGRA buffers normally go to the recorder, so this is the rare path
+		if (!scratch.init_full(srcBuf.width, srcBuf.height, BUF_PIX_FMT_RGBA)) return nullptr;
+		for (uint64_t ii = 0; ii < srcBuf.height; ++ii) {
+			const uint8_t *rowsrc = srcBuf.crowptr<uint8_t>(ii);
+			uint8_t *rowdst = scratch.rowptr<uint8_t>(ii);
+			for (uint64_t jj = 0; jj < srcBuf.width; ++jj) {
+				rowdst[jj * 4 + 0] = rowsrc[jj * 4 + 2];
+				rowdst[jj * 4 + 1] = rowsrc[jj * 4 + 1];
+				rowdst[jj * 4 + 2] = rowsrc[jj * 4 + 0];
+				rowdst[jj * 4 + 3] = rowsrc[jj * 4 + 3];
+			}
+		}
+		return &scratch;
+	default:
+		return nullptr;
+	}
+}
+
+static bool packedbuf_is_color(const simple_packed_buf &srcBuf) {
+	return srcBuf.pixfmt != BUF_PIX_FMT_GRAYF32 && srcBuf.pixfmt != BUF_PIX_FMT_GRAYU32;
+}
+
 bool save_packedbuf_as_8bit_png_image(const std::string &filepath,
 	const simple_packed_buf &srcBuf, std::string &errstr)
 {
-	if (srcBuf.pixfmt == BUF_PIX_FMT_RGB24 || srcBuf.pixfmt == BUF_PIX_FMT_RGBA) {
-		return stbi_write_png(filepath.c_str(), srcBuf.width, srcBuf.height,
-			srcBuf.bytes_per_pixel(), srcBuf.cdata<uint8_t>(), srcBuf.rowstride_bytes()) != 0;
-	}
-	simple_packed_buf dstBuf;
+	int len = 0;
+	// encoded before the call: len is only set once the png exists
 	if (srcBuf.pixfmt == BUF_PIX_FMT_GRAYF32) {
-		if (!pack_32bitgray_into_8bitrgb<float>(srcBuf, dstBuf)) return false;
+		unsigned char *png = depth_preview_png_to_mem<float>(srcBuf, 8, &len);
+		return write_png_mem_to_file(filepath, png, len, errstr);
 	} else if(srcBuf.pixfmt == BUF_PIX_FMT_GRAYU32) {
-		if (!pack_32bitgray_into_8bitrgb<uint32_t>(srcBuf, dstBuf)) return false;
-	} else {
+		unsigned char *png = depth_preview_png_to_mem<uint32_t>(srcBuf, 8, &len);
+		return write_png_mem_to_file(filepath, png, len, errstr);
+	}
+	simple_packed_buf scratch;
+	const simple_packed_buf *rgb = packedbuf_as_8bit_rgb(srcBuf, scratch);
+	if (!rgb) {
 		errstr += std::string("save_8bitpng: unrecognized buf format ") + std::to_string(srcBuf.pixfmt);
 		return false;
 	}
-	return stbi_write_png(filepath.c_str(), dstBuf.width, dstBuf.height, 3, dstBuf.data<uint8_t>(), dstBuf.rowstride_bytes()) != 0;
+	return stbi_write_png(filepath.c_str(), rgb->width, rgb->height, rgb->bytes_per_pixel(), rgb->cdata<uint8_t>(), rgb->rowstride_bytes()) != 0;
+}
+
+static void fpng_init_once() {
+	static std::once_flag once;
+	std::call_once(once, fpng::fpng_init);
+}
+
+// fpng picks its SSE4.1/PCLMUL kernels at runtime (fpng_init), with scalar code on older CPUs
+static bool encode_fpng_to_mem(const simple_packed_buf &srcBuf, std::vector<uint8_t> &png, std::string &errstr) {
+	simple_packed_buf scratch;
+	const simple_packed_buf *rgb = packedbuf_as_8bit_rgb(srcBuf, scratch);
+	if (!rgb) {
+		errstr += std::string("fpng: unrecognized buf format ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	fpng_init_once();
+	if (!fpng::fpng_encode_image_to_memory(rgb->cdata<uint8_t>(), static_cast<uint32_t>(rgb->width), static_cast<uint32_t>(rgb->height),
+			static_cast<uint32_t>(rgb->bytes_per_pixel()), png)) {
+		errstr += std::string("fpng: failed to encode ") + std::to_string(rgb->width) + std::string("x") + std::to_string(rgb->height);
+		return false;
+	}
+	return true;
+}
+
+bool save_packedbuf_as_fpng_image(const std::string &filepath,
+	const simple_packed_buf &srcBuf, std::string &errstr)
+{
+	// fpng only writes RGB and RGBA; depth previews are grayscale
+	if (!packedbuf_is_color(srcBuf)) return save_packedbuf_as_8bit_png_image(filepath, srcBuf, errstr);
+	// kept per writer thread, so each frame reuses the previous frame's output buffer
+	thread_local std::vector<uint8_t> png;
+	if (!encode_fpng_to_mem(srcBuf, png, errstr)) return false;
+	return write_bytes_to_file(filepath, png, "fpng", errstr);
+}
+
+// 8-bit color, or the 8-bit grayscale depth preview, deflated in strips of rows on the writer row pool
+bool save_packedbuf_as_strip_png_image(const std::string &filepath,
+	const simple_packed_buf &srcBuf, std::string &errstr)
+{
+	simple_packed_buf scratch;
+	const simple_packed_buf *rgb = nullptr;
+	png_row_fn fill_row;
+	int channels = 1;
+	if (srcBuf.pixfmt == BUF_PIX_FMT_GRAYF32) {
+		fill_row = depth_preview_rows<float>(srcBuf, 8);
+	} else if (srcBuf.pixfmt == BUF_PIX_FMT_GRAYU32) {
+		fill_row = depth_preview_rows<uint32_t>(srcBuf, 8);
+	} else {
+		rgb = packedbuf_as_8bit_rgb(srcBuf, scratch);
+		if (!rgb) {
+			errstr += std::string("png strips: unrecognized buf format ") + std::to_string(srcBuf.pixfmt);
+			return false;
+		}
+		channels = static_cast<int>(rgb->bytes_per_pixel());
+		fill_row = [rgb](int j, unsigned char *dst) {
+			memcpy(dst, rgb->crowptr<uint8_t>(j), rgb->rowstride_bytes());
+		};
+	}
+	// kept per writer thread, so each frame reuses the previous frame's output buffer
+	thread_local std::vector<uint8_t> png;
+	if (!encode_png_in_strips(static_cast<int>(srcBuf.width), static_cast<int>(srcBuf.height), 8, channels, fill_row, png, errstr)) return false;
+	return write_bytes_to_file(filepath, png, "png strips", errstr);
+}
+
+// float depth as 16-bit codes, with the quantization in a tEXt chunk; the strip encoder at zlib level 1 keeps it fast
+static bool encode_png16depth_to_mem(const simple_packed_buf &srcBuf, const DepthQuantization &quant, std::vector<uint8_t> &png, std::string &errstr) {
+	if (srcBuf.pixfmt != BUF_PIX_FMT_GRAYF32) {
+		errstr += std::string("png16depth: needs float depth, not buf format ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	if (!quant.valid(errstr)) return false;
+	nlohmann::json meta;
+	quant.into_json(meta);
+	PngStripSettings settings;
+	settings.text_chunks.emplace_back("depth_quantization", meta.dump());
+	return encode_png_in_strips(static_cast<int>(srcBuf.width), static_cast<int>(srcBuf.height), 16, 1, [&](int j, unsigned char *dst) {
+		quant.encode_row_be(srcBuf.crowptr<float>(j), srcBuf.width, dst);
+	}, png, errstr, settings);
+}
+
+bool save_packedbuf_as_png16depth(const std::string &filepath,
+	const simple_packed_buf &srcBuf, const DepthQuantization &quant, std::string &errstr)
+{
+	thread_local std::vector<uint8_t> png;
+	if (!encode_png16depth_to_mem(srcBuf, quant, png, errstr)) return false;
+	return write_bytes_to_file(filepath, png, "png16depth", errstr);
+}
+
+// 16-bit color keeps all its bits; depth becomes a 16-bit grayscale preview
+bool save_packedbuf_as_16bit_png_image(const std::string &filepath,
+	const simple_packed_buf &srcBuf, std::string &errstr)
+{
+	int len = 0;
+	unsigned char *png = nullptr;
+	switch (srcBuf.pixfmt) {
+	case BUF_PIX_FMT_RGB48: case BUF_PIX_FMT_RGBA64:
+		png = write_png16_to_mem(srcBuf, &len);
+		break;
+	case BUF_PIX_FMT_GRAYF32:
+		png = depth_preview_png_to_mem<float>(srcBuf, 16, &len);
+		break;
+	case BUF_PIX_FMT_GRAYU32:
+		png = depth_preview_png_to_mem<uint32_t>(srcBuf, 16, &len);
+		break;
+	default:
+		return save_packedbuf_as_8bit_png_image(filepath, srcBuf, errstr);
+	}
+	return write_png_mem_to_file(filepath, png, len, errstr);
+}
+
+// OpenEXR attribute: name, type, size, value
+static void exr_attribute(std::string &header, const char *name, const char *type, const void *value, int32_t size) {
+	header.append(name, strlen(name) + 1);
+	header.append(type, strlen(type) + 1);
+	header.append(reinterpret_cast<const char*>(&size), 4);
+	header.append(static_cast<const char*>(value), size);
+}
+
+typedef std::function<void(const void *bytes, size_t len)> exr_byte_sink;
+
+// scanline OpenEXR, one line per block, no compression, 32-bit float channels, handed to out piece by piece.
+// Uncompressed because the point is a fast, lossless dump of linear render targets; zip/piz would cost more than the disk write.
+static bool encode_exr(const simple_packed_buf &srcBuf, const exr_byte_sink &out, const std::string &filepath, std::string &errstr)
+{
+	// channels are stored in alphabetical order; src_channel maps each one back to its place in the pixel
+	std::vector<std::string> names;
+	std::vector<int> src_channel;
+	switch (srcBuf.pixfmt) {
+	case BUF_PIX_FMT_GRAYF32: names = { "Y" }; src_channel = { 0 }; break;
+	case BUF_PIX_FMT_RGF32: names = { "G", "R" }; src_channel = { 1, 0 }; break;
+	case BUF_PIX_FMT_RGBAF32: names = { "A", "B", "G", "R" }; src_channel = { 3, 2, 1, 0 }; break;
+	default:
+		errstr += std::string("exr: only writes float buffers; refusing ") + filepath
+			+ std::string(" of type ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	const int32_t width = static_cast<int32_t>(srcBuf.width);
+	const int32_t height = static_cast<int32_t>(srcBuf.height);
+	const size_t num_channels = names.size();
+
+	std::string header;
+	const int32_t magic_and_version[2] = { 20000630, 2 };
+	header.append(reinterpret_cast<const char*>(magic_and_version), 8);
+	std::string chlist;
+	for (const std::string &name : names) {
+		const int32_t pixel_type_float = 2;
+		const uint8_t plinear_and_reserved[4] = { 0, 0, 0, 0 };
+		const int32_t sampling[2] = { 1, 1 };
+		chlist.append(name.c_str(), name.size() + 1);
+		chlist.append(reinterpret_cast<const char*>(&pixel_type_float), 4);
+		chlist.append(reinterpret_cast<const char*>(plinear_and_reserved), 4);
+		chlist.append(reinterpret_cast<const char*>(sampling), 8);
+	}
+	chlist.push_back('\0');
+	exr_attribute(header, "channels", "chlist", chlist.data(), static_cast<int32_t>(chlist.size()));
+	const uint8_t no_compression = 0, increasing_y = 0;
+	exr_attribute(header, "compression", "compression", &no_compression, 1);
+	const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+	exr_attribute(header, "dataWindow", "box2i", window, 16);
+	exr_attribute(header, "displayWindow", "box2i", window, 16);
+	exr_attribute(header, "lineOrder", "lineOrder", &increasing_y, 1);
+	const float aspect = 1.0f, center[2] = { 0.0f, 0.0f };
+	exr_attribute(header, "pixelAspectRatio", "float", &aspect, 4);
+	exr_attribute(header, "screenWindowCenter", "v2f", center, 8);
+	exr_attribute(header, "screenWindowWidth", "float", &aspect, 4);
+	header.push_back('\0');
+
+	// line offset table, then each line: y, byte count, and the line's values channel by channel
+	const int32_t line_bytes = static_cast<int32_t>(num_channels * srcBuf.width * sizeof(float));
+	std::vector<uint64_t> offsets(srcBuf.height);
+	for (size_t y = 0; y < srcBuf.height; ++y) {
+		offsets[y] = header.size() + offsets.size() * sizeof(uint64_t) + y * (8 + static_cast<uint64_t>(line_bytes));
+	}
+	out(header.data(), header.size());
+	out(offsets.data(), offsets.size() * sizeof(uint64_t));
+	std::vector<uint8_t> line(8 + line_bytes);
+	for (int32_t y = 0; y < height; ++y) {
+		memcpy(line.data(), &y, 4);
+		memcpy(line.data() + 4, &line_bytes, 4);
+		const float *rowsrc = srcBuf.crowptr<float>(y);
+		for (size_t c = 0; c < num_channels; ++c) {
+			float *planar = reinterpret_cast<float*>(line.data() + 8) + c * srcBuf.width;
+			for (size_t x = 0; x < srcBuf.width; ++x) {
+				planar[x] = rowsrc[x * num_channels + src_channel[c]];
+			}
+		}
+		out(line.data(), line.size());
+	}
+	return true;
+}
+
+bool save_packedbuf_as_exr(const std::string &filepath,
+	const simple_packed_buf &srcBuf, std::string &errstr)
+{
+	// opened on the first bytes, so a buffer the encoder refuses leaves no empty file behind
+	std::ofstream ofs;
+	const exr_byte_sink to_file = [&ofs, &filepath](const void *bytes, size_t len) {
+		if (!ofs.is_open()) ofs.open(filepath, std::ios::binary);
+		ofs.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(len));
+	};
+	if (!encode_exr(srcBuf, to_file, filepath, errstr)) return false;
+	if (!ofs.good()) {
+		errstr += std::string("exr: failed to write all data to ") + filepath;
+		return false;
+	}
+	return true;
 }
 
 bool save_packedbuf_f32_using_fpzip(const std::string &filepath,
@@ -144,32 +634,33 @@ bool save_packedbuf_to_epr(const std::string& filepath,
 bool queue_item_image2write::write_to_disk(std::string &errstr) const {
 	if (writers == ImageWriter_none || writers >= ImageWriter_end) return false;
 	bool allgood = true;
-	if (writers & ImageWriter_STB_png) {
+	if (writers & ImageWriter_png16) {
+		allgood &= save_packedbuf_as_16bit_png_image(filepath_noexten + std::string(".png"), mybuf, errstr);
+	} else if (writers & ImageWriter_png_strips) {
+		allgood &= save_packedbuf_as_strip_png_image(filepath_noexten + std::string(".png"), mybuf, errstr);
+	} else if (writers & ImageWriter_fpng) {
+		allgood &= save_packedbuf_as_fpng_image(filepath_noexten + std::string(".png"), mybuf, errstr);
+	} else if (writers & ImageWriter_STB_png) {
 		allgood &= save_packedbuf_as_8bit_png_image(filepath_noexten + std::string(".png"), mybuf, errstr);
 	}
 	if (writers & ImageWriter_numpy) {
-		switch (mybuf.pixfmt) {
-		case BUF_PIX_FMT_RGBA: case BUF_PIX_FMT_RGB24: {
-			cnpy::npy_save<uint8_t>(filepath_noexten + std::string(".npy"),
-				mybuf.cdata<uint8_t>(), { static_cast<size_t>(mybuf.height), static_cast<size_t>(mybuf.width) });
-			break;
-		}
-		case BUF_PIX_FMT_GRAYU32: {
-			cnpy::npy_save<uint32_t>(filepath_noexten + std::string(".npy"),
-				mybuf.cdata<uint32_t>(), { static_cast<size_t>(mybuf.height), static_cast<size_t>(mybuf.width) });
-			break;
-		}
-		case BUF_PIX_FMT_GRAYF32: {
-			cnpy::npy_save<float>(filepath_noexten + std::string(".npy"),
-				mybuf.cdata<float>(), { static_cast<size_t>(mybuf.height), static_cast<size_t>(mybuf.width) });
-			break;
-		}
-		default: allgood = false;
-		}
+		allgood &= save_packedbuf_as_npy(filepath_noexten + std::string(".npy"), mybuf, errstr);
+	}
+	if (writers & ImageWriter_png16depth) {
+		allgood &= save_packedbuf_as_png16depth(filepath_noexten + std::string("_u16.png"), mybuf, depth_quant, errstr);
+	}
+	if (writers & ImageWriter_exr) {
+		allgood &= save_packedbuf_as_exr(filepath_noexten + std::string(".exr"), mybuf, errstr);
+	}
+	if (writers & ImageWriter_fpzip_tiled) {
+		allgood &= save_packedbuf_as_fpzip_tiled(filepath_noexten + std::string(".fpzt"), mybuf, errstr);
 	}
 	if (writers & ImageWriter_fpzip) {
 		allgood &= save_packedbuf_f32_using_fpzip(filepath_noexten + std::string(".fpzip"),
 			mybuf, errstr);
+	}
+	if (writers & ImageWriter_epr_lz4) {
+		allgood &= save_packedbuf_as_epr_v2(filepath_noexten + std::string(".epr"), mybuf, epr_settings, errstr);
 	}
 	 if (writers & ImageWriter_epr) {
         allgood &= save_packedbuf_to_epr(filepath_noexten + std::string(".epr"),
@@ -177,3 +668,397 @@ bool queue_item_image2write::write_to_disk(std::string &errstr) const {
     }
 	return allgood;
 }
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+// 8-bit grayscale samples of depth over [fmin, fmax], as depth_preview_png_to_mem maps them
+template<typename FT>
+static std::vector<unsigned char> depth_preview_samples(const simple_packed_buf &srcBuf, double fmin, double fmax) {
+	std::vector<unsigned char> samples(srcBuf.width * srcBuf.height);
+	const double frescale = 255.0 / std::max(0.000000000001, fmax - fmin);
+	for (size_t ii = 0; ii < srcBuf.height; ++ii) {
+		for (size_t jj = 0; jj < srcBuf.width; ++jj) {
+			samples[ii * srcBuf.width + jj] = static_cast<unsigned char>(std::clamp(std::lround((static_cast<double>(srcBuf.crowptr<FT>(ii)[jj]) - fmin) * frescale), 0l, 255l));
+		}
+	}
+	return samples;
+}
+
+static bool png_header_is(const unsigned char *png, int len, uint32_t width, uint32_t height, int bit_depth, int ctype) {
+	if (png == nullptr || len < 8 + 8 + 13) return false;
+	const unsigned char *ihdr = png + 16;
+	const uint32_t w = (uint32_t(ihdr[0]) << 24) | (uint32_t(ihdr[1]) << 16) | (uint32_t(ihdr[2]) << 8) | ihdr[3];
+	const uint32_t h = (uint32_t(ihdr[4]) << 24) | (uint32_t(ihdr[5]) << 16) | (uint32_t(ihdr[6]) << 8) | ihdr[7];
+	return memcmp(png + 12, "IHDR", 4) == 0 && w == width && h == height && ihdr[8] == bit_depth && ihdr[9] == ctype;
+}
+
+// writes srcBuf with the save function into a temporary file and decodes what landed on disk
+typedef bool (*png_save_fn)(const std::string &filepath, const simple_packed_buf &srcBuf, std::string &errstr);
+static bool png_file_round_trip(png_save_fn save, const simple_packed_buf &srcBuf, uint32_t &width, uint32_t &height, size_t &bpp,
+	std::vector<uint8_t> &pixels, std::string &errstr)
+{
+	std::error_code ec;
+	const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "gcv_png_file_tests";
+	std::filesystem::create_directories(dir, ec);
+	const std::string path = (dir / "test.png").string();
+	if (!save(path, srcBuf, errstr)) return false;
+	std::ifstream ifs(path, std::ios::binary);
+	const std::vector<uint8_t> png((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	std::filesystem::remove_all(dir, ec);
+	if (png.empty()) {
+		errstr += std::string("empty file");
+		return false;
+	}
+	return decode_png_rows(png, width, height, bpp, pixels, errstr);
+}
+
+std::string run_depth_preview_png_tests() {
+	std::mt19937 rng(1234);
+	// exact robust range, for fewer pixels than RobustNth too; values repeat, so ties fall across the ranks
+	const size_t sizes[3][2] = { { 37, 1 }, { 64, 48 }, { 301, 17 } };
+	for (const auto &size : sizes) {
+		simple_packed_buf depth, ints;
+		if (!depth.init_full(size[0], size[1], BUF_PIX_FMT_GRAYF32) || !ints.init_full(size[0], size[1], BUF_PIX_FMT_GRAYU32)) RETURNFAILST("alloc");
+		for (size_t ii = 0; ii < size[1]; ++ii) {
+			for (size_t jj = 0; jj < size[0]; ++jj) {
+				const uint32_t rr = rng();
+				float val = static_cast<float>(rr % 997) * 0.37f - 90.0f;
+				if (rr % 41 == 0) val = std::numeric_limits<float>::infinity();
+				if (rr % 43 == 0) val = -0.0f;
+				depth.rowptr<float>(ii)[jj] = val;
+				ints.rowptr<uint32_t>(ii)[jj] = (rr % 5 == 0) ? 0xffffffffu : (rr >> (rr % 24));
+			}
+		}
+		double hmin, hmax, rmin, rmax;
+		robust_min_max_by_heap<float>(depth, hmin, hmax);
+		if (!robust_min_max_by_selection<float>(depth, rmin, rmax) || hmin != rmin || hmax != rmax) {
+			RETURNFAILST(std::string("float range ") + std::to_string(rmin) + std::string(", ") + std::to_string(rmax)
+				+ std::string(" instead of ") + std::to_string(hmin) + std::string(", ") + std::to_string(hmax));
+		}
+		robust_min_max_by_heap<uint32_t>(ints, hmin, hmax);
+		if (!robust_min_max_by_selection<uint32_t>(ints, rmin, rmax) || hmin != rmin || hmax != rmax) RETURNFAILST("uint32 range");
+
+		// the 8-bit preview is the png stb writes from a whole grayscale image, without the image
+		const std::vector<unsigned char> samples = depth_preview_samples<float>(depth, hmin, hmax);
+		int len = 0, stb_len = 0;
+		unsigned char *png = depth_preview_png_to_mem<float>(depth, 8, &len);
+		unsigned char *stb_png = stbi_write_png_to_mem(samples.data(), static_cast<int>(depth.width), static_cast<int>(depth.width), static_cast<int>(depth.height), 1, &stb_len);
+		const bool same = png != nullptr && stb_png != nullptr && len == stb_len && memcmp(png, stb_png, len) == 0;
+		STBIW_FREE(png);
+		STBIW_FREE(stb_png);
+		if (!same) RETURNFAILST(std::string("8-bit grayscale png of ") + std::to_string(size[0]) + std::string(" x ") + std::to_string(size[1]));
+
+		png = depth_preview_png_to_mem<uint32_t>(ints, 16, &len);
+		const bool gray16 = png_header_is(png, len, static_cast<uint32_t>(size[0]), static_cast<uint32_t>(size[1]), 16, 0);
+		STBIW_FREE(png);
+		if (!gray16) RETURNFAILST("16-bit grayscale png header");
+
+		// and the save functions put the same previews into files
+		uint32_t width = 0, height = 0;
+		size_t bpp = 0;
+		std::vector<uint8_t> pixels;
+		std::string errstr;
+		if (!png_file_round_trip(save_packedbuf_as_8bit_png_image, depth, width, height, bpp, pixels, errstr)) RETURNFAILST(std::string("8-bit preview file: ") + errstr);
+		if (width != depth.width || height != depth.height || bpp != 1 || pixels != std::vector<uint8_t>(samples.begin(), samples.end())) RETURNFAILST("8-bit preview file pixels");
+		if (!png_file_round_trip(save_packedbuf_as_16bit_png_image, ints, width, height, bpp, pixels, errstr)) RETURNFAILST(std::string("16-bit preview file: ") + errstr);
+		if (width != ints.width || height != ints.height || bpp != 2) RETURNFAILST("16-bit preview file size");
+	}
+	{
+		// NaNs are left out of the range, and a frame of only NaNs has none
+		simple_packed_buf depth;
+		depth.init_full(8, 8, BUF_PIX_FMT_GRAYF32);
+		for (size_t ii = 0; ii < 64; ++ii) depth.data<float>()[ii] = std::numeric_limits<float>::quiet_NaN();
+		double rmin, rmax;
+		if (robust_min_max_by_selection<float>(depth, rmin, rmax)) RETURNFAILST("range of only NaNs");
+		depth.data<float>()[5] = 3.0f;
+		depth.data<float>()[9] = -2.0f;
+		if (!robust_min_max_by_selection<float>(depth, rmin, rmax) || rmin != 3.0 || rmax != -2.0) RETURNFAILST("range around NaNs");
+	}
+	return "ok";
+}
+
+std::string benchmark_depth_preview_png(const simple_packed_buf &depth, int repeats) {
+	if (depth.pixfmt != BUF_PIX_FMT_GRAYF32 || depth.width == 0 || depth.height == 0) return "depth preview benchmark: needs a GRAYF32 frame";
+	typedef std::chrono::steady_clock benchclock;
+	const auto ms_since = [](benchclock::time_point start) {
+		return std::chrono::duration<double, std::milli>(benchclock::now() - start).count();
+	};
+	double heap_ms = 0.0, select_ms = 0.0, rgb_ms = 0.0, gray8_ms = 0.0, gray16_ms = 0.0;
+	int rgb_len = 0, gray8_len = 0, gray16_len = 0;
+	bool same_range = true;
+	repeats = std::max(repeats, 1);
+	for (int rep = 0; rep < repeats; ++rep) {
+		double hmin, hmax, rmin, rmax;
+		benchclock::time_point start = benchclock::now();
+		robust_min_max_by_heap<float>(depth, hmin, hmax);
+		heap_ms += ms_since(start);
+		start = benchclock::now();
+		robust_min_max_by_selection<float>(depth, rmin, rmax);
+		select_ms += ms_since(start);
+		same_range &= (hmin == rmin && hmax == rmax);
+
+		// the previous preview: the heap range, then the gray value repeated into an RGB24 image for stb
+		start = benchclock::now();
+		robust_min_max_by_heap<float>(depth, hmin, hmax);
+		const std::vector<unsigned char> samples = depth_preview_samples<float>(depth, hmin, hmax);
+		std::vector<unsigned char> rgb(samples.size() * 3);
+		for (size_t ii = 0; ii < samples.size(); ++ii) rgb[ii * 3] = rgb[ii * 3 + 1] = rgb[ii * 3 + 2] = samples[ii];
+		STBIW_FREE(stbi_write_png_to_mem(rgb.data(), static_cast<int>(depth.width * 3), static_cast<int>(depth.width), static_cast<int>(depth.height), 3, &rgb_len));
+		rgb_ms += ms_since(start);
+
+		start = benchclock::now();
+		STBIW_FREE(depth_preview_png_to_mem<float>(depth, 8, &gray8_len));
+		gray8_ms += ms_since(start);
+		start = benchclock::now();
+		STBIW_FREE(depth_preview_png_to_mem<float>(depth, 16, &gray16_len));
+		gray16_ms += ms_since(start);
+	}
+	char buf[512];
+	snprintf(buf, sizeof(buf), "depth preview of %zu x %zu, mean of %d: robust range by heap %.1f ms, by selection %.1f ms%s\n"
+		"  rgb24 png (previous) %.1f ms, %.2f MB\n  gray8 png %.1f ms, %.2f MB\n  gray16 png %.1f ms, %.2f MB",
+		static_cast<size_t>(depth.width), static_cast<size_t>(depth.height), repeats, heap_ms / repeats, select_ms / repeats,
+		same_range ? "" : " (DIFFERENT RANGES)", rgb_ms / repeats, rgb_len / 1e6, gray8_ms / repeats, gray8_len / 1e6, gray16_ms / repeats, gray16_len / 1e6);
+	return std::string(buf);
+}
+
+// RGB24, RGBA and BGRA buffers of the given size with a gradient and a checker pattern in them
+static bool color_png_test_buf(BufPixelFormat pixfmt, size_t width, size_t height, simple_packed_buf &buf) {
+	if (!buf.init_full(width, height, pixfmt)) return false;
+	const size_t bpp = buf.bytes_per_pixel();
+	for (size_t ii = 0; ii < height; ++ii) {
+		uint8_t *row = buf.rowptr<uint8_t>(ii);
+		for (size_t jj = 0; jj < width; ++jj) {
+			for (size_t c = 0; c < bpp; ++c) {
+				row[jj * bpp + c] = static_cast<uint8_t>((ii * 7 + jj * 3 + c * 50) ^ (((ii / 4 + jj / 4) & 1) ? 0x80 : 0));
+			}
+		}
+	}
+	return true;
+}
+
+std::string run_color_png_writer_tests() {
+	// 16-bit color reads back with every bit, big-endian; smooth gradients and noise make the rows pick different filters
+	std::mt19937 rng(16);
+	for (const BufPixelFormat pixfmt : { BUF_PIX_FMT_RGB48, BUF_PIX_FMT_RGBA64 }) {
+		const std::string which = std::string((pixfmt == BUF_PIX_FMT_RGB48) ? "rgb48" : "rgba64") + std::string(": ");
+		simple_packed_buf color;
+		if (!color.init_full(37, 23, pixfmt)) RETURNFAILST(which + "init");
+		const size_t channels = (pixfmt == BUF_PIX_FMT_RGBA64) ? 4 : 3;
+		for (size_t jj = 0; jj < color.height; ++jj) {
+			uint16_t *row = color.rowptr<uint16_t>(jj);
+			for (size_t ii = 0; ii < color.width * channels; ++ii) {
+				row[ii] = (jj % 3 == 0) ? static_cast<uint16_t>(rng()) : static_cast<uint16_t>(ii * 1234 + jj * 517);
+			}
+		}
+		int len = 0;
+		unsigned char *png = write_png16_to_mem(color, &len);
+		const bool header = png_header_is(png, len, 37, 23, 16, (channels == 4) ? 6 : 2);
+		const std::vector<uint8_t> pngbytes = png ? std::vector<uint8_t>(png, png + len) : std::vector<uint8_t>();
+		STBIW_FREE(png);
+		if (!header) RETURNFAILST(which + "16-bit color png header");
+		uint32_t width = 0, height = 0;
+		size_t bpp = 0;
+		std::vector<uint8_t> pixels;
+		std::string err;
+		if (!decode_png_rows(pngbytes, width, height, bpp, pixels, err)) RETURNFAILST(which + std::string("decode: ") + err);
+		if (width != color.width || height != color.height || bpp != channels * 2) RETURNFAILST(which + "decoded size");
+		for (size_t jj = 0; jj < color.height; ++jj) {
+			const uint16_t *row = color.crowptr<uint16_t>(jj);
+			const uint8_t *back = pixels.data() + jj * width * bpp;
+			for (size_t ii = 0; ii < color.width * channels; ++ii) {
+				if (((back[ii * 2] << 8) | back[ii * 2 + 1]) != row[ii]) {
+					RETURNFAILST(which + std::string("sample ") + std::to_string(ii) + std::string(" of row ") + std::to_string(jj) + std::string(" differs"));
+				}
+			}
+		}
+		// the file save_packedbuf_as_16bit_png_image writes holds the same pixels
+		std::vector<uint8_t> file_pixels;
+		if (!png_file_round_trip(save_packedbuf_as_16bit_png_image, color, width, height, bpp, file_pixels, err)) RETURNFAILST(which + std::string("file: ") + err);
+		if (width != color.width || height != color.height || bpp != channels * 2 || file_pixels != pixels) RETURNFAILST(which + "file pixels");
+	}
+	const BufPixelFormat formats[] = { BUF_PIX_FMT_RGB24, BUF_PIX_FMT_RGBA, BUF_PIX_FMT_BGRA };
+	const size_t sizes[][2] = { {1, 1}, {37, 19}, {256, 3} };
+	for (const BufPixelFormat pixfmt : formats) {
+		for (const auto &size : sizes) {
+			simple_packed_buf color;
+			if (!color_png_test_buf(pixfmt, size[0], size[1], color)) RETURNFAILST("init");
+			std::vector<uint8_t> png;
+			std::string errstr;
+			if (!encode_fpng_to_mem(color, png, errstr)) RETURNFAILST(errstr);
+			// fpng reads back its own files exactly; other decoders see a regular png
+			std::vector<uint8_t> decoded;
+			uint32_t width = 0, height = 0, channels = 0;
+			const uint32_t bpp = static_cast<uint32_t>(color.bytes_per_pixel());
+			if (fpng::fpng_decode_memory(png.data(), static_cast<uint32_t>(png.size()), decoded, width, height, channels, bpp) != fpng::FPNG_DECODE_SUCCESS) RETURNFAILST("decode");
+			if (width != color.width || height != color.height || channels != bpp || decoded.size() != color.num_total_bytes()) RETURNFAILST("decoded size");
+			for (size_t ii = 0; ii < color.num_total_bytes(); ++ii) {
+				// BGRA is written in RGBA order
+				const size_t src = (pixfmt == BUF_PIX_FMT_BGRA && (ii % 4) != 3) ? (ii - ii % 4 + 2 - ii % 4) : ii;
+				if (decoded[ii] != color.cdata<uint8_t>()[src]) RETURNFAILST(std::string("pixel mismatch, format ") + std::to_string(pixfmt) + std::string(" byte ") + std::to_string(ii));
+			}
+		}
+	}
+	// depth frames are not color: they keep the stb grayscale preview
+	simple_packed_buf depth;
+	if (!depth.init_full(4, 4, BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init depth");
+	std::vector<uint8_t> png;
+	std::string errstr;
+	if (encode_fpng_to_mem(depth, png, errstr)) RETURNFAILST("fpng accepted a depth buffer");
+	return "ok";
+}
+
+// the header attributes and scanlines of an uncompressed exr as encode_exr writes it, read back by name and offset
+static std::string exr_decode_check(const std::string &exr, const simple_packed_buf &srcBuf,
+	const std::vector<std::string> &names, const std::vector<int> &src_channel)
+{
+	size_t pos = 0;
+	const auto read_i32 = [&exr](size_t at) { int32_t v = 0; memcpy(&v, exr.data() + at, 4); return v; };
+	if (exr.size() < 8 || read_i32(0) != 20000630 || read_i32(4) != 2) RETURNFAILST("magic/version");
+	pos = 8;
+	std::vector<std::string> channels;
+	int32_t window[4] = { -1, -1, -1, -1 };
+	int compression = -1;
+	while (pos < exr.size() && exr[pos] != '\0') {
+		const std::string name(exr.c_str() + pos);
+		pos += name.size() + 1;
+		const std::string type(exr.c_str() + pos);
+		pos += type.size() + 1;
+		const int32_t size = read_i32(pos);
+		pos += 4;
+		if (size < 0 || pos + size > exr.size()) RETURNFAILST(std::string("attribute ") + name + std::string(" overruns the file"));
+		if (name == "channels") {
+			for (size_t at = pos; exr[at] != '\0'; at += 16) {
+				channels.emplace_back(exr.c_str() + at);
+				at += channels.back().size() + 1;
+				if (read_i32(at) != 2) RETURNFAILST(std::string("channel ") + channels.back() + std::string(" is not float"));
+			}
+		} else if (name == "dataWindow") {
+			memcpy(window, exr.data() + pos, 16);
+		} else if (name == "compression") {
+			compression = exr[pos];
+		}
+		pos += size;
+	}
+	++pos;
+	if (channels != names) RETURNFAILST("channel list");
+	if (compression != 0) RETURNFAILST("compression");
+	if (window[0] != 0 || window[1] != 0 || window[2] + 1 != static_cast<int32_t>(srcBuf.width)
+		|| window[3] + 1 != static_cast<int32_t>(srcBuf.height)) RETURNFAILST("data window");
+	const size_t line_bytes = names.size() * srcBuf.width * sizeof(float);
+	if (exr.size() != pos + srcBuf.height * (8 + 8 + line_bytes)) RETURNFAILST("file size");
+	for (size_t y = 0; y < srcBuf.height; ++y) {
+		uint64_t offset = 0;
+		memcpy(&offset, exr.data() + pos + y * 8, 8);
+		if (read_i32(offset) != static_cast<int32_t>(y) || read_i32(offset + 4) != static_cast<int32_t>(line_bytes)) RETURNFAILST(std::string("line header ") + std::to_string(y));
+		const float *rowsrc = srcBuf.crowptr<float>(y);
+		for (size_t c = 0; c < names.size(); ++c) {
+			for (size_t x = 0; x < srcBuf.width; ++x) {
+				const float expected = rowsrc[x * names.size() + src_channel[c]];
+				if (memcmp(exr.data() + offset + 8 + (c * srcBuf.width + x) * sizeof(float), &expected, sizeof(float)) != 0) {
+					RETURNFAILST(std::string("channel ") + names[c] + std::string(" differs at x ") + std::to_string(x) + std::string(", y ") + std::to_string(y));
+				}
+			}
+		}
+	}
+	return "ok";
+}
+
+std::string run_exr_writer_tests() {
+	struct exr_case { BufPixelFormat pixfmt; std::vector<std::string> names; std::vector<int> src_channel; };
+	const exr_case cases[] = {
+		{ BUF_PIX_FMT_GRAYF32, { "Y" }, { 0 } },
+		{ BUF_PIX_FMT_RGF32, { "G", "R" }, { 1, 0 } },
+		{ BUF_PIX_FMT_RGBAF32, { "A", "B", "G", "R" }, { 3, 2, 1, 0 } },
+	};
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> values(-1000.0f, 1000.0f);
+	for (const exr_case &tc : cases) {
+		simple_packed_buf buf;
+		if (!buf.init_full(13, 7, tc.pixfmt)) RETURNFAILST("init");
+		float *vals = buf.data<float>();
+		for (size_t ii = 0; ii < buf.width * buf.height * tc.names.size(); ++ii) {
+			vals[ii] = (ii % 11 == 0) ? std::numeric_limits<float>::infinity() : values(rng);
+		}
+		std::string exr, errstr;
+		const exr_byte_sink to_mem = [&exr](const void *bytes, size_t len) { exr.append(static_cast<const char*>(bytes), len); };
+		if (!encode_exr(buf, to_mem, "test.exr", errstr)) RETURNFAILST(errstr);
+		const std::string result = exr_decode_check(exr, buf, tc.names, tc.src_channel);
+		if (result != "ok") return result + std::string(", format ") + std::to_string(tc.pixfmt);
+	}
+	// integer buffers are refused before anything is written
+	simple_packed_buf color;
+	if (!color.init_full(2, 2, BUF_PIX_FMT_RGBA)) RETURNFAILST("init rgba");
+	std::string exr, errstr;
+	const exr_byte_sink to_mem = [&exr](const void *bytes, size_t len) { exr.append(static_cast<const char*>(bytes), len); };
+	if (encode_exr(color, to_mem, "test.exr", errstr) || !exr.empty()) RETURNFAILST("exr accepted an 8-bit buffer");
+
+	// r16g16_float targets also go to png, as R and G with blue at 0
+	simple_packed_buf rg, scratch;
+	if (!rg.init_full(3, 1, BUF_PIX_FMT_RGF32)) RETURNFAILST("init rg");
+	const float rgvals[6] = { 0.0f, 1.0f, 0.5f, -2.0f, 7.0f, std::numeric_limits<float>::quiet_NaN() };
+	memcpy(rg.data<float>(), rgvals, sizeof(rgvals));
+	const simple_packed_buf *png_rows = packedbuf_as_8bit_rgb(rg, scratch);
+	if (png_rows == nullptr || png_rows->pixfmt != BUF_PIX_FMT_RGB24) RETURNFAILST("rgf32 has no 8-bit png form");
+	const uint8_t expected[9] = { 0, 255, 0, 188, 0, 0, 255, 0, 0 };
+	if (memcmp(png_rows->cdata<uint8_t>(), expected, 9) != 0) RETURNFAILST("rgf32 as 8-bit rgb");
+	return "ok";
+}
+
+std::string run_png16depth_tests() {
+	// a floor receding from 0.3 m to the far plane, with holes, sky and a few values no code can hold
+	simple_packed_buf depth;
+	if (!depth.init_full(67, 45, BUF_PIX_FMT_GRAYF32)) RETURNFAILST("init");
+	for (size_t ii = 0; ii < depth.height; ++ii) {
+		float *row = depth.rowptr<float>(ii);
+		for (size_t jj = 0; jj < depth.width; ++jj) {
+			row[jj] = 0.3f * std::pow(1.25f, static_cast<float>(ii) + 0.01f * static_cast<float>(jj));
+		}
+	}
+	depth.rowptr<float>(3)[5] = std::numeric_limits<float>::quiet_NaN();
+	depth.rowptr<float>(4)[6] = std::numeric_limits<float>::infinity();
+	depth.rowptr<float>(5)[7] = 0.0f;
+	depth.rowptr<float>(6)[8] = 1e9f;
+	DepthQuantization linear;
+	linear.mode = DepthQuant_Linear;
+	linear.near_depth = 0.0;
+	linear.far_depth = 65.0;
+	DepthQuantization logq;
+	for (const DepthQuantization &quant : { linear, logq }) {
+		std::vector<uint8_t> png, pixels;
+		std::vector<std::pair<std::string, std::string>> text;
+		std::string errstr;
+		const std::string which = (quant.mode == DepthQuant_Log) ? "log: " : "linear: ";
+		if (!encode_png16depth_to_mem(depth, quant, png, errstr)) RETURNFAILST(which + errstr);
+		uint32_t width = 0, height = 0;
+		size_t bpp = 0;
+		if (!decode_png_rows(png, width, height, bpp, pixels, errstr, &text)) RETURNFAILST(which + errstr);
+		if (width != depth.width || height != depth.height || bpp != 2) RETURNFAILST(which + "header");
+		// the file alone is enough to get depth back: its tEXt chunk holds the formula's scale and offset
+		if (text.size() != 1 || text[0].first != "depth_quantization") RETURNFAILST(which + "tEXt chunk");
+		const nlohmann::json meta = nlohmann::json::parse(text[0].second);
+		const double scale = meta["scale"].get<double>(), offset = meta["offset"].get<double>();
+		for (size_t ii = 0; ii < depth.height; ++ii) {
+			for (size_t jj = 0; jj < depth.width; ++jj) {
+				const size_t at = (ii * depth.width + jj) * 2;
+				const uint16_t code = static_cast<uint16_t>((pixels[at] << 8) | pixels[at + 1]);
+				const float orig = depth.crowptr<float>(ii)[jj];
+				if (code != quant.encode(orig)) RETURNFAILST(which + std::string("code at ") + std::to_string(ii) + "," + std::to_string(jj));
+				if (!(orig > 0.0f) || !std::isfinite(orig)) {
+					if (code != DepthQuantization::no_depth_code) RETURNFAILST(which + "no-depth pixel");
+					continue;
+				}
+				if (orig < quant.near_depth || orig > quant.far_depth) continue; // clamped
+				const double back = (quant.mode == DepthQuant_Log) ? std::exp(offset + scale * code) : (offset + scale * code);
+				const double err = (quant.mode == DepthQuant_Log) ? std::abs(std::log(back / orig)) : std::abs(back - orig);
+				if (err > 0.5 * scale + 1e-6) RETURNFAILST(which + std::string("round trip error ") + std::to_string(err) + std::string(" at depth ") + std::to_string(orig));
+			}
+		}
+	}
+	std::vector<uint8_t> png;
+	std::string errstr;
+	simple_packed_buf rawdepth;
+	if (!rawdepth.init_full(4, 4, BUF_PIX_FMT_GRAYU32)) RETURNFAILST("init raw");
+	if (encode_png16depth_to_mem(rawdepth, logq, png, errstr)) RETURNFAILST("coded raw integer depth");
+	return "ok";
+}
@@ -1,7 +1,11 @@
 #pragma once
 // Copyright (C) 2022 Jason Bunk
 #include "gcv_utils/simple_packed_buf.h" 
+#include "gcv_utils/depth_frame_stats.h"
+#include "gcv_utils/depth_quantize.h"
+#include "gcv_utils/epr_lz4.h"
 #include <string>
+#include <functional>
 
 enum ImageWriterType {
 	ImageWriter_none    = 0,
@@ -9,13 +13,26 @@ enum ImageWriterType {
 	ImageWriter_numpy   = (1 << 1),
 	ImageWriter_fpzip   = (1 << 2),
 	ImageWriter_epr     = (1 << 3),
-	ImageWriter_end     = (1 << 4),
+	ImageWriter_png16   = (1 << 4), // 16-bit png for RGB48/RGBA64 buffers and 16-bit grayscale depth previews, like STB_png otherwise; replaces STB_png
+	ImageWriter_exr     = (1 << 5), // float buffers as uncompressed OpenEXR
+	ImageWriter_fpng    = (1 << 6), // 8-bit color png through fpng: much faster than STB_png, slightly larger files; depth as STB_png; replaces STB_png
+	ImageWriter_png_strips = (1 << 7), // 8-bit png deflated in strips of rows on the writer row pool, for 8K and panorama frames; depth as an 8-bit preview; replaces STB_png
+	ImageWriter_png16depth = (1 << 8), // float depth as 16-bit codes of depth_quant into <name>_u16.png, the scale in a tEXt chunk (depth_quantize.h)
+	ImageWriter_fpzip_tiled = (1 << 9), // float depth as bands of fpzip streams compressed on the writer row pool, into .fpzt (fpzip_tiled.h)
+	ImageWriter_epr_lz4 = (1 << 10), // float depth as byte-shuffled LZ4 bands with checksums, into .epr v2 (epr_lz4.h); replaces epr
+	ImageWriter_end     = (1 << 11),
 };
 
 struct queue_item_image2write {
 	uint64_t writers = ImageWriter_none;
 	simple_packed_buf mybuf;
 	std::string filepath_noexten;
+	DepthFrameStats depth_stats; // gathered while copying depth textures; empty otherwise
+	DepthQuantization depth_quant; // codes of ImageWriter_png16depth
+	EprLz4Settings epr_settings; // ImageWriter_epr_lz4
+	// Set when the render thread only copied the texture's rows: the writer thread calls it before writing,
+	// to fill mybuf and depth_stats. Returning false fails the image; clearing writers drops it without an error.
+	std::function<bool(queue_item_image2write &item, std::string &errstr)> convert_before_write;
 
 	queue_item_image2write(uint64_t image_writers,
 		const std::string &filepath_noextension)
@@ -23,3 +40,22 @@ struct queue_item_image2write {
 
 	bool write_to_disk(std::string &errstr) const;
 };
+
+// return error string if test failed; "ok" means the robust depth range matched the heap-based reference,
+// the grayscale depth previews encoded like stb would, and the files the png save functions wrote decoded to them
+std::string run_depth_preview_png_tests();
+
+// return error string if test failed; "ok" means 16-bit depth codes read back from the png, through the scale and
+// offset in its tEXt chunk, came within half a quantization step of the float depth
+std::string run_png16depth_tests();
+
+// times the depth png preview of a GRAYF32 frame against the previous heap + RGB24 path; returns a summary
+std::string benchmark_depth_preview_png(const simple_packed_buf &depth, int repeats = 3);
+
+// return error string if test failed; "ok" means 16-bit and fpng color pngs decoded back to the buffers they were written from,
+// 16-bit ones also from the files save_packedbuf_as_16bit_png_image wrote
+std::string run_color_png_writer_tests();
+
+// return error string if test failed; "ok" means float buffers encoded as exr read back bit for bit, channel by
+// channel from each line's offset, and RGF32 packed into 8-bit RGB for png
+std::string run_exr_writer_tests();
@@ -0,0 +1,377 @@
+#include "gcv_utils/image_write_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+std::string WriteQueueStats::summary() const {
+	char buf[320];
+	snprintf(buf, sizeof(buf), "%zu waiting (%llu MB, peak %zu / %llu MB), %llu written, %llu dropped oldest, %llu dropped newest, "
+		"%llu producer waits (%.1f ms), %zu writer threads (peak %zu)",
+		depth_items, static_cast<unsigned long long>(depth_bytes >> 20), peak_items, static_cast<unsigned long long>(peak_bytes >> 20),
+		static_cast<unsigned long long>(written), static_cast<unsigned long long>(dropped_oldest), static_cast<unsigned long long>(dropped_newest),
+		static_cast<unsigned long long>(producer_waits), producer_wait_ms, num_threads, peak_threads);
+	return std::string(buf);
+}
+
+image_write_queue::~image_write_queue() {
+	stop();
+	delete_waiting();
+}
+
+void image_write_queue::work(std::list<worker>::iterator self) {
+	std::unique_lock<std::mutex> lock(mtx);
+	const auto has_news = [this] { return !is_running || !waiting.empty() || num_live > limits.max_threads; };
+	while (true) {
+		++num_idle;
+		bool idle_too_long = false;
+		if (num_live > limits.min_threads) {
+			idle_too_long = !cv_item.wait_for(lock, std::chrono::milliseconds(limits.idle_retire_ms), has_news);
+		} else {
+			cv_item.wait(lock, has_news);
+		}
+		--num_idle;
+		if (!is_running || num_live > limits.max_threads) break;
+		if (idle_too_long) {
+			if (num_live > limits.min_threads) break;
+			continue;
+		}
+		const queued qq = waiting.front();
+		waiting.pop_front();
+		counters.depth_items = waiting.size();
+		counters.depth_bytes -= qq.bytes;
+		++num_writing;
+		cv_space.notify_all();
+		lock.unlock();
+		write_fn(*qq.item);
+		delete qq.item;
+		lock.lock();
+		--num_writing;
+		++counters.written;
+		if (waiting.empty() && num_writing == 0) cv_space.notify_all();
+	}
+	--num_live;
+	self->exited = true;
+}
+
+void image_write_queue::spawn_worker_locked() {
+	workers.emplace_back();
+	const std::list<worker>::iterator self = std::prev(workers.end());
+	++num_live;
+	counters.peak_threads = std::max(counters.peak_threads, num_live);
+	self->thread = std::thread(&image_write_queue::work, this, self);
+}
+
+void image_write_queue::join_exited_locked() {
+	// an exited worker set its flag under the lock and never takes it again, so it can be joined while holding it
+	for (std::list<worker>::iterator it = workers.begin(); it != workers.end();) {
+		if (it->exited) {
+			it->thread.join();
+			it = workers.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+bool image_write_queue::has_room_locked(uint64_t bytes) const {
+	return waiting.empty() || (waiting.size() < limits.max_items && counters.depth_bytes + bytes <= limits.max_bytes);
+}
+
+static WriteQueueLimits sanitized_limits(WriteQueueLimits limits) {
+	limits.max_items = std::max<size_t>(limits.max_items, 1);
+	limits.max_threads = std::max<size_t>(std::max<size_t>(limits.max_threads, limits.min_threads), 1);
+	return limits;
+}
+
+void image_write_queue::start(const WriteQueueLimits &new_limits, write_function fn) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!is_running) {
+			join_exited_locked();
+			write_fn = std::move(fn);
+			is_running = true;
+		}
+	}
+	set_limits(new_limits);
+}
+
+static bool same_limits(const WriteQueueLimits &aa, const WriteQueueLimits &bb) {
+	return aa.max_items == bb.max_items && aa.max_bytes == bb.max_bytes && aa.policy == bb.policy
+		&& aa.min_threads == bb.min_threads && aa.max_threads == bb.max_threads && aa.idle_retire_ms == bb.idle_retire_ms;
+}
+
+void image_write_queue::set_limits(const WriteQueueLimits &new_limits) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		join_exited_locked();
+		const WriteQueueLimits sanitized = sanitized_limits(new_limits);
+		// the pool passes its options with every image: nothing to wake anyone for when they did not change
+		if (same_limits(sanitized, limits) && (!is_running || num_live >= limits.min_threads)) return;
+		limits = sanitized;
+		while (is_running && (num_live < limits.min_threads || (num_live < limits.max_threads && waiting.size() > num_live))) {
+			spawn_worker_locked();
+		}
+	}
+	// surplus writers stop, and blocked producers may fit now
+	cv_item.notify_all();
+	cv_space.notify_all();
+}
+
+void image_write_queue::stop() {
+	std::list<worker> joining;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		is_running = false;
+		joining.splice(joining.end(), workers);
+	}
+	cv_item.notify_all();
+	cv_space.notify_all();
+	for (worker &ww : joining) ww.thread.join();
+}
+
+bool image_write_queue::running() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return is_running;
+}
+
+size_t image_write_queue::num_threads() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return num_live;
+}
+
+WriteQueuePushResult image_write_queue::push(queue_item_image2write *item, uint64_t bytes) {
+	std::vector<queue_item_image2write *> dropped;
+	WriteQueuePushResult result = WriteQueuePush_Queued;
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		join_exited_locked();
+		++counters.pushed;
+		if (!has_room_locked(bytes) && limits.policy == WriteQueue_BlockProducer && is_running) {
+			++counters.producer_waits;
+			const std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+			cv_space.wait(lock, [&] { return !is_running || limits.policy != WriteQueue_BlockProducer || has_room_locked(bytes); });
+			counters.producer_wait_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+		}
+		// still full: the writers stopped, or the policy was changed to a dropping one while waiting
+		if (!has_room_locked(bytes)) {
+			if (limits.policy == WriteQueue_DropOldest) {
+				while (!has_room_locked(bytes)) {
+					dropped.push_back(waiting.front().item);
+					counters.depth_bytes -= waiting.front().bytes;
+					waiting.pop_front();
+					++counters.dropped_oldest;
+				}
+				result = WriteQueuePush_QueuedDroppedOldest;
+			} else {
+				dropped.push_back(item);
+				++counters.dropped_newest;
+				result = WriteQueuePush_DroppedNewest;
+			}
+		}
+		if (result != WriteQueuePush_DroppedNewest) {
+			waiting.push_back(queued{ item, bytes });
+			counters.depth_bytes += bytes;
+			counters.peak_bytes = std::max(counters.peak_bytes, counters.depth_bytes);
+			counters.peak_items = std::max(counters.peak_items, waiting.size());
+			// more images waiting than writers: one more writer, up to max_threads
+			if (is_running && num_live < limits.max_threads && waiting.size() > num_live) spawn_worker_locked();
+		}
+		counters.depth_items = waiting.size();
+	}
+	cv_item.notify_one();
+	for (queue_item_image2write *dd : dropped) delete dd;
+	return result;
+}
+
+void image_write_queue::wait_until_idle() {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv_space.wait(lock, [this] { return !is_running || (waiting.empty() && num_writing == 0); });
+}
+
+size_t image_write_queue::delete_waiting() {
+	std::deque<queued> deleting;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		deleting.swap(waiting);
+		counters.depth_items = 0;
+		counters.depth_bytes = 0;
+	}
+	cv_space.notify_all();
+	for (const queued &qq : deleting) delete qq.item;
+	return deleting.size();
+}
+
+WriteQueueStats image_write_queue::stats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	WriteQueueStats result = counters;
+	result.num_threads = num_live;
+	return result;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+namespace {
+// holds the writers inside the write function until opened
+struct test_gate {
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool open = false;
+	std::vector<std::string> written;
+
+	void set_open(bool open_) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			open = open_;
+		}
+		cv.notify_all();
+	}
+	void write(queue_item_image2write &item) {
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock, [this] { return open; });
+		written.push_back(item.filepath_noexten);
+	}
+	std::string written_names() {
+		std::lock_guard<std::mutex> lock(mtx);
+		std::string names;
+		for (const std::string &name : written) names += name;
+		return names;
+	}
+};
+// declared after the queue, so a failing test opens the gate before the queue joins its writers
+struct test_gate_opener {
+	test_gate &gate;
+	~test_gate_opener() { gate.set_open(true); }
+};
+}
+
+template<typename Pred>
+static bool wait_for_test(Pred pred, int max_ms = 2000) {
+	for (int ms = 0; ms < max_ms; ++ms) {
+		if (pred()) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return pred();
+}
+
+static queue_item_image2write *test_item(const char *name) {
+	return new queue_item_image2write(ImageWriter_none, name);
+}
+
+std::string run_image_write_queue_tests() {
+	test_gate gate;
+	const image_write_queue::write_function write_fn = [&gate](queue_item_image2write &item) { gate.write(item); };
+	WriteQueueLimits limits;
+	limits.max_items = 2;
+	limits.min_threads = 1;
+	limits.max_threads = 1;
+
+	// blocking: the fourth push waits until the writer makes room, and everything is written in order
+	{
+		limits.policy = WriteQueue_BlockProducer;
+		gate.set_open(false);
+		gate.written.clear();
+		image_write_queue queue;
+		test_gate_opener opener{ gate };
+		queue.start(limits, write_fn);
+		queue.push(test_item("a"), 10);
+		if (!wait_for_test([&] { return queue.stats().depth_items == 0; })) RETURNFAILST("block: writer did not take the first image");
+		queue.push(test_item("b"), 10);
+		queue.push(test_item("c"), 10);
+		std::atomic<bool> pushed{ false };
+		std::thread producer([&] { queue.push(test_item("d"), 10); pushed = true; });
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		const bool pushed_early = pushed;
+		gate.set_open(true);
+		producer.join();
+		if (pushed_early) RETURNFAILST("block: producer did not wait");
+		queue.wait_until_idle();
+		if (queue.stats().written != 4) RETURNFAILST(std::string("block: ") + queue.stats().summary());
+		const WriteQueueStats st = queue.stats();
+		if (gate.written_names() != "abcd" || st.producer_waits != 1 || st.dropped_newest + st.dropped_oldest != 0 || st.peak_items != 2) RETURNFAILST(std::string("block: ") + gate.written_names() + std::string(", ") + st.summary());
+	}
+
+	// dropping the newest or the oldest image when full
+	const WriteQueuePolicy dropping[2] = { WriteQueue_DropNewest, WriteQueue_DropOldest };
+	for (const WriteQueuePolicy policy : dropping) {
+		gate.set_open(false);
+		gate.written.clear();
+		image_write_queue queue;
+		test_gate_opener opener{ gate };
+		limits.policy = policy;
+		queue.start(limits, write_fn);
+		queue.push(test_item("a"), 10);
+		if (!wait_for_test([&] { return queue.stats().depth_items == 0; })) RETURNFAILST("drop: writer did not take the first image");
+		queue.push(test_item("b"), 10);
+		queue.push(test_item("c"), 10);
+		const WriteQueuePushResult res = queue.push(test_item("d"), 10);
+		gate.set_open(true);
+		if (!wait_for_test([&] { return queue.stats().depth_items == 0 && queue.stats().written == 3; })) RETURNFAILST(std::string("drop: ") + queue.stats().summary());
+		const WriteQueueStats st = queue.stats();
+		if (policy == WriteQueue_DropNewest && (res != WriteQueuePush_DroppedNewest || gate.written_names() != "abc" || st.dropped_newest != 1 || st.producer_waits != 0)) RETURNFAILST(std::string("drop newest: ") + gate.written_names() + std::string(", ") + st.summary());
+		if (policy == WriteQueue_DropOldest && (res != WriteQueuePush_QueuedDroppedOldest || gate.written_names() != "acd" || st.dropped_oldest != 1 || st.producer_waits != 0)) RETURNFAILST(std::string("drop oldest: ") + gate.written_names() + std::string(", ") + st.summary());
+	}
+
+	// the byte cap: one image larger than the cap alone is taken, a second one doesn't fit
+	{
+		gate.set_open(false);
+		gate.written.clear();
+		image_write_queue queue;
+		test_gate_opener opener{ gate };
+		limits.policy = WriteQueue_DropNewest;
+		limits.max_items = 100;
+		limits.max_bytes = 100;
+		queue.start(limits, write_fn);
+		queue.push(test_item("a"), 10);
+		if (!wait_for_test([&] { return queue.stats().depth_items == 0; })) RETURNFAILST("bytes: writer did not take the first image");
+		if (queue.push(test_item("b"), 500) != WriteQueuePush_Queued) RETURNFAILST("bytes: refused a large image in an empty queue");
+		if (queue.push(test_item("c"), 1) != WriteQueuePush_DroppedNewest) RETURNFAILST("bytes: went over the cap");
+		if (queue.stats().depth_bytes != 500 || queue.stats().peak_bytes != 500) RETURNFAILST(std::string("bytes: ") + queue.stats().summary());
+	}
+
+	// writers scale up with the backlog and retire when idle, never below min_threads
+	{
+		gate.set_open(false);
+		gate.written.clear();
+		image_write_queue queue;
+		test_gate_opener opener{ gate };
+		limits = WriteQueueLimits();
+		limits.min_threads = 1;
+		limits.max_threads = 4;
+		limits.idle_retire_ms = 20;
+		queue.start(limits, write_fn);
+		if (queue.num_threads() != 1) RETURNFAILST("scale: did not start min_threads");
+		for (int ii = 0; ii < 10; ++ii) queue.push(test_item("x"), 10);
+		if (!wait_for_test([&] { return queue.num_threads() == 4 && queue.stats().depth_items == 6; })) RETURNFAILST(std::string("scale up: ") + queue.stats().summary());
+		gate.set_open(true);
+		if (!wait_for_test([&] { return queue.stats().written == 10 && queue.num_threads() == 1; })) RETURNFAILST(std::string("scale down: ") + queue.stats().summary());
+		std::this_thread::sleep_for(std::chrono::milliseconds(60));
+		if (queue.num_threads() != 1 || queue.stats().peak_threads != 4) RETURNFAILST(std::string("scale down: ") + queue.stats().summary());
+		// lowering max_threads below the writers running stops the surplus
+		limits.min_threads = 3;
+		limits.max_threads = 3;
+		queue.set_limits(limits);
+		if (queue.num_threads() != 3) RETURNFAILST("raising min_threads");
+		limits.min_threads = 1;
+		limits.max_threads = 2;
+		queue.set_limits(limits);
+		if (!wait_for_test([&] { return queue.num_threads() == 2; })) RETURNFAILST("lowering max_threads");
+	}
+
+	// without writers, images wait until they are deleted, and a full blocking queue does not block
+	{
+		image_write_queue queue;
+		limits = WriteQueueLimits();
+		limits.max_items = 2;
+		limits.policy = WriteQueue_BlockProducer;
+		queue.start(limits, write_fn);
+		queue.stop();
+		if (queue.running() || queue.num_threads() != 0) RETURNFAILST("stop");
+		queue.push(test_item("a"), 10);
+		queue.push(test_item("b"), 10);
+		if (queue.push(test_item("c"), 10) != WriteQueuePush_DroppedNewest) RETURNFAILST("stopped: full queue");
+		if (queue.delete_waiting() != 2 || queue.stats().depth_items != 0 || queue.stats().depth_bytes != 0) RETURNFAILST("delete_waiting");
+	}
+	return "ok";
+}
@@ -0,0 +1,113 @@
+#pragma once
+// Images waiting for the writer threads of image_writer_thread_pool. Idle writers sleep on a condition variable
+// instead of polling, and the queue is bounded in items and bytes so a recording that outruns the disk can't grow
+// memory without limit: the producer then waits (the default, so no image is lost), or the oldest or newest image
+// is dropped. Writers between min_threads and max_threads: one more starts whenever more images wait than there are
+// writers, and writers above min_threads stop after idle_retire_ms without work.
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "gcv_utils/image_queue_entry.h"
+
+enum WriteQueuePolicy {
+	WriteQueue_BlockProducer = 0, // every image is written; the render thread waits for room
+	WriteQueue_DropOldest,        // the render thread never waits; the longest waiting images make room
+	WriteQueue_DropNewest,        // the render thread never waits; images that find the queue full are not written
+};
+
+struct WriteQueueLimits {
+	size_t max_items = 64;
+	uint64_t max_bytes = uint64_t(2) << 30; // of the images' buffers; one image alone is always taken
+	WriteQueuePolicy policy = WriteQueue_BlockProducer;
+	size_t min_threads = 1;
+	size_t max_threads = 4;
+	uint32_t idle_retire_ms = 2000;
+};
+
+enum WriteQueuePushResult {
+	WriteQueuePush_Queued = 0,
+	WriteQueuePush_QueuedDroppedOldest, // queued after older images were dropped
+	WriteQueuePush_DroppedNewest,       // the image itself was dropped
+};
+
+struct WriteQueueStats {
+	size_t depth_items = 0;
+	uint64_t depth_bytes = 0;
+	size_t peak_items = 0;
+	uint64_t peak_bytes = 0;
+	uint64_t pushed = 0;
+	uint64_t written = 0; // handed to the write function and finished
+	uint64_t dropped_oldest = 0;
+	uint64_t dropped_newest = 0;
+	uint64_t producer_waits = 0; // pushes that waited for room with WriteQueue_BlockProducer
+	double producer_wait_ms = 0.0;
+	size_t num_threads = 0;
+	size_t peak_threads = 0;
+
+	std::string summary() const;
+};
+
+class image_write_queue {
+public:
+	// converts and writes one image, on a writer thread; the queue deletes the image afterwards
+	typedef std::function<void(queue_item_image2write &item)> write_function;
+private:
+	struct queued {
+		queue_item_image2write *item;
+		uint64_t bytes;
+	};
+	struct worker {
+		std::thread thread;
+		bool exited = false;
+	};
+	std::deque<queued> waiting;
+	std::list<worker> workers;
+	mutable std::mutex mtx;
+	std::condition_variable cv_item;
+	std::condition_variable cv_space;
+	WriteQueueLimits limits;
+	WriteQueueStats counters;
+	write_function write_fn;
+	size_t num_live = 0; // workers that have not exited
+	size_t num_idle = 0; // of those, waiting for an image
+	size_t num_writing = 0;
+	bool is_running = false;
+
+	void work(std::list<worker>::iterator self);
+	void spawn_worker_locked();
+	void join_exited_locked();
+	bool has_room_locked(uint64_t bytes) const;
+public:
+	image_write_queue() = default;
+	image_write_queue(const image_write_queue &) = delete;
+	image_write_queue &operator=(const image_write_queue &) = delete;
+	~image_write_queue();
+
+	// starts min_threads writers; queued images are written by fn
+	void start(const WriteQueueLimits &new_limits, write_function fn);
+	// new capacity, policy and thread range take effect right away; writers above max_threads stop after their image
+	void set_limits(const WriteQueueLimits &new_limits);
+	// joins the writers once they finish their current image; waiting images stay queued
+	void stop();
+	bool running() const;
+	size_t num_threads() const;
+
+	// takes ownership of item; bytes is what it holds while waiting (its buffer, or the raw rows it will convert)
+	WriteQueuePushResult push(queue_item_image2write *item, uint64_t bytes);
+	// blocks until no image waits or is being written (or the writers stop)
+	void wait_until_idle();
+	// deletes the images that are still waiting, and returns how many
+	size_t delete_waiting();
+
+	WriteQueueStats stats() const;
+};
+
+// return error string if test failed; "ok" means every policy kept its limits and counted its drops, blocked
+// producers resumed, and writers scaled up with the backlog and back down when idle
+std::string run_image_write_queue_tests();
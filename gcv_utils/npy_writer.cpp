@@ -0,0 +1,298 @@
+#include "gcv_utils/npy_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+size_t npy_dtype_size(NpyDtype dtype) {
+	switch (dtype) {
+	case NpyDtype_u8: return 1;
+	case NpyDtype_u16: case NpyDtype_f16: return 2;
+	case NpyDtype_f32: case NpyDtype_u32: return 4;
+	}
+	return 0;
+}
+
+static const char *npy_dtype_descr(NpyDtype dtype) {
+	switch (dtype) {
+	case NpyDtype_u8: return "|u1";
+	case NpyDtype_u16: return "<u2";
+	case NpyDtype_f16: return "<f2";
+	case NpyDtype_f32: return "<f4";
+	case NpyDtype_u32: return "<u4";
+	}
+	return "";
+}
+
+#ifdef _WIN32
+bool write_spans_to_file(const std::string &filepath, const file_write_span *spans, size_t num_spans, std::string &errstr) {
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		errstr += std::string("failed to create ") + filepath + std::string(": error ") + std::to_string(GetLastError());
+		return false;
+	}
+	bool ok = true;
+	for (size_t ss = 0; ss < num_spans && ok; ++ss) {
+		const char *src = static_cast<const char*>(spans[ss].data);
+		size_t left = spans[ss].size;
+		while (left > 0) {
+			// WriteFile takes a DWORD of bytes
+			const DWORD chunk = static_cast<DWORD>(std::min<size_t>(left, size_t(1) << 30));
+			DWORD written = 0;
+			if (!WriteFile(file, src, chunk, &written, nullptr) || written == 0) {
+				errstr += std::string("failed to write ") + filepath + std::string(": error ") + std::to_string(GetLastError());
+				ok = false;
+				break;
+			}
+			src += written;
+			left -= written;
+		}
+	}
+	if (!CloseHandle(file) && ok) {
+		errstr += std::string("failed to close ") + filepath;
+		ok = false;
+	}
+	return ok;
+}
+#else
+bool write_spans_to_file(const std::string &filepath, const file_write_span *spans, size_t num_spans, std::string &errstr) {
+	const int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		errstr += std::string("failed to create ") + filepath + std::string(": ") + std::strerror(errno);
+		return false;
+	}
+	bool ok = true;
+	size_t next = 0, done_in_next = 0; // the first span not fully written, and how much of it is
+	while (ok) {
+		while (next < num_spans && done_in_next == spans[next].size) {
+			++next;
+			done_in_next = 0;
+		}
+		if (next >= num_spans) break;
+		iovec iov[16];
+		int num_iov = 0;
+		for (size_t ss = next; ss < num_spans && num_iov < 16; ++ss) {
+			const size_t skip = (ss == next) ? done_in_next : 0;
+			if (spans[ss].size == skip) continue;
+			iov[num_iov].iov_base = const_cast<char*>(static_cast<const char*>(spans[ss].data) + skip);
+			iov[num_iov].iov_len = spans[ss].size - skip;
+			++num_iov;
+		}
+		const ssize_t written = writev(fd, iov, num_iov);
+		if (written < 0 && errno == EINTR) continue;
+		if (written <= 0) {
+			errstr += std::string("failed to write ") + filepath + std::string(": ") + std::strerror(errno);
+			ok = false;
+			break;
+		}
+		// a short write (e.g. over 2 GB at once) leaves off anywhere, even inside a span
+		size_t advance = static_cast<size_t>(written);
+		while (advance > 0) {
+			const size_t left = spans[next].size - done_in_next;
+			if (advance < left) {
+				done_in_next += advance;
+				break;
+			}
+			advance -= left;
+			++next;
+			done_in_next = 0;
+		}
+	}
+	if (close(fd) != 0 && ok) {
+		errstr += std::string("failed to close ") + filepath + std::string(": ") + std::strerror(errno);
+		ok = false;
+	}
+	return ok;
+}
+#endif
+
+size_t format_npy_header(NpyDtype dtype, const size_t *shape, size_t ndim, char (&header)[npy_max_header_bytes]) {
+	if (ndim == 0 || ndim > npy_max_ndim || npy_dtype_size(dtype) == 0) return 0;
+	char shapestr[npy_max_ndim * 24];
+	size_t shapelen = 0;
+	for (size_t dd = 0; dd < ndim; ++dd) {
+		shapelen += snprintf(shapestr + shapelen, sizeof(shapestr) - shapelen, (dd == 0) ? "%zu" : ", %zu", shape[dd]);
+	}
+	if (ndim == 1) shapestr[shapelen++] = ','; // a 1-tuple
+	shapestr[shapelen] = '\0';
+	// magic, version 1.0, little-endian header length, then the dict
+	std::memcpy(header, "\x93NUMPY\x01\x00", 8);
+	const int dictlen = snprintf(header + 10, npy_max_header_bytes - 10, "{'descr': '%s', 'fortran_order': False, 'shape': (%s), }",
+		npy_dtype_descr(dtype), shapestr);
+	if (dictlen <= 0) return 0;
+	// spaces then a newline up to the next multiple of 64, so the data is aligned for memory mapping
+	const size_t total = (10 + static_cast<size_t>(dictlen) + 1 + 63) / 64 * 64;
+	if (total > npy_max_header_bytes) return 0;
+	std::memset(header + 10 + dictlen, ' ', total - 10 - dictlen - 1);
+	header[total - 1] = '\n';
+	header[8] = static_cast<char>((total - 10) & 0xff);
+	header[9] = static_cast<char>((total - 10) >> 8);
+	return total;
+}
+
+bool save_npy(const std::string &filepath, NpyDtype dtype, const size_t *shape, size_t ndim, const void *data, std::string &errstr) {
+	char header[npy_max_header_bytes];
+	const size_t headerlen = format_npy_header(dtype, shape, ndim, header);
+	if (headerlen == 0) {
+		errstr += std::string("npy: cannot describe an array of ") + std::to_string(ndim) + std::string(" dimensions");
+		return false;
+	}
+	size_t num_bytes = npy_dtype_size(dtype);
+	for (size_t dd = 0; dd < ndim; ++dd) num_bytes *= shape[dd];
+	const file_write_span spans[2] = { { header, headerlen }, { data, num_bytes } };
+	return write_spans_to_file(filepath, spans, 2, errstr);
+}
+
+bool save_packedbuf_as_npy(const std::string &filepath, const simple_packed_buf &srcBuf, std::string &errstr) {
+	NpyDtype dtype = NpyDtype_u8;
+	switch (srcBuf.pixfmt) {
+	case BUF_PIX_FMT_RGB24: case BUF_PIX_FMT_RGBA: case BUF_PIX_FMT_BGRA: dtype = NpyDtype_u8; break;
+	case BUF_PIX_FMT_RGB48: case BUF_PIX_FMT_RGBA64: dtype = NpyDtype_u16; break;
+	case BUF_PIX_FMT_GRAYF32: case BUF_PIX_FMT_RGF32: case BUF_PIX_FMT_RGBAF32: dtype = NpyDtype_f32; break;
+	case BUF_PIX_FMT_GRAYU32: dtype = NpyDtype_u32; break;
+	default:
+		errstr += std::string("npy: unsupported buf format ") + std::to_string(srcBuf.pixfmt);
+		return false;
+	}
+	const size_t num_channels = srcBuf.bytes_per_pixel() / npy_dtype_size(dtype);
+	const size_t shape[3] = { srcBuf.height, srcBuf.width, num_channels };
+	return save_npy(filepath, dtype, shape, (num_channels > 1) ? 3 : 2, srcBuf.cdata<void>(), errstr);
+}
+
+// the patterns check_npy_roundtrip.py expects, element ii of the flattened array
+struct npy_roundtrip_sample {
+	const char *name;
+	NpyDtype dtype;
+	size_t shape[3];
+	size_t ndim;
+};
+static const npy_roundtrip_sample npy_roundtrip_samples[] = {
+	{ "u8", NpyDtype_u8, { 5, 7, 3 }, 3 },    // ii % 251
+	{ "u16", NpyDtype_u16, { 6, 5, 4 }, 3 },  // (ii * 40503) % 2^16
+	{ "f16", NpyDtype_f16, { 9, 11, 0 }, 2 }, // bits (ii * 97) % 0x7c00, finite halves
+	{ "f32", NpyDtype_f32, { 13, 17, 0 }, 2 }, // (ii - 100) * 0.375
+	{ "f32_1d", NpyDtype_f32, { 10, 0, 0 }, 1 },
+	{ "u32", NpyDtype_u32, { 4, 3, 0 }, 2 },  // (ii * 2654435761) % 2^32
+};
+
+static std::vector<uint8_t> npy_roundtrip_sample_data(const npy_roundtrip_sample &sample) {
+	size_t count = 1;
+	for (size_t dd = 0; dd < sample.ndim; ++dd) count *= sample.shape[dd];
+	std::vector<uint8_t> data(count * npy_dtype_size(sample.dtype));
+	for (size_t ii = 0; ii < count; ++ii) {
+		switch (sample.dtype) {
+		case NpyDtype_u8: data[ii] = static_cast<uint8_t>(ii % 251); break;
+		case NpyDtype_u16: { const uint16_t val = static_cast<uint16_t>(ii * 40503u); std::memcpy(&data[ii * 2], &val, 2); break; }
+		case NpyDtype_f16: { const uint16_t val = static_cast<uint16_t>((ii * 97u) % 0x7c00u); std::memcpy(&data[ii * 2], &val, 2); break; }
+		case NpyDtype_f32: { const float val = (static_cast<float>(ii) - 100.0f) * 0.375f; std::memcpy(&data[ii * 4], &val, 4); break; }
+		case NpyDtype_u32: { const uint32_t val = static_cast<uint32_t>(ii * 2654435761u); std::memcpy(&data[ii * 4], &val, 4); break; }
+		}
+	}
+	return data;
+}
+
+bool write_npy_roundtrip_samples(const std::string &dirpath, std::string &errstr) {
+	for (const npy_roundtrip_sample &sample : npy_roundtrip_samples) {
+		const std::vector<uint8_t> data = npy_roundtrip_sample_data(sample);
+		if (!save_npy(dirpath + std::string("/npy_roundtrip_") + sample.name + std::string(".npy"), sample.dtype, sample.shape, sample.ndim, data.data(), errstr)) return false;
+	}
+	return true;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+static std::vector<uint8_t> read_whole_file(const std::string &filepath) {
+	std::ifstream ifs(filepath, std::ios::binary);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+// reads dtype and shape back out of a file's header text the way numpy does, without format_npy_header; false if the
+// header is not one numpy would take
+static bool parse_npy_file_header(const std::vector<uint8_t> &file, std::string &descr, std::vector<size_t> &shape, size_t &data_offset) {
+	if (file.size() < 10 || std::memcmp(file.data(), "\x93NUMPY\x01\x00", 8) != 0) return false;
+	data_offset = 10 + file[8] + 256 * size_t(file[9]);
+	if (data_offset > file.size() || file[data_offset - 1] != '\n') return false;
+	const std::string dict(file.begin() + 10, file.begin() + data_offset);
+	const size_t descr_at = dict.find("'descr': '"), shape_at = dict.find("'shape': ("), shape_end = dict.find(')', shape_at);
+	if (descr_at == std::string::npos || shape_at == std::string::npos || shape_end == std::string::npos
+		|| dict.find("'fortran_order': False") == std::string::npos) return false;
+	descr = dict.substr(descr_at + 10, dict.find('\'', descr_at + 10) - descr_at - 10);
+	shape.clear();
+	for (const char *cc = dict.c_str() + shape_at + 10; *cc != ')';) {
+		char *next = nullptr;
+		shape.push_back(std::strtoull(cc, &next, 10));
+		if (next == cc) return false;
+		cc = next;
+		while (*cc == ',' || *cc == ' ') ++cc;
+	}
+	return true;
+}
+
+std::string run_npy_writer_tests() {
+	std::error_code ec;
+	const std::filesystem::path dir = std::filesystem::temp_directory_path(ec) / "gcv_npy_writer_tests";
+	std::filesystem::create_directories(dir, ec);
+	if (ec) RETURNFAILST("no temp directory");
+	std::string errstr;
+	const std::string path = (dir / "test.npy").string();
+
+	char header[npy_max_header_bytes];
+	const size_t hw[2] = { 1080, 1920 };
+	const size_t headerlen = format_npy_header(NpyDtype_f32, hw, 2, header);
+	const std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': (1080, 1920), }";
+	if (headerlen != 128 || std::memcmp(header, "\x93NUMPY\x01\x00", 8) != 0 || static_cast<uint8_t>(header[8]) + 256 * static_cast<uint8_t>(header[9]) != 118
+		|| std::string(header + 10, dict.size()) != dict || header[127] != '\n' || header[126] != ' ') RETURNFAILST("1080p float header");
+
+	for (const npy_roundtrip_sample &sample : npy_roundtrip_samples) {
+		const std::vector<uint8_t> data = npy_roundtrip_sample_data(sample);
+		if (!save_npy(path, sample.dtype, sample.shape, sample.ndim, data.data(), errstr)) RETURNFAILST(errstr);
+		const std::vector<uint8_t> file = read_whole_file(path);
+		const size_t hlen = format_npy_header(sample.dtype, sample.shape, sample.ndim, header);
+		if (hlen % 64 != 0 || file.size() != hlen + data.size() || std::memcmp(file.data(), header, hlen) != 0
+			|| std::memcmp(file.data() + hlen, data.data(), data.size()) != 0) RETURNFAILST(std::string("bytes of ") + sample.name);
+		// and the header says what numpy needs to read it
+		std::string descr;
+		std::vector<size_t> shape;
+		size_t data_offset = 0;
+		if (!parse_npy_file_header(file, descr, shape, data_offset) || descr != npy_dtype_descr(sample.dtype)
+			|| shape != std::vector<size_t>(sample.shape, sample.shape + sample.ndim) || data_offset != hlen) RETURNFAILST(std::string("header of ") + sample.name);
+	}
+
+	// color keeps its channels as a third axis
+	simple_packed_buf rgba;
+	if (!rgba.init_full(9, 4, BUF_PIX_FMT_RGBA)) RETURNFAILST("init");
+	for (size_t ii = 0; ii < rgba.bytes.size(); ++ii) rgba.bytes[ii] = static_cast<uint8_t>(ii * 7);
+	if (!save_packedbuf_as_npy(path, rgba, errstr)) RETURNFAILST(errstr);
+	const std::vector<uint8_t> rgba_file = read_whole_file(path);
+	std::string rgba_descr;
+	std::vector<size_t> rgba_shape;
+	size_t rgba_offset = 0;
+	if (!parse_npy_file_header(rgba_file, rgba_descr, rgba_shape, rgba_offset) || rgba_descr != "|u1" || rgba_shape != std::vector<size_t>({ 4, 9, 4 })
+		|| rgba_file.size() != rgba_offset + rgba.bytes.size() || std::memcmp(rgba_file.data() + rgba_offset, rgba.bytes.data(), rgba.bytes.size()) != 0) RETURNFAILST("rgba buffer");
+
+	// many spans, some empty
+	const std::string text = "gathered write of several spans";
+	const file_write_span spans[5] = { { text.data(), 9 }, { text.data(), 0 }, { text.data() + 9, 6 }, { text.data() + 15, text.size() - 15 }, { text.data(), 0 } };
+	if (!write_spans_to_file(path, spans, 5, errstr)) RETURNFAILST(errstr);
+	const std::vector<uint8_t> file = read_whole_file(path);
+	if (std::string(file.begin(), file.end()) != text) RETURNFAILST("spans");
+
+	std::string expected_err;
+	const size_t five[5] = { 1, 1, 1, 1, 1 };
+	if (save_npy(path, NpyDtype_u8, five, 5, text.data(), expected_err)) RETURNFAILST("wrote 5 dimensions");
+	if (save_npy((dir / "missing_dir" / "x.npy").string(), NpyDtype_u8, five, 1, text.data(), expected_err)) RETURNFAILST("wrote into a missing directory");
+	std::filesystem::remove_all(dir, ec);
+	return "ok";
+}
@@ -0,0 +1,49 @@
+#pragma once
+// Writes .npy files straight from their pixels: the header is formatted on the stack and handed to the OS together
+// with the payload in one vectored write, without the header vector, the file stream and the two fwrite calls of cnpy.
+// Files are NPY format 1.0, little-endian, C order, with the header padded so the data starts 64-byte aligned.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "gcv_utils/simple_packed_buf.h"
+
+enum NpyDtype {
+	NpyDtype_u8 = 0,
+	NpyDtype_u16,
+	NpyDtype_f16, // IEEE half floats, as uint16 bit patterns
+	NpyDtype_f32,
+	NpyDtype_u32,
+};
+
+size_t npy_dtype_size(NpyDtype dtype);
+
+// one piece of a file, written in order
+struct file_write_span {
+	const void *data;
+	size_t size;
+};
+
+// Creates or truncates filepath and writes the spans one after another: a gathered write (writev) where the OS has one.
+// On Windows the spans go through WriteFile on a single handle; WriteFileGather wants page-sized, page-aligned,
+// unbuffered pieces, which a header does not make.
+bool write_spans_to_file(const std::string &filepath, const file_write_span *spans, size_t num_spans, std::string &errstr);
+
+static constexpr size_t npy_max_ndim = 4;
+static constexpr size_t npy_max_header_bytes = 256;
+
+// the NPY header of an array; returns its length (a multiple of 64), or 0 if ndim is 0 or above npy_max_ndim
+size_t format_npy_header(NpyDtype dtype, const size_t *shape, size_t ndim, char (&header)[npy_max_header_bytes]);
+
+// data holds the product of shape elements of dtype, in C order
+bool save_npy(const std::string &filepath, NpyDtype dtype, const size_t *shape, size_t ndim, const void *data, std::string &errstr);
+
+// height x width (x channels) array of the buffer as it is in memory: BGRA stays in BGRA order, RGB48 is uint16 and so on
+bool save_packedbuf_as_npy(const std::string &filepath, const simple_packed_buf &srcBuf, std::string &errstr);
+
+// Writes one array of every dtype, of a pattern check_npy_roundtrip.py in python_threedee rebuilds, to compare it
+// with what numpy.load reads from the files (capture_bench --npy-bench leaves them in its directory).
+bool write_npy_roundtrip_samples(const std::string &dirpath, std::string &errstr);
+
+// return error string if test failed; "ok" means files of every dtype and rank read back byte for byte, with a header
+// whose dtype and shape parse back the way numpy reads them
+std::string run_npy_writer_tests();
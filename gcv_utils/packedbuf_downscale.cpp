@@ -0,0 +1,177 @@
+#include "gcv_utils/packedbuf_downscale.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+template<typename T> static inline bool is_nan_value(T v) { return v != v; }
+
+// integer channels are summed exactly and rounded to nearest; 2x2 and 4x4 blocks divide by shifting
+template<typename T> struct block_sum { typedef uint32_t type; };
+template<> struct block_sum<uint32_t> { typedef uint64_t type; };
+template<> struct block_sum<float> { typedef double type; };
+
+template<typename T, typename S> static inline T block_mean(S sum, size_t count, int shift) {
+	if (shift >= 0) return static_cast<T>((sum + (S(1) << shift >> 1)) >> shift);
+	return static_cast<T>((sum + count / 2) / count);
+}
+template<typename T> static inline T block_mean(double sum, size_t count, int /*shift*/) {
+	return static_cast<T>(sum / static_cast<double>(count));
+}
+
+// channels, and the common factors 2 and 4, are template parameters so the per-block loops unroll
+template<typename T, size_t channels, size_t fixed_factor>
+static void downscale_typed(const uint8_t *src, size_t src_stride, size_t out_width, size_t out_height,
+	size_t runtime_factor, PackedBufDownscaleFilter filter, uint8_t *dst, size_t dst_stride)
+{
+	const size_t factor = fixed_factor ? fixed_factor : runtime_factor;
+	const size_t count = factor * factor;
+	int shift = -1;
+	if ((count & (count - 1)) == 0) for (shift = 0; (size_t(1) << shift) < count; ++shift) {}
+	for (size_t y = 0; y < out_height; ++y) {
+		T *const out = reinterpret_cast<T *>(dst + y * dst_stride);
+		const uint8_t *const block_row = src + y * factor * src_stride;
+		if (filter == PackedBufDownscale_Nearest) {
+			const T *const in = reinterpret_cast<const T *>(block_row);
+			for (size_t x = 0; x < out_width; ++x) {
+				std::memcpy(out + x * channels, in + x * factor * channels, channels * sizeof(T));
+			}
+			continue;
+		}
+		for (size_t x = 0; x < out_width; ++x) {
+			if (filter == PackedBufDownscale_Box) {
+				typename block_sum<T>::type sums[channels] = {};
+				for (size_t by = 0; by < factor; ++by) {
+					const T *in = reinterpret_cast<const T *>(block_row + by * src_stride) + x * factor * channels;
+					for (size_t bx = 0; bx < factor; ++bx, in += channels) {
+						for (size_t c = 0; c < channels; ++c) sums[c] += in[c];
+					}
+				}
+				for (size_t c = 0; c < channels; ++c) out[x * channels + c] = block_mean<T>(sums[c], count, shift);
+			} else {
+				const bool want_min = (filter == PackedBufDownscale_Min);
+				T best[channels];
+				std::memcpy(best, reinterpret_cast<const T *>(block_row) + x * factor * channels, sizeof(best));
+				for (size_t by = 0; by < factor; ++by) {
+					const T *in = reinterpret_cast<const T *>(block_row + by * src_stride) + x * factor * channels;
+					for (size_t bx = 0; bx < factor; ++bx, in += channels) {
+						for (size_t c = 0; c < channels; ++c) {
+							if (is_nan_value(best[c]) || (want_min ? (in[c] < best[c]) : (in[c] > best[c]))) best[c] = in[c];
+						}
+					}
+				}
+				std::memcpy(out + x * channels, best, sizeof(best));
+			}
+		}
+	}
+}
+
+template<typename T, size_t channels>
+static void downscale_any_factor(const uint8_t *src, size_t src_stride, size_t src_width, size_t src_height,
+	size_t factor, PackedBufDownscaleFilter filter, uint8_t *dst, size_t dst_stride)
+{
+	const size_t out_width = src_width / factor;
+	const size_t out_height = src_height / factor;
+	if (factor == 2) downscale_typed<T, channels, 2>(src, src_stride, out_width, out_height, factor, filter, dst, dst_stride);
+	else if (factor == 4) downscale_typed<T, channels, 4>(src, src_stride, out_width, out_height, factor, filter, dst, dst_stride);
+	else downscale_typed<T, channels, 0>(src, src_stride, out_width, out_height, factor, filter, dst, dst_stride);
+}
+
+bool downscale_packed_pixels(BufPixelFormat pixfmt, const uint8_t *src, size_t src_stride, size_t src_width, size_t src_height,
+	size_t factor, PackedBufDownscaleFilter filter, uint8_t *dst, size_t dst_stride)
+{
+	if (factor == 0) return false;
+	switch (pixfmt) {
+	case BUF_PIX_FMT_RGB24: downscale_any_factor<uint8_t, 3>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_RGBA:
+	case BUF_PIX_FMT_BGRA: downscale_any_factor<uint8_t, 4>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_RGB48: downscale_any_factor<uint16_t, 3>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_RGBA64: downscale_any_factor<uint16_t, 4>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_GRAYF32: downscale_any_factor<float, 1>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_GRAYU32: downscale_any_factor<uint32_t, 1>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_RGF32: downscale_any_factor<float, 2>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	case BUF_PIX_FMT_RGBAF32: downscale_any_factor<float, 4>(src, src_stride, src_width, src_height, factor, filter, dst, dst_stride); return true;
+	default: return false;
+	}
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+// one output channel of one block, written out the obvious way
+template<typename T>
+static double reference_block(const simple_packed_buf &src, size_t /*channels*/, size_t factor, PackedBufDownscaleFilter filter, size_t ox, size_t oy, size_t c) {
+	std::vector<double> samples;
+	for (size_t by = 0; by < factor; ++by) {
+		for (size_t bx = 0; bx < factor; ++bx) {
+			samples.push_back(static_cast<double>(src.centryptr<T>(oy * factor + by, ox * factor + bx)[c]));
+		}
+	}
+	if (filter == PackedBufDownscale_Nearest) return samples[0];
+	if (filter == PackedBufDownscale_Box) {
+		double sum = 0.0;
+		for (const double v : samples) sum += v;
+		const double mean = sum / static_cast<double>(samples.size());
+		return std::numeric_limits<T>::is_integer ? std::floor(mean + 0.5) : mean;
+	}
+	std::vector<double> finite;
+	for (const double v : samples) if (v == v) finite.push_back(v);
+	if (finite.empty()) return samples[0];
+	return (filter == PackedBufDownscale_Min) ? *std::min_element(finite.begin(), finite.end()) : *std::max_element(finite.begin(), finite.end());
+}
+
+template<typename T>
+static std::string check_format(BufPixelFormat pixfmt, size_t channels, std::mt19937 &rng) {
+	// odd sizes, so the leftover row and column are exercised
+	simple_packed_buf src;
+	if (!src.init_full(37, 23, pixfmt)) RETURNFAILST("init src");
+	std::uniform_int_distribution<uint32_t> bits;
+	std::uniform_real_distribution<float> dist(0.0f, 1000.0f);
+	for (size_t y = 0; y < src.height; ++y) {
+		T *row = src.rowptr<T>(y);
+		for (size_t ii = 0; ii < src.width * channels; ++ii) {
+			if (std::numeric_limits<T>::is_integer) row[ii] = static_cast<T>(bits(rng));
+			else row[ii] = (bits(rng) % 29 == 0) ? std::numeric_limits<T>::quiet_NaN() : static_cast<T>(dist(rng));
+		}
+	}
+	for (const size_t factor : { 1, 2, 3, 4 }) {
+		for (const PackedBufDownscaleFilter filter : { PackedBufDownscale_Box, PackedBufDownscale_Nearest, PackedBufDownscale_Min, PackedBufDownscale_Max }) {
+			simple_packed_buf dst;
+			if (!dst.init_full(src.width / factor, src.height / factor, pixfmt)) RETURNFAILST("init dst");
+			if (!downscale_packed_pixels(pixfmt, src.cdata<uint8_t>(), src.rowstride_bytes(), src.width, src.height, factor, filter,
+				dst.data<uint8_t>(), dst.rowstride_bytes())) {
+				RETURNFAILST("format not handled");
+			}
+			for (size_t oy = 0; oy < dst.height; ++oy) {
+				for (size_t ox = 0; ox < dst.width; ++ox) {
+					for (size_t c = 0; c < channels; ++c) {
+						const double expected = reference_block<T>(src, channels, factor, filter, ox, oy, c);
+						const double got = static_cast<double>(dst.centryptr<T>(oy, ox)[c]);
+						const bool both_nan = (expected != expected) && (got != got);
+						if (!both_nan && std::abs(expected - got) > (std::numeric_limits<T>::is_integer ? 0.0 : 1e-3)) {
+							RETURNFAILST(std::string("pixfmt ") + std::to_string(pixfmt) + std::string(" factor ") + std::to_string(factor)
+								+ std::string(" filter ") + std::to_string(filter) + std::string(": ") + std::to_string(got)
+								+ std::string(" vs ") + std::to_string(expected));
+						}
+					}
+				}
+			}
+		}
+	}
+	return std::string("ok");
+}
+
+std::string run_packedbuf_downscale_tests() {
+	std::mt19937 rng(15);
+	std::string result;
+	if ((result = check_format<uint8_t>(BUF_PIX_FMT_RGB24, 3, rng)) != "ok") return result;
+	if ((result = check_format<uint8_t>(BUF_PIX_FMT_BGRA, 4, rng)) != "ok") return result;
+	if ((result = check_format<uint16_t>(BUF_PIX_FMT_RGB48, 3, rng)) != "ok") return result;
+	if ((result = check_format<uint16_t>(BUF_PIX_FMT_RGBA64, 4, rng)) != "ok") return result;
+	if ((result = check_format<float>(BUF_PIX_FMT_GRAYF32, 1, rng)) != "ok") return result;
+	if ((result = check_format<uint32_t>(BUF_PIX_FMT_GRAYU32, 1, rng)) != "ok") return result;
+	if ((result = check_format<float>(BUF_PIX_FMT_RGBAF32, 4, rng)) != "ok") return result;
+	if (downscale_packed_pixels(BUF_PIX_FMT_NONE, nullptr, 0, 4, 4, 2, PackedBufDownscale_Box, nullptr, 0)) RETURNFAILST("BUF_PIX_FMT_NONE accepted");
+	return std::string("ok");
+}
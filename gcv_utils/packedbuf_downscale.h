@@ -0,0 +1,23 @@
+#pragma once
+// Integer downscaling of packed buffer pixels, used to reduce captures band by band while they are
+// converted (copy_texture_into_packedbuf.cpp), so the full-resolution frame is never packed.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "gcv_utils/simple_packed_buf.h"
+
+enum PackedBufDownscaleFilter {
+	PackedBufDownscale_Box = 0, // mean of each block, rounded to nearest for integer channels (color)
+	PackedBufDownscale_Nearest, // top-left sample of each block (segmentation ids, depth without blending edges)
+	PackedBufDownscale_Min,     // per channel; NaN samples are skipped unless the whole block is NaN
+	PackedBufDownscale_Max,
+};
+
+// Reduces each factor x factor block of src (src_width x src_height pixels of pixfmt, rows src_stride bytes apart)
+// into one pixel of dst. Writes src_height/factor rows of src_width/factor pixels; columns and rows that
+// don't fill a whole block are skipped. Returns false for pixel formats without a known channel layout.
+bool downscale_packed_pixels(BufPixelFormat pixfmt, const uint8_t *src, size_t src_stride, size_t src_width, size_t src_height,
+	size_t factor, PackedBufDownscaleFilter filter, uint8_t *dst, size_t dst_stride);
+
+// return error string if test failed; "ok" means every format and filter matches a per-pixel reference
+std::string run_packedbuf_downscale_tests();
@@ -0,0 +1,157 @@
+#include "gcv_utils/parallel_rows.h"
+#include <algorithm>
+
+row_thread_pool::~row_thread_pool() {
+	change_num_threads(1);
+}
+
+void row_thread_pool::change_num_threads(size_t new_num) {
+	// waits for a running job, and keeps new jobs serial while the workers change
+	while (job_running.exchange(true)) {
+		std::this_thread::yield();
+	}
+	if (!workthreads.empty()) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		cv_job.notify_all();
+		for (auto &thr : workthreads) {
+			thr.join();
+		}
+		workthreads.clear();
+		stopping = false;
+	}
+	for (size_t ii = 1; ii < new_num; ++ii) {
+		workthreads.emplace_back(&row_thread_pool::worker_loop, this, job_generation);
+	}
+	job_running = false;
+}
+
+void row_thread_pool::work_on_bands() {
+	for (;;) {
+		const size_t row_begin = job_next_band.fetch_add(1) * job_grain;
+		if (row_begin >= job_height) break;
+		(*job_fn)(row_begin, std::min(row_begin + job_grain, job_height));
+	}
+}
+
+void row_thread_pool::worker_loop(uint64_t seen_generation) {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv_job.wait(lock, [&] { return stopping || job_generation != seen_generation; });
+			if (stopping) return;
+			seen_generation = job_generation;
+		}
+		work_on_bands();
+		bool lastone;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			lastone = (--workers_busy == 0);
+		}
+		if (lastone) cv_done.notify_one();
+	}
+}
+
+void row_thread_pool::parallel_for_rows(size_t height, size_t grain, const row_band_fn &fn) {
+	if (height == 0) return;
+	// nested or concurrent calls (e.g. recorder and snapshot at once) just run on the caller
+	if (job_running.exchange(true)) {
+		fn(0, height);
+		return;
+	}
+	if (grain == 0) {
+		// a few bands per thread so uneven rows (and busy cores) balance out
+		grain = std::max<size_t>(1, height / (num_threads() * 4));
+	}
+	if (workthreads.empty() || height <= grain) {
+		job_running = false;
+		fn(0, height);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		job_fn = &fn;
+		job_height = height;
+		job_grain = grain;
+		job_next_band = 0;
+		workers_busy = workthreads.size();
+		++job_generation;
+	}
+	cv_job.notify_all();
+	work_on_bands();
+	std::unique_lock<std::mutex> lock(mtx);
+	cv_done.wait(lock, [&] { return workers_busy == 0; });
+	job_fn = nullptr;
+	job_running = false;
+}
+
+row_thread_pool &global_row_thread_pool() {
+	static row_thread_pool pool;
+	return pool;
+}
+
+row_thread_pool &writer_row_thread_pool() {
+	static row_thread_pool pool;
+	return pool;
+}
+
+static thread_local bool rows_serial_here = false;
+
+serial_rows_on_this_thread::serial_rows_on_this_thread() : was_serial(rows_serial_here) {
+	rows_serial_here = true;
+}
+
+serial_rows_on_this_thread::~serial_rows_on_this_thread() {
+	rows_serial_here = was_serial;
+}
+
+bool serial_rows_on_this_thread::active() {
+	return rows_serial_here;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_parallel_for_rows_tests() {
+	row_thread_pool pool;
+	pool.change_num_threads(4);
+	const size_t heights[] = { 1, 3, 4, 17, 1080, 2160 };
+	const size_t grains[] = { 0, 1, 7, 64, 5000 };
+	for (const size_t height : heights) {
+		for (const size_t grain : grains) {
+			std::vector<std::atomic<int>> visits(height);
+			for (auto &v : visits) v = 0;
+			pool.parallel_for_rows(height, grain, [&](size_t row_begin, size_t row_end) {
+				for (size_t y = row_begin; y < row_end; ++y) visits[y]++;
+			});
+			for (size_t y = 0; y < height; ++y) {
+				if (visits[y] != 1) {
+					RETURNFAILST(std::string("row ") + std::to_string(y) + std::string(" of ") + std::to_string(height)
+						+ std::string(" visited ") + std::to_string(visits[y]) + std::string(" times with grain ") + std::to_string(grain));
+				}
+			}
+		}
+	}
+	// nested calls must not deadlock
+	std::atomic<size_t> nested_rows{0};
+	pool.parallel_for_rows(8, 1, [&](size_t /*row_begin*/, size_t /*row_end*/) {
+		pool.parallel_for_rows(16, 1, [&](size_t b, size_t e) { nested_rows += e - b; });
+	});
+	if (nested_rows != 8 * 16) RETURNFAILST("nested parallel_for_rows");
+	// a serial scope does every row in one band on the calling thread, whatever the size of the global pool
+	{
+		const std::thread::id caller = std::this_thread::get_id();
+		std::atomic<size_t> bands{0}, elsewhere{0};
+		{
+			const serial_rows_on_this_thread serial;
+			parallel_for_rows(64, 1, [&](size_t /*row_begin*/, size_t /*row_end*/) {
+				++bands;
+				if (std::this_thread::get_id() != caller) ++elsewhere;
+			});
+		}
+		if (bands != 1 || elsewhere != 0) RETURNFAILST("rows left the thread of serial_rows_on_this_thread");
+		if (serial_rows_on_this_thread::active()) RETURNFAILST("serial_rows_on_this_thread outlived its scope");
+	}
+	return std::string("ok");
+}
@@ -0,0 +1,77 @@
+#pragma once
+// Persistent worker pool for splitting per-row image work (texture format conversion,
+// BC decode, depth assembly) into bands of rows. The calling thread works on bands too,
+// so parallel_for_rows returns once every row has been processed.
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <condition_variable>
+
+// processes rows [row_begin, row_end)
+typedef std::function<void(size_t row_begin, size_t row_end)> row_band_fn;
+
+class row_thread_pool {
+	std::vector<std::thread> workthreads;
+	std::mutex mtx;
+	std::condition_variable cv_job;
+	std::condition_variable cv_done;
+	std::atomic<bool> job_running{false}; // one parallel_for_rows at a time; others run serially on their own thread
+	const row_band_fn *job_fn = nullptr;
+	size_t job_height = 0;
+	size_t job_grain = 1;
+	std::atomic<size_t> job_next_band{0};
+	size_t workers_busy = 0;
+	uint64_t job_generation = 0;
+	bool stopping = false;
+
+	void worker_loop(uint64_t seen_generation);
+	void work_on_bands();
+public:
+	~row_thread_pool();
+
+	// number of threads that work on a job, including the calling thread
+	size_t num_threads() const { return workthreads.size() + 1; }
+	void change_num_threads(size_t new_num);
+
+	// grain is the number of rows per band; 0 picks a few bands per thread
+	void parallel_for_rows(size_t height, size_t grain, const row_band_fn &fn);
+};
+
+// process-wide pool; starts with only the calling thread, the addon sizes it in on_init
+// and shrinks it back to 1 in on_destroy so no worker outlives the device
+row_thread_pool &global_row_thread_pool();
+
+// The image writers' own pool, for the bands of one image they compress (png strips, fpzip and LZ4 bands). Kept apart
+// from global_row_thread_pool, which runs one job at a time, so a writer deflating an 8K frame never makes the render
+// thread convert its textures serially. Sized and shrunk by the addon like the global pool.
+row_thread_pool &writer_row_thread_pool();
+
+// While one of these lives, parallel_for_rows on its thread does every row there instead of on the global pool.
+// Writer threads convert images this way: there are several of them, each already busy on a core, and the global
+// pool runs one job at a time, so sharing it would only keep the render thread's conversions waiting.
+class serial_rows_on_this_thread {
+	bool was_serial;
+public:
+	serial_rows_on_this_thread();
+	~serial_rows_on_this_thread();
+	serial_rows_on_this_thread(const serial_rows_on_this_thread &) = delete;
+	serial_rows_on_this_thread &operator=(const serial_rows_on_this_thread &) = delete;
+	static bool active();
+};
+
+inline void parallel_for_rows(size_t height, size_t grain, const row_band_fn &fn) {
+	if (serial_rows_on_this_thread::active()) {
+		if (height > 0) fn(0, height);
+		return;
+	}
+	global_row_thread_pool().parallel_for_rows(height, grain, fn);
+}
+
+// return error string if test failed; "ok" means every row was visited exactly once, and only by the calling thread
+// under serial_rows_on_this_thread
+std::string run_parallel_for_rows_tests();
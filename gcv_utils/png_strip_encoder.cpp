@@ -0,0 +1,369 @@
+#include "gcv_utils/png_strip_encoder.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+static const size_t DeflateWindowBytes = 32768;
+static const size_t DefaultStripBytes = size_t(1) << 20;
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t val) {
+	out.push_back(static_cast<uint8_t>(val >> 24));
+	out.push_back(static_cast<uint8_t>(val >> 16));
+	out.push_back(static_cast<uint8_t>(val >> 8));
+	out.push_back(static_cast<uint8_t>(val));
+}
+
+// length and tag of a chunk whose data is appended next; end_png_chunk adds its CRC
+static size_t begin_png_chunk(std::vector<uint8_t> &out, const char *tag, uint32_t data_len) {
+	put_be32(out, data_len);
+	const size_t tag_at = out.size();
+	out.insert(out.end(), tag, tag + 4);
+	return tag_at;
+}
+
+static void end_png_chunk(std::vector<uint8_t> &out, size_t tag_at) {
+	put_be32(out, static_cast<uint32_t>(crc32(0L, out.data() + tag_at, static_cast<uInt>(out.size() - tag_at))));
+}
+
+static inline uint8_t paeth_predictor(int a, int b, int c) {
+	const int p = a + b - c;
+	const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) return static_cast<uint8_t>(a);
+	return static_cast<uint8_t>((pb <= pc) ? b : c);
+}
+
+template<int FilterType>
+static inline uint8_t png_filter_byte(const uint8_t *row, const uint8_t *prior, size_t ii, size_t bpp) {
+	const int a = (ii >= bpp) ? row[ii - bpp] : 0;
+	const int b = prior[ii];
+	const int c = (ii >= bpp) ? prior[ii - bpp] : 0;
+	switch (FilterType) {
+	case 1: return static_cast<uint8_t>(row[ii] - a);
+	case 2: return static_cast<uint8_t>(row[ii] - b);
+	case 3: return static_cast<uint8_t>(row[ii] - ((a + b) >> 1));
+	case 4: return static_cast<uint8_t>(row[ii] - paeth_predictor(a, b, c));
+	default: return row[ii];
+	}
+}
+
+// sum of absolute residuals (as signed bytes) of a filter, the estimate stb and libpng choose filters by
+template<int FilterType>
+static uint64_t png_filter_cost(const uint8_t *row, const uint8_t *prior, size_t row_bytes, size_t bpp) {
+	uint64_t sum = 0;
+	for (size_t ii = 0; ii < row_bytes; ++ii) {
+		sum += static_cast<uint64_t>(std::abs(static_cast<int>(static_cast<int8_t>(png_filter_byte<FilterType>(row, prior, ii, bpp)))));
+	}
+	return sum;
+}
+
+template<int FilterType>
+static void png_filter_apply(const uint8_t *row, const uint8_t *prior, size_t row_bytes, size_t bpp, uint8_t *out) {
+	out[0] = static_cast<uint8_t>(FilterType);
+	for (size_t ii = 0; ii < row_bytes; ++ii) {
+		out[ii + 1] = png_filter_byte<FilterType>(row, prior, ii, bpp);
+	}
+}
+
+// filter byte and filtered row, with the filter of the smallest cost; prior is all zeros above the first row
+static void filter_png_row(const uint8_t *row, const uint8_t *prior, size_t row_bytes, size_t bpp, uint8_t *out) {
+	const uint64_t costs[5] = {
+		png_filter_cost<0>(row, prior, row_bytes, bpp), png_filter_cost<1>(row, prior, row_bytes, bpp),
+		png_filter_cost<2>(row, prior, row_bytes, bpp), png_filter_cost<3>(row, prior, row_bytes, bpp),
+		png_filter_cost<4>(row, prior, row_bytes, bpp),
+	};
+	switch (std::min_element(costs, costs + 5) - costs) {
+	case 0: png_filter_apply<0>(row, prior, row_bytes, bpp, out); break;
+	case 1: png_filter_apply<1>(row, prior, row_bytes, bpp, out); break;
+	case 2: png_filter_apply<2>(row, prior, row_bytes, bpp, out); break;
+	case 3: png_filter_apply<3>(row, prior, row_bytes, bpp, out); break;
+	default: png_filter_apply<4>(row, prior, row_bytes, bpp, out); break;
+	}
+}
+
+namespace {
+struct png_strip {
+	std::vector<uint8_t> idat; // a whole IDAT chunk with the strip's deflate blocks
+	uLong adler = 1;           // of the strip's filtered rows
+	size_t filtered_bytes = 0;
+	std::string err;
+};
+}
+
+// filters rows [first_row, end_row) plus the rows before them that fill the dictionary, and deflates them into an IDAT chunk
+static void encode_png_strip(int height, size_t row_bytes, size_t bpp, int level, size_t first_row, size_t end_row,
+	const png_row_fn &fill_row, png_strip &strip)
+{
+	const size_t filtered_row_bytes = row_bytes + 1;
+	const size_t dict_rows = std::min(first_row, (DeflateWindowBytes + filtered_row_bytes - 1) / filtered_row_bytes);
+	const size_t dict_first = first_row - dict_rows;
+	std::vector<uint8_t> prior(row_bytes, 0), row(row_bytes);
+	if (dict_first > 0) fill_row(static_cast<int>(dict_first - 1), prior.data());
+	std::vector<uint8_t> filtered((end_row - dict_first) * filtered_row_bytes);
+	for (size_t jj = dict_first; jj < end_row; ++jj) {
+		fill_row(static_cast<int>(jj), row.data());
+		filter_png_row(row.data(), prior.data(), row_bytes, bpp, filtered.data() + (jj - dict_first) * filtered_row_bytes);
+		prior.swap(row);
+	}
+	const size_t dict_len = std::min(DeflateWindowBytes, dict_rows * filtered_row_bytes);
+	const uint8_t *input = filtered.data() + dict_rows * filtered_row_bytes;
+	strip.filtered_bytes = (end_row - first_row) * filtered_row_bytes;
+	strip.adler = adler32(1L, input, static_cast<uInt>(strip.filtered_bytes));
+
+	z_stream strm;
+	std::memset(&strm, 0, sizeof(strm));
+	// raw deflate: the zlib header and the Adler-32 are written once for the whole image
+	if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		strip.err = "deflateInit2 failed";
+		return;
+	}
+	if (dict_len > 0 && deflateSetDictionary(&strm, input - dict_len, static_cast<uInt>(dict_len)) != Z_OK) {
+		deflateEnd(&strm);
+		strip.err = "deflateSetDictionary failed";
+		return;
+	}
+	const bool last_strip = (end_row == static_cast<size_t>(height));
+	// the first strip carries the zlib header
+	const size_t header_len = (first_row == 0) ? 2 : 0;
+	// room for the sync flush's empty stored block on top of the bound
+	std::vector<uint8_t> &idat = strip.idat;
+	idat.resize(8 + header_len + deflateBound(&strm, static_cast<uLong>(strip.filtered_bytes)) + 16);
+	strm.next_in = const_cast<Bytef *>(input);
+	strm.avail_in = static_cast<uInt>(strip.filtered_bytes);
+	size_t written = 8 + header_len;
+	int zret = Z_OK;
+	for (;;) {
+		strm.next_out = idat.data() + written;
+		strm.avail_out = static_cast<uInt>(idat.size() - written);
+		zret = deflate(&strm, last_strip ? Z_FINISH : Z_SYNC_FLUSH);
+		written = idat.size() - strm.avail_out;
+		if (zret == Z_STREAM_END) break;
+		// a sync flush is complete once it leaves output space unused
+		if (!last_strip && (zret == Z_OK || zret == Z_BUF_ERROR) && strm.avail_out > 0) {
+			zret = Z_OK;
+			break;
+		}
+		if ((zret != Z_OK && zret != Z_BUF_ERROR) || strm.avail_out > 0) break;
+		idat.resize(idat.size() * 2);
+	}
+	deflateEnd(&strm);
+	if (zret != (last_strip ? Z_STREAM_END : Z_OK)) {
+		strip.err = std::string("deflate failed: ") + std::to_string(zret);
+		return;
+	}
+	idat.resize(written);
+	if (idat.size() - 8 > 0x7fffffffu) {
+		strip.err = "strip too large for one IDAT chunk";
+		return;
+	}
+	std::vector<uint8_t> chunk_head;
+	chunk_head.reserve(8);
+	begin_png_chunk(chunk_head, "IDAT", static_cast<uint32_t>(idat.size() - 8));
+	std::memcpy(idat.data(), chunk_head.data(), 8);
+	if (header_len > 0) {
+		// CM 8 with a 32 KB window, FLEVEL from the level, FCHECK making the pair a multiple of 31
+		const unsigned flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+		unsigned flg = flevel << 6;
+		flg += 31 - ((0x78u << 8) + flg) % 31;
+		idat[8] = 0x78;
+		idat[9] = static_cast<uint8_t>(flg);
+	}
+	end_png_chunk(idat, 4);
+}
+
+bool encode_png_in_strips(int width, int height, int bit_depth, int channels, const png_row_fn &fill_row,
+	std::vector<uint8_t> &png, std::string &errstr, const PngStripSettings &settings, row_thread_pool &pool)
+{
+	static const uint8_t color_types[5] = { 0, 0, 4, 2, 6 };
+	for (const auto &text : settings.text_chunks) {
+		// keywords are 1-79 Latin-1 characters without NULs
+		if (text.first.empty() || text.first.size() > 79 || text.first.find('\0') != std::string::npos || text.second.find('\0') != std::string::npos) {
+			errstr += std::string("png strips: invalid tEXt keyword or text for ") + text.first;
+			return false;
+		}
+	}
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4 || (bit_depth != 8 && bit_depth != 16)) {
+		errstr += std::string("png strips: unsupported image ") + std::to_string(width) + std::string("x") + std::to_string(height)
+			+ std::string(", ") + std::to_string(channels) + std::string(" channels of ") + std::to_string(bit_depth) + std::string(" bits");
+		return false;
+	}
+	const size_t bpp = static_cast<size_t>(channels) * bit_depth / 8;
+	const size_t row_bytes = static_cast<size_t>(width) * bpp;
+	const size_t strip_rows = (settings.strip_rows > 0) ? settings.strip_rows : std::max<size_t>(1, DefaultStripBytes / (row_bytes + 1));
+	const size_t num_strips = (static_cast<size_t>(height) + strip_rows - 1) / strip_rows;
+	const int level = std::clamp(settings.compression_level, 1, 9);
+
+	std::vector<png_strip> strips(num_strips);
+	pool.parallel_for_rows(num_strips, 1, [&](size_t strip_begin, size_t strip_end) {
+		for (size_t ss = strip_begin; ss < strip_end; ++ss) {
+			encode_png_strip(height, row_bytes, bpp, level, ss * strip_rows, std::min(static_cast<size_t>(height), (ss + 1) * strip_rows), fill_row, strips[ss]);
+		}
+	});
+
+	uLong adler = 1;
+	size_t total = 8 + 25 + 16 + 12;
+	for (const png_strip &strip : strips) {
+		if (!strip.err.empty()) {
+			errstr += std::string("png strips: ") + strip.err;
+			return false;
+		}
+		adler = adler32_combine(adler, strip.adler, static_cast<z_off_t>(strip.filtered_bytes));
+		total += strip.idat.size();
+	}
+	png.clear();
+	png.reserve(total);
+	static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	png.insert(png.end(), signature, signature + 8);
+	size_t tag_at = begin_png_chunk(png, "IHDR", 13);
+	put_be32(png, static_cast<uint32_t>(width));
+	put_be32(png, static_cast<uint32_t>(height));
+	png.push_back(static_cast<uint8_t>(bit_depth));
+	png.push_back(color_types[channels]);
+	png.push_back(0); // deflate
+	png.push_back(0); // adaptive filtering
+	png.push_back(0); // not interlaced
+	end_png_chunk(png, tag_at);
+	for (const auto &text : settings.text_chunks) {
+		tag_at = begin_png_chunk(png, "tEXt", static_cast<uint32_t>(text.first.size() + 1 + text.second.size()));
+		png.insert(png.end(), text.first.begin(), text.first.end());
+		png.push_back(0);
+		png.insert(png.end(), text.second.begin(), text.second.end());
+		end_png_chunk(png, tag_at);
+	}
+	for (png_strip &strip : strips) {
+		png.insert(png.end(), strip.idat.begin(), strip.idat.end());
+		std::vector<uint8_t>().swap(strip.idat);
+	}
+	// the zlib stream ends with the Adler-32 of all strips, in an IDAT chunk of its own
+	tag_at = begin_png_chunk(png, "IDAT", 4);
+	put_be32(png, static_cast<uint32_t>(adler));
+	end_png_chunk(png, tag_at);
+	tag_at = begin_png_chunk(png, "IEND", 0);
+	end_png_chunk(png, tag_at);
+	return true;
+}
+
+static uint32_t get_be32(const uint8_t *pp) {
+	return (uint32_t(pp[0]) << 24) | (uint32_t(pp[1]) << 16) | (uint32_t(pp[2]) << 8) | uint32_t(pp[3]);
+}
+
+bool decode_png_rows(const std::vector<uint8_t> &png, uint32_t &width, uint32_t &height, size_t &bpp,
+	std::vector<uint8_t> &pixels, std::string &err, std::vector<std::pair<std::string, std::string>> *text_chunks)
+{
+	if (png.size() < 8 || png[0] != 137 || png[1] != 'P') { err = "signature"; return false; }
+	width = height = 0;
+	bpp = 0;
+	std::vector<uint8_t> zdata;
+	bool ended = false;
+	size_t pos = 8;
+	while (pos + 12 <= png.size()) {
+		const uint32_t len = get_be32(png.data() + pos);
+		if (pos + 12 + len > png.size()) { err = "truncated chunk"; return false; }
+		const uint8_t *tag = png.data() + pos + 4;
+		const uint8_t *data = tag + 4;
+		if (get_be32(data + len) != static_cast<uint32_t>(crc32(0L, tag, len + 4))) { err = "chunk crc"; return false; }
+		if (std::memcmp(tag, "IHDR", 4) == 0) {
+			width = get_be32(data);
+			height = get_be32(data + 4);
+			const size_t channels = (data[9] == 0) ? 1 : (data[9] == 4) ? 2 : (data[9] == 2) ? 3 : 4;
+			bpp = channels * data[8] / 8;
+			if (data[8] < 8 || data[12] != 0) { err = "only non-interlaced 8 and 16-bit pngs are read"; return false; }
+		} else if (std::memcmp(tag, "IDAT", 4) == 0) {
+			zdata.insert(zdata.end(), data, data + len);
+		} else if (std::memcmp(tag, "tEXt", 4) == 0 && text_chunks) {
+			const uint8_t *sep = static_cast<const uint8_t *>(std::memchr(data, 0, len));
+			if (!sep) { err = "tEXt without keyword"; return false; }
+			text_chunks->emplace_back(std::string(reinterpret_cast<const char *>(data), sep - data),
+				std::string(reinterpret_cast<const char *>(sep + 1), data + len - (sep + 1)));
+		} else if (std::memcmp(tag, "IEND", 4) == 0) {
+			ended = true;
+		}
+		pos += 12 + len;
+	}
+	if (!ended || pos != png.size()) { err = "IEND"; return false; }
+	if (bpp == 0) { err = "IHDR"; return false; }
+	const size_t row_bytes = width * bpp;
+	std::vector<uint8_t> filtered((row_bytes + 1) * height);
+	uLongf filtered_len = static_cast<uLongf>(filtered.size());
+	if (uncompress(filtered.data(), &filtered_len, zdata.data(), static_cast<uLong>(zdata.size())) != Z_OK || filtered_len != filtered.size()) {
+		err = "inflate";
+		return false;
+	}
+	pixels.assign(row_bytes * height, 0);
+	const std::vector<uint8_t> zeros(row_bytes, 0);
+	for (size_t jj = 0; jj < height; ++jj) {
+		const uint8_t *src = filtered.data() + jj * (row_bytes + 1);
+		uint8_t *row = pixels.data() + jj * row_bytes;
+		const uint8_t *prior = (jj > 0) ? (row - row_bytes) : zeros.data();
+		for (size_t ii = 0; ii < row_bytes; ++ii) {
+			const int a = (ii >= bpp) ? row[ii - bpp] : 0;
+			const int b = prior[ii];
+			const int c = (ii >= bpp) ? prior[ii - bpp] : 0;
+			int pred = 0;
+			switch (src[0]) {
+			case 0: pred = 0; break;
+			case 1: pred = a; break;
+			case 2: pred = b; break;
+			case 3: pred = (a + b) / 2; break;
+			case 4: pred = paeth_predictor(a, b, c); break;
+			default: err = "filter type"; return false;
+			}
+			row[ii] = static_cast<uint8_t>(src[ii + 1] + pred);
+		}
+	}
+	return true;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_png_strip_encoder_tests() {
+	row_thread_pool pool;
+	pool.change_num_threads(3);
+	struct test_case { int width, height, bit_depth, channels; size_t strip_rows; };
+	const test_case cases[] = {
+		{1, 1, 8, 3, 0}, {37, 29, 8, 4, 1}, {37, 29, 8, 4, 5}, {301, 77, 8, 3, 7}, {64, 200, 8, 1, 3},
+		{129, 41, 16, 1, 4}, {50, 33, 16, 4, 2}, {2000, 40, 8, 4, 3}, {700, 150, 8, 3, 0},
+	};
+	for (const test_case &tc : cases) {
+		const size_t bpp = static_cast<size_t>(tc.channels) * tc.bit_depth / 8;
+		// gradients the filters can predict, with a hashed pattern over some rows so deflate sees incompressible bytes too
+		const png_row_fn fill_row = [&](int j, unsigned char *dst) {
+			for (size_t ii = 0; ii < static_cast<size_t>(tc.width) * bpp; ++ii) {
+				const uint32_t hash = (static_cast<uint32_t>(j) * 2654435761u) ^ (static_cast<uint32_t>(ii) * 40503u);
+				dst[ii] = static_cast<unsigned char>((j % 3 == 0) ? (hash >> 13) : (ii + 3 * j));
+			}
+		};
+		PngStripSettings settings;
+		settings.strip_rows = tc.strip_rows;
+		std::vector<uint8_t> png, pixels;
+		std::string errstr;
+		const std::string which = std::to_string(tc.width) + std::string("x") + std::to_string(tc.height) + std::string("x") + std::to_string(tc.channels)
+			+ std::string(" ") + std::to_string(tc.bit_depth) + std::string("-bit, strips of ") + std::to_string(tc.strip_rows) + std::string(": ");
+		if (!encode_png_in_strips(tc.width, tc.height, tc.bit_depth, tc.channels, fill_row, png, errstr, settings, pool)) RETURNFAILST(which + errstr);
+		uint32_t width = 0, height = 0;
+		size_t decoded_bpp = 0;
+		if (!decode_png_rows(png, width, height, decoded_bpp, pixels, errstr)) RETURNFAILST(which + errstr);
+		if (width != static_cast<uint32_t>(tc.width) || height != static_cast<uint32_t>(tc.height) || decoded_bpp != bpp) RETURNFAILST(which + std::string("header"));
+		std::vector<uint8_t> expected(static_cast<size_t>(tc.width) * bpp);
+		for (int jj = 0; jj < tc.height; ++jj) {
+			fill_row(jj, expected.data());
+			if (std::memcmp(expected.data(), pixels.data() + jj * expected.size(), expected.size()) != 0) RETURNFAILST(which + std::string("row ") + std::to_string(jj));
+		}
+	}
+	// text chunks come back as they were written
+	PngStripSettings with_text;
+	with_text.text_chunks = { {"Comment", "strips"}, {"depth", "{\"scale\": 0.001}"} };
+	std::vector<uint8_t> png, pixels;
+	std::vector<std::pair<std::string, std::string>> text_read;
+	std::string errstr;
+	uint32_t width = 0, height = 0;
+	size_t bpp = 0;
+	if (!encode_png_in_strips(3, 2, 16, 1, [](int, unsigned char *dst) { std::memset(dst, 7, 6); }, png, errstr, with_text, pool)
+		|| !decode_png_rows(png, width, height, bpp, pixels, errstr, &text_read)) RETURNFAILST(std::string("text chunks: ") + errstr);
+	if (text_read != with_text.text_chunks) RETURNFAILST("text chunks read back differently");
+	with_text.text_chunks = { {"", "no keyword"} };
+	if (encode_png_in_strips(3, 2, 16, 1, [](int, unsigned char *dst) { std::memset(dst, 7, 6); }, png, errstr, with_text, pool)) RETURNFAILST("accepted an empty keyword");
+	if (encode_png_in_strips(0, 5, 8, 3, [](int, unsigned char *) {}, png, errstr, PngStripSettings(), pool)) RETURNFAILST("accepted an empty image");
+	if (encode_png_in_strips(5, 5, 12, 3, [](int, unsigned char *) {}, png, errstr, PngStripSettings(), pool)) RETURNFAILST("accepted 12-bit samples");
+	return "ok";
+}
@@ -0,0 +1,39 @@
+#pragma once
+// PNG encoding of very large frames (8K captures, panoramas) on a row pool, the way pigz splits gzip: the filtered
+// image is cut into strips of rows, every strip is deflated on its own and ends in a sync flush, so the compressed
+// strips only need to be concatenated, and their Adler-32s are combined into the one of the whole zlib stream.
+// Each strip starts with the 32 KB of filtered rows before it as its deflate dictionary, so the cuts cost little in size.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <utility>
+#include "gcv_utils/parallel_rows.h"
+
+// fills row j with its pixels in png byte order (RGB/RGBA or gray; 16-bit samples big-endian)
+typedef std::function<void(int j, unsigned char *dst)> png_row_fn;
+
+struct PngStripSettings {
+	int compression_level = 1; // zlib level, 1-9; 1 is already smaller than stb, 6 takes ~4x longer for ~10% less
+	size_t strip_rows = 0;     // rows per strip; 0 picks strips of about 1 MB of filtered rows
+	std::vector<std::pair<std::string, std::string>> text_chunks; // tEXt chunks (keyword, text) written before the pixels
+};
+
+// Encodes a width x height png of 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA) channels of 8 or 16 bits into png.
+// fill_row is called from the pool's threads at once, a few rows twice (the rows before a strip, for its dictionary).
+// The writers' pool is the default, so texture conversion on the global pool never waits for a png; two pngs encoded at
+// once share it, and the second one is deflated on its own writer thread.
+bool encode_png_in_strips(int width, int height, int bit_depth, int channels, const png_row_fn &fill_row,
+	std::vector<uint8_t> &png, std::string &errstr, const PngStripSettings &settings = PngStripSettings(),
+	row_thread_pool &pool = writer_row_thread_pool());
+
+// Reads back a non-interlaced png, e.g. one from encode_png_in_strips: checks every chunk CRC, inflates the image
+// with zlib (checking its Adler-32) and undoes the filters into rows of bpp bytes per pixel, in png byte order.
+// tEXt chunks are collected into text_chunks if it is not null. Written apart from the encoder, for tests and tools.
+bool decode_png_rows(const std::vector<uint8_t> &png, uint32_t &width, uint32_t &height, size_t &bpp,
+	std::vector<uint8_t> &pixels, std::string &err, std::vector<std::pair<std::string, std::string>> *text_chunks = nullptr);
+
+// return error string if test failed; "ok" means pngs of every layout and strip size inflated and unfiltered
+// with zlib back into their rows, with valid chunk CRCs and Adler-32
+std::string run_png_strip_encoder_tests();
@@ -0,0 +1,112 @@
+#include "gcv_utils/raw_frame_pool.h"
+#include <algorithm>
+
+std::string RawFramePoolStats::summary() const {
+	return std::to_string(hits) + std::string(" hits, ") + std::to_string(misses) + std::string(" misses, ")
+		+ std::to_string(num_free) + std::string(" free (") + std::to_string(free_bytes >> 20) + std::string(" MB)");
+}
+
+std::vector<uint8_t> RawFramePool::acquire(size_t size) {
+	std::vector<uint8_t> result;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		size_t best = free_buffers.size();
+		for (size_t ii = 0; ii < free_buffers.size(); ++ii) {
+			if (free_buffers[ii].capacity() >= size && (best == free_buffers.size() || free_buffers[ii].capacity() < free_buffers[best].capacity())) {
+				best = ii;
+			}
+		}
+		if (best < free_buffers.size()) {
+			result.swap(free_buffers[best]);
+			free_buffers.erase(free_buffers.begin() + best);
+			counters.free_bytes -= result.capacity();
+			++counters.hits;
+		} else {
+			++counters.misses;
+		}
+	}
+	// a reused buffer keeps its old size, so only bytes past it are zeroed (all of them on a miss)
+	result.resize(size);
+	return result;
+}
+
+void RawFramePool::release(std::vector<uint8_t> &&buf) {
+	if (buf.capacity() == 0) return;
+	std::lock_guard<std::mutex> lock(mtx);
+	if (buf.capacity() > max_free_bytes) {
+		std::vector<uint8_t>().swap(buf);
+		return;
+	}
+	// the smallest buffers go first when over the cap
+	while (!free_buffers.empty() && counters.free_bytes + buf.capacity() > max_free_bytes) {
+		auto smallest = std::min_element(free_buffers.begin(), free_buffers.end(), [](const std::vector<uint8_t> &aa, const std::vector<uint8_t> &bb) {
+			return aa.capacity() < bb.capacity();
+		});
+		if (smallest->capacity() >= buf.capacity()) break;
+		counters.free_bytes -= smallest->capacity();
+		free_buffers.erase(smallest);
+	}
+	if (counters.free_bytes + buf.capacity() > max_free_bytes) {
+		std::vector<uint8_t>().swap(buf);
+		return;
+	}
+	counters.free_bytes += buf.capacity();
+	free_buffers.push_back(std::move(buf));
+	buf = std::vector<uint8_t>();
+}
+
+void RawFramePool::clear() {
+	std::lock_guard<std::mutex> lock(mtx);
+	free_buffers.clear();
+	counters.free_bytes = 0;
+}
+
+RawFramePoolStats RawFramePool::stats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	RawFramePoolStats result = counters;
+	result.num_free = free_buffers.size();
+	return result;
+}
+
+RawFramePool &global_raw_frame_pool() {
+	static RawFramePool pool;
+	return pool;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+std::string run_raw_frame_pool_tests() {
+	RawFramePool pool;
+	pool.max_free_bytes = 3000;
+
+	// snapshots of one size reuse one buffer
+	for (int frame = 0; frame < 10; ++frame) {
+		std::vector<uint8_t> buf = pool.acquire(1000);
+		if (buf.size() != 1000) RETURNFAILST("acquired size");
+		buf[999] = static_cast<uint8_t>(frame);
+		pool.release(std::move(buf));
+	}
+	if (pool.stats().misses != 1 || pool.stats().hits != 9 || pool.stats().num_free != 1) RETURNFAILST(std::string("steady state: ") + pool.stats().summary());
+
+	// a smaller request takes the free buffer without growing it; a larger one allocates
+	std::vector<uint8_t> small = pool.acquire(400);
+	if (small.size() != 400 || small.capacity() < 1000 || pool.stats().hits != 10) RETURNFAILST("smaller request");
+	std::vector<uint8_t> big = pool.acquire(2500);
+	if (big.size() != 2500 || pool.stats().misses != 2) RETURNFAILST("larger request");
+
+	// over the cap, the smaller buffer makes room for the larger one
+	pool.release(std::move(small));
+	pool.release(std::move(big));
+	const RawFramePoolStats capped = pool.stats();
+	if (capped.num_free != 1 || capped.free_bytes < 2500 || capped.free_bytes > pool.max_free_bytes) RETURNFAILST(std::string("cap: ") + capped.summary());
+	std::vector<uint8_t> again = pool.acquire(2000);
+	if (pool.stats().hits != 11 || pool.stats().num_free != 0) RETURNFAILST("reuse after cap");
+
+	// a buffer larger than the cap is freed instead of kept
+	pool.release(pool.acquire(5000));
+	if (pool.stats().num_free != 0) RETURNFAILST("kept a buffer above the cap");
+	pool.release(std::move(again));
+	pool.clear();
+	if (pool.stats().num_free != 0 || pool.stats().free_bytes != 0) RETURNFAILST("clear");
+	return "ok";
+}
@@ -0,0 +1,51 @@
+#pragma once
+// Byte buffers for texture rows copied out of a mapped readback texture as they are, so the render thread
+// can unmap right away and leave the conversion to a writer thread. Snapshots come in the same few sizes
+// over and over, so released buffers are kept and handed out again instead of allocating a frame each time.
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <string>
+
+// rows of a texture exactly as they were mapped
+struct raw_texture_rows {
+	std::vector<uint8_t> bytes;
+	uint32_t format = 0; // reshade::api::format of the rows, already typed
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t row_pitch = 0; // bytes from one row to the next; a row of 4x4 blocks for block-compressed formats
+};
+
+struct RawFramePoolStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0; // a buffer had to be allocated or grown
+	size_t num_free = 0;
+	size_t free_bytes = 0;
+
+	std::string summary() const;
+};
+
+class RawFramePool {
+	std::vector<std::vector<uint8_t>> free_buffers;
+	mutable std::mutex mtx;
+	RawFramePoolStats counters;
+public:
+	// bytes kept in released buffers; more are freed on release
+	size_t max_free_bytes = size_t(512) << 20;
+
+	// a buffer of exactly size bytes (contents undefined), from the smallest free one that is large enough
+	std::vector<uint8_t> acquire(size_t size);
+	// keeps the buffer's memory for a later acquire, from any thread
+	void release(std::vector<uint8_t> &&buf);
+	// frees every kept buffer
+	void clear();
+
+	RawFramePoolStats stats() const;
+};
+
+// process-wide pool of the snapshot writers
+RawFramePool &global_raw_frame_pool();
+
+// return error string if test failed; "ok" means buffers were reused by size and the free bytes stayed capped
+std::string run_raw_frame_pool_tests();
@@ -0,0 +1,339 @@
+#include "gcv_utils/readback_ring.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+
+std::string ReadbackRingStats::summary() const {
+	return std::to_string(submitted) + std::string(" submitted, ") + std::to_string(consumed) + std::string(" read, ")
+		+ std::to_string(dropped) + std::string(" dropped, ") + std::to_string(stalls) + std::string(" stalls, ")
+		+ std::to_string(failed) + std::string(" failed, ") + std::to_string(in_flight) + std::string(" in flight");
+}
+
+ReadbackRing::ReadbackRing(size_t depth) : slots(std::max<size_t>(depth, 1)) {}
+
+bool ReadbackRing::slot_ready(ReadbackDevice &dev, const slot &ss) {
+	return !have_fence || dev.completed_fence_value(fence) >= ss.fence_value;
+}
+
+void ReadbackRing::consume_oldest(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume, bool readable) {
+	slot &ss = slots[oldest];
+	const uint8_t *data = nullptr;
+	uint32_t row_pitch = 0;
+	if (readable && dev.map_readback(ss.readback, data, row_pitch)) {
+		const ReadbackFrame frame = { &ss.tag, ss.format, ss.width, ss.height, data, row_pitch };
+		consume(frame);
+		dev.unmap_readback(ss.readback);
+		++counters.consumed;
+	} else {
+		++counters.failed;
+	}
+	pool.release(dev, ss.readback);
+	oldest = (oldest + 1) % slots.size();
+	--count;
+}
+
+size_t ReadbackRing::collect_ready(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume) {
+	size_t num_consumed = 0;
+	// stop at the first slot still in flight, even if a later one is done, so frames come out in order
+	while (count > 0 && slot_ready(dev, slots[oldest])) {
+		consume_oldest(dev, pool, consume, true);
+		++num_consumed;
+	}
+	return num_consumed;
+}
+
+bool ReadbackRing::submit(ReadbackDevice &dev, StagingPool &pool, uint32_t format, uint32_t width, uint32_t height,
+	uint64_t source, const ReadbackFrameTag &tag, const consume_fn &consume)
+{
+	if (!bound) {
+		bound = true;
+		device_id = dev.device_id();
+		have_fence = dev.create_fence(fence);
+		if (!have_fence) fence = 0;
+	} else if (dev.device_id() != device_id) {
+		++counters.failed;
+		return false;
+	}
+
+	collect_ready(dev, pool, consume);
+	if (count == slots.size()) {
+		if (back_pressure == ReadbackRing_DropNewest) {
+			++counters.dropped;
+			return false;
+		}
+		++counters.stalls;
+		consume_oldest(dev, pool, consume, dev.wait_fence(fence, slots[oldest].fence_value));
+	}
+
+	slot &ss = slots[(oldest + count) % slots.size()];
+	if (!pool.acquire(dev, format, width, height, ss.readback)) {
+		++counters.failed;
+		return false;
+	}
+	ss.fence_value = have_fence ? next_fence_value++ : 0;
+	if (!dev.submit_copy(source, ss.readback, fence, ss.fence_value)) {
+		pool.release(dev, ss.readback);
+		++counters.failed;
+		return false;
+	}
+	ss.tag = tag;
+	ss.format = format;
+	ss.width = width;
+	ss.height = height;
+	++count;
+	++counters.submitted;
+	// without a fence the copy is already done, don't hold it back for a frame
+	if (!have_fence) collect_ready(dev, pool, consume);
+	return true;
+}
+
+size_t ReadbackRing::drain(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume) {
+	size_t num_consumed = 0;
+	while (count > 0) {
+		const bool readable = slot_ready(dev, slots[oldest]) || dev.wait_fence(fence, slots[oldest].fence_value);
+		consume_oldest(dev, pool, consume, readable);
+		++num_consumed;
+	}
+	return num_consumed;
+}
+
+void ReadbackRing::release(ReadbackDevice &dev, StagingPool &pool) {
+	for (; count > 0; --count) {
+		pool.release(dev, slots[oldest].readback);
+		oldest = (oldest + 1) % slots.size();
+	}
+	if (have_fence) dev.destroy_fence(fence);
+	bound = false;
+	have_fence = false;
+	fence = 0;
+}
+
+ReadbackRingStats ReadbackRing::stats() const {
+	ReadbackRingStats result = counters;
+	result.in_flight = count;
+	return result;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+// A GPU that finishes each copy a fixed number of ticks after it was submitted, in submission order.
+// The copy only lands in the readback texture when it finishes, so mapping a slot early reads stale bytes.
+class mock_readback_device : public ReadbackDevice {
+	struct texture {
+		uint32_t width;
+		uint32_t height;
+		std::vector<uint8_t> bytes;
+	};
+	struct pending_copy {
+		uint64_t source;
+		uint64_t readback;
+		uint64_t value;
+		uint64_t done_at;
+	};
+	std::map<uint64_t, texture> textures;
+	std::deque<pending_copy> pending;
+	uint64_t next_handle = 1;
+	uint64_t completed = 0;
+
+	void retire() {
+		while (!pending.empty() && pending.front().done_at <= now) {
+			texture &tt = textures[pending.front().readback];
+			fill(tt, pending.front().source);
+			completed = std::max(completed, pending.front().value);
+			pending.pop_front();
+		}
+	}
+public:
+	bool fences_supported = true;
+	uint64_t latency = 2; // ticks from submit to fence signal
+	uint64_t now = 0;
+	uint64_t num_waits = 0;
+	uint64_t num_early_maps = 0; // a readback mapped while a copy into it was still pending
+	bool fence_alive = false;
+
+	// every row starts with the source handle, the rest is a pattern of source and position
+	static void fill(texture &tt, uint64_t source) {
+		const uint32_t pitch = tt.width * 4;
+		for (uint32_t y = 0; y < tt.height; ++y) {
+			uint8_t *row = tt.bytes.data() + size_t(y) * pitch;
+			for (uint32_t x = 0; x < pitch; ++x) row[x] = static_cast<uint8_t>(source * 31u + y * 7u + x);
+			std::memcpy(row, &source, sizeof(source));
+		}
+	}
+	void advance(uint64_t ticks) {
+		now += ticks;
+		retire();
+	}
+	size_t num_textures() const { return textures.size(); }
+
+	uint64_t device_id() const override { return 1; }
+	bool create_readback_texture(uint32_t /*format*/, uint32_t width, uint32_t height, uint64_t &handle) override {
+		if (width < 2 || height == 0) return false;
+		handle = next_handle++;
+		textures[handle] = texture{ width, height, std::vector<uint8_t>(size_t(width) * height * 4, 0) };
+		return true;
+	}
+	void destroy_texture(uint64_t handle) override { textures.erase(handle); }
+	bool create_fence(uint64_t &fence) override {
+		if (!fences_supported) return false;
+		fence = 77;
+		fence_alive = true;
+		return true;
+	}
+	void destroy_fence(uint64_t /*fence*/) override { fence_alive = false; }
+	bool submit_copy(uint64_t source, uint64_t readback, uint64_t fence, uint64_t value) override {
+		if (textures.count(readback) == 0) return false;
+		if (fence == 0) {
+			fill(textures[readback], source);
+			return true;
+		}
+		pending.push_back(pending_copy{ source, readback, value, now + latency });
+		retire();
+		return true;
+	}
+	uint64_t completed_fence_value(uint64_t /*fence*/) override { return completed; }
+	bool wait_fence(uint64_t /*fence*/, uint64_t value) override {
+		++num_waits;
+		while (completed < value) {
+			if (pending.empty()) return false;
+			now = std::max(now, pending.front().done_at);
+			retire();
+		}
+		return true;
+	}
+	bool map_readback(uint64_t readback, const uint8_t *&data, uint32_t &row_pitch) override {
+		auto found = textures.find(readback);
+		if (found == textures.end()) return false;
+		for (const pending_copy &pp : pending) {
+			if (pp.readback == readback) ++num_early_maps;
+		}
+		data = found->second.bytes.data();
+		row_pitch = found->second.width * 4;
+		return true;
+	}
+	void unmap_readback(uint64_t /*readback*/) override {}
+};
+
+// frame index, pose and pixels of every consumed frame must agree, and frame indices must increase
+struct ring_test_consumer {
+	std::vector<uint64_t> frames;
+	std::string error;
+
+	void operator()(const ReadbackFrame &frame) {
+		uint64_t source = 0;
+		std::memcpy(&source, frame.data, sizeof(source));
+		const uint64_t index = frame.tag->frame_index;
+		if (source != index + 1000) error = std::string("pixels of source ") + std::to_string(source) + std::string(" tagged as frame ") + std::to_string(index);
+		const uint8_t *lastrow = frame.data + size_t(frame.height - 1) * frame.row_pitch;
+		if (lastrow[frame.row_pitch - 1] != static_cast<uint8_t>(source * 31u + (frame.height - 1) * 7u + frame.row_pitch - 1)) error = "pixel pattern";
+		if (frame.tag->camera.extrinsic_cam2world(0, cam_matrix_position_column) != ftype(index)
+			|| frame.tag->time_us != int64_t(index) * 1000 || frame.tag->flags != uint32_t(index & 3)) {
+			error = std::string("pose/time/flags of frame ") + std::to_string(index);
+		}
+		if (!frames.empty() && index <= frames.back()) error = std::string("frame ") + std::to_string(index) + std::string(" after ") + std::to_string(frames.back());
+		frames.push_back(index);
+	}
+};
+
+static ReadbackFrameTag ring_test_tag(uint64_t index) {
+	ReadbackFrameTag tag;
+	tag.frame_index = index;
+	tag.time_us = int64_t(index) * 1000;
+	tag.camera.extrinsic_cam2world.setZero();
+	tag.camera.extrinsic_cam2world(0, cam_matrix_position_column) = ftype(index);
+	tag.camera_ok = true;
+	tag.flags = uint32_t(index & 3);
+	return tag;
+}
+
+// one capture per tick, like one per rendered frame; returns error string or empty
+static std::string run_ring_case(mock_readback_device &dev, ReadbackRing &ring, StagingPool &pool, ring_test_consumer &consumer, uint64_t num_frames) {
+	const ReadbackRing::consume_fn consume = std::ref(consumer);
+	for (uint64_t ii = 0; ii < num_frames; ++ii) {
+		ring.submit(dev, pool, 28, 64, 16, ii + 1000, ring_test_tag(ii), consume);
+		dev.advance(1);
+	}
+	ring.drain(dev, pool, consume);
+	if (!consumer.error.empty()) return consumer.error;
+	if (dev.num_early_maps != 0) return std::string("mapped a slot before its fence");
+	if (ring.stats().in_flight != 0 || pool.stats().num_in_use != 0) return std::string("slots left after drain: ") + ring.stats().summary();
+	return std::string();
+}
+
+std::string run_readback_ring_tests() {
+	std::string err;
+	{
+		// the GPU keeps up: only drain waits, every frame comes out in order
+		mock_readback_device dev;
+		dev.latency = 2;
+		ReadbackRing ring(3);
+		StagingPool pool;
+		ring_test_consumer consumer;
+		if (!(err = run_ring_case(dev, ring, pool, consumer, 40)).empty()) RETURNFAILST(std::string("keeping up: ") + err);
+		const ReadbackRingStats st = ring.stats();
+		if (consumer.frames.size() != 40 || st.stalls != 0 || dev.num_waits > ring.depth()) RETURNFAILST(std::string("keeping up: ") + st.summary());
+		// one staging texture per slot at most, and they are reused
+		if (dev.num_textures() > ring.depth()) RETURNFAILST(std::string("keeping up: textures ") + std::to_string(dev.num_textures()));
+		ring.release(dev, pool);
+		pool.evict_device(dev);
+		if (dev.fence_alive || dev.num_textures() != 0) RETURNFAILST("release left the fence or textures behind");
+	}
+	{
+		// the GPU is 5 frames behind a 2-deep ring: waiting keeps every frame
+		mock_readback_device dev;
+		dev.latency = 5;
+		ReadbackRing ring(2);
+		StagingPool pool;
+		ring_test_consumer consumer;
+		if (!(err = run_ring_case(dev, ring, pool, consumer, 30)).empty()) RETURNFAILST(std::string("waiting: ") + err);
+		const ReadbackRingStats st = ring.stats();
+		if (consumer.frames.size() != 30 || st.stalls == 0 || st.dropped != 0) RETURNFAILST(std::string("waiting: ") + st.summary());
+		for (uint64_t ii = 0; ii < 30; ++ii) {
+			if (consumer.frames[ii] != ii) RETURNFAILST("waiting: missing frame");
+		}
+	}
+	{
+		// same, but dropping: never waits, and what comes out is still aligned
+		mock_readback_device dev;
+		dev.latency = 5;
+		ReadbackRing ring(2);
+		ring.back_pressure = ReadbackRing_DropNewest;
+		StagingPool pool;
+		ring_test_consumer consumer;
+		if (!(err = run_ring_case(dev, ring, pool, consumer, 30)).empty()) RETURNFAILST(std::string("dropping: ") + err);
+		const ReadbackRingStats st = ring.stats();
+		if (st.dropped == 0 || st.stalls != 0 || st.consumed + st.dropped != 30 || consumer.frames.size() != st.consumed) {
+			RETURNFAILST(std::string("dropping: ") + st.summary());
+		}
+		// drain waits on the remaining fences, nothing else does
+		if (dev.num_waits > ring.depth()) RETURNFAILST(std::string("dropping: waited ") + std::to_string(dev.num_waits) + std::string(" times"));
+	}
+	{
+		// no fences: every copy is read back within its own submit
+		mock_readback_device dev;
+		dev.fences_supported = false;
+		ReadbackRing ring(3);
+		StagingPool pool;
+		ring_test_consumer consumer;
+		const ReadbackRing::consume_fn consume = std::ref(consumer);
+		for (uint64_t ii = 0; ii < 5; ++ii) {
+			ring.submit(dev, pool, 28, 64, 16, ii + 1000, ring_test_tag(ii), consume);
+			if (consumer.frames.size() != ii + 1 || ring.stats().in_flight != 0) RETURNFAILST("without fences a frame was held back");
+		}
+		if (!consumer.error.empty()) RETURNFAILST(std::string("without fences: ") + consumer.error);
+	}
+	{
+		// failed staging textures are counted and don't block later frames
+		mock_readback_device dev;
+		ReadbackRing ring(2);
+		StagingPool pool;
+		ring_test_consumer consumer;
+		const ReadbackRing::consume_fn consume = std::ref(consumer);
+		if (ring.submit(dev, pool, 28, 0, 16, 1000, ring_test_tag(0), consume)) RETURNFAILST("zero-size texture submitted");
+		ring.submit(dev, pool, 28, 64, 16, 1001, ring_test_tag(1), consume);
+		ring.drain(dev, pool, consume);
+		if (ring.stats().failed != 1 || consumer.frames.size() != 1 || !consumer.error.empty()) RETURNFAILST(std::string("failure: ") + ring.stats().summary());
+	}
+	return std::string("ok");
+}
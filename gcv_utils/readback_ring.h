@@ -0,0 +1,110 @@
+#pragma once
+// N-deep asynchronous texture readback. Each capture copies into a free staging texture and
+// signals a fence after the copy; a slot is only mapped once its fence has passed, a few
+// frames later, so the render thread no longer waits for the GPU to go idle on every capture.
+// Slots carry the frame index and camera pose of the frame they were copied from, and are
+// handed out in submission order. Like the staging pool, the ring only sees 64-bit handles
+// through ReadbackDevice, so it can be tested with a simulated GPU (see run_readback_ring_tests).
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include "gcv_utils/staging_pool.h"
+#include "gcv_utils/camera_data_struct.h"
+
+class ReadbackDevice : public StagingDevice {
+public:
+	// false if the device has no fences: copies then complete synchronously inside submit_copy
+	virtual bool create_fence(uint64_t &fence) = 0;
+	virtual void destroy_fence(uint64_t fence) = 0;
+	// records a copy of source into readback, then a signal of fence to value, and submits both without waiting.
+	// fence is 0 when create_fence failed; the copy must then have finished when this returns.
+	virtual bool submit_copy(uint64_t source, uint64_t readback, uint64_t fence, uint64_t value) = 0;
+	virtual uint64_t completed_fence_value(uint64_t fence) = 0;
+	// blocks until the fence reaches value
+	virtual bool wait_fence(uint64_t fence, uint64_t value) = 0;
+	virtual bool map_readback(uint64_t readback, const uint8_t *&data, uint32_t &row_pitch) = 0;
+	virtual void unmap_readback(uint64_t readback) = 0;
+};
+
+struct ReadbackFrameTag {
+	uint64_t frame_index = 0;
+	int64_t time_us = 0;
+	CamMatrixData camera;
+	bool camera_ok = false;
+	uint32_t flags = 0; // caller-defined, handed back untouched
+};
+
+// a completed slot, valid only during the consume callback
+struct ReadbackFrame {
+	const ReadbackFrameTag *tag;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	const uint8_t *data;
+	uint32_t row_pitch;
+};
+
+enum ReadbackBackPressure {
+	ReadbackRing_WaitOldest = 0, // every frame comes out; the render thread stalls when the GPU falls N frames behind
+	ReadbackRing_DropNewest,     // the render thread never stalls; frames that find the ring full are not captured
+};
+
+struct ReadbackRingStats {
+	uint64_t submitted = 0;
+	uint64_t consumed = 0;
+	uint64_t dropped = 0; // found the ring full with ReadbackRing_DropNewest
+	uint64_t stalls = 0;  // waited on the oldest slot's fence with ReadbackRing_WaitOldest
+	uint64_t failed = 0;  // staging texture, copy or map failed
+	size_t in_flight = 0;
+
+	std::string summary() const;
+};
+
+class ReadbackRing {
+public:
+	typedef std::function<void(const ReadbackFrame &frame)> consume_fn;
+private:
+	struct slot {
+		ReadbackFrameTag tag;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint64_t readback;
+		uint64_t fence_value;
+	};
+	std::vector<slot> slots;
+	size_t oldest = 0;
+	size_t count = 0;
+	bool bound = false; // to device_id, by the first submit
+	uint64_t device_id = 0;
+	uint64_t fence = 0;
+	bool have_fence = false;
+	uint64_t next_fence_value = 1;
+	ReadbackRingStats counters;
+
+	bool slot_ready(ReadbackDevice &dev, const slot &ss);
+	void consume_oldest(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume, bool readable);
+	size_t collect_ready(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume);
+public:
+	ReadbackBackPressure back_pressure = ReadbackRing_WaitOldest;
+
+	explicit ReadbackRing(size_t depth);
+	size_t depth() const { return slots.size(); }
+
+	// first hands every slot whose copy has finished to consume, oldest first. Then copies source
+	// into a staging texture from pool, applying back_pressure if all slots are still in flight.
+	// Returns false if this frame was dropped or its copy could not be submitted.
+	bool submit(ReadbackDevice &dev, StagingPool &pool, uint32_t format, uint32_t width, uint32_t height,
+		uint64_t source, const ReadbackFrameTag &tag, const consume_fn &consume);
+	// waits for and consumes every slot in flight, e.g. when a recording stops
+	size_t drain(ReadbackDevice &dev, StagingPool &pool, const consume_fn &consume);
+	// gives back staging textures and the fence without reading them (the device is going away)
+	void release(ReadbackDevice &dev, StagingPool &pool);
+
+	ReadbackRingStats stats() const;
+};
+
+// return error string if test failed; "ok" means ordering, back-pressure and frame/pose alignment held with a simulated GPU
+std::string run_readback_ring_tests();
@@ -0,0 +1,34 @@
+#include "gcv_utils/seg_pixel_runs.h"
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <random>
+
+std::string run_seg_pixel_run_tests() {
+	std::mt19937 rng(77);
+	// mostly long runs of a few draw IDs, like a real frame, with some single-pixel noise
+	std::geometric_distribution<int> runlen(0.05);
+	std::uniform_int_distribution<int> ids(0, 5);
+	std::vector<uint8_t> row;
+	for (int trial = 0; trial < 200; ++trial) {
+		const size_t width = 1 + rng() % 700;
+		row.assign(width * 16, 0);
+		for (size_t x = 0; x < width;) {
+			const size_t len = std::min<size_t>(width - x, 1 + runlen(rng));
+			uint32_t px[4] = { static_cast<uint32_t>(ids(rng)), 0u, static_cast<uint32_t>(ids(rng) % 2), 0u };
+			if (rng() % 16 == 0) px[rng() % 4] ^= 1u << (rng() % 32); // differs from a neighbor in one bit of any channel
+			for (size_t ii = 0; ii < len; ++ii) memcpy(row.data() + (x + ii) * 16, px, 16);
+			x += len;
+		}
+		for (size_t x = 0; x < width; ++x) {
+			size_t expected = 1;
+			while (x + expected < width && memcmp(row.data() + x * 16, row.data() + (x + expected) * 16, 16) == 0) ++expected;
+			const size_t got = seg_pixel_run_length(row.data() + x * 16, width - x);
+			if (got != expected) {
+				return std::string("failed: run at ") + std::to_string(x) + std::string(" of width ") + std::to_string(width)
+					+ std::string(": ") + std::to_string(got) + std::string(" vs ") + std::to_string(expected);
+			}
+		}
+	}
+	return std::string("ok");
+}
@@ -0,0 +1,30 @@
+#pragma once
+// Segmentation readback textures (r32g32b32a32) hold a draw/instance/primitive ID per pixel,
+// and neighboring pixels almost always belong to the same draw. The readback loops find runs
+// of identical 16-byte pixels, hash the first pixel of each run and fill the rest of the run,
+// so the colors are the same as hashing every pixel.
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <emmintrin.h>
+
+// number of leading pixels (at least 1, at most count) equal to the first; pixels are 16 bytes each
+inline size_t seg_pixel_run_length(const uint8_t *pixels, size_t count) {
+	const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+	size_t n = 1;
+	// 4 pixels per test while the whole group matches, then pixel by pixel to find where the run ends
+	for (; n + 4 <= count; n += 4) {
+		const __m128i *const p = reinterpret_cast<const __m128i *>(pixels + n * 16);
+		const __m128i eq01 = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p), first), _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), first));
+		const __m128i eq23 = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), first), _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), first));
+		if (_mm_movemask_epi8(_mm_and_si128(eq01, eq23)) != 0xFFFF) break;
+	}
+	for (; n < count; ++n) {
+		const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + n * 16));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(px, first)) != 0xFFFF) break;
+	}
+	return n;
+}
+
+// return error string if test failed; "ok" means run lengths match a memcmp reference
+std::string run_seg_pixel_run_tests();
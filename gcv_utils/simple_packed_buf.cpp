@@ -5,8 +5,13 @@ size_t simple_packed_buf::bytes_per_pixel() const {
 	switch (pixfmt) {
 	case BUF_PIX_FMT_RGB24: return 3;
 	case BUF_PIX_FMT_RGBA: return 4;
+	case BUF_PIX_FMT_BGRA: return 4;
 	case BUF_PIX_FMT_GRAYU32: return 4;
 	case BUF_PIX_FMT_GRAYF32: return sizeof(float);
+	case BUF_PIX_FMT_RGB48: return 6;
+	case BUF_PIX_FMT_RGBA64: return 8;
+	case BUF_PIX_FMT_RGF32: return 2 * sizeof(float);
+	case BUF_PIX_FMT_RGBAF32: return 4 * sizeof(float);
 	}
 	// TODO: raise error!
 	return 0;
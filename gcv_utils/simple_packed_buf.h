@@ -9,6 +9,11 @@ enum BufPixelFormat {
 	BUF_PIX_FMT_RGBA,
 	BUF_PIX_FMT_GRAYF32,
 	BUF_PIX_FMT_GRAYU32,
+	BUF_PIX_FMT_BGRA, // same layout as RGBA with red and blue swapped (native order of bgra8 textures)
+	BUF_PIX_FMT_RGB48,  // uint16 per channel, little-endian (10-bit color widened to 16 bits)
+	BUF_PIX_FMT_RGBA64, // uint16 per channel, little-endian
+	BUF_PIX_FMT_RGF32,   // float per channel (half-float render targets, e.g. motion vectors)
+	BUF_PIX_FMT_RGBAF32, // float per channel (half-float render targets, e.g. linear HDR color)
 };
 
 // row accessors assume data is row-major
@@ -0,0 +1,156 @@
+#include "gcv_utils/staging_pool.h"
+#include <algorithm>
+#include <set>
+
+std::string StagingPoolStats::summary() const {
+	return std::to_string(hits) + std::string(" hits, ") + std::to_string(misses) + std::string(" misses, ")
+		+ std::to_string(evictions) + std::string(" evicted, ") + std::to_string(num_free) + std::string(" free, ")
+		+ std::to_string(num_in_use) + std::string(" in use");
+}
+
+bool StagingPool::acquire(StagingDevice &dev, uint32_t format, uint32_t width, uint32_t height, uint64_t &handle) {
+	const uint64_t device_id = dev.device_id();
+	std::lock_guard<std::mutex> lock(mtx);
+	for (entry &ee : entries) {
+		if (!ee.in_use && ee.device_id == device_id && ee.format == format && ee.width == width && ee.height == height) {
+			ee.in_use = true;
+			handle = ee.handle;
+			++counters.hits;
+			return true;
+		}
+	}
+	++counters.misses;
+	for (size_t ii = entries.size(); ii-- > 0;) {
+		const entry &ee = entries[ii];
+		if (!ee.in_use && ee.device_id == device_id && ee.format == format) {
+			dev.destroy_texture(ee.handle);
+			entries.erase(entries.begin() + ii);
+			++counters.evictions;
+		}
+	}
+	if (!dev.create_readback_texture(format, width, height, handle)) return false;
+	entries.push_back(entry{ device_id, format, width, height, handle, true });
+	return true;
+}
+
+void StagingPool::release(StagingDevice &dev, uint64_t handle) {
+	const uint64_t device_id = dev.device_id();
+	std::lock_guard<std::mutex> lock(mtx);
+	auto found = std::find_if(entries.begin(), entries.end(), [&](const entry &ee) {
+		return ee.device_id == device_id && ee.handle == handle && ee.in_use;
+	});
+	if (found == entries.end()) {
+		dev.destroy_texture(handle);
+		return;
+	}
+	const size_t num_free_same_key = std::count_if(entries.begin(), entries.end(), [&](const entry &ee) {
+		return !ee.in_use && ee.device_id == device_id && ee.format == found->format && ee.width == found->width && ee.height == found->height;
+	});
+	if (num_free_same_key >= max_free_per_key) {
+		dev.destroy_texture(handle);
+		entries.erase(found);
+		++counters.evictions;
+		return;
+	}
+	found->in_use = false;
+}
+
+void StagingPool::evict_device(StagingDevice &dev) {
+	const uint64_t device_id = dev.device_id();
+	std::lock_guard<std::mutex> lock(mtx);
+	for (size_t ii = entries.size(); ii-- > 0;) {
+		if (entries[ii].device_id == device_id) {
+			dev.destroy_texture(entries[ii].handle);
+			entries.erase(entries.begin() + ii);
+			++counters.evictions;
+		}
+	}
+}
+
+StagingPoolStats StagingPool::stats() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	StagingPoolStats result = counters;
+	result.num_free = 0;
+	result.num_in_use = 0;
+	for (const entry &ee : entries) {
+		if (ee.in_use) ++result.num_in_use;
+		else ++result.num_free;
+	}
+	return result;
+}
+
+StagingPool &global_staging_pool() {
+	static StagingPool pool;
+	return pool;
+}
+
+#define RETURNFAILST(msg) return std::string("failed: ") + std::string(msg)
+
+// hands out increasing handles and remembers which are alive
+class fake_staging_device : public StagingDevice {
+	uint64_t id;
+	uint64_t next_handle = 1;
+public:
+	std::set<uint64_t> alive;
+	uint64_t num_created = 0;
+
+	explicit fake_staging_device(uint64_t id_) : id(id_) {}
+	uint64_t device_id() const override { return id; }
+	bool create_readback_texture(uint32_t /*format*/, uint32_t width, uint32_t height, uint64_t &handle) override {
+		if (width == 0 || height == 0) return false;
+		handle = next_handle++;
+		alive.insert(handle);
+		++num_created;
+		return true;
+	}
+	void destroy_texture(uint64_t handle) override {
+		alive.erase(handle);
+	}
+};
+
+std::string run_staging_pool_tests() {
+	StagingPool pool;
+	fake_staging_device dev_a(100), dev_b(200);
+	const uint32_t rgba8 = 28, r32f = 41;
+	uint64_t h0 = 0, h1 = 0, h2 = 0;
+
+	// a capture loop reuses one texture per format
+	for (int frame = 0; frame < 24; ++frame) {
+		if (!pool.acquire(dev_a, rgba8, 1920, 1080, h0) || !pool.acquire(dev_a, r32f, 1920, 1080, h1)) RETURNFAILST("acquire");
+		pool.release(dev_a, h0);
+		pool.release(dev_a, h1);
+	}
+	if (dev_a.num_created != 2 || pool.stats().hits != 46 || pool.stats().misses != 2) {
+		RETURNFAILST(std::string("steady state: ") + pool.stats().summary());
+	}
+
+	// two at once need two textures, both kept afterwards (max_free_per_key = 2), a third is destroyed
+	pool.acquire(dev_a, rgba8, 1920, 1080, h0);
+	pool.acquire(dev_a, rgba8, 1920, 1080, h1);
+	pool.acquire(dev_a, rgba8, 1920, 1080, h2);
+	if (h0 == h1 || h1 == h2 || h0 == h2) RETURNFAILST("same texture handed out twice");
+	pool.release(dev_a, h0);
+	pool.release(dev_a, h1);
+	pool.release(dev_a, h2);
+	if (dev_a.alive.size() != 3 || pool.stats().num_free != 3) RETURNFAILST(std::string("free list cap: ") + pool.stats().summary());
+
+	// a resize evicts the old size of that format only
+	pool.acquire(dev_a, rgba8, 2560, 1440, h0);
+	pool.release(dev_a, h0);
+	if (dev_a.alive.size() != 2 || pool.stats().num_free != 2) RETURNFAILST(std::string("resize: ") + pool.stats().summary());
+
+	// devices are kept apart, and destroying one leaves nothing of it behind
+	pool.acquire(dev_b, rgba8, 2560, 1440, h1);
+	if (dev_b.num_created != 1 || h1 == 0) RETURNFAILST("second device got a texture of the first");
+	pool.release(dev_b, h1);
+	pool.evict_device(dev_a);
+	if (!dev_a.alive.empty() || dev_b.alive.size() != 1 || pool.stats().num_free != 1) {
+		RETURNFAILST(std::string("evict device: ") + pool.stats().summary());
+	}
+	pool.evict_device(dev_b);
+	if (!dev_b.alive.empty() || pool.stats().num_free != 0) RETURNFAILST("evict second device");
+
+	// failed creation is reported and leaves nothing behind
+	if (pool.acquire(dev_a, rgba8, 0, 0, h0) || pool.stats().num_in_use != 0) RETURNFAILST("failed creation");
+	return std::string("ok");
+}
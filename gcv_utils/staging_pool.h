@@ -0,0 +1,64 @@
+#pragma once
+// Reusable CPU-readable staging textures for texture readback. Creating and destroying
+// one per capture costs a driver allocation on the render thread every time; the pool
+// keeps them keyed by (device, format, width, height) instead.
+// The pool only sees resources as 64-bit handles through StagingDevice, so it does not
+// depend on reshade and can be tested with a fake device (see run_staging_pool_tests).
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <string>
+
+class StagingDevice {
+public:
+	virtual ~StagingDevice() = default;
+	virtual uint64_t device_id() const = 0;
+	// a texture the GPU can copy into and the CPU can map for reading
+	virtual bool create_readback_texture(uint32_t format, uint32_t width, uint32_t height, uint64_t &handle) = 0;
+	virtual void destroy_texture(uint64_t handle) = 0;
+};
+
+struct StagingPoolStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;    // a texture had to be created
+	uint64_t evictions = 0; // textures destroyed because of a resize, a full free list or the device going away
+	size_t num_free = 0;
+	size_t num_in_use = 0;
+
+	std::string summary() const;
+};
+
+class StagingPool {
+	struct entry {
+		uint64_t device_id;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint64_t handle;
+		bool in_use;
+	};
+	// a capture uses a handful of textures at most, a linear scan is enough
+	std::vector<entry> entries;
+	mutable std::mutex mtx;
+	StagingPoolStats counters;
+public:
+	// free textures kept per key; more are destroyed on release
+	size_t max_free_per_key = 2;
+
+	// hands out a free texture of this size and format, or creates one. On a miss, free textures of
+	// the same format but another size on this device are destroyed: the game changed resolution.
+	bool acquire(StagingDevice &dev, uint32_t format, uint32_t width, uint32_t height, uint64_t &handle);
+	// gives the texture back for reuse; textures the pool does not know are destroyed
+	void release(StagingDevice &dev, uint64_t handle);
+	// destroys every texture of this device (from destroy_device); none may still be in use
+	void evict_device(StagingDevice &dev);
+
+	StagingPoolStats stats() const;
+};
+
+// process-wide pool shared by every device; entries of a device are dropped in its destroy_device
+StagingPool &global_staging_pool();
+
+// return error string if test failed; "ok" means reuse, eviction and counters behaved with a fake device
+std::string run_staging_pool_tests();
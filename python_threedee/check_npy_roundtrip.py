@@ -0,0 +1,64 @@
+# Round trip of the addon's .npy writer (gcv_utils/npy_writer.cpp) through numpy.load.
+# Write the samples with the headless benchmark, then check them:
+#   ./capture_bench --npy-bench /tmp/npycheck
+#   python check_npy_roundtrip.py /tmp/npycheck
+# Optionally also checks captured frames: each *_depth.npy must be a 2D float32 array, color .npy HxWxC uint8/uint16.
+import argparse
+import glob
+import os
+import sys
+import numpy as np
+
+
+def expected_samples():
+    # the same patterns as npy_roundtrip_samples in npy_writer.cpp, element ii of the flattened array
+    def idx(shape):
+        return np.arange(int(np.prod(shape)), dtype=np.uint64)
+    return {
+        'u8': (idx((5, 7, 3)) % 251).astype(np.uint8).reshape(5, 7, 3),
+        'u16': ((idx((6, 5, 4)) * 40503) % 65536).astype(np.uint16).reshape(6, 5, 4),
+        'f16': ((idx((9, 11)) * 97) % 0x7c00).astype(np.uint16).view(np.float16).reshape(9, 11),
+        'f32': ((idx((13, 17)).astype(np.float32) - 100.0) * 0.375).astype(np.float32).reshape(13, 17),
+        'f32_1d': ((idx((10,)).astype(np.float32) - 100.0) * 0.375).astype(np.float32),
+        'u32': ((idx((4, 3)) * 2654435761) % (1 << 32)).astype(np.uint32).reshape(4, 3),
+    }
+
+
+def check_samples(dirpath):
+    failures = 0
+    for name, want in expected_samples().items():
+        path = os.path.join(dirpath, 'npy_roundtrip_' + name + '.npy')
+        got = np.load(path)
+        mm = np.load(path, mmap_mode='r')  # the data offset is 64-byte aligned
+        ok = got.dtype == want.dtype and got.shape == want.shape and got.flags['C_CONTIGUOUS'] \
+            and np.array_equal(got.view(np.uint8), want.view(np.uint8)) and mm.offset % 64 == 0
+        print('{:8s} {:10s} {:14s} {}'.format(name, str(got.dtype), str(got.shape), 'ok' if ok else 'MISMATCH'))
+        failures += 0 if ok else 1
+    return failures
+
+
+def check_captures(dirpath):
+    failures = 0
+    for path in sorted(glob.glob(os.path.join(dirpath, '*.npy'))):
+        if os.path.basename(path).startswith('npy_roundtrip_'):
+            continue
+        arr = np.load(path)
+        if path.endswith('_depth.npy'):
+            ok = arr.ndim == 2 and arr.dtype == np.float32
+        else:
+            ok = arr.ndim in (2, 3) and arr.dtype in (np.uint8, np.uint16, np.uint32, np.float32)
+        print('{} {} {} {}'.format(os.path.basename(path), arr.dtype, arr.shape, 'ok' if ok else 'UNEXPECTED'))
+        failures += 0 if ok else 1
+    return failures
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='check .npy files written by the addon against numpy.load')
+    parser.add_argument('dir', help='directory given to capture_bench --npy-bench')
+    parser.add_argument('--captures', default='', help='also check the .npy frames in this directory')
+    args = parser.parse_args()
+    failures = check_samples(args.dir)
+    if args.captures:
+        failures += check_captures(args.captures)
+    print('ok' if failures == 0 else '{} failed'.format(failures))
+    sys.exit(1 if failures else 0)
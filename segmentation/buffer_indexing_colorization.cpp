@@ -3,6 +3,7 @@
 #include "buffer_indexing_colorization.hpp"
 #include "segmentation_app_data.hpp"
 #include "xxhash.h"
+#include "gcv_utils/seg_pixel_runs.h"
 #include "concurrentqueue.h"
 #include "colormap_util.hpp"
 #include <sstream>     // std::ostringstream
@@ -38,7 +39,10 @@ void multithreaded_row_colorization_worker(moodycamel::ConcurrentQueue<uint32_t>
 	while (row_queue->try_dequeue(rowidx)) {
 		const uint32_t* inrowptr = reinterpret_cast<const uint32_t*>(datastartptr + rowidx * row_stride_bytes);
 		perdraw_metadata_type* outmetarowptr = mapp->draw_metadata_seg_image.rowptr(rowidx);
-		for (size_t x = 0; x < row_width_pix; ++x) {
+		uint32_t* colorrowptr = mapp->viz_seg_colorized_for_display.rowptr<uint32_t>(rowidx);
+		for (size_t x = 0; x < row_width_pix;) {
+			// identical pixels get identical metadata and colors, so only the first of each run is looked up and hashed
+			const size_t run = seg_pixel_run_length(reinterpret_cast<const uint8_t*>(inrowptr + x * 4u), row_width_pix - x);
 			outmetarowptr[x] = (*draw_metadata)[std::min<size_t>(one_minus_draw_meta_size, inrowptr[x * 4u])];
 			switch (mapp->viz_seg_colorization_mode) {
 			case CVM_FullMetaHash:
@@ -65,7 +69,12 @@ void multithreaded_row_colorization_worker(moodycamel::ConcurrentQueue<uint32_t>
 				seg_idx_color = colorhashfun(inrowptr + (x * 4u + mapp->viz_seg_colorization_mode), 4ull, mapp->viz_seg_colorization_seed);
 				break;
 			}
-			*(mapp->viz_seg_colorized_for_display.entryptr<uint32_t>(rowidx, x)) = seg_idx_color;
+			colorrowptr[x] = seg_idx_color;
+			for (size_t ii = 1; ii < run; ++ii) {
+				outmetarowptr[x + ii] = outmetarowptr[x];
+				colorrowptr[x + ii] = seg_idx_color;
+			}
+			x += run;
 		}
 	}
 }